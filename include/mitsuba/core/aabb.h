@@ -389,6 +389,14 @@ public:
 	FINLINE bool rayIntersectPacket(const RayPacket4 &ray, RayInterval4 &interval) const;
 #endif
 
+#ifdef MTS_AVX
+	/**
+	 * \brief Intersect against a packet of eight rays. 
+	 * \return \c false if none of the rays intersect.
+	 */
+	FINLINE bool rayIntersectPacket(const RayPacket8 &ray, RayInterval8 &interval) const;
+#endif
+
 	/// Create a bounding sphere, which contains the axis-aligned box
 	BSphere getBSphere() const;
 };
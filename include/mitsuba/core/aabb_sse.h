@@ -77,6 +77,45 @@ FINLINE bool AABB::rayIntersectPacket(const RayPacket4 &ray,
 	return hasIntersection;
 }
 
+#if defined(MTS_AVX)
+/**
+ * AVX version of the above slab test (Intersects against 8 rays 
+ * simultaneously). Returns false if none of the rays intersect.
+ */
+FINLINE bool AABB::rayIntersectPacket(const RayPacket8 &ray, 
+								   RayInterval8 &interval) const {
+	const __m256
+		p_inf = _mm256_set1_ps(std::numeric_limits<float>::infinity()),
+		n_inf = _mm256_set1_ps(-std::numeric_limits<float>::infinity());
+
+	__m256 lmax = p_inf, lmin = n_inf;
+
+	for (int axis=0; axis<3; ++axis) {
+		const __m256
+			l1 = _mm256_mul_ps(ray.dRcp[axis].ps,
+				_mm256_sub_ps(_mm256_set1_ps(min[axis]), ray.o[axis].ps)),
+			l2 = _mm256_mul_ps(ray.dRcp[axis].ps, 
+				_mm256_sub_ps(_mm256_set1_ps(max[axis]), ray.o[axis].ps)),
+			l1a = _mm256_min_ps(l1, p_inf),
+			l2a = _mm256_min_ps(l2, p_inf),
+			l1b = _mm256_max_ps(l1, n_inf),
+			l2b = _mm256_max_ps(l2, n_inf);
+
+		lmax = _mm256_min_ps(_mm256_max_ps(l1a, l2a), lmax);
+		lmin = _mm256_max_ps(_mm256_min_ps(l1b, l2b), lmin);
+	}
+
+	const bool hasIntersection = _mm256_movemask_ps(
+		_mm256_and_ps(
+			_mm256_cmp_ps(lmax, _mm256_setzero_ps(), _CMP_GE_OQ),
+			_mm256_cmp_ps(lmin, lmax, _CMP_LE_OQ))) != 0;
+
+	interval.mint.ps = lmin;
+	interval.maxt.ps = lmax;
+	return hasIntersection;
+}
+#endif
+
 MTS_NAMESPACE_END
 
 #endif /* __AABB_SSE_H */
@@ -160,6 +160,64 @@ protected:
 	Float m_gamma;
 };
 
+/** \brief Incrementally writes a tiled RGBA OpenEXR image
+ *
+ * Tiles can be supplied in any order and are immediately passed on to the
+ * underlying stream, hence very large images can be written while only
+ * keeping a few tiles in memory. Tiles that were never written are
+ * filled with zeros when the file is closed.
+ *
+ * \ingroup libcore
+ */
+class MTS_EXPORT_CORE TiledEXRWriter : public Object {
+public:
+	/**
+	 * \brief Create a new tiled EXR file
+	 *
+	 * \param stream
+	 *    Seekable output stream
+	 * \param size
+	 *    Resolution of the image
+	 * \param tileSize
+	 *    Resolution of the (square) tiles
+	 * \param alpha
+	 *    Should an alpha channel be written?
+	 */
+	TiledEXRWriter(Stream *stream, const Vector2i &size, int tileSize, bool alpha);
+
+	/// Return the number of tiles in each direction
+	inline const Vector2i &getTileCount() const { return m_tileCount; }
+
+	/// Return the number of tiles that have been written so far
+	inline int getTilesWritten() const { return m_tilesWritten; }
+
+	/**
+	 * \brief Write the tile with the given index
+	 *
+	 * \param data
+	 *    Linear RGBA values in row-major order. Tiles at the right and 
+	 *    bottom border of the image can be smaller than \c tileSize, 
+	 *    and the row stride always equals the width of the tile.
+	 */
+	void writeTile(const Point2i &tile, const float *data);
+
+	/// Fill in all missing tiles and finish writing the file
+	void close();
+
+	MTS_DECLARE_CLASS()
+protected:
+	/// Virtual destructor (implicitly closes the file)
+	virtual ~TiledEXRWriter();
+private:
+	/// OpenEXR-specific state (defined in bitmap.cpp)
+	struct EXRFile;
+	EXRFile *m_file;
+	ref<Stream> m_stream;
+	Vector2i m_size, m_tileCount;
+	int m_tileSize, m_tilesWritten;
+	std::vector<bool> m_written;
+};
+
 MTS_NAMESPACE_END
 
 #endif /* __BITMAP_H */
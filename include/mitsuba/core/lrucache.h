@@ -20,6 +20,7 @@
 #define __LRUCACHE_H
 
 #include <mitsuba/mitsuba.h>
+#include <mitsuba/core/lock.h>
 
 /* push_macro(..) is not supported everywhere :( */
 #undef Float
@@ -63,11 +64,14 @@ public:
 
 	// Constuctor specifies the cached function and
 	// the maximum number of records to be stored.
+	// When a cost function is given, the capacity instead
+	// bounds the sum of the costs of all stored records.
 	LRUCache(size_t capacity,
 		const boost::function<V(const K&)>& generatorFunction,
-		const boost::function<void (const V&)>& cleanupFunction = NULL)
-		: m_capacity(capacity), m_generatorFunction(generatorFunction),
-		  m_cleanupFunction(cleanupFunction) {
+		const boost::function<void (const V&)>& cleanupFunction = NULL,
+		const boost::function<size_t (const V&)>& costFunction = NULL)
+		: m_capacity(capacity), m_usage(0), m_generatorFunction(generatorFunction),
+		  m_cleanupFunction(cleanupFunction), m_costFunction(costFunction) {
 		SAssert(m_capacity != 0);
 	}
 
@@ -81,7 +85,7 @@ public:
 	}
 		
 	bool isFull() const {
-		return m_cache.size() == m_capacity;
+		return m_usage >= m_capacity;
 	}
 
 	// Obtain value of the cached function for k
@@ -120,27 +124,104 @@ public:
 			*dst++=(*src++).second;
 	}
 protected:
+	inline size_t cost(const V& v) const {
+		return m_costFunction ? m_costFunction(v) : 1;
+	}
+
 	void insert(const K& k,const V& v) {
-		SAssert(m_cache.size() <= m_capacity);
-		if (m_cache.size() == m_capacity) {
+		const size_t vCost = cost(v);
+		// If necessary, make space by purging the
+		// least-recently-used elements. A record that
+		// exceeds the capacity by itself is still stored.
+		while (!m_cache.empty() && m_usage + vCost > m_capacity) {
+			const V &victim = m_cache.right.begin()->info;
+			m_usage -= cost(victim);
 			if (m_cleanupFunction)
-				m_cleanupFunction(m_cache.right.begin()->info);
-			// If necessary, make space
-			// by purging the least-recently-used element
+				m_cleanupFunction(victim);
 			m_cache.right.erase(m_cache.right.begin());
 		}
 
 		// Create a new record from the key, a dummy and the value
 		m_cache.insert(typename cache_type::value_type(k,0,v));
+		m_usage += vCost;
 	}
 
 private:
-	size_t m_capacity;
+	size_t m_capacity, m_usage;
 	boost::function<V(const K&)> m_generatorFunction;
 	boost::function<void(const V&)> m_cleanupFunction;
+	boost::function<size_t(const V&)> m_costFunction;
 	cache_type m_cache;
 };
 
+/**
+ * \brief Thread-safe LRU cache, which is split into several
+ * independently locked shards to reduce lock contention
+ *
+ * Each key is assigned to a shard using the provided hash function.
+ * Every shard is an \ref LRUCache with its own capacity, hence the
+ * eviction order is only approximately LRU with respect to the whole
+ * cache. The generator function runs while the associated shard is
+ * locked, which ensures that a value is never generated twice
+ * concurrently. The cleanup function is invoked for evicted values.
+ *
+ * \tparam K Key data type
+ * \tparam KComp Key comparator
+ * \tparam V Value data type
+ * \ingroup libcore
+ */
+template <typename K, typename KComp, typename V> struct ShardedLRUCache : public Object {
+public:
+	typedef LRUCache<K, KComp, V> shard_type;
+
+	/**
+	 * Create a sharded cache with \c shardCount shards, each of
+	 * which can hold up to \c capacityPerShard records (or records
+	 * with a total cost of up to \c capacityPerShard when a cost
+	 * function is specified)
+	 */
+	ShardedLRUCache(size_t shardCount, size_t capacityPerShard,
+		const boost::function<size_t(const K&)>& hashFunction,
+		const boost::function<V(const K&)>& generatorFunction,
+		const boost::function<void (const V&)>& cleanupFunction = NULL,
+		const boost::function<size_t (const V&)>& costFunction = NULL)
+		: m_hashFunction(hashFunction) {
+		SAssert(shardCount != 0);
+		m_shards.resize(shardCount);
+		for (size_t i=0; i<shardCount; ++i) {
+			m_shards[i].mutex = new Mutex();
+			m_shards[i].cache = new shard_type(capacityPerShard,
+				generatorFunction, cleanupFunction, costFunction);
+		}
+	}
+
+	/// Return the number of shards
+	inline size_t getShardCount() const { return m_shards.size(); }
+
+	// Obtain value of the cached function for k
+	V get(const K& k, bool &hit) {
+		Shard &shard = m_shards[m_hashFunction(k) % m_shards.size()];
+		shard.mutex->lock();
+		try {
+			const V v = shard.cache->get(k, hit);
+			shard.mutex->unlock();
+			return v;
+		} catch (...) {
+			/* The generator function failed */
+			shard.mutex->unlock();
+			throw;
+		}
+	}
+private:
+	struct Shard {
+		ref<Mutex> mutex;
+		ref<shard_type> cache;
+	};
+
+	boost::function<size_t(const K&)> m_hashFunction;
+	std::vector<Shard> m_shards;
+};
+
 MTS_NAMESPACE_END
 
 #endif /* __LRUCACHE_H */
@@ -30,8 +30,14 @@ MTS_NAMESPACE_BEGIN
  */
 class MTS_EXPORT_CORE MemoryMappedFile : public Object {
 public:
-	/// Map the specified file into memory
-	MemoryMappedFile(const fs::path &filename);
+	/**
+	 * \brief Map the specified file into memory
+	 *
+	 * By default, the mapping is read-only. When \c copyOnWrite is set
+	 * to \c true, the mapped memory may also be modified. Such changes 
+	 * are private to the process and never written back to the file.
+	 */
+	MemoryMappedFile(const fs::path &filename, bool copyOnWrite = false);
 
 	/// Return a pointer to the file contents in memory
 	inline void *getData() { return m_data; }
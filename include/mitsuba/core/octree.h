@@ -57,12 +57,27 @@ public:
 		return m_head;
 	}
 
+	/// Append an item at the end of the list (takes linear time)
 	void append(const T &value) {
 		ListItem *item = new ListItem(value);
 		ListItem **cur = &m_head;
 		while (!atomicCompareAndExchangePtr<ListItem>(cur, item, NULL))
 			cur = &((*cur)->next);
 	}
+
+	/**
+	 * \brief Insert an item at the beginning of the list
+	 *
+	 * Takes constant time unless several threads push at
+	 * the same moment. Since items are never removed,
+	 * this is not susceptible to the ABA problem.
+	 */
+	void push(const T &value) {
+		ListItem *item = new ListItem(value);
+		do {
+			item->next = m_head;
+		} while (!atomicCompareAndExchangePtr<ListItem>(&m_head, item, item->next));
+	}
 private:
 	ListItem *m_head;
 };
@@ -71,7 +86,8 @@ private:
  * \brief Generic multiple-reference octree.
  *
  * Based on the excellent implementation in PBRT. Modifications are 
- * the addition of a bounding sphere query and support for multithreading.
+ * the addition of a bounding sphere query and support for multithreading:
+ * insertions are lock-free and may happen concurrently with lookups.
  *
  * \ingroup libcore
  */
@@ -147,7 +163,7 @@ private:
 		   than the current node size */
 		if (depth == m_maxDepth || 
 			(nodeAABB.getExtents().lengthSquared() < diag2)) {
-			node->data.append(value);
+			node->data.push(value);
 			return;
 		}
 
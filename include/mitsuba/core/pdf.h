@@ -168,6 +168,111 @@ private:
 	bool m_ready;
 };
 
+/**
+ * \brief Stores a discrete probability distribution over the
+ * cells of a two-dimensional grid
+ * 
+ * Cells are sampled by first choosing a row according to the marginal
+ * distribution, followed by a column according to the conditional 
+ * distribution of that row. Both steps use a binary search, hence
+ * sampling takes O(log n) time. Compared to flattening the grid into
+ * a single \ref DiscretePDF, the per-row cumulative distributions
+ * retain much more precision for large grids (e.g. full-resolution
+ * environment maps) and require only one value per cell.
+ *
+ * Probabilities are computed from the stored cumulative distributions, 
+ * hence they exactly match the behavior of the sampling routine.
+ * 
+ * \ingroup libcore
+ */
+struct DiscretePDF2D {
+public:
+	/// Allocate a distribution with the given number of columns and rows
+	explicit inline DiscretePDF2D(const Vector2i &size = Vector2i(0, 0)) 
+			: m_size(size), m_marginal(size.y), m_ready(false) {
+		m_cdf.resize((size_t) (size.x+1) * size.y);
+	}
+
+	/// Return the number of columns and rows
+	inline const Vector2i &getSize() const {
+		return m_size;
+	}
+
+	/// Access the (unnormalized) value of a cell before calling \ref build()
+	inline Float &operator()(int x, int y) {
+		return m_cdf[(size_t) y * (m_size.x+1) + x + 1];
+	}
+
+	/// Has the distribution been built?
+	inline bool isReady() const {
+		return m_ready;
+	}
+
+	/// Return the original (unnormalized) sum of all cell values
+	inline Float getOriginalSum() const {
+		return m_marginal.getOriginalSum();
+	}
+
+	/**
+	 * \brief Normalize the distribution and build the associated 
+	 * marginal and conditional cumulative distribution functions.
+	 * \return Sum of all unnormalized cell values
+	 */
+	inline Float build() {
+		SAssert(m_size.x > 0 && m_size.y > 0);
+		for (int y=0; y<m_size.y; ++y) {
+			Float *cdf = &m_cdf[(size_t) y * (m_size.x+1)];
+			double sum = 0;
+			cdf[0] = 0.0f;
+			for (int x=1; x<=m_size.x; ++x) {
+				sum += cdf[x];
+				cdf[x] = (Float) sum;
+			}
+			m_marginal[y] = (Float) sum;
+
+			/* Rows without any mass are never sampled -- still,
+			   produce a valid conditional distribution */
+			for (int x=1; x<=m_size.x; ++x)
+				cdf[x] = sum > 0 ? (Float) (cdf[x] / sum) : (Float) x / m_size.x;
+			cdf[m_size.x] = 1.0f;
+		}
+		m_ready = true;
+		return m_marginal.build();
+	}
+
+	/**
+	 * \brief %Transform a uniformly distributed 2D sample. 
+	 * 
+	 * The original sample is adjusted so that it can be reused to 
+	 * choose a position within the returned cell.
+	 * \param[in,out] sample Uniform sample
+	 * \param[out] pdf Probability value of the sampled cell
+	 * \return Column and row of the sampled cell
+	 */
+	inline Point2i sampleReuse(Point2 &sample, Float &pdf) const {
+		Float pdfRow;
+		int y = m_marginal.sampleReuse(sample.y, pdfRow);
+		const Float *cdf = &m_cdf[(size_t) y * (m_size.x+1)];
+		int x = (int) (std::upper_bound(cdf, cdf + m_size.x + 1, sample.x) - cdf) - 1;
+		x = std::max(0, std::min(x, m_size.x - 1));
+		Float width = cdf[x+1] - cdf[x];
+		sample.x = width > 0 ? (sample.x - cdf[x]) / width : 0.0f;
+		pdf = pdfRow * width;
+		return Point2i(x, y);
+	}
+
+	/// Return the probability of sampling the given cell
+	inline Float pdf(int x, int y) const {
+		const Float *cdf = &m_cdf[(size_t) y * (m_size.x+1)];
+		return m_marginal[y] * (cdf[x+1] - cdf[x]);
+	}
+private:
+	Vector2i m_size;
+	std::vector<Float> m_cdf;
+	DiscretePDF m_marginal;
+	bool m_ready;
+};
+
 MTS_NAMESPACE_END
 
 #endif /* __PDF_H */
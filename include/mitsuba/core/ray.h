@@ -212,11 +212,14 @@ struct RayPacket4 {
 	QuadVector o, d;
 	QuadVector dRcp;
 	uint8_t signs[4][4];
+	/// Shared time value (only used by non-triangle shapes)
+	Float time;
 
-	inline RayPacket4() {
+	inline RayPacket4() : time(0.0f) {
 	}
 
 	inline bool load(const Ray *rays) {
+		time = rays[0].time;
 		for (int i=0; i<4; i++) {
 			for (int axis=0; axis<3; axis++) {
 				o[axis].f[i] = rays[i].o[axis];
@@ -266,6 +269,69 @@ struct Intersection4 {
 
 #endif
 
+#if defined(MTS_AVX)
+/** \brief AVX octo-packed ray for coherent ray tracing */
+struct RayPacket8 {
+	OctVector o, d;
+	OctVector dRcp;
+	uint8_t signs[4][8];
+	/// Shared time value (only used by non-triangle shapes)
+	Float time;
+
+	inline RayPacket8() : time(0.0f) {
+	}
+
+	/// Returns \c false when the direction signs of the rays differ
+	inline bool load(const Ray *rays) {
+		time = rays[0].time;
+		for (int i=0; i<8; i++) {
+			for (int axis=0; axis<3; axis++) {
+				o[axis].f[i] = rays[i].o[axis];
+				d[axis].f[i] = rays[i].d[axis];
+				dRcp[axis].f[i] = rays[i].dRcp[axis];
+				signs[axis][i] = rays[i].d[axis] < 0 ? 1 : 0;
+				if (signs[axis][i] != signs[axis][0])
+					return false;
+			}
+		}
+		return true;
+	}
+};
+
+struct RayInterval8 {
+	AVXVector mint;
+	AVXVector maxt;
+
+	inline RayInterval8() {
+		mint.ps = _mm256_set1_ps(Epsilon);
+		maxt.ps = _mm256_set1_ps(std::numeric_limits<float>::infinity());
+	}
+
+	inline RayInterval8(const Ray *rays) {
+		for (int i=0; i<8; i++) {
+			mint.f[i] = rays[i].mint;
+			maxt.f[i] = rays[i].maxt;
+		}
+	}
+};
+
+struct Intersection8 {
+	AVXVector t;
+	AVXVector u;
+	AVXVector v;
+	AVXVector primIndex;
+	AVXVector shapeIndex;
+
+	inline Intersection8() {
+		t.ps          = _mm256_set1_ps(std::numeric_limits<float>::infinity());
+		u.ps          = _mm256_setzero_ps();
+		v.ps          = _mm256_setzero_ps();
+		primIndex.ps  = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+		shapeIndex.ps = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+	}
+};
+#endif
+
 MTS_NAMESPACE_END
 
 #endif /* __RAY_H */
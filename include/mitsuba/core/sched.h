@@ -438,6 +438,32 @@ public:
 	/// Does the scheduler have one or more remote workers?
 	bool hasRemoteWorkers() const;
 
+	/**
+	 * \brief Enable or disable work stealing between local workers.
+	 *
+	 * By default, every local worker acquires its work units one at a 
+	 * time through the central scheduler lock, which can become a point 
+	 * of contention on machines with many cores and processes that 
+	 * generate very small work units. In work stealing mode, each local 
+	 * worker instead fetches up to \c prefetchCount work units from 
+	 * <tt>\ref ParallelProcess::generateWork()</tt> in one go and stores 
+	 * them in a private double-ended queue. Workers consume their own 
+	 * queue in LIFO order, and idle workers steal from the other end of 
+	 * the queues of their neighbors before falling back to the central 
+	 * scheduler lock. Remote workers are not affected by this setting.
+	 *
+	 * Note that a stolen work unit may have been generated for a 
+	 * different worker ID than the one that ends up processing it.
+	 * This function may only be called while the scheduler is stopped.
+	 */
+	void setWorkStealing(bool enabled, int prefetchCount = 4);
+
+	/// Is work stealing between local workers enabled?
+	inline bool getWorkStealing() const { return m_workStealing; }
+
+	/// Return the number of work units prefetched per local worker
+	inline int getPrefetchCount() const { return m_prefetchCount; }
+
 	/// Return a pointer to the scheduler of this process
 	inline static Scheduler *getInstance() { return m_scheduler; }
 
@@ -510,6 +536,7 @@ public:
 	struct ResourceRecord {
 		std::vector<SerializableObject *> resources;
 		ref<MemoryStream> stream;
+		std::string hash;
 		int refCount;
 		bool manifold;
 
@@ -523,6 +550,24 @@ public:
 		}
 	};
 
+	/// Work unit that has been generated ahead of time (work stealing mode)
+	struct QueuedUnit {
+		int id;
+		ref<WorkUnit> workUnit;
+
+		inline QueuedUnit() : id(-1) { }
+		inline QueuedUnit(int id, WorkUnit *workUnit) 
+			: id(id), workUnit(workUnit) { }
+	};
+
+	/// Per-worker double-ended queue of prefetched work units
+	struct WorkQueue {
+		ref<Mutex> mutex;
+		std::deque<QueuedUnit> units;
+
+		inline WorkQueue() : mutex(new Mutex()) { }
+	};
+
 	/// A list of status codes returned by acquireWork()
 	enum EStatus {
 		/// Sucessfully acquired a work unit
@@ -540,6 +585,15 @@ public:
 	/// Return a resource in the form of a binary data stream
 	const MemoryStream *getResourceStream(int id);
 
+	/**
+	 * \brief Return a content hash of the binary data stream 
+	 * associated with a resource (see \ref hashBuffer())
+	 *
+	 * Remote workers use this to avoid transmitting resources that
+	 * are already cached on the processing node.
+	 */
+	std::string getResourceHash(int id);
+
 	/**
 	 * \brief Test whether a resource is marked as manifold, 
 	 * i.e. different for every core.
@@ -558,6 +612,34 @@ protected:
 	 */
 	EStatus acquireWork(Item &item, bool local, bool onlyTry, bool keepLock);
 
+	/**
+	 * Work stealing mode: acquire a prefetched work unit from the queue 
+	 * of the worker associated with \c item, or steal one from another
+	 * worker's queue. Returns \c false if all queues are empty.
+	 */
+	bool acquireQueuedWork(Item &item);
+
+	/**
+	 * Work stealing mode: generate additional work units for the process
+	 * referenced by \c item and append them to the associated worker's 
+	 * queue. Must be called while the main scheduler lock is held.
+	 */
+	void prefetchWork(Item &item);
+
+	/**
+	 * Work stealing mode: remove all queued work units belonging to the 
+	 * process with the given record. Must be called while the main 
+	 * scheduler lock is held.
+	 */
+	void discardQueuedWork(ProcessRecord *rec);
+
+	/**
+	 * Serialize a (non-manifold) resource into a binary data stream 
+	 * and compute its content hash. Must be called while the main 
+	 * scheduler lock is held.
+	 */
+	void serializeResource(ResourceRecord *rec);
+
 	/// Release the main scheduler lock -- internally used by the remote worker
 	inline void releaseLock() { m_mutex->unlock(); }
 
@@ -636,8 +718,13 @@ private:
 	std::map<int, ResourceRecord *> m_resources;
 	/// List of all active workers
 	std::vector<Worker *> m_workers;
+	/// Per-worker queues of prefetched work units (work stealing mode)
+	std::vector<WorkQueue *> m_workQueues;
+	/// Total number of work units that are stored in the above queues
+	volatile int32_t m_queuedUnits;
 	int m_resourceCounter, m_processCounter;
-	bool m_running;
+	int m_prefetchCount;
+	bool m_running, m_workStealing;
 };
 
 /**
@@ -20,6 +20,11 @@
 #define __SCHED_REMOTE_H
 
 #include <mitsuba/core/sched.h>
+#include <mitsuba/core/timer.h>
+#include <boost/filesystem/path.hpp>
+#include <list>
+
+namespace fs = boost::filesystem;
 
 /** How many work units should be sent to a remote worker
    at a time? This is a multiple of the worker's core count */
@@ -30,6 +35,18 @@
    continue sending batches of work units */
 #define CONTINUE_FACTOR 2
 
+/** Upper bound on the back log factor when it is increased to
+   hide the measured round-trip latency of a connection */
+#define MAX_BACKLOG_FACTOR 32
+
+/** Minimum time between two round-trip latency measurements
+   of a connection (in milliseconds) */
+#define PING_INTERVAL 1000
+
+/** Default size limit of the on-disk resource cache of a
+   processing node (in bytes) */
+#define MTS_RESOURCE_CACHE_DEFAULT_SIZE (4096ULL * 1024 * 1024)
+
 MTS_NAMESPACE_BEGIN
 
 class RemoteWorkerReader;
@@ -47,12 +64,45 @@ public:
 	/**
 	 * \brief Construct a new remote worker with the given name and 
 	 * communication stream
+	 *
+	 * \param compressionLevel
+	 *    When set to a value between 1 and 9, the processing node
+	 *    compresses all work results using \c zlib with the given
+	 *    level before sending them. This reduces the required
+	 *    bandwidth when the results are large (e.g. image blocks),
+	 *    at the cost of some processing time on both sides. 
+	 *    The default (0) disables compression.
 	 */
-	RemoteWorker(const std::string &name, Stream *stream);
+	RemoteWorker(const std::string &name, Stream *stream,
+		int compressionLevel = 0);
 
 	/// Return the name of the node on the other side
 	inline const std::string &getNodeName() const { return m_nodeName; }
 
+	/// Return the number of resources that were found in the node's cache
+	inline size_t getResourceCacheHits() const { return m_resourceHits; }
+
+	/// Return the number of resources that had to be transmitted to the node
+	inline size_t getResourceCacheMisses() const { return m_resourceMisses; }
+
+	/// Return the number of resource bytes that were transmitted to the node
+	inline size_t getResourceBytesSent() const { return m_resourceBytesSent; }
+
+	/// Return the total size of all resources used by the node
+	inline size_t getResourceBytesTotal() const { return m_resourceBytesTotal; }
+
+	/// Return the compression level used for work results (0 = disabled)
+	inline int getCompressionLevel() const { return m_compressionLevel; }
+
+	/// Return the current round-trip latency estimate in seconds
+	inline Float getRoundTripTime() const { return m_rtt; }
+
+	/**
+	 * \brief Return the current number of work units that may 
+	 * be in flight before the worker waits for results
+	 */
+	inline size_t getBacklog() const { return m_backlog; }
+
 	MTS_DECLARE_CLASS()
 protected:
 	/// Virtual destructor
@@ -66,15 +116,41 @@ protected:
 	virtual void start(Scheduler *scheduler, int workerIndex, int coreOffset);
 	void flush();
 
-	inline void signalCompletion() {
+	/**
+	 * \brief Called by the reader thread when a work unit has been 
+	 * returned. Also updates the processing time estimate of the node.
+	 */
+	void signalCompletion();
+
+	/**
+	 * \brief Called by the reader thread when the response to a
+	 * latency measurement arrives
+	 *
+	 * \param token Timer value at the time the request was sent
+	 */
+	void signalPong(unsigned int token);
+
+	/**
+	 * \brief Adapt the number of in-flight work units to the current
+	 * round-trip time and per-unit processing time estimates
+	 */
+	void updateBacklog();
+
+	/**
+	 * \brief Deliver the node's response to a resource cache query.
+	 * An empty list signals that the connection was lost.
+	 */
+	inline void signalResourceStatus(const std::vector<bool> &status) {
 		m_mutex->lock();
-		m_inFlight--;
-		m_finishCond->signal();
+		m_resourceStatus = status;
+		m_resourceStatusReady = true;
+		m_resourceCond->signal();
 		m_mutex->unlock();
 	}
 protected:
 	ref<Mutex> m_mutex;
 	ref<ConditionVariable> m_finishCond;
+	ref<ConditionVariable> m_resourceCond;
 	ref<MemoryStream> m_memStream;
 	ref<Stream> m_stream;
 	ref<RemoteWorkerReader> m_reader;
@@ -86,6 +162,21 @@ protected:
 	std::set<std::string> m_plugins;
 	std::string m_nodeName;
 	size_t m_inFlight;
+	int m_compressionLevel;
+
+	/* Latency hiding: the worker keeps up to 'm_backlog' work units
+	   in flight and resumes sending once only 'm_continue' remain */
+	ref<Timer> m_timer;
+	size_t m_backlog, m_continue;
+	Float m_rtt, m_unitTime;
+	unsigned int m_lastPing, m_lastCompletion;
+	bool m_pingPending;
+
+	/* Resource cache query state and statistics */
+	std::vector<bool> m_resourceStatus;
+	bool m_resourceStatusReady;
+	size_t m_resourceHits, m_resourceMisses;
+	size_t m_resourceBytesSent, m_resourceBytesTotal;
 };
 
 /**
@@ -113,6 +204,9 @@ private:
 	bool m_shutdown;
 	int m_currentID;
 	Scheduler::Item m_schedItem;
+	/* Buffers used to decompress work results */
+	ref<MemoryStream> m_compressed, m_inflated;
+	size_t m_compressedBytes, m_uncompressedBytes;
 };
 
 /**
@@ -184,6 +278,83 @@ private:
 	bool m_done;
 };
 
+/**
+ * \brief Bounded, content-addressed on-disk cache of serialized resources
+ *
+ * Processing nodes use this class to keep the resources (scenes, meshes,
+ * textures, ..) submitted by clients across connections. Entries are 
+ * identified by their content hash (see \ref Scheduler::getResourceHash()),
+ * which allows a client to skip the transmission of resources that the 
+ * node has seen before. When the total size exceeds the specified limit,
+ * the least recently used entries are removed. The class is thread-safe
+ * and can be shared by several \ref StreamBackend instances.
+ *
+ * \ingroup libcore
+ */
+class MTS_EXPORT_CORE ResourceCache : public Object {
+public:
+	/**
+	 * \brief Create a new resource cache or open an existing one
+	 *
+	 * \param directory Directory containing the cache entries
+	 * \param maxSize   Maximum total size of the cached data in bytes
+	 */
+	ResourceCache(const fs::path &directory, 
+		size_t maxSize = MTS_RESOURCE_CACHE_DEFAULT_SIZE);
+
+	/**
+	 * \brief Look up a cached resource
+	 *
+	 * Returns a stream containing the serialized resource, or \c NULL 
+	 * if there is no entry with the given hash and size.
+	 */
+	ref<MemoryStream> get(const std::string &hash, size_t size);
+
+	/// Add a serialized resource to the cache (replaces existing entries)
+	void put(const std::string &hash, const void *data, size_t size);
+
+	/// Return the number of successful lookups
+	inline size_t getHits() const { return m_hits; }
+
+	/// Return the number of failed lookups
+	inline size_t getMisses() const { return m_misses; }
+
+	/// Return the total size of all cached resources
+	inline size_t getSize() const { return m_size; }
+
+	/// Return a string representation
+	std::string toString() const;
+
+	MTS_DECLARE_CLASS()
+protected:
+	/// Virtual destructor
+	virtual ~ResourceCache() { }
+
+	/// Return the path of the cache entry with the given hash
+	fs::path getPath(const std::string &hash) const;
+
+	/**
+	 * \brief Check that \c hash has the format produced by \ref hashBuffer()
+	 * (32 hexadecimal digits). Hashes are received from remote peers and
+	 * must never be used to construct a path otherwise.
+	 */
+	static bool isValidHash(const std::string &hash);
+
+	/// Remove least recently used entries until the size limit is met
+	void evict();
+private:
+	typedef std::list<std::string> lru_list;
+	typedef std::map<std::string, std::pair<size_t, lru_list::iterator> > entry_map;
+
+	fs::path m_directory;
+	mutable ref<Mutex> m_mutex;
+	lru_list m_lru;
+	entry_map m_entries;
+	size_t m_maxSize, m_size;
+	size_t m_hits, m_misses;
+	int m_tempCounter;
+};
+
 /**
  * \brief Network processing communication backend
  *
@@ -208,8 +379,14 @@ public:
 		EProcessCancelled,
 		EEnsurePluginLoaded,
 		EResourceExpired,
+		EQueryResources,
+		EResourceStatus,
 		EQuit,
 		EIncompatible,
+		ESetCompression,
+		ECompressedWorkResult,
+		EPing,
+		EPong,
 		EHello = 0x1bcd
 	};
 
@@ -226,9 +403,13 @@ public:
 	 *    Stream used for communications
 	 * \param detach
 	 *    Should the associated thread be joinable or detach instead?
+	 * \param cache
+	 *    Optional cache that is used to retain resources submitted by
+	 *    clients across connections
 	 */
 	StreamBackend(const std::string &name, Scheduler *scheduler, 
-		const std::string &nodeName, Stream *stream, bool detach);
+		const std::string &nodeName, Stream *stream, bool detach,
+		ResourceCache *cache = NULL);
 
 	MTS_DECLARE_CLASS()
 protected:
@@ -237,6 +418,10 @@ protected:
 	virtual void run();
 	void sendWorkResult(int id, const WorkResult *result, bool cancelled);
 	void sendCancellation(int id, int numLost);
+	void sendResourceStatus(const std::vector<bool> &status);
+	void sendPong(int token);
+	/// Unserialize a resource and register it with the local scheduler
+	void registerResource(int id, MemoryStream *mstream);
 private:
 	Scheduler *m_scheduler;
 	std::string m_nodeName;
@@ -245,6 +430,8 @@ private:
 	std::map<int, RemoteProcess *> m_processes;
 	std::map<int, int> m_resources;
 	ref<Mutex> m_sendMutex;
+	ref<ResourceCache> m_cache;
+	int m_compressionLevel;
 	bool m_detach;
 };
 
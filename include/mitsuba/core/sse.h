@@ -25,6 +25,7 @@
 #define FINLINE                inline __attribute__((always_inline))
 #define NOINLINE               __attribute__((noinline))
 #define MM_ALIGN16             __attribute__ ((aligned (16)))
+#define MM_ALIGN32             __attribute__ ((aligned (32)))
 #define EXPECT_TAKEN(a)        __builtin_expect(!!(a), true)
 #define EXPECT_NOT_TAKEN(a)    __builtin_expect(!!(a), false)
 #define BREAKPOINT()            do { __asm__("int3"); } while(0)
@@ -32,6 +33,7 @@
 #define FINLINE                inline __attribute__((always_inline))
 #define NOINLINE               __attribute__((noinline))
 #define MM_ALIGN16             __attribute__ ((aligned (16)))
+#define MM_ALIGN32             __attribute__ ((aligned (32)))
 #define EXPECT_TAKEN(a)        __builtin_expect(!!(a), true)
 #define EXPECT_NOT_TAKEN(a)    __builtin_expect(!!(a), false)
 #define BREAKPOINT()            do { __asm__("int3"); } while(0)
@@ -39,6 +41,7 @@
 #define FINLINE                __forceinline
 #define NOINLINE               __declspec(noinline)
 #define MM_ALIGN16             __declspec(align(16))
+#define MM_ALIGN32             __declspec(align(32))
 #define EXPECT_TAKEN(a)        (a)
 #define EXPECT_NOT_TAKEN(a)    (a)
 #define BREAKPOINT()           do { _asm { int 3 } } while (0)
@@ -174,6 +177,48 @@ inline void _mm_debug_epi32(const char *desc, __m128i value) {
 
 MTS_NAMESPACE_END
 
+#endif
+
+/* ========= AVX intrinsics ========= */
+#if defined(MTS_AVX)
+#if !defined(MTS_SSE)
+#error AVX support requires MTS_SSE
+#endif
+
+/* Include AVX intrinsics header file */
+#include <immintrin.h>
+
+#define mux256_ps(sel, op1, op2) _mm256_blendv_ps((op2), (op1), (sel))
+
+MTS_NAMESPACE_BEGIN
+
+/**
+ * \headerfile mitsuba/core/sse.h mitsuba/mitsuba.h
+ * \brief AVX 8-vector
+ */
+union AVXVector {
+	__m256 ps;
+	float f[8];
+	int32_t	i[8];
+
+	inline AVXVector() {
+	}
+
+	explicit AVXVector(__m256 ps)
+		: ps(ps) {
+	}
+
+	inline AVXVector &operator=(const AVXVector &vec) {
+		ps = vec.ps;
+		return *this;
+	}
+};
+
+/** Eight 3D vectors as SoA (structure of arrays) */
+typedef AVXVector OctVector[3];
+
+MTS_NAMESPACE_END
+
 #endif
 	
 /* ====== Performance counters (not really related to SSE) ====== */
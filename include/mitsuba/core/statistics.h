@@ -136,6 +136,29 @@ public:
 	}
 #endif
 	
+	/**
+	 * \brief Decrement the counter by the specified amount
+	 *
+	 * Useful for counters that track a current value, such as the
+	 * amount of memory held by a cache. Individual per-thread slots 
+	 * may wrap around, but their sum remains correct.
+	 */
+#ifdef MTS_NO_STATISTICS
+	inline void operator-=(size_t amount) { }
+#elif defined(WIN64)
+	inline void operator-=(size_t amount) {
+		InterlockedExchangeAdd64(reinterpret_cast<LONG64 *>(&m_value[Thread::getID() & NUM_COUNTERS_MASK].value), -(LONG64) amount);
+	}
+#elif defined(WIN32)
+	inline void operator-=(size_t amount) {
+		InterlockedExchangeAdd(reinterpret_cast<LONG *>(&m_value[Thread::getID() & NUM_COUNTERS_MASK].value), -(LONG) amount);
+	}
+#else
+	inline void operator-=(size_t amount) {
+		__sync_fetch_and_sub(&m_value[Thread::getID() & NUM_COUNTERS_MASK].value, amount);
+	}
+#endif
+
 	/// Increment the base counter by the specified amount (only for use with EPercentage/EAverage)
 #ifdef MTS_NO_STATISTICS
 	inline void incrementBase(size_t amount = 1) { }
@@ -267,6 +290,14 @@ public:
 	/// Register a counter with the statistics collector
 	void registerCounter(const StatsCounter *ctr);
 
+	/**
+	 * \brief Look up a registered counter by its category and name
+	 *
+	 * \return The counter, or \c NULL if no such counter exists
+	 */
+	const StatsCounter *getCounter(const std::string &category,
+		const std::string &name);
+
 	/// Record that a plugin has been loaded
 	void logPlugin(const std::string &pname, const std::string &descr);
 
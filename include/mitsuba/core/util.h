@@ -59,6 +59,16 @@ extern MTS_EXPORT_CORE std::string timeString(Float time, bool precise = false);
 /// Turn a memory size into a human-readable string
 extern MTS_EXPORT_CORE std::string memString(size_t size);
 
+/**
+ * \brief Compute a 128-bit hash of a memory region and return 
+ * it as a hexadecimal string
+ *
+ * Uses the x64 variant of MurmurHash3. This is not a cryptographic
+ * hash function, but it is fast and well-suited for identifying
+ * content such as serialized scene resources.
+ */
+extern MTS_EXPORT_CORE std::string hashBuffer(const void *data, size_t size);
+
 /// Return a string representation of a list of objects
 template<class Iterator> std::string containerToString(const Iterator &start, const Iterator &end) {
 	std::ostringstream oss;
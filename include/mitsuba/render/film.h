@@ -58,6 +58,18 @@ public:
 	/// Develop the film and write the result to the specified filename
 	virtual void develop(const fs::path &fileName) = 0;
 
+	/**
+	 * \brief Announce an upcoming block-based rendering
+	 *
+	 * Called by \ref BlockedRenderProcess users after \ref clear() when 
+	 * every image block of the given size (following the layout of 
+	 * \ref BlockedImageProcess) will be passed to \ref putImageBlock() 
+	 * exactly once. Films can use this information to write finished parts 
+	 * of the image to \c fileName while rendering is still in progress. 
+	 * The default implementation does nothing.
+	 */
+	virtual void setDestinationFile(const fs::path &fileName, int blockSize);
+
 	/// Ignoring the crop window, return the resolution of the underlying sensor
 	inline const Vector2i &getSize() const { return m_size; }
 	
@@ -51,6 +51,7 @@ template <typename Derived> class SAHKDTree3D;
 class ShapeKDTree;
 class LocalWorker;
 class Luminaire;
+class LightTree;
 struct LuminaireSamplingRecord;
 class Medium;
 struct MediumSamplingRecord;
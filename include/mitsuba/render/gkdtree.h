@@ -26,6 +26,10 @@
 #include <boost/tuple/tuple.hpp>
 #include <stack>
 
+#if defined(_OPENMP)
+#include <omp.h>
+#endif
+
 /// Activate lots of extra checks
 // #define MTS_KD_DEBUG 1
 
@@ -40,6 +44,9 @@
 #define MTS_KD_BLOCKSIZE_KD  (512*1024/sizeof(KDNode))
 #define MTS_KD_BLOCKSIZE_IDX (512*1024/sizeof(uint32_t))
 
+/// Nodes with fewer primitives are always binned/partitioned on a single thread
+#define MTS_KD_MIN_PARALLEL_PRIMS 32768
+
 #if defined(MTS_KD_DEBUG)
 #define KDAssert(expr) SAssert(expr)
 #define KDAssertEx(expr, text) SAssertEx(expr, text)
@@ -678,7 +685,10 @@ MTS_NAMESPACE_BEGIN
  * cache misses. Once the input data has been narrowed down to a 
  * reasonable amount, the implementation switches over to the O(N log N)
  * builder. When multiple processors are available, the build process runs
- * in parallel.
+ * in parallel: independent subtrees are handed to builder threads, while
+ * binning, partitioning and event sorting of large nodes near the top of
+ * the tree are distributed over all cores using OpenMP. The resulting
+ * tree does not depend on the number of threads.
  *
  * \author Wenzel Jakob
  */
@@ -704,11 +714,33 @@ public:
 	using Parent::m_tightAABB;
 	using Parent::isBuilt;
 
+	/// Tree construction phases, for which timings are recorded
+	enum EBuildPhase {
+		/// Computation of the scene bounds
+		EBoundsPhase = 0,
+		/// Min-max binning in the upper levels of the tree
+		EBinningPhase,
+		/// Min-max classification and partitioning
+		EPartitionPhase,
+		/// Creation of edge event lists (incl. primitive clipping)
+		EEventPhase,
+		/// Sorting of edge event lists
+		ESortPhase,
+		/// Greedy O(n log n) optimization of subtrees
+		EGreedyPhase,
+		/// Rewriting the tree into its final memory layout
+		ELayoutPhase,
+		/// Number of phases (not a phase)
+		EBuildPhaseCount
+	};
+
 	/**
 	 * \brief Create a new kd-tree instance initialized with 
 	 * the default parameters.
 	 */
 	GenericKDTree() : m_indices(NULL) {
+		for (int i=0; i<EBuildPhaseCount; ++i)
+			m_buildTime[i] = 0;
 		m_nodes = NULL;
 		m_traversalCost = 15;
 		m_queryCost = 20;
@@ -720,13 +752,19 @@ public:
 		m_maxDepth = 0;
 		m_retract = true;
 		m_parallelBuild = true;
+		m_buildThreadCount = 0;
+		m_activeThreadCount = 1;
 		m_minMaxBins = 128;
+		m_nodeCount = m_indexCount = 0;
+		m_externalStorage = false;
 	}
 
 	/**
 	 * \brief Release all memory
 	 */
 	virtual ~GenericKDTree() {
+		if (m_externalStorage)
+			return;
 		if (m_indices)
 			delete[] m_indices;
 		if (m_nodes)
@@ -887,6 +925,48 @@ public:
 		return m_parallelBuild;
 	}
 
+	/**
+	 * \brief Limit the number of threads that are used for 
+	 * parallel tree construction (0 = use all cores, default)
+	 */
+	inline void setBuildThreadCount(size_type count) {
+		m_buildThreadCount = count;
+	}
+
+	/**
+	 * \brief Return the maximum number of threads that are used for
+	 * parallel tree construction (0 = use all cores)
+	 */
+	inline size_type getBuildThreadCount() const {
+		return m_buildThreadCount;
+	}
+
+	/**
+	 * \brief Return the time (in seconds) that the last tree 
+	 * construction spent in the specified phase.
+	 *
+	 * Phases that run concurrently in several builder threads
+	 * (\ref EEventPhase, \ref ESortPhase and \ref EGreedyPhase)
+	 * report the accumulated time of all threads.
+	 */
+	inline Float getBuildTime(EBuildPhase phase) const {
+		return m_buildTime[phase];
+	}
+
+	/// Return a human-readable name of a tree construction phase
+	static const char *getBuildPhaseName(EBuildPhase phase) {
+		switch (phase) {
+			case EBoundsPhase: return "Scene bounds";
+			case EBinningPhase: return "Min-max binning";
+			case EPartitionPhase: return "Min-max partitioning";
+			case EEventPhase: return "Event list creation";
+			case ESortPhase: return "Event sorting";
+			case EGreedyPhase: return "Greedy O(n log n) build";
+			case ELayoutPhase: return "Memory layout";
+			default: return "Unknown";
+		}
+	}
+
 	/**
 	 * \brief Specify the number of primitives, at which the builder will 
 	 * switch from (approximate) Min-Max binning to the accurate 
@@ -904,7 +984,49 @@ public:
 	inline size_type getExactPrimitiveThreshold() const {
 		return m_exactPrimThreshold;
 	}
+
+	/// Return the number of nodes of the constructed tree
+	inline size_type getNodeCount() const {
+		return m_nodeCount;
+	}
+
+	/// Return the length of the primitive index list of the constructed tree
+	inline size_type getIndexCount() const {
+		return m_indexCount;
+	}
+
+	/// Return the primitive index list of the constructed tree
+	inline const index_type *getIndices() const {
+		return m_indices;
+	}
 protected:
+	/**
+	 * \brief Initialize the kd-tree using previously constructed node and
+	 * index lists (e.g. from a memory-mapped cache file) instead of 
+	 * building it from scratch.
+	 *
+	 * The storage is owned by the caller and must outlive the kd-tree.
+	 * To satisfy the alignment requirements of \ref KDNode::getSibling, 
+	 * \c nodes must point 8 bytes past a 16-byte aligned address. 
+	 *
+	 * To be called by the subclass instead of \ref buildInternal().
+	 */
+	void setExternalStorage(KDNode *nodes, size_type nodeCount,
+			index_type *indices, size_type indexCount,
+			const AABBType &aabb, const AABBType &tightAABB) {
+		if (isBuilt()) 
+			KDLog(EError, "The kd-tree has already been built!");
+		if (((ptrdiff_t) nodes & 15) != 8)
+			KDLog(EError, "setExternalStorage(): misaligned node storage!");
+		m_nodes = nodes;
+		m_nodeCount = nodeCount;
+		m_indices = indices;
+		m_indexCount = indexCount;
+		m_aabb = aabb;
+		m_tightAABB = tightAABB;
+		m_externalStorage = true;
+	}
+
 	/**
 	 * \brief Build a KD-tree over the supplied geometry
 	 *
@@ -936,9 +1058,28 @@ protected:
 			return;
 		}
 
-		if (primCount <= m_exactPrimThreshold)
+		for (int i=0; i<EBuildPhaseCount; ++i)
+			m_buildTime[i] = 0;
+
+		size_type procCount = getProcessorCount();
+		if (m_buildThreadCount > 0)
+			procCount = std::min(procCount, m_buildThreadCount);
+		if (procCount == 1)
 			m_parallelBuild = false;
 
+		/* Number of threads used to bin, partition and sort within a 
+		   single (large) node on the main thread */
+		m_activeThreadCount = 1;
+#if defined(_OPENMP)
+		if (m_parallelBuild)
+			m_activeThreadCount = (int) std::min((size_type) 
+				omp_get_max_threads(), procCount);
+#endif
+
+		/* Builder threads are only useful when the top levels of the 
+		   tree are constructed using min-max binning */
+		bool useBuilders = m_parallelBuild && primCount > m_exactPrimThreshold;
+
 		BuildContext ctx(primCount, m_minMaxBins);
 
 		/* Establish an ad-hoc depth cutoff value (Formula from PBRT) */
@@ -955,11 +1096,33 @@ protected:
 		ref<Timer> timer = new Timer();
 		AABBType &aabb = m_aabb;
 		aabb.reset();
-		for (index_type i=0; i<primCount; ++i) {
-			aabb.expandBy(cast()->getAABB(i));
-			indices[i] = i;
+#if defined(_OPENMP)
+		if (m_activeThreadCount > 1 && primCount >= MTS_KD_MIN_PARALLEL_PRIMS) {
+			/* The bounds are a min/max reduction and therefore 
+			   independent of the order of evaluation */
+			std::vector<AABBType> threadAABBs(m_activeThreadCount);
+			#pragma omp parallel num_threads(m_activeThreadCount)
+			{
+				AABBType threadAABB;
+				#pragma omp for schedule(static)
+				for (int i=0; i<(int) primCount; ++i) {
+					threadAABB.expandBy(cast()->getAABB(i));
+					indices[i] = i;
+				}
+				threadAABBs[omp_get_thread_num()] = threadAABB;
+			}
+			for (size_t i=0; i<threadAABBs.size(); ++i)
+				aabb.expandBy(threadAABBs[i]);
+		} else
+#endif
+		{
+			for (index_type i=0; i<primCount; ++i) {
+				aabb.expandBy(cast()->getAABB(i));
+				indices[i] = i;
+			}
 		}
 
+		m_buildTime[EBoundsPhase] = timer->getMicroseconds() * 1e-6f;
 		KDLog(EDebug, "Computed scene bounds in %i ms", 
 				timer->getMilliseconds());
 		KDLog(EDebug, "");
@@ -984,11 +1147,7 @@ protected:
 				m_parallelBuild ? "yes" : "no");
 		KDLog(EDebug, "");
 
-		size_type procCount = getProcessorCount();
-		if (procCount == 1)
-			m_parallelBuild = false;
-
-		if (m_parallelBuild) {
+		if (useBuilders) {
 			m_builders.resize(procCount);
 			for (size_type i=0; i<procCount; ++i) {
 				m_builders[i] = new TreeBuilder(i, this);
@@ -1006,7 +1165,7 @@ protected:
 		KDAssert(ctx.leftAlloc.used() == 0);
 		KDAssert(ctx.rightAlloc.used() == 0);
 
-		if (m_parallelBuild) {
+		if (useBuilders) {
 			m_interface.mutex->lock();
 			m_interface.done = true;
 			m_interface.cond->broadcast();
@@ -1042,6 +1201,8 @@ protected:
 			subCtx.rightAlloc.cleanup();
 			ctx.accumulateStatisticsFrom(subCtx);
 		}
+		for (int i=EBinningPhase; i<=EGreedyPhase; ++i)
+			m_buildTime[i] = ctx.buildTime[i];
 		KDLog(EDebug, "   Total: %s", memString(totalUsage).c_str());
 
 		KDLog(EDebug, "");
@@ -1140,6 +1301,7 @@ protected:
 		KDAssert(nodePtr == ctx.innerNodeCount + ctx.leafNodeCount);
 		KDAssert(indexPtr == m_indexCount);
 
+		m_buildTime[ELayoutPhase] = timer->getMicroseconds() * 1e-6f;
 		KDLog(EDebug, "Finished -- took %i ms.", timer->getMilliseconds());
 
 		/* Free some more memory */
@@ -1211,6 +1373,11 @@ protected:
 				expPrimitivesIntersected);
 		KDLog(EDebug, "   Final cost                  : %.2f", heuristicCost);
 		KDLog(EDebug, "");
+		KDLog(EDebug, "Time spent in the individual build phases:");
+		for (int i=0; i<EBuildPhaseCount; ++i)
+			KDLog(EDebug, "   %-27s : %.3f s", getBuildPhaseName((EBuildPhase) i),
+				m_buildTime[i]);
+		KDLog(EDebug, "");
 	}
 
 protected:
@@ -1285,7 +1452,11 @@ protected:
 				return a.axis < b.axis;
 			if (a.pos != b.pos)
 				return a.pos < b.pos;
-			return a.type < b.type;
+			if (a.type != b.type)
+				return a.type < b.type;
+			/* Break ties using the primitive index so that the ordering
+			   is strict and does not depend on the sorting algorithm */
+			return a.index < b.index;
 		}
 	};
 
@@ -1337,9 +1508,16 @@ protected:
 		size_type retractedSplits;
 		size_type pruned;
 
+		/* Time spent in the individual construction phases */
+		ref<Timer> timer;
+		Float buildTime[EBuildPhaseCount];
+
 		BuildContext(size_type primCount, size_type binCount)
 			: classStorage(primCount), minMaxBins(binCount) {
 			classStorage.setPrimitiveCount(primCount);
+			timer = new Timer();
+			for (int i=0; i<EBuildPhaseCount; ++i)
+				buildTime[i] = 0;
 			leafNodeCount = 0;
 			nonemptyLeafNodeCount = 0;
 			innerNodeCount = 0;
@@ -1378,6 +1556,8 @@ protected:
 			primIndexCount += ctx.primIndexCount;
 			retractedSplits += ctx.retractedSplits;
 			pruned += ctx.pruned;
+			for (int i=0; i<EBuildPhaseCount; ++i)
+				buildTime[i] += ctx.buildTime[i];
 		}
 	};
 
@@ -1396,7 +1576,7 @@ protected:
 		int depth;
 		KDNode *node;
 		AABBType nodeAABB;
-		EdgeEvent *eventStart, *eventEnd;
+		index_type *indices;
 		size_type primCount;
 		int badRefines;
 
@@ -1431,6 +1611,8 @@ protected:
 
 		void run() {
 			OrderedChunkAllocator &leftAlloc = m_context.leftAlloc;
+			OrderedChunkAllocator &rightAlloc = m_context.rightAlloc;
+			Timer *timer = m_context.timer;
 			while (true) {
 				m_interface.mutex->lock();
 				while (!m_interface.done && !m_interface.node)
@@ -1442,22 +1624,36 @@ protected:
 				int depth = m_interface.depth;
 				KDNode *node = m_interface.node;
 				AABBType nodeAABB = m_interface.nodeAABB;
-				size_t eventCount = m_interface.eventEnd - m_interface.eventStart;
 				size_type primCount = m_interface.primCount;
 				int badRefines = m_interface.badRefines;
-				EdgeEvent *eventStart = leftAlloc.allocate<EdgeEvent>(eventCount),
-						  *eventEnd = eventStart + eventCount;
-				memcpy(eventStart, m_interface.eventStart, 
-						eventCount * sizeof(EdgeEvent));
+				index_type *indices = rightAlloc.allocate<index_type>(primCount);
+				memcpy(indices, m_interface.indices, 
+						primCount * sizeof(index_type));
 				m_interface.threadMap[node] = m_id;
 				m_interface.node = NULL;
 				m_interface.condJobTaken->signal();
 				m_interface.mutex->unlock();
 
-				std::sort(eventStart, eventEnd, EdgeEventOrdering());
-				m_parent->buildTree(m_context, depth, node,
-					nodeAABB, eventStart, eventEnd, primCount, true, badRefines);
-				leftAlloc.release(eventStart);
+				/* Clip the primitives & create the event list here 
+				   rather than on the main thread */
+				timer->reset();
+				boost::tuple<EdgeEvent *, EdgeEvent *, size_type> events  
+					= m_parent->createEventList(leftAlloc, nodeAABB, 
+						indices, primCount);
+				rightAlloc.release(indices);
+				m_context.buildTime[EEventPhase] += timer->getMicroseconds() * 1e-6f;
+
+				timer->reset();
+				std::sort(boost::get<0>(events), boost::get<1>(events), 
+						EdgeEventOrdering());
+				m_context.buildTime[ESortPhase] += timer->getMicroseconds() * 1e-6f;
+
+				timer->reset();
+				m_parent->buildTree(m_context, depth, node, nodeAABB, 
+					boost::get<0>(events), boost::get<1>(events), 
+					boost::get<2>(events), true, badRefines);
+				m_context.buildTime[EGreedyPhase] += timer->getMicroseconds() * 1e-6f;
+				leftAlloc.release(boost::get<0>(events));
 			}
 		}
 
@@ -1529,6 +1725,41 @@ protected:
 		return boost::make_tuple(eventStart, eventEnd, actualPrimCount);
 	}
 
+	/**
+	 * \brief Sort an edge event list using up to \c threadCount threads
+	 *
+	 * The parallel version sorts one contiguous chunk per thread and
+	 * subsequently merges them in pairs. Since \ref EdgeEventOrdering
+	 * is a strict total order, the result is identical to that of a
+	 * serial sort.
+	 */
+	static void sortEvents(EdgeEvent *eventStart, EdgeEvent *eventEnd, 
+			int threadCount) {
+#if defined(_OPENMP)
+		size_t eventCount = eventEnd - eventStart;
+		int chunkCount = threadCount;
+		if (chunkCount > 1 && eventCount >= MTS_KD_MIN_PARALLEL_PRIMS) {
+			std::vector<EdgeEvent *> bounds(chunkCount + 1);
+			for (int i=0; i<=chunkCount; ++i)
+				bounds[i] = eventStart + (eventCount * i) / chunkCount;
+
+			#pragma omp parallel for schedule(static, 1) num_threads(chunkCount)
+			for (int i=0; i<chunkCount; ++i)
+				std::sort(bounds[i], bounds[i+1], EdgeEventOrdering());
+
+			for (int step=1; step<chunkCount; step *= 2) {
+				#pragma omp parallel for schedule(static, 1) num_threads(chunkCount)
+				for (int i=0; i<chunkCount-step; i += 2*step)
+					std::inplace_merge(bounds[i], bounds[i+step], 
+						bounds[std::min(i+2*step, chunkCount)], 
+						EdgeEventOrdering());
+			}
+			return;
+		}
+#endif
+		std::sort(eventStart, eventEnd, EdgeEventOrdering());
+	}
+
 	/**
 	 * \brief Leaf node creation helper function
 	 *
@@ -1668,19 +1899,15 @@ protected:
 	inline Float transitionToNLogN(BuildContext &ctx, unsigned int depth, KDNode *node, 
 			const AABBType &nodeAABB, index_type *indices,
 			size_type primCount, bool isLeftChild, size_type badRefines) {
-		OrderedChunkAllocator &alloc = isLeftChild 
-				? ctx.leftAlloc : ctx.rightAlloc;
-		boost::tuple<EdgeEvent *, EdgeEvent *, size_type> events  
-				= createEventList(alloc, nodeAABB, indices, primCount);
-		Float cost;
-		if (m_parallelBuild) {
+		if (m_builders.size() > 0) {
+			/* Hand the index list to a builder thread, which takes 
+			   care of event list creation, sorting and construction */
 			m_interface.mutex->lock();
 			m_interface.depth = depth;
 			m_interface.node = node;
 			m_interface.nodeAABB = nodeAABB;
-			m_interface.eventStart = boost::get<0>(events);
-			m_interface.eventEnd = boost::get<1>(events);
-			m_interface.primCount = boost::get<2>(events);
+			m_interface.indices = indices;
+			m_interface.primCount = primCount;
 			m_interface.badRefines = badRefines;
 			m_interface.cond->signal();
 
@@ -1690,15 +1917,29 @@ protected:
 			m_interface.mutex->unlock();
 
 			// Never tear down this subtree (return a cost of -infinity)
-			cost = -std::numeric_limits<Float>::infinity();
-		} else {
-			std::sort(boost::get<0>(events), boost::get<1>(events), 
-					EdgeEventOrdering());
-
-			cost = buildTree(ctx, depth, node, nodeAABB,
-				boost::get<0>(events), boost::get<1>(events), 
-				boost::get<2>(events), isLeftChild, badRefines);
+			return -std::numeric_limits<Float>::infinity();
 		}
+
+		OrderedChunkAllocator &alloc = isLeftChild 
+				? ctx.leftAlloc : ctx.rightAlloc;
+		ctx.timer->reset();
+		boost::tuple<EdgeEvent *, EdgeEvent *, size_type> events  
+				= createEventList(alloc, nodeAABB, indices, primCount);
+		ctx.buildTime[EEventPhase] += ctx.timer->getMicroseconds() * 1e-6f;
+
+		/* Executed on the main thread -- use all cores to sort if 
+		   parallel construction is enabled */
+		ctx.timer->reset();
+		sortEvents(boost::get<0>(events), boost::get<1>(events), 
+				m_activeThreadCount);
+		ctx.buildTime[ESortPhase] += ctx.timer->getMicroseconds() * 1e-6f;
+
+		ctx.timer->reset();
+		Float cost = buildTree(ctx, depth, node, nodeAABB,
+			boost::get<0>(events), boost::get<1>(events), 
+			boost::get<2>(events), isLeftChild, badRefines);
+		ctx.buildTime[EGreedyPhase] += ctx.timer->getMicroseconds() * 1e-6f;
+
 		alloc.release(boost::get<0>(events));
 		return cost;
 	}
@@ -1751,14 +1992,16 @@ protected:
 	    /*                              Binning                                 */
 	    /* ==================================================================== */
 
+		ctx.timer->reset();
 		ctx.minMaxBins.setAABB(tightAABB);
-		ctx.minMaxBins.bin(cast(), indices, primCount);
+		ctx.minMaxBins.bin(cast(), indices, primCount, m_activeThreadCount);
 
 		/* ==================================================================== */
 	    /*                        Split candidate search                        */
     	/* ==================================================================== */
 		SplitCandidate bestSplit = ctx.minMaxBins.minimizeCost(m_traversalCost,
 				m_queryCost);
+		ctx.buildTime[EBinningPhase] += ctx.timer->getMicroseconds() * 1e-6f;
 
 		if (bestSplit.cost == std::numeric_limits<Float>::infinity()) {
 			/* This is bad: we have either run out of floating point precision to
@@ -1789,9 +2032,11 @@ protected:
 	    /*                            Partitioning                              */
 	    /* ==================================================================== */
 
+		ctx.timer->reset();
 		boost::tuple<AABBType, index_type *, AABBType, index_type *> partition = 
 			ctx.minMaxBins.partition(ctx, cast(), indices, bestSplit, 
-				isLeftChild, m_traversalCost, m_queryCost);
+				isLeftChild, m_traversalCost, m_queryCost, m_activeThreadCount);
+		ctx.buildTime[EPartitionPhase] += ctx.timer->getMicroseconds() * 1e-6f;
 
 		/* ==================================================================== */
 	    /*                              Recursion                               */
@@ -2375,26 +2620,57 @@ protected:
 		 *     a given list of primitives
 		 * \param indices Primitive indirection list
 		 * \param primCount Specifies the length of \a indices
+		 * \param threadCount Number of threads to distribute the work
+		 *     over. Each thread bins into private counters, which are
+		 *     summed up afterwards (hence the result is the same).
 		 */
 		void bin(const Derived *derived, index_type *indices, 
-				size_type primCount) {
+				size_type primCount, int threadCount = 1) {
+			const size_type binCount = m_binCount * point_type::dim;
 			m_primCount = primCount;
-			memset(m_minBins, 0, sizeof(size_type) * point_type::dim * m_binCount);
-			memset(m_maxBins, 0, sizeof(size_type) * point_type::dim * m_binCount);
-			const int64_t maxBin = m_binCount-1;
-
-			for (size_type i=0; i<m_primCount; ++i) {
-				const AABBType aabb = derived->getAABB(indices[i]);
-				for (int axis=0; axis<point_type::dim; ++axis) {
-					int64_t minIdx = (int64_t) ((aabb.min[axis] - m_aabb.min[axis]) 
-							* m_invBinSize[axis]);
-					int64_t maxIdx = (int64_t) ((aabb.max[axis] - m_aabb.min[axis]) 
-							* m_invBinSize[axis]);
-					m_maxBins[axis * m_binCount 
-						+ std::max((int64_t) 0, std::min(maxIdx, maxBin))]++;
-					m_minBins[axis * m_binCount 
-						+ std::max((int64_t) 0, std::min(minIdx, maxBin))]++;
+			memset(m_minBins, 0, sizeof(size_type) * binCount);
+			memset(m_maxBins, 0, sizeof(size_type) * binCount);
+
+#if defined(_OPENMP)
+			if (threadCount > 1 && primCount >= MTS_KD_MIN_PARALLEL_PRIMS) {
+				std::vector<size_type> bins(2 * binCount * threadCount, 0);
+				#pragma omp parallel num_threads(threadCount)
+				{
+					size_type *minBins = &bins[2 * binCount * omp_get_thread_num()],
+							  *maxBins = minBins + binCount;
+					#pragma omp for schedule(static)
+					for (int i=0; i<(int) primCount; ++i)
+						binPrimitive(derived->getAABB(indices[i]), minBins, maxBins);
 				}
+				for (int t=0; t<threadCount; ++t) {
+					const size_type *minBins = &bins[2 * binCount * t],
+						  *maxBins = minBins + binCount;
+					for (size_type i=0; i<binCount; ++i) {
+						m_minBins[i] += minBins[i];
+						m_maxBins[i] += maxBins[i];
+					}
+				}
+				return;
+			}
+#endif
+
+			for (size_type i=0; i<m_primCount; ++i)
+				binPrimitive(derived->getAABB(indices[i]), m_minBins, m_maxBins);
+		}
+
+		/// Add a single primitive to the specified min and max bins
+		inline void binPrimitive(const AABBType &aabb, size_type *minBins,
+				size_type *maxBins) const {
+			const int64_t maxBin = m_binCount-1;
+			for (int axis=0; axis<point_type::dim; ++axis) {
+				int64_t minIdx = (int64_t) ((aabb.min[axis] - m_aabb.min[axis]) 
+						* m_invBinSize[axis]);
+				int64_t maxIdx = (int64_t) ((aabb.max[axis] - m_aabb.min[axis]) 
+						* m_invBinSize[axis]);
+				maxBins[axis * m_binCount 
+					+ std::max((int64_t) 0, std::min(maxIdx, maxBin))]++;
+				minBins[axis * m_binCount 
+					+ std::max((int64_t) 0, std::min(minIdx, maxBin))]++;
 			}
 		}
 
@@ -2518,7 +2794,7 @@ protected:
 		boost::tuple<AABBType, index_type *, AABBType, index_type *> partition(
 				BuildContext &ctx, const Derived *derived, index_type *primIndices,
 				SplitCandidate &split, bool isLeftChild, Float traversalCost, 
-				Float queryCost) {
+				Float queryCost, int threadCount = 1) {
 			const float splitPos = split.pos;
 			const int axis = split.axis;
 			size_type numLeft = 0, numRight = 0;
@@ -2535,25 +2811,94 @@ protected:
 				rightIndices = primIndices;
 			}
 
-			for (size_type i=0; i<m_primCount; ++i) {
-				const index_type primIndex = primIndices[i];
-				const AABBType aabb = derived->getAABB(primIndex);
-
-				if (aabb.max[axis] <= splitPos) {
-					KDAssert(numLeft < split.numLeft);
-					leftBounds.expandBy(aabb);
-					leftIndices[numLeft++] = primIndex;
-				} else if (aabb.min[axis] > splitPos) {
-					KDAssert(numRight < split.numRight);
-					rightBounds.expandBy(aabb);
-					rightIndices[numRight++] = primIndex;
-				} else {
-					leftBounds.expandBy(aabb);
-					rightBounds.expandBy(aabb);
-					KDAssert(numLeft < split.numLeft);
-					KDAssert(numRight < split.numRight);
-					leftIndices[numLeft++] = primIndex;
-					rightIndices[numRight++] = primIndex;
+#if defined(_OPENMP)
+			int chunkCount = threadCount;
+			if (chunkCount > 1 && m_primCount >= MTS_KD_MIN_PARALLEL_PRIMS) {
+				/* Parallel classification: each thread classifies a contiguous
+				   chunk of primitives and counts the results. A prefix sum over
+				   the counts then allows to scatter the indices into the 
+				   output lists in their original order */
+				std::vector<uint8_t> classes(m_primCount);
+				std::vector<size_type> chunkLeft(chunkCount + 1, 0),
+					chunkRight(chunkCount + 1, 0);
+				std::vector<AABBType> chunkLeftBounds(chunkCount),
+					chunkRightBounds(chunkCount);
+
+				#pragma omp parallel for schedule(static, 1) num_threads(chunkCount)
+				for (int c=0; c<chunkCount; ++c) {
+					size_type start = (size_type) (((uint64_t) m_primCount * c) / chunkCount),
+							  end = (size_type) (((uint64_t) m_primCount * (c+1)) / chunkCount);
+					for (size_type i=start; i<end; ++i) {
+						const AABBType aabb = derived->getAABB(primIndices[i]);
+						if (aabb.max[axis] <= splitPos) {
+							classes[i] = ELeftSide;
+							chunkLeftBounds[c].expandBy(aabb);
+							chunkLeft[c+1]++;
+						} else if (aabb.min[axis] > splitPos) {
+							classes[i] = ERightSide;
+							chunkRightBounds[c].expandBy(aabb);
+							chunkRight[c+1]++;
+						} else {
+							classes[i] = EBothSides;
+							chunkLeftBounds[c].expandBy(aabb);
+							chunkRightBounds[c].expandBy(aabb);
+							chunkLeft[c+1]++;
+							chunkRight[c+1]++;
+						}
+					}
+				}
+
+				for (int c=0; c<chunkCount; ++c) {
+					chunkLeft[c+1] += chunkLeft[c];
+					chunkRight[c+1] += chunkRight[c];
+					leftBounds.expandBy(chunkLeftBounds[c]);
+					rightBounds.expandBy(chunkRightBounds[c]);
+				}
+				numLeft = chunkLeft[chunkCount];
+				numRight = chunkRight[chunkCount];
+				KDAssert(numLeft == split.numLeft);
+				KDAssert(numRight == split.numRight);
+
+				/* One of the output lists aliases the input -- copy it */
+				std::vector<index_type> source(primIndices, primIndices + m_primCount);
+
+				#pragma omp parallel for schedule(static, 1) num_threads(chunkCount)
+				for (int c=0; c<chunkCount; ++c) {
+					size_type start = (size_type) (((uint64_t) m_primCount * c) / chunkCount),
+							  end = (size_type) (((uint64_t) m_primCount * (c+1)) / chunkCount);
+					index_type *left = leftIndices + chunkLeft[c],
+							   *right = rightIndices + chunkRight[c];
+					for (size_type i=start; i<end; ++i) {
+						const index_type primIndex = source[i];
+						if (classes[i] != ERightSide)
+							*left++ = primIndex;
+						if (classes[i] != ELeftSide)
+							*right++ = primIndex;
+					}
+				}
+			} else
+#endif
+			{
+				for (size_type i=0; i<m_primCount; ++i) {
+					const index_type primIndex = primIndices[i];
+					const AABBType aabb = derived->getAABB(primIndex);
+
+					if (aabb.max[axis] <= splitPos) {
+						KDAssert(numLeft < split.numLeft);
+						leftBounds.expandBy(aabb);
+						leftIndices[numLeft++] = primIndex;
+					} else if (aabb.min[axis] > splitPos) {
+						KDAssert(numRight < split.numRight);
+						rightBounds.expandBy(aabb);
+						rightIndices[numRight++] = primIndex;
+					} else {
+						leftBounds.expandBy(aabb);
+						rightBounds.expandBy(aabb);
+						KDAssert(numLeft < split.numLeft);
+						KDAssert(numRight < split.numRight);
+						leftIndices[numLeft++] = primIndex;
+						rightIndices[numRight++] = primIndex;
+					}
 				}
 			}
 
@@ -2622,6 +2967,7 @@ protected:
 	Float m_queryCost;
 	Float m_emptySpaceBonus;
 	bool m_clip, m_retract, m_parallelBuild;
+	bool m_externalStorage;
 	size_type m_maxDepth;
 	size_type m_stopPrims;
 	size_type m_maxBadRefines;
@@ -2631,6 +2977,9 @@ protected:
 	size_type m_indexCount;
 	std::vector<TreeBuilder *> m_builders;
 	std::vector<KDNode *> m_indirections;
+	Float m_buildTime[EBuildPhaseCount];
+	size_type m_buildThreadCount;
+	int m_activeThreadCount;
 	ref<Mutex> m_indirectionLock;
 	BuildInterface m_interface;
 };
@@ -309,6 +309,16 @@ public:
 	 */
 	inline void setExtra(int32_t value) { extra = value; }
 
+	/**
+	 * \brief Return the estimated relative variance of a single sample,
+	 * averaged over the pixels of this block. This is used by the
+	 * adaptive sampling mode of \ref BlockedRenderProcess.
+	 */
+	inline Float getVarianceEstimate() const { return varianceEstimate; }
+
+	/// Set the estimated relative per-sample variance of this block
+	inline void setVarianceEstimate(Float value) { varianceEstimate = value; }
+
 	// ======================================================================
 	//! @{ \name Implementation of the WorkResult interface
 	// ======================================================================
@@ -352,6 +362,8 @@ protected:
 	Float *alphaSnapshot;
 	/* Implementation specific payload */
 	int32_t extra;
+	/* Relative per-sample variance estimate (adaptive sampling) */
+	Float varianceEstimate;
 };
 
 MTS_NAMESPACE_END
@@ -228,6 +228,18 @@ public:
 	 */
 	inline bool rayIntersect(const RayDifferential &ray);
 
+	/**
+	 * \brief Variant of \ref rayIntersect(), which uses an intersection 
+	 * record that was already computed by a batched intersection query
+	 * (see \ref Scene::rayIntersect(const Ray *, Intersection *, size_t)).
+	 *
+	 * Apart from not tracing the ray, this function behaves exactly like
+	 * \ref rayIntersect().
+	 *
+	 * \return \c true if there is a valid intersection.
+	 */
+	inline bool rayIntersect(const RayDifferential &ray, const Intersection &its);
+
 	/// Retrieve a 2D sample
 	inline Point2 nextSample2D();
 
@@ -236,6 +248,9 @@ public:
 
 	/// Return a string representation
 	std::string toString() const;
+protected:
+	/// Post-process a new intersection (opacity, distance, flags)
+	inline void finishIntersection(const RayDifferential &ray);
 public:
 	// An asterisk (*) marks entries, which may be overwritten
 	// by the callee.
@@ -357,6 +372,26 @@ public:
 		Sampler *sampler, ImageBlock *block, const bool &stop,
 		const std::vector<Point2i> *points = NULL) const;
 
+	/**
+	 * \brief Render a range of pixel samples within an image block
+	 *
+	 * This is a variant of \ref renderBlock(), which only takes the pixel
+	 * samples with the indices <tt>firstSample, .., firstSample + 
+	 * sampleCount - 1</tt> (the sampler must support at least 
+	 * <tt>firstSample + sampleCount</tt> samples per pixel). Subsequent
+	 * calls therefore continue a sample sequence rather than repeating
+	 * it. It also stores an estimate of the relative per-sample variance 
+	 * in the block (see \ref ImageBlock::getVarianceEstimate()).
+	 *
+	 * This is used by the adaptive sampling mode of 
+	 * \ref BlockedRenderProcess. The default implementation of 
+	 * \ref renderBlock() forwards all samples to this function.
+	 */
+	virtual void renderSampleRange(const Scene *scene, const Camera *camera, 
+		Sampler *sampler, ImageBlock *block, const bool &stop,
+		const std::vector<Point2i> *points, size_t firstSample, 
+		size_t sampleCount) const;
+
 	/**
 	 * <tt>NetworkedObject</tt> implementation:
 	 * When a parallel rendering process starts, the integrator is 
@@ -395,6 +430,10 @@ protected:
 protected:
 	/// Used to temporarily cache a parallel process while it is in operation
 	ref<ParallelProcess> m_process;
+	/* Adaptive sampling configuration (see \ref BlockedRenderProcess) */
+	bool m_adaptive;
+	Float m_adaptiveBudget;
+	int m_adaptivePasses;
 };
 
 /*
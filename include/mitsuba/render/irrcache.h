@@ -208,9 +208,48 @@ public:
 	 */
 	bool get(const Intersection &its, Spectrum &E) const;
 
-	/// Manually insert an irradiance record
+	/**
+	 * \brief Manually insert an irradiance record
+	 *
+	 * The cache takes ownership of the record. Insertions are
+	 * lock-free and can safely be performed from multiple threads.
+	 */
 	void insert(Record *rec);
 
+	/**
+	 * \brief Merge the records of another irradiance cache
+	 *
+	 * Inserts copies of all records of \c cache, except for ones
+	 * which are already present (e.g. when both caches were
+	 * warm-started from the same file). This can be used to combine
+	 * the caches computed by several network nodes.
+	 *
+	 * \return The number of added records
+	 */
+	size_t merge(const IrradianceCache *cache);
+
+	/**
+	 * \brief Write the irradiance cache to a file
+	 *
+	 * The file can be loaded again using \ref load() to 
+	 * warm-start the cache in a later frame or job.
+	 */
+	void save(const fs::path &path) const;
+
+	/**
+	 * \brief Load an irradiance cache from a file created by \ref save()
+	 *
+	 * To warm-start a cache with different parameters (quality, 
+	 * clamping, etc.), \ref merge() the result into it.
+	 */
+	static ref<IrradianceCache> load(const fs::path &path);
+
+	/// Return the bounding box of the cache
+	inline const AABB &getAABB() const { return m_octree.getAABB(); }
+
+	/// Return the number of records stored in the cache
+	size_t getRecordCount() const;
+
 	/**
 	 * Serialize an irradiance cache to a binary data stream
 	 */
@@ -326,12 +365,11 @@ protected:
     /* ===================================================================== */
 
 	Octree<Record *> m_octree;
-	std::vector<Record *> m_records;
+	LockFreeList<Record *> m_records;
 	Float m_kappa;
 	Float m_sceneSize;
 	Float m_minDist, m_maxDist;
 	bool m_clampScreen, m_clampNeighbor, m_useGradients;
-	ref<Mutex> m_mutex;
 };
 
 MTS_NAMESPACE_END
@@ -0,0 +1,165 @@
+/*
+    This file is part of Mitsuba, a physically based rendering system.
+
+    Copyright (c) 2007-2011 by Wenzel Jakob and others.
+
+    Mitsuba is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Mitsuba is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#if !defined(__LIGHTTREE_H)
+#define __LIGHTTREE_H
+
+#include <mitsuba/core/aabb.h>
+#include <mitsuba/core/pdf.h>
+#include <mitsuba/render/luminaire.h>
+
+MTS_NAMESPACE_BEGIN
+
+/**
+ * \brief Bounding volume hierarchy over the luminaires of a scene,
+ * which is used to choose a luminaire for direct illumination
+ * sampling based on the position of the shading point.
+ *
+ * Every node stores the total power of its luminaires, their spatial
+ * bounds and a cone bounding their emission directions. The tree is
+ * traversed stochastically: at each inner node, one of the children
+ * is chosen proportionally to a conservative estimate of the amount
+ * of light it sends towards the shading point. Since the estimate
+ * only depends on the shading point, the probability of choosing
+ * a certain luminaire can be computed exactly by retracing the path
+ * from its leaf to the root (e.g. for multiple importance sampling).
+ *
+ * Luminaires without a finite spatial extent (e.g. environment and
+ * directional sources) are not part of the hierarchy. They are
+ * chosen in a first step along with the tree as a whole, using
+ * the same weights as the standard scene luminaire sampling code.
+ *
+ * Based on "Importance Sampling of Many Lights with Adaptive
+ * Tree Splitting" by Alejandro Conty Estevez and Christopher Kulla
+ * (Proceedings of HPG 2018), without the splitting part.
+ */
+class MTS_EXPORT_RENDER LightTree : public Object {
+public:
+	/**
+	 * \brief Build a luminaire hierarchy
+	 *
+	 * \param luminaires
+	 *    List of luminaires (which must already have been pre-processed)
+	 * \param importanceSample
+	 *    Should luminaires be chosen proportional to their power?
+	 *    Otherwise, only the geometric terms are considered.
+	 */
+	LightTree(const std::vector<Luminaire *> &luminaires, bool importanceSample);
+
+	/**
+	 * \brief Choose a luminaire for direct illumination sampling
+	 * at the point \c p
+	 *
+	 * \param sample
+	 *    A uniformly distributed sample in [0, 1). It is re-scaled
+	 *    upon return so that it can be used again.
+	 * \param pdf
+	 *    Will be set to the discrete probability of the chosen luminaire
+	 */
+	const Luminaire *sample(const Point &p, Float &sample, Float &pdf) const;
+
+	/// Return the probability of choosing \c luminaire at the point \c p
+	Float pdf(const Point &p, const Luminaire *luminaire) const;
+
+	/// Return the number of luminaires that are part of the hierarchy
+	inline size_t getLocalLuminaireCount() const { return m_leaves.size(); }
+
+	/// Return the number of nodes in the hierarchy
+	inline size_t getNodeCount() const { return m_nodes.size(); }
+
+	/// Return a string representation
+	std::string toString() const;
+
+	/**
+	 * \brief Merge a direction cone (given by its axis and half-angle
+	 * in radians) into another one, so that the result bounds both
+	 */
+	static void mergeCone(Vector &axis, Float &thetaO,
+		const Vector &axis2, Float thetaO2);
+
+	MTS_DECLARE_CLASS()
+protected:
+	/// Virtual destructor
+	virtual ~LightTree() { }
+
+	/// Luminaire hierarchy node
+	struct Node {
+		AABB aabb;
+		Vector axis;
+		Float thetaO, thetaE;
+		Float cosThetaO, sinThetaO, cosThetaE;
+		Float power;
+		uint32_t parent;
+		/// First child (inner nodes) or luminaire index (leaves)
+		uint32_t index;
+		bool leaf;
+	};
+
+	/// Luminaire (cluster) bounds used during construction
+	struct Item {
+		AABB aabb;
+		Vector axis;
+		Float thetaO, thetaE;
+		Float power;
+		uint32_t index;
+
+		/// Create an empty item
+		inline Item() : axis(0.0f), thetaO(-1), thetaE(0), power(0), index(0) { }
+
+		/// Is this item empty?
+		inline bool isEmpty() const { return thetaO < 0; }
+
+		/// Expand the bounds to include another item
+		void expandBy(const Item &item);
+	};
+
+	/// Recursively build the subtree at \c nodeIndex
+	void build(std::vector<Item> &items, uint32_t nodeIndex,
+		size_t start, size_t end, int depth);
+
+	/// Set the bounds of a node
+	static void setBounds(Node &node, const Item &bounds);
+
+	/// Return the relative cost of a node according to the surface area orientation heuristic
+	static Float getCost(const Item &bounds);
+
+	/// Return the estimated contribution of a node at the point \c p
+	Float importance(const Node &node, const Point &p) const;
+
+	/// Return the probability of choosing the left child of \c node at \c p
+	Float probLeft(const Node &node, const Point &p) const;
+private:
+	std::vector<Node> m_nodes;
+	/// Maps luminaires in the hierarchy to their leaf node
+	std::vector<uint32_t> m_leaves;
+	std::vector<const Luminaire *> m_local;
+	std::vector<const Luminaire *> m_infinite;
+	/**
+	 * Maps infinite luminaires to their entry in \c m_topPDF and
+	 * local luminaires to <tt>m_infinite.size()</tt> + their index
+	 * in \c m_local
+	 */
+	std::map<const Luminaire *, uint32_t> m_index;
+	/// Chooses between infinite luminaires and the hierarchy
+	DiscretePDF m_topPDF;
+	int m_maxDepth;
+};
+
+MTS_NAMESPACE_END
+
+#endif /* __LIGHTTREE_H */
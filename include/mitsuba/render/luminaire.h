@@ -179,6 +179,27 @@ public:
 	 */
 	inline Float getSamplingWeight() const { return m_samplingWeight; }
 
+	/**
+	 * \brief Return conservative bounds on the positions and 
+	 * directions of emission, which are used to build a luminaire 
+	 * hierarchy (see \ref LightTree).
+	 *
+	 * \param aabb
+	 *    Bounds on all points from which light is emitted
+	 * \param axis
+	 *    Axis of a cone bounding the luminaire's normal directions
+	 * \param thetaO
+	 *    Half-angle of the normal cone (in radians)
+	 * \param thetaE
+	 *    Maximum angle between an emitted direction and the
+	 *    associated normal (e.g. pi/2 for diffuse area sources)
+	 * \return \c false if the luminaire is not spatially localized
+	 *    (e.g. a directional or environment source). This is what
+	 *    the default implementation does.
+	 */
+	virtual bool getEmissionBounds(AABB &aabb, Vector &axis,
+		Float &thetaO, Float &thetaE) const;
+
 	//! @}
 	// =============================================================
 
@@ -20,12 +20,29 @@
 #define __MIPMAP_H
 
 #include <mitsuba/core/bitmap.h>
+#include <mitsuba/core/fstream.h>
+#include <mitsuba/core/lock.h>
 
 MTS_NAMESPACE_BEGIN
 
 #define MIPMAP_LUTSIZE 128
 
+/// Side length of the square tiles used by tiled mip maps (must be a power of two)
+#define MIPMAP_TILESIZE 64
+
+/// Default size of the tile cache that is shared by all tiled mip maps (in bytes)
+#define MIPMAP_DEFAULT_CACHESIZE (256 * 1024 * 1024)
+
+struct MIPMapTile;
+
 /** \brief Isotropic/anisotropic EWA mip-map texture map class based on PBRT 
+ *
+ * A mip map can either keep its entire image pyramid in memory, or it can
+ * be opened from a tiled file created using \ref writeTiled(). In the latter
+ * case, individual tiles of the pyramid are decompressed on first access
+ * and kept in a bounded LRU cache, which is shared by all tiled mip maps.
+ * This makes it possible to render scenes whose textures exceed the
+ * available memory.
  */
 class MTS_EXPORT_RENDER MIPMap : public Object {
 public:
@@ -45,18 +62,92 @@ public:
 		ENone
 	};
 
+	/**
+	 * \brief Storage format of the texels in the image pyramid
+	 *
+	 * The compact formats are converted to a \ref Spectrum at lookup time.
+	 */
+	enum ETexelFormat {
+		/// Full spectral representation (SPECTRUM_SAMPLES values of type \c Float)
+		ESpectrum = 0,
+		/// 8-bit sRGB-encoded RGB (3 bytes per texel)
+		ESRGB8,
+		/// Linear RGB stored as half-precision floats (6 bytes per texel)
+		EHalfRGB
+	};
+
 	/**
 	 * Construct a new mip-map from the given texture. Does not
-	 * need to have a power-of-two size.
+	 * need to have a power-of-two size. Takes ownership of the
+	 * \c pixels array.
 	 */
 	MIPMap(int width, int height, Spectrum *pixels, 
 		EFilterType filterType = EEWA, EWrapMode wrapMode = ERepeat,
-		Float maxAnisotropy = 8.0f);
+		Float maxAnisotropy = 8.0f, ETexelFormat texelFormat = ESpectrum);
 
 	/// Construct a mip map from a HDR bitmap
 	static ref<MIPMap> fromBitmap(Bitmap *bitmap, 
 		EFilterType filterType = EEWA, EWrapMode wrapMode = ERepeat,
-		Float maxAnisotropy = 8.0f);
+		Float maxAnisotropy = 8.0f, ETexelFormat texelFormat = ESpectrum);
+
+	/**
+	 * \brief Parse the name of a texel format ("spectrum", 
+	 * "srgb8" or "half"). Throws an exception for unknown names.
+	 */
+	static ETexelFormat parseTexelFormat(const std::string &name);
+
+	/**
+	 * \brief Open a tiled mip map file created by \ref writeTiled()
+	 *
+	 * Only the file header is read by this constructor. The filter type,
+	 * wrap mode and texel format are the ones that were used to create 
+	 * the file.
+	 */
+	MIPMap(const fs::path &filename, Float maxAnisotropy = 8.0f);
+
+	/**
+	 * \brief Open a cached tiled mip map file if it is usable
+	 *
+	 * Returns \c NULL if \c cacheFile does not exist, is older than
+	 * \c sourceFile, or was created with different settings.
+	 */
+	static ref<MIPMap> fromTiledFile(const fs::path &cacheFile,
+		const fs::path &sourceFile, EFilterType filterType = EEWA,
+		EWrapMode wrapMode = ERepeat, Float maxAnisotropy = 8.0f,
+		ETexelFormat texelFormat = ESpectrum);
+
+	/**
+	 * \brief Write the image pyramid to a tiled and compressed file,
+	 * which can later be opened without loading it into memory.
+	 *
+	 * The file is first written to a temporary location and then renamed.
+	 * Returns \c false (and logs a warning) if the file could not be
+	 * written.
+	 */
+	bool writeTiled(const fs::path &filename) const;
+
+	/// Is this a tiled mip map that loads its texels on demand?
+	inline bool isTiled() const { return m_pyramid == NULL; }
+
+	/**
+	 * \brief Load and decompress one tile of a tiled mip map
+	 *
+	 * Used internally by the tile cache -- there should be
+	 * no need to call this function directly.
+	 */
+	ref<MIPMapTile> loadTile(uint32_t index) const;
+
+	/**
+	 * \brief Set the memory budget of the tile cache that is 
+	 * shared by all tiled mip maps (in bytes). 
+	 *
+	 * Only has an effect before the first tiled mip map is opened, 
+	 * or after all of them have been released.
+	 */
+	static void setTileCacheSize(size_t size);
+
+	/// Return the memory budget of the tile cache
+	static size_t getTileCacheSize();
 
 	/// Do a mip-map lookup at the appropriate level
 	Spectrum getValue(Float u, Float v,
@@ -65,6 +156,17 @@ public:
 	/// Return the number of mip-map levels
 	inline int getLevels() const { return m_levels; }
 
+	/// Return the storage format of the texels
+	inline ETexelFormat getTexelFormat() const { return m_texelFormat; }
+
+	/**
+	 * \brief Return the memory used by the image pyramid (in bytes)
+	 *
+	 * Tiled mip maps return zero, since their texels are 
+	 * stored in the shared tile cache.
+	 */
+	size_t getMemoryUsage() const;
+
 	/// Bilinear interpolation using a triangle filter
 	Spectrum triangle(int level, Float x, Float y) const;
 
@@ -74,11 +176,22 @@ public:
 	/// Return the height of the represented texture
 	inline int getHeight() const { return m_height; }
 
-	/// Return a pointer to internal image representation at full resolution
-	inline const Spectrum *getImageData() const { return m_pyramid[0]; }
+	/**
+	 * \brief Return a pointer to internal image representation at full resolution
+	 *
+	 * Returns \c NULL for tiled mip maps and compact texel formats.
+	 */
+	inline const Spectrum *getImageData() const { return getImageData(0); }
 	
-	/// Return a pointer to internal image representation at the specified resolution
-	inline const Spectrum *getImageData(int level) const { return m_pyramid[level]; }
+	/**
+	 * \brief Return a pointer to internal image representation at the specified resolution
+	 *
+	 * Returns \c NULL for tiled mip maps and compact texel formats.
+	 */
+	inline const Spectrum *getImageData(int level) const { 
+		return (m_pyramid && m_texelFormat == ESpectrum) 
+			? reinterpret_cast<const Spectrum *>(m_pyramid[level]) : NULL;
+	}
 
 	/// Return the resolution of the specified level
 	inline const Vector2i getLevelResolution(int level) const {
@@ -109,6 +222,24 @@ protected:
 	/// Look up a texel at the given hierarchy level
 	Spectrum getTexel(int level, int x, int y) const;
 
+	/// Compute the component-wise maximum at the zero level
+	Spectrum computeMaximum() const;
+
+	/// Convert a texel from the storage format into a spectrum
+	inline Spectrum decodeTexel(const uint8_t *ptr) const;
+
+	/// Convert the pyramid from \ref ESpectrum to the given texel format
+	void convertPyramid(ETexelFormat texelFormat);
+
+	/// Release the storage of one level of a resident pyramid
+	void releaseLevel(int level);
+
+	/// Look up a texel of a tiled mip map (coordinates must be valid)
+	Spectrum getTiledTexel(int level, int x, int y) const;
+
+	/// Allocate the per-level resolution arrays and the EWA weight table
+	void initialize();
+
 	/**
 	 * Calculate the elliptically weighted average of a sample with
      * differential uv information
@@ -123,11 +254,22 @@ private:
 	int m_levels;
 	int *m_levelWidth;
 	int *m_levelHeight;
-	Spectrum **m_pyramid;
+	uint8_t **m_pyramid;
+	ETexelFormat m_texelFormat;
+	size_t m_texelSize;
 	EFilterType m_filterType;
 	EWrapMode m_wrapMode;
 	Float *m_weightLut;
 	Float m_maxAnisotropy;
+
+	/* Tiled mip maps */
+	uint32_t m_id;
+	mutable ref<FileStream> m_tileFile;
+	mutable ref<Mutex> m_tileFileMutex;
+	uint32_t *m_levelTileOffset;
+	int *m_levelTilesX;
+	uint64_t *m_tileOffsets;
+	Spectrum m_maximum;
 };
 
 MTS_NAMESPACE_END
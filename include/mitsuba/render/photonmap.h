@@ -29,6 +29,9 @@ MTS_NAMESPACE_BEGIN
  */
 #define MAX_PHOTONMAP_DEPTH 30 // corresponds to 1,073,741,824 photons
 
+/// Photon maps with fewer entries are always balanced on a single thread
+#define PHOTONMAP_MIN_PARALLEL_PHOTONS 32768
+
 /** \brief Generic photon map implementation based on Henrik Wann Jensen's book
  * "Realistic Image Synthesis Using Photon Mapping". Uses 64-bit addressing
  * for really really large photon maps. STL-ified implementation with some 
@@ -74,6 +77,20 @@ public:
 	 */
 	bool storePhoton(const Photon &photon);
 
+	/**
+	 * \brief Append a buffer of photons to the photon map
+	 *
+	 * In contrast to \ref storePhoton(), this function is thread-safe
+	 * and lock-free: each caller atomically reserves a contiguous range
+	 * of slots and then copies its photons without further
+	 * synchronization. This makes it possible to gather photons into
+	 * per-thread buffers and to merge them concurrently.
+	 *
+	 * \return The number of photons that were stored. This is less than
+	 * \c count when the photon map runs out of space.
+	 */
+	size_t storePhotons(const Photon *photons, size_t count);
+
 	/// Scale all photon power values contained in this photon map
 	inline void setScaleFactor(Float value) { m_scale = value; }
 
@@ -84,8 +101,15 @@ public:
 	 * Recursively build a left-balanced kd-tree. This has to be
 	 * done once after all photons have been stored, but prior to
 	 * executing any queries.
+	 *
+	 * Large photon maps are balanced in parallel using OpenMP. The
+	 * resulting tree is identical to the one created by the serial
+	 * algorithm.
+	 *
+	 * \param threadCount Maximum number of threads to be used. The
+	 * default (\c 0) uses all available OpenMP threads.
 	 */
-	void balance();
+	void balance(int threadCount = 0);
 
 	/**
 	 * Using the photon map, estimate the irradiance on a surface (Unfiltered)
@@ -274,6 +298,21 @@ protected:
 	inline bool isInnerNode(size_t index) const { return index <= m_lastInnerNode; }
 	inline bool hasRightChild(size_t index) const { return index <= m_lastRChildNode; }
 
+	/// Subtree that still needs to be balanced (used by \ref balanceParallel())
+	struct BalanceTask {
+		size_t start, end, heapIndex;
+		AABB aabb;
+
+		inline BalanceTask() { }
+		inline BalanceTask(size_t start, size_t end, size_t heapIndex, const AABB &aabb)
+			: start(start), end(end), heapIndex(heapIndex), aabb(aabb) { }
+
+		inline size_t size() const { return end - start; }
+		inline bool operator<(const BalanceTask &other) const {
+			return size() > other.size();
+		}
+	};
+
 	/// \endcond
 protected:
     /* ===================================================================== */
@@ -317,6 +356,33 @@ protected:
 		photon_iterator sortEnd,
 		std::vector<size_t> &heapPermutation,
 		AABB &aabb, size_t heapIndex) const;
+
+	/**
+	 * \brief Create a single node of the left-balanced kd-tree
+	 *
+	 * Partitions the range [\c sortStart, \c sortEnd) along the
+	 * largest axis of \c aabb, records the resulting pivot photon at
+	 * position \c heapIndex of the heap permutation and returns it.
+	 */
+	photon_iterator partitionNode(
+		photon_iterator basePtr,
+		photon_iterator sortStart,
+		photon_iterator sortEnd,
+		std::vector<size_t> &heapPermutation,
+		const AABB &aabb, size_t heapIndex) const;
+
+	/**
+	 * \brief Parallel version of \ref balanceRecursive()
+	 *
+	 * The top levels of the tree are created one level at a time, 
+	 * where all nodes on a level are partitioned in parallel. As soon
+	 * as there are enough independent subtrees to keep all threads
+	 * busy, these are handed to \ref balanceRecursive().
+	 */
+	void balanceParallel(
+		std::vector<photon_ptr> &photonPointers,
+		std::vector<size_t> &heapPermutation,
+		int threadCount) const;
 private:
     /* ===================================================================== */
     /*                        Protected attributes                           */
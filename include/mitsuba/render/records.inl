@@ -90,21 +90,34 @@ inline bool RadianceQueryRecord::rayIntersect(const RayDifferential &ray) {
 	/* Only search for an intersection if this was explicitly requested */
 	if (type & EIntersection) {
 		scene->rayIntersect(ray, its);
-		if (type & EOpacity) {
-			if (its.isValid())
-				alpha = 1.0f;
-			else if (medium == NULL)
-				alpha = 0.0f;
-			else
-				alpha = 1-medium->getTransmittance(ray).average();
-		}
-		if (type & EDistance)
-			dist = its.t;
-		type ^= EIntersection; // unset the intersection bit
+		finishIntersection(ray);
 	}
 	return its.isValid();
 }
 
+inline bool RadianceQueryRecord::rayIntersect(const RayDifferential &ray,
+		const Intersection &_its) {
+	if (type & EIntersection) {
+		its = _its;
+		finishIntersection(ray);
+	}
+	return its.isValid();
+}
+
+inline void RadianceQueryRecord::finishIntersection(const RayDifferential &ray) {
+	if (type & EOpacity) {
+		if (its.isValid())
+			alpha = 1.0f;
+		else if (medium == NULL)
+			alpha = 0.0f;
+		else
+			alpha = 1-medium->getTransmittance(ray).average();
+	}
+	if (type & EDistance)
+		dist = its.t;
+	type ^= EIntersection; // unset the intersection bit
+}
+
 inline Point2 RadianceQueryRecord::nextSample2D() {
 	return sampler->next2D();
 }
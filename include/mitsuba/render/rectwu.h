@@ -54,6 +54,41 @@ private:
 	Vector2i m_size;
 };
 
+/**
+ * \brief Rectangular work unit that additionally specifies a range of 
+ * pixel sample indices that should be rendered.
+ *
+ * Used by the adaptive sampling mode of \ref BlockedRenderProcess. A
+ * sample count of zero denotes that all samples should be rendered.
+ */
+class MTS_EXPORT_RENDER SampleRangeWorkUnit : public RectangularWorkUnit {
+public:
+	inline SampleRangeWorkUnit() : m_firstSample(0), m_sampleCount(0) { }
+
+	/* WorkUnit implementation */
+	void set(const WorkUnit *wu);
+	void load(Stream *stream);
+	void save(Stream *stream) const;
+
+	inline size_t getFirstSample() const { return m_firstSample; }
+	inline size_t getSampleCount() const { return m_sampleCount; }
+
+	inline void setSampleRange(size_t firstSample, size_t sampleCount) {
+		m_firstSample = firstSample;
+		m_sampleCount = sampleCount;
+	}
+
+	std::string toString() const;
+
+	MTS_DECLARE_CLASS()
+protected:
+	/// Virtual destructor
+	virtual ~SampleRangeWorkUnit() { }
+private:
+	size_t m_firstSample;
+	size_t m_sampleCount;
+};
+
 MTS_NAMESPACE_END
 
 #endif /* __RECT_WORKUNIT_H */
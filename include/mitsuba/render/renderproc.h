@@ -22,6 +22,8 @@
 #include <mitsuba/render/scene.h>
 #include <mitsuba/render/imageproc.h>
 #include <mitsuba/render/renderqueue.h>
+#include <mitsuba/core/fstream.h>
+#include <mitsuba/core/mstream.h>
 
 MTS_NAMESPACE_BEGIN
 
@@ -31,6 +33,20 @@ MTS_NAMESPACE_BEGIN
  * Splits an image into independent rectangular pixel regions, which are
  * then rendered in parallel.
  *
+ * Optionally, the process can perform adaptive sampling (see 
+ * \ref setAdaptiveSampling()). In this case, the image is rendered in
+ * several passes: a uniform base pass is followed by passes that each
+ * distribute a share of the remaining sample budget over the blocks, 
+ * so that the estimated relative variance of all blocks becomes equal.
+ * Since successive passes continue the pixel sample sequence of the
+ * sampler (see \ref SampleIntegrator::renderSampleRange()), this works 
+ * with all samplers and sample-based integrators.
+ *
+ * Long renderings can furthermore be checkpointed (see \ref setCheckpoint()):
+ * every finished image block is then appended to a checkpoint file, from 
+ * which an interrupted job can later be resumed without redoing any of the
+ * completed work.
+ *
  * \sa SampleIntegrator
  */
 class MTS_EXPORT_RENDER BlockedRenderProcess : public BlockedImageProcess {
@@ -38,6 +54,42 @@ public:
 	BlockedRenderProcess(const RenderJob *parent, RenderQueue *queue, 
 		int blockSize);
 
+	/**
+	 * \brief Enable adaptive sampling
+	 *
+	 * \param maxSampleCount
+	 *    Maximum number of samples per pixel (usually the sample
+	 *    count of the sampler)
+	 * \param budget
+	 *    Average number of samples per pixel, specified as a 
+	 *    fraction of \c maxSampleCount
+	 * \param passCount
+	 *    Number of adaptive passes following the base pass
+	 */
+	void setAdaptiveSampling(size_t maxSampleCount, Float budget, int passCount);
+
+	/**
+	 * \brief Incrementally write the rendering progress to a checkpoint file
+	 *
+	 * The file records the accumulated contents of all finished image
+	 * blocks (including their weights, alpha values and statistics), 
+	 * which identifies the completed work units. In adaptive mode, this 
+	 * also determines the per-block sampler state, i.e. the index of the 
+	 * next pixel sample. The file is removed by \ref RenderJob once the
+	 * output image has been written.
+	 *
+	 * \param path
+	 *    Path of the checkpoint file
+	 * \param resume
+	 *    When set to \c true, an existing checkpoint file at \c path
+	 *    is replayed into the film, and rendering continues from there.
+	 *    Otherwise, any existing file is overwritten.
+	 * \param sampleCount
+	 *    Number of samples per pixel of the sampler. A checkpoint 
+	 *    can only be resumed using the same sample count.
+	 */
+	void setCheckpoint(const fs::path &path, bool resume, size_t sampleCount);
+
 	// ======================================================================
 	//! @{ \name Implementation of the ParallelProcess interface
 	// ======================================================================
@@ -54,7 +106,51 @@ public:
 protected:
 	/// Virtual destructor
 	virtual ~BlockedRenderProcess();
+
+	/**
+	 * \brief Determine the work units of the next adaptive pass based 
+	 * on the current variance estimates. Returns \c false when there is 
+	 * nothing left to do.
+	 */
+	bool planAdaptivePass();
+
+	/// Index of the image block containing the given pixel offset
+	inline size_t getBlockIndex(const Point2i &offset) const {
+		const Vector2i pos = (offset - m_offset) / m_blockSize;
+		return pos.x + pos.y * m_numBlocks.x;
+	}
+
+	/// Account for a finished image block (m_resultMutex must be held)
+	bool accountResult(const ImageBlock *block, bool cancelled);
+
+	/// Create or resume the checkpoint file (called by \ref bindResource())
+	void openCheckpoint();
+
+	/// Replay the records of an existing checkpoint file
+	void replayCheckpoint();
+
+	/// Append an image block to the checkpoint file
+	void writeCheckpoint(const ImageBlock *block);
 protected:
+	/// Adaptive sampling state of an image block
+	struct AdaptiveTile {
+		Point2i offset;
+		Vector2i size;
+		/// Samples per pixel that have been scheduled so far
+		size_t sampleCount;
+		/// Relative per-sample variance estimate and its weight
+		Float variance;
+		size_t varianceWeight;
+	};
+
+	/// Adaptive sampling: a range of samples in a single tile
+	struct AdaptiveWork {
+		size_t tile, firstSample, sampleCount;
+
+		inline AdaptiveWork(size_t tile, size_t firstSample, size_t sampleCount)
+			: tile(tile), firstSample(firstSample), sampleCount(sampleCount) { }
+	};
+
 	ref<RenderQueue> m_queue;
 	ref<Scene> m_scene;
 	ref<Film> m_film;
@@ -63,6 +159,29 @@ protected:
 	ref<Mutex> m_resultMutex;
 	ProgressReporter *m_progress;
 	int m_borderSize;
+
+	/* Adaptive sampling */
+	bool m_adaptive;
+	size_t m_maxSampleCount, m_baseSampleCount;
+	Float m_budget;
+	int m_passCount, m_pass;
+	std::vector<AdaptiveTile> m_tiles;
+	std::vector<size_t> m_spiralOrder;
+	std::vector<AdaptiveWork> m_passWork;
+	size_t m_passGenerated, m_passFinished;
+	size_t m_samplesDone, m_samplesTotal;
+	bool m_finished;
+	/// Maps (tile, first sample) to an entry of \c m_passWork
+	std::map<std::pair<size_t, size_t>, size_t> m_passIndex;
+
+	/* Checkpointing */
+	fs::path m_checkpointPath;
+	bool m_resume;
+	size_t m_checkpointSampleCount;
+	ref<FileStream> m_checkpoint;
+	ref<MemoryStream> m_checkpointBuffer;
+	/// Finished blocks (non-adaptive) or work units of the current pass
+	std::vector<bool> m_done;
 };
 
 MTS_NAMESPACE_END
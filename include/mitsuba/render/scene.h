@@ -26,6 +26,7 @@
 #include <mitsuba/render/skdtree.h>
 #include <mitsuba/render/camera.h>
 #include <mitsuba/render/luminaire.h>
+#include <mitsuba/render/lighttree.h>
 #include <mitsuba/render/integrator.h>
 #include <mitsuba/render/bsdf.h>
 #include <mitsuba/render/subsurface.h>
@@ -231,6 +232,26 @@ public:
 		return m_kdtree->rayIntersect(ray, t, shape, n);
 	}
 
+	/**
+	 * \brief Intersect a batch of rays against all primitives stored
+	 * in the scene and return detailed intersection information
+	 *
+	 * Groups of coherent rays (e.g. several camera rays of the same 
+	 * pixel) are internally traced as SIMD packets when Mitsuba was
+	 * compiled with coherent ray tracing support. For rays that miss,
+	 * <tt>its[i].t</tt> is set to infinity.
+	 *
+	 * \param rays
+	 *    An array of \c count rays
+	 *
+	 * \param its
+	 *    An array of \c count intersection records, which will 
+	 *    be filled by the intersection query
+	 */
+	inline void rayIntersect(const Ray *rays, Intersection *its, size_t count) const {
+		m_kdtree->rayIntersect(rays, its, count);
+	}
+
 	/**
 	 * \brief Test for occlusion between \c p1 and \c p2 at the
 	 * specified time
@@ -245,6 +266,31 @@ public:
 		return m_kdtree->rayIntersect(ray);
 	}
 
+	/**
+	 * \brief Batched version of \ref isOccluded(), which tests for 
+	 * occlusion between \c p1 and each of the \c count points in \c p2
+	 *
+	 * Since all shadow rays share the same origin, they are traced 
+	 * as SIMD packets when coherent ray tracing support is available.
+	 * The result for each segment is written to \c occluded.
+	 */
+	void isOccluded(const Point &p1, const Point *p2, size_t count,
+		Float time, bool *occluded) const;
+
+	/**
+	 * \brief Batched version of \ref isOccluded() for \c count
+	 * arbitrary segments
+	 *
+	 * The rays (including their \c mint and \c maxt values) must be
+	 * set up by the caller. Groups of consecutive rays with directions
+	 * in the same octant are traced as SIMD packets when coherent ray
+	 * tracing support is available. The result for each ray is 
+	 * written to \c occluded.
+	 */
+	inline void isOccluded(const Ray *rays, size_t count, bool *occluded) const {
+		m_kdtree->rayIntersect(rays, occluded, count);
+	}
+
 	/**
 	 * \brief Return the transmittance between \c p1 and \c p2 at
 	 * the specified time.
@@ -513,6 +559,8 @@ public:
 	inline std::vector<Shape *> &getShapes() { return m_shapes; }
 	/// Return the scene's shapes (including triangular meshes)
 	inline const std::vector<Shape *> &getShapes() const { return m_shapes; }
+	/// Return the luminaire hierarchy used for direct illumination sampling (if enabled)
+	inline const LightTree *getLightTree() const { return m_lightTree.get(); }
 	/// Return the scene's luminaires
 	inline std::vector<Luminaire *> &getLuminaires() { return m_luminaires; }
 	/// Return the scene's luminaires
@@ -542,6 +590,21 @@ public:
 	/// Return the block resolution used to split images into parallel workloads
 	inline int getBlockSize() const { return m_blockSize; }
 
+	/**
+	 * \brief Set the checkpoint file used by block-based renderings
+	 *
+	 * When non-empty, the rendering progress is incrementally written to 
+	 * this file, which is removed once the output image has been written.
+	 * When \c resume is set to \c true, an interrupted rendering continues 
+	 * from the state recorded in an existing checkpoint file.
+	 */
+	inline void setCheckpointFile(const fs::path &name, bool resume = false) {
+		m_checkpointFile = name; m_resumeCheckpoint = resume; }
+	/// Return the checkpoint file (or an empty path if checkpointing is disabled)
+	inline const fs::path &getCheckpointFile() const { return m_checkpointFile; }
+	/// Should rendering resume from an existing checkpoint?
+	inline bool getResumeCheckpoint() const { return m_resumeCheckpoint; }
+
 	/// Serialize the whole scene to a network/file stream
 	void serialize(Stream *stream, InstanceManager *manager) const;
 	/* NetworkedObject implementation */
@@ -562,6 +625,14 @@ protected:
 	/// Add a shape to the scene
 	void addShape(Shape *shape);
 
+	/// Choose a luminaire for direct illumination sampling at \c p
+	inline const Luminaire *chooseLuminaire(const Point &p,
+			Float &sample, Float &pdf) const {
+		if (m_lightTree.get())
+			return m_lightTree->sample(p, sample, pdf);
+		return m_luminaires[m_luminairePDF.sampleReuse(sample, pdf)];
+	}
+
 private:
 	ref<ShapeKDTree> m_kdtree;
 	ref<Camera> m_camera;
@@ -577,10 +648,14 @@ private:
 	std::set<Medium *> m_media;
 	fs::path m_sourceFile;
 	fs::path m_destinationFile;
+	fs::path m_checkpointFile;
+	bool m_resumeCheckpoint;
 	DiscretePDF m_luminairePDF;
+	ref<LightTree> m_lightTree;
 	AABB m_aabb;
 	BSphere m_bsphere;
 	bool m_importanceSampleLuminaires;
+	bool m_useLightTree;
 	ETestType m_testType;
 	Float m_testThresh;
 	int m_blockSize;
@@ -216,6 +216,34 @@ public:
 	 */
 	virtual AABB getClippedAABB(const AABB &box) const;
 
+	/**
+	 * \brief Return the number of time segments of a moving shape
+	 *
+	 * A shape, whose position changes over time, can return a value
+	 * greater than one to be split temporally: kd-trees then store 
+	 * one primitive per segment using the (much tighter) bounds 
+	 * returned by \ref getTimeSegmentAABB(), and a ray is only tested
+	 * against the segment containing its time value. 
+	 * The default implementation returns 1.
+	 */
+	virtual size_t getTimeSegmentCount() const;
+
+	/**
+	 * \brief Return the index of the time segment containing the
+	 * specified time value (must be in [0, getTimeSegmentCount()-1])
+	 *
+	 * The default implementation returns 0.
+	 */
+	virtual size_t getTimeSegment(Float time) const;
+
+	/**
+	 * \brief Return a bounding box containing the shape during
+	 * a certain time segment. 
+	 *
+	 * The default implementation returns \ref getAABB()
+	 */
+	virtual AABB getTimeSegmentAABB(size_t segment) const;
+
 	/**
 	 * \brief Create a triangle mesh approximation of this shape
 	 *
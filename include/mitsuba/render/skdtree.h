@@ -22,6 +22,7 @@
 #include <mitsuba/render/shape.h>
 #include <mitsuba/render/sahkdtree3.h>
 #include <mitsuba/render/triaccel.h>
+#include <mitsuba/core/mmap.h>
 
 #if defined(MTS_KD_CONSERVE_MEMORY)
 #if defined(MTS_HAS_COHERENT_RT)
@@ -36,6 +37,13 @@
 #define MTS_KD_INTERSECTION_TEMP 64
 #endif
 
+/// Number of rays per SIMD packet used by the batched intersection routines
+#if defined(MTS_AVX)
+#define MTS_KD_PACKET_SIZE 8
+#else
+#define MTS_KD_PACKET_SIZE 4
+#endif
+
 MTS_NAMESPACE_BEGIN
 
 typedef const Shape * ConstShapePtr;
@@ -61,6 +69,11 @@ typedef const Shape * ConstShapePtr;
  * test is used instead, which doesn't need any extra storage. However, it also
  * tends to be quite a bit slower.
  *
+ * Optionally, built trees can be stored in an on-disk cache (see 
+ * \ref setCacheDirectory). The cache files are keyed by a hash of the 
+ * geometry and the construction parameters and are memory-mapped on 
+ * subsequent runs, which skips tree construction altogether.
+ *
  * \sa GenericKDTree
  */
 
@@ -99,6 +112,23 @@ public:
 	/// Build the kd-tree (needs to be called before tracing any rays)
 	void build();
 
+	/**
+	 * \brief Enable the on-disk kd-tree cache and store its files
+	 * in the specified directory.
+	 *
+	 * When set, \ref build() first looks for a cached tree matching
+	 * the current geometry and construction parameters and memory-maps 
+	 * it. Otherwise, the tree is built as usual and written to the cache.
+	 * An empty path disables the cache (the default).
+	 */
+	inline void setCacheDirectory(const fs::path &path) { m_cacheDirectory = path; }
+
+	/// Return the directory of the on-disk kd-tree cache (if enabled)
+	inline const fs::path &getCacheDirectory() const { return m_cacheDirectory; }
+
+	/// Was the kd-tree loaded from the on-disk cache?
+	inline bool isCached() const { return m_cacheFile.get() != NULL; }
+
 	//! @}
 	// =============================================================
 
@@ -170,6 +200,37 @@ public:
 	 */
 	bool rayIntersect(const Ray &ray) const;
 
+	/**
+	 * \brief Intersect a batch of rays against all primitives stored in
+	 * the kd-tree and return detailed intersection information
+	 *
+	 * The result is equivalent to calling \ref rayIntersect() for each
+	 * ray. When compiled with \c MTS_HAS_COHERENT_RT, groups of 
+	 * \ref MTS_KD_PACKET_SIZE rays with matching direction signs 
+	 * and time values are traced as SIMD packets.
+	 *
+	 * \param rays
+	 *    An array of \c count rays
+	 *
+	 * \param its
+	 *    An array of \c count intersection records. Rays without
+	 *    an intersection produce an invalid record.
+	 */
+	void rayIntersect(const Ray *rays, Intersection *its, size_t count) const;
+
+	/**
+	 * \brief Test a batch of shadow rays for occlusion
+	 *
+	 * The result is equivalent to calling the shadow ray variant 
+	 * of \ref rayIntersect() for each ray. Coherent groups of rays
+	 * are traced as SIMD packets (see above).
+	 *
+	 * \param occluded
+	 *    An array of \c count entries, which will be set to \c true
+	 *    for rays that hit an occluder
+	 */
+	void rayIntersect(const Ray *rays, bool *occluded, size_t count) const;
+
 #if defined(MTS_HAS_COHERENT_RT)
 	/**
 	 * \brief Intersect four rays with the stored triangle meshes while making
@@ -184,6 +245,15 @@ public:
 	 */
 	void rayIntersectPacketIncoherent(const RayPacket4 &packet, 
 		const RayInterval4 &interval, Intersection4 &its, void *temp) const;
+
+#if defined(MTS_AVX)
+	/**
+	 * \brief Intersect eight rays with the stored triangle meshes while 
+	 * making use of ray coherence. Requires AVX.
+	 */
+	void rayIntersectPacket(const RayPacket8 &packet, 
+		const RayInterval8 &interval, Intersection8 &its, void *temp) const;
+#endif
 #endif
 	//! @}
 	// =============================================================
@@ -211,6 +281,8 @@ protected:
 		if (m_triangleFlag[shapeIdx]) {
 			const TriMesh *mesh = static_cast<const TriMesh *>(shape);
 			return mesh->getTriangles()[idx].getAABB(mesh->getVertexPositions());
+		} else if (m_timeSegmentFlag[shapeIdx]) {
+			return shape->getTimeSegmentAABB(idx);
 		} else {
 			return shape->getAABB();
 		}
@@ -223,11 +295,26 @@ protected:
 		if (m_triangleFlag[shapeIdx]) {
 			const TriMesh *mesh = static_cast<const TriMesh *>(shape);
 			return mesh->getTriangles()[idx].getClippedAABB(mesh->getVertexPositions(), aabb);
+		} else if (m_timeSegmentFlag[shapeIdx]) {
+			AABB result = shape->getTimeSegmentAABB(idx);
+			result.clip(aabb);
+			return result;
 		} else {
 			return shape->getClippedAABB(aabb);
 		}
 	}
 
+	/**
+	 * \brief Check whether a primitive of a temporally split shape
+	 * (see \ref Shape::getTimeSegmentCount()) is active at a given time.
+	 * Always returns \c true for other shapes.
+	 */
+	FINLINE bool isTimeSegmentActive(const Shape *shape, index_type shapeIdx,
+			index_type segment, Float time) const {
+		return !m_timeSegmentFlag[shapeIdx] || 
+			shape->getTimeSegment(time) == segment;
+	}
+
 	/// Temporarily holds some intersection information
 	struct IntersectionCache {
 		size_type shapeIndex;
@@ -265,7 +352,8 @@ protected:
 			}
 		} else {
 			const Shape *shape = m_shapes[shapeIdx];
-			if (shape->rayIntersect(ray, mint, maxt, t, 
+			if (isTimeSegmentActive(shape, shapeIdx, idx, ray.time) &&
+				shape->rayIntersect(ray, mint, maxt, t, 
 					reinterpret_cast<uint8_t*>(temp) + 8)) {
 				cache->shapeIndex = shapeIdx;
 				cache->primIndex = KNoTriangleFlag;
@@ -287,7 +375,8 @@ protected:
 		} else {
 			uint32_t shapeIndex = ta.shapeIndex;
 			const Shape *shape = m_shapes[shapeIndex];
-			if (shape->rayIntersect(ray, mint, maxt, t, 
+			if (isTimeSegmentActive(shape, shapeIndex, ta.primIndex, ray.time) &&
+				shape->rayIntersect(ray, mint, maxt, t, 
 					reinterpret_cast<uint8_t*>(temp) + 8)) {
 				cache->shapeIndex = shapeIndex;
 				cache->primIndex = KNoTriangleFlag;
@@ -318,6 +407,7 @@ protected:
 		} else {
 			const Shape *shape = m_shapes[shapeIdx];
 			return shape->isOccluder() &&
+				isTimeSegmentActive(shape, shapeIdx, idx, ray.time) &&
 				shape->rayIntersect(ray, mint, maxt);
 		}
 #else
@@ -330,6 +420,7 @@ protected:
 				ta.rayIntersect(ray, mint, maxt, tempU, tempV, tempT);
 		} else {
 			return shape->isOccluder() && 
+				isTimeSegmentActive(shape, shapeIndex, ta.primIndex, ray.time) &&
 				shape->rayIntersect(ray, mint, maxt);
 		}
 #endif
@@ -343,6 +434,16 @@ protected:
 		/* Pointer to the far child */
 		const KDNode * __restrict node;
 	};
+
+#if defined(MTS_AVX)
+	/// Ray traversal stack entry for 8-wide packets
+	struct CoherentKDStackEntry8 {
+		/* Current ray interval */
+		RayInterval8 MM_ALIGN32 interval;
+		/* Pointer to the far child */
+		const KDNode * __restrict node;
+	};
+#endif
 #endif
 
 	/**
@@ -463,14 +564,26 @@ protected:
 
 	/// Virtual destructor
 	virtual ~ShapeKDTree();
+
+	/// Compute the cache key of the current geometry and build parameters
+	uint64_t getCacheKey() const;
+
+	/// Try to memory-map a cached kd-tree. Returns \c false upon failure
+	bool loadCache(const fs::path &filename, uint64_t key);
+
+	/// Write the built kd-tree to the cache
+	void saveCache(const fs::path &filename, uint64_t key) const;
 private:
 	std::vector<const Shape *> m_shapes;
 	std::vector<bool> m_triangleFlag;
+	std::vector<bool> m_timeSegmentFlag;
 	std::vector<index_type> m_shapeMap;
 #if !defined(MTS_KD_CONSERVE_MEMORY)
 	TriAccel *m_triAccel;
 #endif
 	BSphere m_bsphere;
+	fs::path m_cacheDirectory;
+	ref<MemoryMappedFile> m_cacheFile;
 };
 
 MTS_NAMESPACE_END
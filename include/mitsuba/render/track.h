@@ -176,6 +176,19 @@ public:
 	/// Compute the transformation at the specified time value
 	void eval(Float t, Transform &trafo) const;
 
+	/**
+	 * \brief Compute the decomposed transformation at the specified 
+	 * time value
+	 *
+	 * The transformation is given by <tt>translate(translation) * 
+	 * rotation * scale(scale)</tt>.
+	 */
+	void eval(Float t, Vector &translation, Quaternion &rotation,
+		Vector &scale) const;
+
+	/// Return the union of the keyframe times of all tracks (sorted)
+	void collectKeyframes(std::vector<Float> &times) const;
+
 	/// Serialize to a binary data stream
 	void serialize(Stream *stream) const;
 
@@ -201,6 +214,110 @@ private:
 	std::vector<AbstractAnimationTrack *> m_tracks;
 };
 
+/**
+ * \brief Pre-sampled representation of an \ref AnimatedTransform, 
+ * which is cheap enough to be evaluated once per ray.
+ *
+ * Stores the decomposed transformation at the union of the keyframe
+ * times of all tracks. Since every track interpolates linearly (or 
+ * spherically in the case of rotations) between its keyframes, 
+ * interpolating these samples reproduces \ref AnimatedTransform::eval().
+ * The transformation and its inverse are assembled directly from the
+ * decomposition, which avoids walking the tracks and composing
+ * several 4x4 matrices.
+ */
+class MTS_EXPORT_RENDER AnimatedTransformCache {
+public:
+	/// Create an empty cache, which evaluates to the identity
+	AnimatedTransformCache() { }
+
+	/// Pre-sample an animated transform
+	AnimatedTransformCache(const AnimatedTransform *trafo);
+
+	/// Return the number of stored keyframes
+	inline size_t getKeyframeCount() const { return m_times.size(); }
+
+	/// Compute the decomposed transformation at the specified time value
+	inline void eval(Float time, Vector &translation, Quaternion &rotation,
+			Vector &scale) const {
+		if (EXPECT_NOT_TAKEN(m_times.empty())) {
+			translation = Vector(0.0f);
+			rotation = Quaternion();
+			scale = Vector(1.0f);
+			return;
+		}
+
+		int idx = (int) (std::upper_bound(m_times.begin(), 
+			m_times.end(), time) - m_times.begin()) - 1;
+		if (idx < 0 || idx >= (int) m_times.size() - 1) {
+			/* Outside of the animated time range */
+			const Keyframe &key = m_keyframes[idx < 0 ? 0 : m_times.size()-1];
+			translation = key.translation;
+			rotation = key.rotation;
+			scale = key.scale;
+			return;
+		}
+
+		const Keyframe &key0 = m_keyframes[idx], &key1 = m_keyframes[idx+1];
+		Float t = (time - m_times[idx]) * key0.invDuration;
+		translation = key0.translation * (1-t) + key1.translation * t;
+		scale = key0.scale * (1-t) + key1.scale * t;
+		if (key0.theta == 0) {
+			/* Same as slerp() for almost parallel quaternions */
+			rotation = normalize(key0.rotation * (1-t) + key1.rotation * t);
+		} else {
+			Float thetap = key0.theta * t;
+			rotation = key0.rotation * std::cos(thetap) 
+				+ key0.rotationPerp * std::sin(thetap);
+		}
+	}
+
+	/// Compute the transformation at the specified time value
+	inline void eval(Float time, Transform &trafo) const {
+		Vector t, s;
+		Quaternion q;
+		eval(time, t, q, s);
+
+		const Float xx = q.v.x * q.v.x, yy = q.v.y * q.v.y, zz = q.v.z * q.v.z,
+			xy = q.v.x * q.v.y, xz = q.v.x * q.v.z, yz = q.v.y * q.v.z,
+			wx = q.v.x * q.w,   wy = q.v.y * q.w,   wz = q.v.z * q.w;
+
+		/* Rotation matrix (see Quaternion::toTransform()) */
+		const Float R[3][3] = {
+			{ 1 - 2 * (yy + zz),     2 * (xy - wz),     2 * (xz + wy) },
+			{     2 * (xy + wz), 1 - 2 * (xx + zz),     2 * (yz - wx) },
+			{     2 * (xz - wy),     2 * (yz + wx), 1 - 2 * (xx + yy) }
+		};
+		const Vector invS(1/s.x, 1/s.y, 1/s.z);
+
+		/* M = T * R * S and M^-1 = S^-1 * R^T * T^-1 */
+		Matrix4x4 M, invM;
+		for (int i=0; i<3; ++i) {
+			invM.m[i][3] = 0;
+			for (int j=0; j<3; ++j) {
+				M.m[i][j] = R[i][j] * s[j];
+				invM.m[i][j] = R[j][i] * invS[i];
+				invM.m[i][3] -= invM.m[i][j] * t[j];
+			}
+			M.m[i][3] = t[i];
+			M.m[3][i] = invM.m[3][i] = 0;
+		}
+		M.m[3][3] = invM.m[3][3] = 1;
+		trafo = Transform(M, invM);
+	}
+private:
+	struct Keyframe {
+		Vector translation, scale;
+		Quaternion rotation;
+		/* Precomputed slerp() parameters of the following segment */
+		Quaternion rotationPerp;
+		Float theta, invDuration;
+	};
+
+	std::vector<Float> m_times;
+	std::vector<Keyframe> m_keyframes;
+};
+
 MTS_NAMESPACE_END
 
 #endif /* __ANIMATION_TRACK_H */
@@ -58,6 +58,11 @@ struct TriAccel {
 	FINLINE __m128 rayIntersectPacket(const RayPacket4 &packet, const
 		__m128 mint, __m128 maxt, __m128 inactive, Intersection4 &its) const;
 #endif
+
+#if defined(MTS_AVX)
+	FINLINE __m256 rayIntersectPacket(const RayPacket8 &packet, const
+		__m256 mint, __m256 maxt, __m256 inactive, Intersection8 &its) const;
+#endif
 };
 
 inline int TriAccel::load(const Point &A, const Point &B, const Point &C) {
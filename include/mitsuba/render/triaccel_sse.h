@@ -109,6 +109,84 @@ FINLINE __m128 TriAccel::rayIntersectPacket(const RayPacket4 &packet,
 	return hasIts;
 }
 
+#if defined(MTS_AVX)
+/// 8-wide version of the above (requires AVX)
+FINLINE __m256 TriAccel::rayIntersectPacket(const RayPacket8 &packet, 
+	__m256 mint, __m256 maxt, __m256 inactive, Intersection8 &its) const {
+	static const MM_ALIGN16 int waldModulo[4] = { 1, 2, 0, 1 };
+	const int ku = waldModulo[k], kv = waldModulo[k+1];
+
+	/* Get the u and v components */
+	const __m256 
+		o_u = packet.o[ku].ps, o_v = packet.o[kv].ps, o_k = packet.o[k].ps,
+		d_u = packet.d[ku].ps, d_v = packet.d[kv].ps, d_k = packet.d[k].ps;
+
+	/* Extract data from the first cache line */
+	const __m256 
+		n_u = _mm256_broadcast_ss(&this->n_u),
+		n_v = _mm256_broadcast_ss(&this->n_v),
+		n_d = _mm256_broadcast_ss(&this->n_d);
+
+	/* Calculate the plane intersection */
+	const __m256
+		num   = _mm256_sub_ps(_mm256_sub_ps(_mm256_sub_ps(n_d, 
+			_mm256_mul_ps(o_u, n_u)), _mm256_mul_ps(o_v, n_v)), o_k),
+		denom = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(d_u, n_u), 
+			_mm256_mul_ps(d_v, n_v)), d_k);
+
+	const __m256 
+		t = _mm256_div_ps(num, denom);
+
+	__m256 hasIts = _mm256_andnot_ps(inactive, _mm256_and_ps(
+		_mm256_cmp_ps(maxt, t, _CMP_GT_OQ), _mm256_cmp_ps(t, mint, _CMP_GT_OQ)));
+
+	if (_mm256_movemask_ps(hasIts) == 0) 
+		return hasIts;
+
+	/* Extract data from the second cache line */
+	const __m256 
+		a_u   = _mm256_broadcast_ss(&this->a_u),
+		a_v   = _mm256_broadcast_ss(&this->a_v),
+		b_nu  = _mm256_broadcast_ss(&this->b_nu),
+		b_nv  = _mm256_broadcast_ss(&this->b_nv);
+
+	const __m256 
+		hu = _mm256_add_ps(o_u, _mm256_sub_ps(_mm256_mul_ps(t, d_u), a_u)),
+		hv = _mm256_add_ps(o_v, _mm256_sub_ps(_mm256_mul_ps(t, d_v), a_v));
+
+	/* Extract data from the third cache line */
+	const __m256 
+		c_nu       = _mm256_broadcast_ss(&this->c_nu),
+		c_nv       = _mm256_broadcast_ss(&this->c_nv),
+		primIndex  = _mm256_broadcast_ss(reinterpret_cast<const float *>(&this->primIndex)),
+		shapeIndex = _mm256_broadcast_ss(reinterpret_cast<const float *>(&this->shapeIndex));
+
+	const __m256
+		u = _mm256_add_ps(_mm256_mul_ps(hv, b_nu), _mm256_mul_ps(hu, b_nv)),
+		v = _mm256_add_ps(_mm256_mul_ps(hu, c_nu), _mm256_mul_ps(hv, c_nv));
+
+	const __m256 
+		zero = _mm256_setzero_ps(),
+		term1 = _mm256_cmp_ps(u, zero, _CMP_GE_OQ),
+		term2 = _mm256_cmp_ps(v, zero, _CMP_GE_OQ),
+		term3 = _mm256_cmp_ps(_mm256_set1_ps(1.0f), 
+			_mm256_add_ps(u, v), _CMP_GE_OQ);
+
+	hasIts = _mm256_and_ps(hasIts, _mm256_and_ps(_mm256_and_ps(term1, term2), term3));
+
+	if (_mm256_movemask_ps(hasIts) == 0) 
+		return hasIts;
+
+	its.t.ps          = mux256_ps(hasIts, t, its.t.ps);
+	its.u.ps          = mux256_ps(hasIts, u, its.u.ps);
+	its.v.ps          = mux256_ps(hasIts, v, its.v.ps);
+	its.primIndex.ps  = mux256_ps(hasIts, primIndex, its.primIndex.ps);
+	its.shapeIndex.ps = mux256_ps(hasIts, shapeIndex, its.shapeIndex.ps);
+
+	return hasIts;
+}
+#endif
+
 MTS_NAMESPACE_END
 
 #endif /* __TRIACCEL_SSE_H */
@@ -21,6 +21,7 @@
 
 #include <mitsuba/core/triangle.h>
 #include <mitsuba/core/pdf.h>
+#include <mitsuba/core/mmap.h>
 #include <mitsuba/render/shape.h>
 #include <boost/filesystem/fstream.hpp>
 
@@ -65,6 +66,8 @@ public:
 	 * will remain stable as Mitsuba evolves. The files
 	 * can optionally contain multiple meshes -- in that case,
 	 * the specified index determines which one to load.
+	 * Both the compressed and the uncompressed variant of
+	 * the format (see \ref serializeMappable()) are supported.
 	 */
 	TriMesh(Stream *stream, int idx = 0);
 	
@@ -200,6 +203,19 @@ public:
 	 */
 	void serialize(Stream *stream) const;
 
+	/**
+	 * \brief Serialize to a file stream using the uncompressed
+	 * variant of the stable file format
+	 *
+	 * All attribute arrays are stored with 16-byte alignment relative
+	 * to the beginning of the file, which allows loading them through a
+	 * memory mapping without any intermediate copies (see the 
+	 * \c serialized shape plugin). Multiple meshes can be concatenated
+	 * in one file -- in that case, the file must end with a table of 
+	 * 64-bit mesh offsets followed by the 32-bit mesh count.
+	 */
+	void serializeMappable(Stream *stream) const;
+
 	/**
 	 * \brief Build a discrete probability distribution 
 	 * for sampling. 
@@ -224,6 +240,40 @@ protected:
 
 	/// Virtual destructor
 	virtual ~TriMesh();
+
+	/**
+	 * \brief Load the triangle data of a mesh stored in the stable file
+	 * format (see \ref serialize(Stream *) const)
+	 *
+	 * When \c mapped is \c true, \c stream must be a \ref MemoryStream
+	 * operating on the contents of \ref m_mappedFile. Attribute arrays 
+	 * of the uncompressed format then point directly into the mapping.
+	 * 
+	 * \return The flags stored in the file
+	 */
+	uint32_t loadSerialized(Stream *stream, int index, bool mapped = false);
+
+	/**
+	 * \brief Load the triangle data of a mesh stored in the stable file 
+	 * format from disk
+	 *
+	 * Files in the uncompressed format are mapped into memory using a 
+	 * private copy-on-write mapping, which avoids any copies of 
+	 * arrays that are not subsequently modified.
+	 *
+	 * \return The flags stored in the file
+	 */
+	uint32_t loadSerialized(const fs::path &filename, int index);
+
+	/// Free an attribute array unless it refers to \ref m_mappedFile
+	template <typename T> inline void releaseArray(T *&array) {
+		if (array && !(m_mappedFile.get() &&
+			(const uint8_t *) array >= (const uint8_t *) m_mappedFile->getData() &&
+			(const uint8_t *) array < (const uint8_t *) m_mappedFile->getData()
+				+ m_mappedFile->getSize()))
+			delete[] array;
+		array = NULL;
+	}
 protected:
 	std::string m_name;
 	AABB m_aabb;
@@ -240,6 +290,7 @@ protected:
 	bool m_faceNormals;
 	Float m_surfaceArea;
 	Float m_invSurfaceArea;
+	ref<MemoryMappedFile> m_mappedFile;
 };
 
 MTS_NAMESPACE_END
@@ -69,6 +69,23 @@ public:
 	 */
 	virtual Float getMaximumFloatValue() const = 0;
 
+	/**
+	 * \brief Compute upper bounds of the values returned by 
+	 * \ref lookupFloat within the cells of a regular grid,
+	 * which subdivides the bounding box into \c res cells.
+	 *
+	 * This is useful when implementing Woodcock-Tracking with
+	 * spatially varying majorants. The default implementation
+	 * returns \ref getMaximumFloatValue for every cell.
+	 *
+	 * \param res
+	 *    Resolution of the grid
+	 * \param maxima
+	 *    Target array with <tt>res.x*res.y*res.z</tt> entries
+	 *    (ordered by X, then Y, then Z)
+	 */
+	virtual void getMaximumFloatValues(const Vector3i &res, Float *maxima) const;
+
 	MTS_DECLARE_CLASS()
 protected:
 	/// Virtual destructor
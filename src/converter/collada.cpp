@@ -462,12 +462,12 @@ void writeGeometry(ColladaContext &ctx, const std::string &prefixName, std::stri
 		filename = id + std::string(".serialized");
 		ref<FileStream> stream = new FileStream(ctx.meshesDirectory / filename, FileStream::ETruncReadWrite);
 		stream->setByteOrder(Stream::ELittleEndian);
-		mesh->serialize(stream);
+		ctx.cvt->serializeMesh(mesh, stream);
 		stream->close();
 		filename = "meshes/" + filename;
 	} else {
-		ctx.cvt->m_geometryDict.push_back((uint32_t) ctx.cvt->m_geometryFile->getPos());
-		mesh->serialize(ctx.cvt->m_geometryFile);
+		ctx.cvt->m_geometryDict.push_back(ctx.cvt->m_geometryFile->getPos());
+		ctx.cvt->serializeMesh(mesh, ctx.cvt->m_geometryFile);
 		filename = ctx.cvt->m_geometryFileName.filename();
 	}
 
@@ -94,6 +94,13 @@ void cleanup(DOMNode *node) {
 	}
 }
 
+void GeometryConverter::serializeMesh(const TriMesh *mesh, Stream *stream) const {
+	if (m_mappableGeometry)
+		mesh->serializeMappable(stream);
+	else
+		mesh->serialize(stream);
+}
+
 void GeometryConverter::convert(const fs::path &inputFile, 
 	const fs::path &outputDirectory, 
 	const fs::path &sceneName,
@@ -291,8 +298,12 @@ void GeometryConverter::convert(const fs::path &inputFile,
 		ofile.close();
 	}
 	if (m_geometryFile) {
-		for (size_t i=0; i<m_geometryDict.size(); ++i)
-			m_geometryFile->writeUInt(m_geometryDict[i]);
+		for (size_t i=0; i<m_geometryDict.size(); ++i) {
+			if (m_mappableGeometry)
+				m_geometryFile->writeULong((uint64_t) m_geometryDict[i]);
+			else
+				m_geometryFile->writeUInt((uint32_t) m_geometryDict[i]);
+		}
 		m_geometryFile->writeUInt((uint32_t) m_geometryDict.size());
 		m_geometryFile->close();
 	}
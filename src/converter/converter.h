@@ -17,6 +17,7 @@
 */
 
 #include <mitsuba/core/fresolver.h>
+#include <mitsuba/render/trimesh.h>
 
 using namespace mitsuba;
 
@@ -28,6 +29,7 @@ public:
 		m_xres = m_yres = -1;
 		m_filmType = "exrfilm";
 		m_packGeometry = true;
+		m_mappableGeometry = false;
 		m_importMaterials = true;
 		m_importAnimations = false;
 	}
@@ -39,10 +41,14 @@ public:
 
 	virtual fs::path locateResource(const fs::path &resource) = 0;
 
+	/// Serialize a mesh using the configured geometry format
+	void serializeMesh(const TriMesh *mesh, Stream *stream) const;
+
 	inline void setSRGB(bool srgb) { m_srgb = srgb; }
 	inline void setMapSmallerSide(bool mapSmallerSide) { m_mapSmallerSide = mapSmallerSide; }
 	inline void setResolution(int xres, int yres) { m_xres = xres; m_yres = yres; }
 	inline void setPackGeometry(bool packGeometry) { m_packGeometry = packGeometry; }
+	inline void setMappableGeometry(bool mappableGeometry) { m_mappableGeometry = mappableGeometry; }
 	inline void setImportMaterials(bool importMaterials) { m_importMaterials = importMaterials; }
 	inline void setImportAnimations(bool importAnimations) { m_importAnimations = importAnimations; }
 	inline void setFilmType(const std::string &filmType) { m_filmType = filmType; }
@@ -62,6 +68,6 @@ public:
 	std::string m_filmType;
 	ref<FileStream> m_geometryFile;
 	fs::path m_geometryFileName;
-	std::vector<uint32_t> m_geometryDict;
-	bool m_packGeometry;
+	std::vector<size_t> m_geometryDict;
+	bool m_packGeometry, m_mappableGeometry;
 };
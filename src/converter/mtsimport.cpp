@@ -58,6 +58,7 @@ void help() {
 		<<  "   -m          Map the larger image side to the full field of view" << endl << endl
 		<<  "   -z          Import animations" << endl << endl
 		<<  "   -y          Don't pack all geometry data into a single file" << endl << endl
+		<<  "   -u          Store geometry uncompressed, so that it can be memory-mapped" << endl << endl
 		<<  "   -n          Don't import any materials (an adjustments file will be necessary)" << endl << endl
 		<<  "   -l <type>   Override the type of film (e.g. 'exrfilm', 'pngfilm', ..)" << endl << endl
 		<<  "   -r <w>x<h>  Override the image resolution to e.g. 1920x1080" << endl << endl
@@ -72,11 +73,11 @@ int colladaMain(int argc, char **argv) {
 	FileResolver *fileResolver = Thread::getThread()->getFileResolver();
 	ELogLevel logLevel = EInfo;
 	bool packGeometry = true, importMaterials = true,
-		 importAnimations = false;
+		 importAnimations = false, mappableGeometry = false;
 
 	optind = 1;
 
-	while ((optchar = getopt(argc, argv, "snzvyhmr:a:l:")) != -1) {
+	while ((optchar = getopt(argc, argv, "snzvyuhmr:a:l:")) != -1) {
 		switch (optchar) {
 			case 'a': {
 					std::vector<std::string> paths = tokenize(optarg, ";");
@@ -105,6 +106,9 @@ int colladaMain(int argc, char **argv) {
 			case 'y':
 				packGeometry = false;
 				break;
+			case 'u':
+				mappableGeometry = true;
+				break;
 			case 'r': {
 					std::vector<std::string> tokens = tokenize(optarg, "x");
 					if (tokens.size() != 2)
@@ -139,6 +143,7 @@ int colladaMain(int argc, char **argv) {
 	converter.setImportAnimations(importAnimations);
 	converter.setMapSmallerSide(mapSmallerSide);
 	converter.setPackGeometry(packGeometry);
+	converter.setMappableGeometry(mappableGeometry);
 	converter.setFilmType(filmType);
 
 	const Logger *logger = Thread::getThread()->getLogger();
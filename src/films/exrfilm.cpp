@@ -30,6 +30,14 @@ MTS_NAMESPACE_BEGIN
  * No gamma correction is applied and spectral radiance values
  * are converted to linear RGB using the CIE 1931 XYZ color matching 
  * functions and ITU-R Rec. BT.709
+ *
+ * When the \c tiled parameter is set, the image is instead written as a
+ * tiled EXR file, and pixel storage is allocated on a per-tile basis. 
+ * During block-based renderings (see \ref Film::setDestinationFile()),
+ * every tile is then written to disk and evicted from memory as soon as 
+ * all image blocks overlapping it (including their reconstruction filter
+ * borders) have been received. This way, only the active wavefront of
+ * tiles needs to be kept in memory, which enables very large renderings.
  */
 class EXRFilm : public Film {
 protected:
@@ -43,76 +51,273 @@ protected:
 		}
 	};
 
-	Pixel *m_pixels;
+	/// Pixel storage of each tile (NULL if not allocated or already written)
+	std::vector<Pixel *> m_tiles;
+	/// Tiles that have already been written to disk
+	std::vector<bool> m_evicted;
+	/// Streaming mode: number of image blocks that will still overlap each tile
+	std::vector<int> m_pending;
+	Vector2i m_tileSize, m_tileCount;
+	ref<TiledEXRWriter> m_writer;
+	mutable ref<Mutex> m_mutex;
+	int m_border;
 	bool m_hasBanner;
 	bool m_hasAlpha;
+	bool m_tiled;
+	bool m_streaming;
 public:
 	EXRFilm(const Properties &props) : Film(props) {
-		m_pixels = new Pixel[m_cropSize.x * m_cropSize.y];
 		/* Should an alpha channel be added to the output image? */
 		m_hasAlpha = props.getBoolean("alpha", true);
 		/* Should an Mitsuba banner be added to the output image? */
 		m_hasBanner = props.getBoolean("banner", false);
+		/* Write a tiled EXR file and stream out finished tiles during rendering? */
+		m_tiled = props.getBoolean("tiled", false);
+		/* Tile resolution used in tiled mode */
+		m_tileSize = Vector2i(props.getInteger("tileSize", 64));
+		initialize();
 	}
 
 	EXRFilm(Stream *stream, InstanceManager *manager) 
 		: Film(stream, manager) {
 		m_hasAlpha = stream->readBool();
 		m_hasBanner = stream->readBool();
-		m_pixels = new Pixel[m_cropSize.x * m_cropSize.y];
+		m_tiled = stream->readBool();
+		m_tileSize = Vector2i(stream->readInt());
+		initialize();
 	}
 
 	void serialize(Stream *stream, InstanceManager *manager) const {
 		Film::serialize(stream, manager);
 		stream->writeBool(m_hasAlpha);
 		stream->writeBool(m_hasBanner);
+		stream->writeBool(m_tiled);
+		stream->writeInt(m_tileSize.x);
+	}
+
+	void initialize() {
+		if (m_tiled) {
+			if (m_tileSize.x <= 0)
+				Log(EError, "The tile size must be positive!");
+			if (m_hasBanner) {
+				Log(EWarn, "Banners are not supported in tiled mode -- ignoring");
+				m_hasBanner = false;
+			}
+		} else {
+			/* A single tile covering the whole crop window */
+			m_tileSize = m_cropSize;
+		}
+		m_tileCount = Vector2i(
+			(m_cropSize.x + m_tileSize.x - 1) / m_tileSize.x,
+			(m_cropSize.y + m_tileSize.y - 1) / m_tileSize.y);
+		m_tiles.resize(m_tileCount.x * m_tileCount.y, NULL);
+		m_evicted.resize(m_tiles.size(), false);
+		m_mutex = new Mutex();
+		m_streaming = false;
+		m_border = 0;
+		if (!m_tiled)
+			m_tiles[0] = new Pixel[m_cropSize.x * m_cropSize.y];
 	}
 
 	virtual ~EXRFilm() {
-		if (m_pixels)
-			delete[] m_pixels;
+		finishStreaming();
+		for (size_t i=0; i<m_tiles.size(); ++i) {
+			if (m_tiles[i])
+				delete[] m_tiles[i];
+		}
 	}
 
 	void clear() {
-		memset(m_pixels, 0, sizeof(Pixel) * m_cropSize.x * m_cropSize.y);
+		m_mutex->lock();
+		finishStreaming();
+		for (size_t i=0; i<m_tiles.size(); ++i) {
+			if (m_tiled && m_tiles[i]) {
+				delete[] m_tiles[i];
+				m_tiles[i] = NULL;
+			}
+			m_evicted[i] = false;
+		}
+		if (!m_tiled)
+			memset(m_tiles[0], 0, sizeof(Pixel) * m_cropSize.x * m_cropSize.y);
+		m_mutex->unlock();
+	}
+
+	/// Return the pixel storage of a tile (allocating it if necessary)
+	inline Pixel *getTile(int tileX, int tileY) {
+		size_t index = tileX + tileY * m_tileCount.x;
+		Pixel *tile = m_tiles[index];
+		if (EXPECT_NOT_TAKEN(!tile) && !m_evicted[index])
+			tile = m_tiles[index] = new Pixel[m_tileSize.x * m_tileSize.y];
+		return tile;
+	}
+
+	/// Look up a pixel relative to the crop window (or return NULL if not resident)
+	inline const Pixel *lookupPixel(int x, int y) const {
+		int tileX = x / m_tileSize.x, tileY = y / m_tileSize.y;
+		const Pixel *tile = m_tiles[tileX + tileY * m_tileCount.x];
+		if (!tile)
+			return NULL;
+		return tile + (x - tileX * m_tileSize.x) + (y - tileY * m_tileSize.y) * m_tileSize.x;
+	}
+
+	/// Convert a pixel into linear RGBA values
+	inline void developPixel(const Pixel &pixel, float *target) const {
+		Float invWeight = 1.0f, r, g, b;
+		if (pixel.weight != 0.0f)
+			invWeight = 1.0f / pixel.weight;
+		Spectrum spec(pixel.spec * invWeight);
+		spec.toLinearRGB(r, g, b);
+		target[0] = std::max(0.0f, (float) r);
+		target[1] = std::max(0.0f, (float) g);
+		target[2] = std::max(0.0f, (float) b);
+		target[3] = m_hasAlpha ? (float) (pixel.alpha*invWeight) : 1.0f;
+	}
+
+	/**
+	 * \brief Determine the range of tiles touched by an image block
+	 * (with the given border). Returns \c false if the block lies 
+	 * outside of the crop window.
+	 */
+	bool getTileRange(const Point2i &offset, const Vector2i &size, int border, 
+			Point2i &min, Point2i &max) const {
+		Vector2i start = offset - Vector2i(border, border) - m_cropOffset,
+			     end = offset + size + Vector2i(border, border) - m_cropOffset;
+		start.x = std::max(start.x, 0); start.y = std::max(start.y, 0);
+		end.x = std::min(end.x, m_cropSize.x); end.y = std::min(end.y, m_cropSize.y);
+		if (start.x >= end.x || start.y >= end.y)
+			return false;
+		min = Point2i(start.x / m_tileSize.x, start.y / m_tileSize.y);
+		max = Point2i((end.x - 1) / m_tileSize.x, (end.y - 1) / m_tileSize.y);
+		return true;
+	}
+
+	void setDestinationFile(const fs::path &destFile, int blockSize) {
+		if (!m_tiled)
+			return;
+
+		m_mutex->lock();
+		finishStreaming();
+
+		/* Replicate the block layout of BlockedRenderProcess */
+		const TabulatedFilter *filter = getTabulatedFilter();
+		m_border = (int) std::ceil(std::max(filter->getFilterSize().x,
+			filter->getFilterSize().y) - (Float) 0.5);
+		Point2i offset = m_cropOffset;
+		Vector2i size = m_cropSize;
+		if (m_highQualityEdges) {
+			offset -= Vector2i(m_border, m_border);
+			size += Vector2i(2*m_border, 2*m_border);
+		}
+
+		/* Count the blocks overlapping each tile */
+		m_pending.clear();
+		m_pending.resize(m_tiles.size(), 0);
+		Point2i min, max;
+		for (int y=0; y<size.y; y += blockSize) {
+			for (int x=0; x<size.x; x += blockSize) {
+				Vector2i blockRes(std::min(blockSize, size.x - x),
+					std::min(blockSize, size.y - y));
+				if (!getTileRange(offset + Vector2i(x, y), blockRes, m_border, min, max))
+					continue;
+				for (int ty=min.y; ty<=max.y; ++ty)
+					for (int tx=min.x; tx<=max.x; ++tx)
+						m_pending[tx + ty * m_tileCount.x]++;
+			}
+		}
+
+		fs::path filename = getFilename(destFile);
+		Log(EInfo, "Streaming tiles to \"%s\" ..", filename.leaf().c_str());
+		ref<FileStream> stream = new FileStream(filename, FileStream::ETruncReadWrite);
+		m_writer = new TiledEXRWriter(stream, m_cropSize, m_tileSize.x, m_hasAlpha);
+		m_streaming = true;
+		m_mutex->unlock();
+	}
+
+	/// Write a tile to disk and release its memory
+	void writeTile(int tileX, int tileY) {
+		size_t index = tileX + tileY * m_tileCount.x;
+		Vector2i size(
+			std::min(m_tileSize.x, m_cropSize.x - tileX * m_tileSize.x),
+			std::min(m_tileSize.y, m_cropSize.y - tileY * m_tileSize.y));
+		float *data = new float[size.x * size.y * 4];
+		const Pixel *tile = m_tiles[index];
+		const Pixel zero;
+		for (int y=0, pos=0; y<size.y; ++y)
+			for (int x=0; x<size.x; ++x, ++pos)
+				developPixel(tile ? tile[x + y * m_tileSize.x] : zero, data + 4*pos);
+		m_writer->writeTile(Point2i(tileX, tileY), data);
+		delete[] data;
+		if (tile)
+			delete[] tile;
+		m_tiles[index] = NULL;
+		m_evicted[index] = true;
+	}
+
+	/// Write all remaining tiles and close the streamed file
+	void finishStreaming() {
+		if (!m_writer)
+			return;
+		for (int y=0; y<m_tileCount.y; ++y)
+			for (int x=0; x<m_tileCount.x; ++x)
+				if (!m_evicted[x + y * m_tileCount.x])
+					writeTile(x, y);
+		m_writer->close();
+		m_writer = NULL;
 	}
 
 	void fromBitmap(const Bitmap *bitmap) {
 		Assert(bitmap->getWidth() == m_cropSize.x 
 			&& bitmap->getHeight() == m_cropSize.y);
 		Assert(bitmap->getBitsPerPixel() == 128);
-		unsigned int lastIndex = m_cropSize.x * m_cropSize.y;
-
-		for (unsigned int index=0; index<lastIndex; ++index) {
-			Pixel &pixel = m_pixels[index];
-			const float 
-				r = bitmap->getFloatData()[index*4+0],
-				g = bitmap->getFloatData()[index*4+1],
-				b = bitmap->getFloatData()[index*4+2],
-				a = bitmap->getFloatData()[index*4+3];
-			pixel.spec.fromLinearRGB(r, g, b);
-			pixel.alpha = a;
-			pixel.weight = 1.0f;
+		m_mutex->lock();
+
+		for (int y=0, index=0; y<m_cropSize.y; ++y) {
+			for (int x=0; x<m_cropSize.x; ++x, ++index) {
+				int tileX = x / m_tileSize.x, tileY = y / m_tileSize.y;
+				Pixel *tile = getTile(tileX, tileY);
+				if (!tile)
+					continue;
+				Pixel &pixel = tile[(x - tileX * m_tileSize.x) 
+					+ (y - tileY * m_tileSize.y) * m_tileSize.x];
+				const float 
+					r = bitmap->getFloatData()[index*4+0],
+					g = bitmap->getFloatData()[index*4+1],
+					b = bitmap->getFloatData()[index*4+2],
+					a = bitmap->getFloatData()[index*4+3];
+				pixel.spec.fromLinearRGB(r, g, b);
+				pixel.alpha = a;
+				pixel.weight = 1.0f;
+			}
 		}
+		m_mutex->unlock();
 	}
 
 	void toBitmap(Bitmap *bitmap) const {
 		Assert(bitmap->getWidth() == m_cropSize.x 
 			&& bitmap->getHeight() == m_cropSize.y);
 		Assert(bitmap->getBitsPerPixel() == 128);
-		unsigned int lastIndex = m_cropSize.x * m_cropSize.y;
 		Float r, g, b, a;
-
-		for (unsigned int index=0; index<lastIndex; ++index) {
-			Pixel &pixel = m_pixels[index];
-			Float invWeight = pixel.weight > 0 ? 1/pixel.weight : 1;
-			pixel.spec.toLinearRGB(r, g, b);
-			a = pixel.alpha;
-			bitmap->getFloatData()[index*4+0] = r*invWeight;
-			bitmap->getFloatData()[index*4+1] = g*invWeight;
-			bitmap->getFloatData()[index*4+2] = b*invWeight;
-			bitmap->getFloatData()[index*4+3] = a*invWeight;
+		m_mutex->lock();
+
+		for (int y=0, index=0; y<m_cropSize.y; ++y) {
+			for (int x=0; x<m_cropSize.x; ++x, ++index) {
+				const Pixel *pixel = lookupPixel(x, y);
+				if (!pixel) {
+					/* Already written to disk */
+					r = g = b = a = 0;
+				} else {
+					Float invWeight = pixel->weight > 0 ? 1/pixel->weight : 1;
+					pixel->spec.toLinearRGB(r, g, b);
+					r *= invWeight; g *= invWeight; b *= invWeight;
+					a = pixel->alpha * invWeight;
+				}
+				bitmap->getFloatData()[index*4+0] = r;
+				bitmap->getFloatData()[index*4+1] = g;
+				bitmap->getFloatData()[index*4+2] = b;
+				bitmap->getFloatData()[index*4+3] = a;
+			}
 		}
+		m_mutex->unlock();
 	}
 
 	Spectrum getValue(int xPixel, int yPixel) {
@@ -121,64 +326,137 @@ public:
 			Log(EWarn, "Pixel out of range : %i,%i", xPixel, yPixel); 
 			return Spectrum(0.0f);
 		}
-		Pixel &pixel = m_pixels[xPixel + yPixel * m_cropSize.x];
-
-		return pixel.weight != 0 ? 
-			(pixel.spec / pixel.weight) : Spectrum(0.0f);
+		m_mutex->lock();
+		const Pixel *pixel = lookupPixel(xPixel, yPixel);
+		Spectrum result(0.0f);
+		if (pixel && pixel->weight != 0)
+			result = pixel->spec / pixel->weight;
+		m_mutex->unlock();
+		return result;
 	}
 
 	void putImageBlock(const ImageBlock *block) {
-		int entry=0, imageY = block->getOffset().y - 
-			block->getBorder() - m_cropOffset.y - 1;
-
-		for (int y=0; y<block->getFullSize().y; ++y) {
-			if (++imageY < 0 || imageY >= m_cropSize.y) {
-				/// Skip a row if it is outside of the crop region
-				entry += block->getFullSize().x;
-				continue;
-			}
-
-			int imageX = block->getOffset().x - block->getBorder()
-				- m_cropOffset.x - 1;
-			for (int x=0; x<block->getFullSize().x; ++x) {
-				if (++imageX < 0 || imageX >= m_cropSize.x) {
-					++entry;
+		const Vector2i &fullSize = block->getFullSize();
+		const Vector2i start = block->getOffset() - m_cropOffset
+			- Vector2i(block->getBorder(), block->getBorder());
+
+		/// Clip the block against the crop region
+		int xStart = std::max(start.x, 0), xEnd = std::min(start.x + fullSize.x, m_cropSize.x),
+		    yStart = std::max(start.y, 0), yEnd = std::min(start.y + fullSize.y, m_cropSize.y);
+		bool dropped = false;
+
+		m_mutex->lock();
+		for (int imageY=yStart; imageY<yEnd; ++imageY) {
+			int tileY = imageY / m_tileSize.y;
+			int imageX = xStart;
+
+			/* Process the row in segments that lie within a single tile */
+			while (imageX < xEnd) {
+				int tileX = imageX / m_tileSize.x,
+					segmentEnd = std::min(xEnd, (tileX + 1) * m_tileSize.x);
+				Pixel *tile = getTile(tileX, tileY);
+				if (!tile) {
+					dropped = true;
+					imageX = segmentEnd;
 					continue;
 				}
 
-				Pixel &pixel = m_pixels[imageY * m_cropSize.x + imageX];
+				int entry = (imageY - start.y) * fullSize.x + (imageX - start.x);
+				Pixel *pixel = tile + (imageX - tileX * m_tileSize.x) 
+					+ (imageY - tileY * m_tileSize.y) * m_tileSize.x;
 
-				pixel.spec += block->getPixel(entry);
-				pixel.alpha += block->getAlpha(entry);
-				pixel.weight += block->getWeight(entry++);
+				for (; imageX < segmentEnd; ++imageX, ++pixel) {
+					pixel->spec += block->getPixel(entry);
+					pixel->alpha += block->getAlpha(entry);
+					pixel->weight += block->getWeight(entry++);
+				}
 			}
 		}
+
+		if (m_streaming) {
+			/* Write out all tiles which will not receive any further blocks */
+			Point2i min, max;
+			if (getTileRange(block->getOffset(), block->getSize(), m_border, min, max)) {
+				for (int ty=min.y; ty<=max.y; ++ty) {
+					for (int tx=min.x; tx<=max.x; ++tx) {
+						size_t index = tx + ty * m_tileCount.x;
+						if (--m_pending[index] == 0 && !m_evicted[index])
+							writeTile(tx, ty);
+					}
+				}
+			}
+
+			if (m_writer->getTilesWritten() == (int) m_tiles.size()) {
+				m_writer->close();
+				m_writer = NULL;
+				m_streaming = false;
+				Log(EInfo, "All tiles have been written");
+			}
+		}
+		m_mutex->unlock();
+
+		if (dropped)
+			Log(EWarn, "putImageBlock(): discarding data of an image block that overlaps "
+				"tiles which have already been written to disk");
+	}
+
+	/// Return the output filename (with an .exr extension)
+	fs::path getFilename(const fs::path &destFile) const {
+		fs::path filename = destFile;
+		std::string extension = boost::to_lower_copy(fs::extension(filename));
+		if (extension != ".exr")
+			filename.replace_extension(".exr");
+		return filename;
 	}
 	
 	void develop(const fs::path &destFile) {
 		Log(EDebug, "Developing film ..");
+		fs::path filename = getFilename(destFile);
+
+		if (m_tiled) {
+			m_mutex->lock();
+			if (m_writer) {
+				/* Streaming mode -- the file cannot be written before all
+				   tiles have been completed */
+				Log(EInfo, "Streaming tiles to \"%s\": %i/%i written so far",
+					filename.leaf().c_str(), m_writer->getTilesWritten(), 
+					(int) m_tiles.size());
+			} else if (!m_evicted[0]) {
+				Log(EInfo, "Writing tiled image to \"%s\" ..", filename.leaf().c_str());
+				ref<FileStream> stream = new FileStream(filename, FileStream::ETruncReadWrite);
+				m_writer = new TiledEXRWriter(stream, m_cropSize, m_tileSize.x, m_hasAlpha);
+				for (int y=0; y<m_tileCount.y; ++y) {
+					for (int x=0; x<m_tileCount.x; ++x) {
+						/* Keep the tiles -- rendering might still be in progress */
+						const Pixel *tile = m_tiles[x + y * m_tileCount.x];
+						Vector2i size(
+							std::min(m_tileSize.x, m_cropSize.x - x * m_tileSize.x),
+							std::min(m_tileSize.y, m_cropSize.y - y * m_tileSize.y));
+						std::vector<float> data(size.x * size.y * 4);
+						const Pixel zero;
+						for (int j=0, pos=0; j<size.y; ++j)
+							for (int i=0; i<size.x; ++i, ++pos)
+								developPixel(tile ? tile[i + j * m_tileSize.x] : zero, &data[4*pos]);
+						m_writer->writeTile(Point2i(x, y), &data[0]);
+					}
+				}
+				m_writer->close();
+				m_writer = NULL;
+			}
+			m_mutex->unlock();
+			return;
+		}
+
 		ref<Bitmap> bitmap = new Bitmap(m_cropSize.x, m_cropSize.y, 128);
 		float *targetPixels = bitmap->getFloatData();
-		Float r, g, b;
-		int pos = 0;
+		const Pixel *pixels = m_tiles[0];
 
 		Float maxLuminance = 0;
-		for (int y=0; y<m_cropSize.y; y++) {
-			for (int x=0; x<m_cropSize.x; x++) {
-				/* Convert spectrum to XYZ colors */
-				Pixel &pixel = m_pixels[pos];
-				Float invWeight = 1.0f;
-				if (pixel.weight != 0.0f)
-					invWeight = 1.0f / pixel.weight;
-				Spectrum spec(pixel.spec * invWeight);
-				spec.toLinearRGB(r, g, b);
-				maxLuminance = std::max(maxLuminance, spec.getLuminance());
-
-				targetPixels[4*pos+0] = std::max(0.0f, (float) r);
-				targetPixels[4*pos+1] = std::max(0.0f, (float) g);
-				targetPixels[4*pos+2] = std::max(0.0f, (float) b);
-				targetPixels[4*pos+3] = m_hasAlpha ? (pixel.alpha*invWeight) : 1.0f;
-				++pos;
+		for (int pos=0; pos<m_cropSize.x * m_cropSize.y; ++pos) {
+			developPixel(pixels[pos], targetPixels + 4*pos);
+			if (m_hasBanner) {
+				Float invWeight = pixels[pos].weight != 0.0f ? 1.0f / pixels[pos].weight : 1.0f;
+				maxLuminance = std::max(maxLuminance, pixels[pos].spec.getLuminance() * invWeight);
 			}
 		}
 		
@@ -198,11 +476,6 @@ public:
 			}
 		}
 
-		fs::path filename = destFile;
-		std::string extension = boost::to_lower_copy(fs::extension(filename));
-		if (extension != ".exr")
-			filename.replace_extension(".exr");
-
 		Log(EInfo, "Writing image to \"%s\" ..", filename.leaf().c_str());
 		ref<FileStream> stream = new FileStream(filename, FileStream::ETruncWrite);
 		bitmap->save(Bitmap::EEXR, stream);
@@ -222,7 +495,9 @@ public:
 			<< "  cropOffset = " << m_cropOffset.toString() << "," << std::endl
 			<< "  cropSize = " << m_cropSize.toString() << "," << std::endl
 			<< "  alpha = " << m_hasAlpha << "," << std::endl
-			<< "  banner = " << m_hasBanner << std::endl
+			<< "  banner = " << m_hasBanner << "," << std::endl
+			<< "  tiled = " << m_tiled << "," << std::endl
+			<< "  tileSize = " << m_tileSize.x << std::endl
 			<< "]";
 		return oss.str();
 	}
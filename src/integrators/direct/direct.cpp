@@ -125,9 +125,32 @@ public:
 			sampleArray = &sample;
 		}
 
-		for (int i=0; i<numLuminaireSamples; ++i) {
-			/* Estimate the direct illumination if this is requested */
-			if (scene->sampleLuminaire(its.p, ray.time, lRec, sampleArray[i])) {
+		/* Sample the luminaires in batches so that the shadow rays, which
+		   all start at the same point, can be traced as coherent packets */
+		const int batchSize = 2 * MTS_KD_PACKET_SIZE;
+		LuminaireSamplingRecord lRecs[batchSize];
+		Point targets[batchSize];
+		bool valid[batchSize], occluded[batchSize];
+
+		for (int i=0; i<numLuminaireSamples; i += batchSize) {
+			int count = std::min(batchSize, numLuminaireSamples - i), 
+				validCount = 0;
+
+			for (int j=0; j<count; ++j) {
+				valid[j] = scene->sampleLuminaire(its.p, ray.time, 
+					lRecs[j], sampleArray[i+j], false);
+				if (valid[j])
+					targets[validCount++] = lRecs[j].sRec.p;
+			}
+
+			scene->isOccluded(its.p, targets, validCount, ray.time, occluded);
+
+			for (int j=0, k=0; j<count; ++j) {
+				/* Estimate the direct illumination if this is requested */
+				if (!valid[j] || occluded[k++])
+					continue;
+				const LuminaireSamplingRecord &lRec = lRecs[j];
+
 				/* Allocate a record for querying the BSDF */
 				const BSDFQueryRecord bRec(its, its.toLocal(-lRec.d));
 
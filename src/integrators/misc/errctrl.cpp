@@ -57,6 +57,12 @@ public:
 		   at the cost of possibly spending lots of time on them. */
 		m_perPixel = props.getBoolean("perPixel", false);
 		m_verbose = props.getBoolean("verbose", false);
+
+		/* Adaptive sampling passes are rendered through renderSampleRange(),
+		   which would bypass the error control implemented in renderBlock() */
+		if (m_adaptive)
+			Log(EError, "The error-controlling integrator already chooses the "
+				"number of samples per pixel and cannot be combined with adaptive=true");
 	}
 
 	ErrorControl(Stream *stream, InstanceManager *manager) 
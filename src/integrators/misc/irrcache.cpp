@@ -41,6 +41,13 @@ MTS_NAMESPACE_BEGIN
  * By default, this integrator also performs a distributed overture pass before
  * rendering, which is recommended to avoid artifacts resulting from the
  * addition of samples as rendering proceeds.
+ *
+ * When a cache file is specified, the irradiance cache is warm-started
+ * using the records stored in it (if the file exists), and the final
+ * cache is written back after rendering. For camera fly-throughs of static
+ * scenes, this means that every frame only has to compute records in 
+ * regions that were not visible before. Files produced by several jobs
+ * can be combined using the 'irrmerge' utility.
  */
 class IrradianceCacheIntegrator : public SampleIntegrator {
 	friend class OvertureThread;
@@ -82,6 +89,9 @@ public:
 		/* If set to false, direct illumination will be suppressed - 
 		   useful for checking the interpolation quality */
 		m_direct = props.getBoolean("direct", true);
+		/* Irradiance cache file used to warm-start the cache. Will be 
+		   (over-)written with the final cache after rendering */
+		m_cacheFile = props.getString("cacheFile", "");
 			
 		Assert(m_influenceMax > m_influenceMin);
 		Assert(m_influenceMax > 0 && m_influenceMax < 1);
@@ -104,6 +114,7 @@ public:
 		m_gradients = stream->readBool();
 		m_debug = stream->readBool();
 		m_direct = stream->readBool();
+		m_cacheFile = stream->readString();
 	}
 
 	void serialize(Stream *stream, InstanceManager *manager) const {
@@ -121,6 +132,7 @@ public:
 		stream->writeBool(m_gradients);
 		stream->writeBool(m_debug);
 		stream->writeBool(m_direct);
+		stream->writeString(m_cacheFile.file_string());
 	}
 
 	void configureSampler(Sampler *sampler) {
@@ -166,6 +178,12 @@ public:
 		m_irrCache->useGradients(m_gradients);
 		m_irrCache->setQuality(m_quality);
 
+		if (!m_cacheFile.empty() && fs::exists(m_cacheFile)) {
+			size_t count = m_irrCache->merge(IrradianceCache::load(m_cacheFile));
+			Log(EInfo, "Warm-starting the irradiance cache with " SIZE_T_FMT 
+				" records from \"%s\"", count, m_cacheFile.file_string().c_str());
+		}
+
 		std::string irrCacheStatus;
 		if (m_overture)
 			irrCacheStatus += "overture, ";
@@ -191,9 +209,17 @@ public:
 			proc->bindResource("scene", sceneResID);
 			proc->bindResource("camera", cameraResID);
 			proc->bindResource("subIntegrator", subIntegratorResID);
+			int irrCacheResID = -1;
+			if (m_irrCache->getRecordCount() > 0) {
+				/* Only compute records where the warm-started cache misses */
+				irrCacheResID = sched->registerResource(m_irrCache);
+				proc->bindResource("irrCache", irrCacheResID);
+			}
 			bindUsedResources(proc);
 			sched->schedule(proc);
 			sched->unregisterResource(subIntegratorResID);
+			if (irrCacheResID != -1)
+				sched->unregisterResource(irrCacheResID);
 			sched->wait(proc);
 			m_proc = NULL;
 
@@ -212,6 +238,18 @@ public:
 		return true;
 	}
 
+	void postprocess(const Scene *scene, RenderQueue *queue, const RenderJob *job,
+			int sceneResID, int cameraResID, int samplerResID) {
+		SampleIntegrator::postprocess(scene, queue, job, sceneResID, cameraResID, samplerResID);
+		m_subIntegrator->postprocess(scene, queue, job, sceneResID, cameraResID, samplerResID);
+
+		if (!m_cacheFile.empty() && m_irrCache != NULL) {
+			Log(EInfo, "Writing " SIZE_T_FMT " irradiance cache records to \"%s\"",
+				m_irrCache->getRecordCount(), m_cacheFile.file_string().c_str());
+			m_irrCache->save(m_cacheFile);
+		}
+	}
+
 	void cancel() {
 		if (m_proc) {
 			Scheduler::getInstance()->cancel(m_proc);
@@ -336,6 +374,7 @@ private:
 	mutable ref<IrradianceCache> m_irrCache;
 	ref<SampleIntegrator> m_subIntegrator;
 	ref<ParallelProcess> m_proc;
+	fs::path m_cacheFile;
 	int m_resolution;
 	Float m_influenceMin, m_influenceMax;
 	Float m_quality, m_qualityAdjustment;
@@ -77,6 +77,10 @@ public:
 		m_irrCache->clampInfluence(m_influenceMin, m_influenceMax);
 		m_irrCache->useGradients(m_gradients);
 		m_irrCache->setQuality(m_quality);
+		if (m_resources.find("irrCache") != m_resources.end()) {
+			/* Start with the records of a warm-started cache */
+			m_irrCache->merge(static_cast<IrradianceCache *>(getResource("irrCache")));
+		}
 		m_hs = new HemisphereSampler(m_resolution, 3*m_resolution);
 	}
 
@@ -18,31 +18,140 @@
 
 #include <mitsuba/render/scene.h>
 #include <mitsuba/core/statistics.h>
+#include <mitsuba/core/random.h>
 
 MTS_NAMESPACE_BEGIN
 
 static StatsCounter avgPathLength("Path tracer", "Average path length", EAverage);
+static StatsCounter avgWavefrontSize("Path tracer", "Average wavefront size", EAverage);
+
+/// Number of pre-drawn sample dimensions per bounce in wavefront mode
+#define WAVEFRONT_BOUNCE_DIMS 5
+
+/**
+ * State of a set of paths that are traced in lockstep by the 
+ * wavefront mode of the path tracer. Per-path data is stored in
+ * structure-of-arrays form, and the per-bounce batches hold the
+ * rays and intersections of all active paths in sorted order.
+ */
+struct PathWavefront {
+	/* Pixels covered by the wavefront */
+	std::vector<Point2i> pixel;
+
+	/* Per-path state */
+	std::vector<RayDifferential> ray;
+	std::vector<Spectrum> throughput, radiance;
+	std::vector<Point2> filmSample;
+	std::vector<Float> alpha, bsdfPdf, samples;
+	std::vector<uint8_t> sampledDelta;
+	std::vector<int> depth;
+
+	/* Batch of rays traced during the current bounce */
+	std::vector<uint32_t> active, nextActive;
+	std::vector<uint64_t> keys;
+	std::vector<Ray> rays;
+	std::vector<Intersection> its;
+	std::vector<const BSDF *> bsdfs;
+	std::vector<std::pair<size_t, uint32_t> > shadingOrder;
+
+	/* Shadow rays generated during the current bounce */
+	std::vector<Ray> shadowRays, sortedShadowRays;
+	std::vector<Spectrum> shadowValue;
+	std::vector<uint32_t> shadowPath;
+	bool *occluded;
+
+	/// Maximum number of paths
+	size_t size;
+
+	PathWavefront(size_t pixelCount, size_t samplesPerPixel, size_t dims) 
+		: pixel(pixelCount), size(pixelCount * samplesPerPixel) {
+		ray.resize(size); throughput.resize(size); radiance.resize(size);
+		filmSample.resize(size); alpha.resize(size); bsdfPdf.resize(size);
+		samples.resize(size * dims); sampledDelta.resize(size); depth.resize(size);
+		keys.resize(size); rays.resize(size); its.resize(size); bsdfs.resize(size);
+		shadowRays.resize(size); sortedShadowRays.resize(size);
+		shadowValue.resize(size); shadowPath.resize(size);
+		active.reserve(size);
+		nextActive.reserve(size);
+		shadingOrder.reserve(size);
+		occluded = new bool[size];
+	}
+
+	~PathWavefront() {
+		delete[] occluded;
+	}
+};
+
+/// Spread the lower 10 bits of \c v so that there are two zero bits between each
+static inline uint32_t expandBits(uint32_t v) {
+	v = (v * 0x00010001u) & 0xFF0000FFu;
+	v = (v * 0x00000101u) & 0x0F00F00Fu;
+	v = (v * 0x00000011u) & 0xC30C30C3u;
+	v = (v * 0x00000005u) & 0x49249249u;
+	return v;
+}
+
+/**
+ * Compute the sort key of a ray: its direction octant (so that 
+ * consecutive rays can be traced as SIMD packets), followed by the
+ * Morton code of the grid cell containing its origin
+ */
+static inline uint32_t rayKey(const Ray &ray, const AABB &aabb, const Vector &invExtents) {
+	uint32_t key = 0, octant = 0;
+	for (int i=0; i<3; ++i) {
+		Float rel = (ray.o[i] - aabb.min[i]) * invExtents[i];
+		uint32_t cell = (uint32_t) std::min(std::max(rel * 512, (Float) 0), (Float) 511);
+		key |= expandBits(cell) << i;
+		if (ray.d[i] < 0)
+			octant |= 1 << i;
+	}
+	return (octant << 27) | key;
+}
 
 /*! \plugin{path}{Path tracer with multiple importance sampling}
  * \parameters{
  *     \parameter{maxDepth}{\Integer}{Maximum path depth \default{-1}}
  *     \parameter{strictNormals}{\Boolean}{Strict normals?}
+ *     \parameter{wavefront}{\Boolean}{Trace the paths of an image block 
+ *        in lockstep (see below) \default{false}}
+ *     \parameter{wavefrontSize}{\Integer}{Number of paths that are traced
+ *        together in wavefront mode, rounded down to whole pixels \default{4096}}
  * }
  * Extended path tracer -- uses multiple importance sampling to combine 
  * two sampling strategies, namely BSDF and luminaire sampling. 
  * This class does not attempt to solve the full radiative transfer 
  * equation (see <tt>volpath</tt> if this is needed).
+ *
+ * By default, one path is traced at a time. In wavefront mode, the
+ * paths of all samples of a group of pixels are instead advanced one
+ * bounce at a time. Before each bounce, the rays are sorted by their
+ * direction octant and origin cell, so that they can be traced as 
+ * coherent packets, and shading is grouped by BSDF. Shadow rays are
+ * traced in sorted batches as well. The sample dimensions of the first
+ * bounces are drawn from the sampler up front; longer paths use 
+ * independent random numbers.
  */
 class MIPathTracer : public MonteCarloIntegrator {
 public:
 	MIPathTracer(const Properties &props)
 		: MonteCarloIntegrator(props) {
 		//m_shadingSamples = props.getInteger("shadingSamples");
+
+		/* Trace the paths of a block in lockstep? */
+		m_wavefront = props.getBoolean("wavefront", false);
+		/* Maximum number of paths that are traced together */
+		m_wavefrontSize = props.getSize("wavefrontSize", 4096);
+
+		if (m_wavefrontSize == 0)
+			Log(EError, "wavefrontSize must be positive!");
 	}
 
 	/// Unserialize from a binary data stream
 	MIPathTracer(Stream *stream, InstanceManager *manager)
-		: MonteCarloIntegrator(stream, manager) { }
+		: MonteCarloIntegrator(stream, manager) {
+		m_wavefront = stream->readBool();
+		m_wavefrontSize = stream->readSize();
+	}
 
 	Spectrum Li(const RayDifferential &r, RadianceQueryRecord &rRec) const {
 		/* Some aliases and local variables */
@@ -221,8 +330,95 @@ public:
 		return pdfA / (pdfA + pdfB);
 	}
 
+	void renderSampleRange(const Scene *scene, const Camera *camera, 
+		Sampler *sampler, ImageBlock *block, const bool &stop, 
+		const std::vector<Point2i> *points, size_t firstSample, 
+		size_t sampleCount) const {
+		if (!m_wavefront || sampleCount == 0) {
+			MonteCarloIntegrator::renderSampleRange(scene, camera, sampler,
+				block, stop, points, firstSample, sampleCount);
+			return;
+		}
+
+		const Vector2i size = block->getSize();
+		const size_t pixelCount = points ? points->size() : (size_t) (size.x * size.y);
+		const size_t pixelsPerWavefront = std::min(pixelCount,
+			std::max(m_wavefrontSize / sampleCount, (size_t) 1));
+		const int sampleBounces = getSampleBounces();
+		const TabulatedFilter *filter = camera->getFilm()->getTabulatedFilter();
+		bool collectStatistics = block->collectStatistics();
+		Float varianceSum = 0;
+		size_t varianceCount = 0;
+
+		PathWavefront wf(pixelsPerWavefront, sampleCount,
+			sampleBounces * WAVEFRONT_BOUNCE_DIMS);
+		ref<Random> random = new Random(((uint64_t) block->getOffset().x << 40)
+			^ ((uint64_t) block->getOffset().y << 20) ^ (uint64_t) firstSample);
+
+		block->clear();
+		for (size_t i=0; i<pixelCount; i += pixelsPerWavefront) {
+			if (stop)
+				break;
+			const size_t count = std::min(pixelsPerWavefront, pixelCount - i);
+
+			/* Generate the camera rays and pre-draw the sample dimensions */
+			wf.active.clear();
+			for (size_t j=0; j<count; ++j) {
+				wf.pixel[j] = Point2i(block->getOffset()) + (points ? Vector2i((*points)[i+j])
+					: Vector2i((int) ((i+j) % size.x), (int) ((i+j) / size.x)));
+				generatePaths(camera, sampler, wf.pixel[j], firstSample, sampleCount,
+					(uint32_t) (j * sampleCount), sampleBounces, wf);
+			}
+
+			/* Advance all paths one bounce at a time */
+			while (!wf.active.empty())
+				traceBounce(scene, sampler, random, sampleBounces, wf);
+
+			/* Splat the samples and estimate the per-pixel variance */
+			for (size_t j=0; j<count; ++j) {
+				const uint32_t base = (uint32_t) (j * sampleCount);
+				const Point2i &offset = wf.pixel[j];
+				Spectrum mean(0.0f), meanSqr(0.0f);
+				Float lumMean = 0, lumMeanSqr = 0;
+
+				for (size_t k=0; k<sampleCount; ++k) {
+					const Spectrum &spec = wf.radiance[base+k];
+					block->putSample(wf.filmSample[base+k], spec, wf.alpha[base+k], filter);
+					avgPathLength.incrementBase();
+					avgPathLength += wf.depth[base+k];
+
+					/* Numerically robust online variance estimation (see 
+					   SampleIntegrator::renderSampleRange()) */
+					const Float lum = spec.getLuminance(),
+					            lumDelta = lum - lumMean;
+					lumMean += lumDelta / ((Float) k+1);
+					lumMeanSqr += lumDelta * (lum - lumMean);
+
+					if (collectStatistics) {
+						const Spectrum delta = spec - mean;
+						mean += delta / ((Float) k+1);
+						meanSqr += delta * (spec - mean);
+						block->setVariance(offset.x, offset.y,
+							meanSqr / (Float) k, (int) k+1);
+					}
+				}
+
+				if (sampleCount > 1) {
+					varianceSum += lumMeanSqr / (Float) (sampleCount - 1)
+						/ (lumMean * lumMean + (Float) 1e-3);
+					varianceCount++;
+				}
+			}
+		}
+
+		if (varianceCount > 0)
+			block->setVarianceEstimate(varianceSum / (Float) varianceCount);
+	}
+
 	void serialize(Stream *stream, InstanceManager *manager) const {
 		MonteCarloIntegrator::serialize(stream, manager);
+		stream->writeBool(m_wavefront);
+		stream->writeSize(m_wavefrontSize);
 	}
 
 	std::string toString() const {
@@ -230,12 +426,279 @@ public:
 		oss << "MIPathTracer[" << std::endl
 			<< "  maxDepth = " << m_maxDepth << "," << std::endl
 			<< "  rrDepth = " << m_rrDepth << "," << std::endl
-			<< "  strictNormals = " << m_strictNormals << std::endl
+			<< "  strictNormals = " << m_strictNormals << "," << std::endl
+			<< "  wavefront = " << m_wavefront << "," << std::endl
+			<< "  wavefrontSize = " << m_wavefrontSize << std::endl
 			<< "]";
 		return oss.str();
 	}
 
 	MTS_DECLARE_CLASS()
+protected:
+	/**
+	 * \brief Return the number of bounces, for which sample dimensions 
+	 * are pre-drawn from the sampler in wavefront mode
+	 */
+	inline int getSampleBounces() const {
+		/* No samples are needed at the last vertex */
+		return m_maxDepth > 0 ? std::max(m_maxDepth - 1, 1) : m_rrDepth;
+	}
+
+	/// Return a 2D sample of the current bounce of a path in wavefront mode
+	inline Point2 sample2D(const PathWavefront &wf, uint32_t path, int offset, 
+			int sampleBounces, Random *random) const {
+		int bounce = wf.depth[path] - 1;
+		if (bounce >= sampleBounces)
+			return Point2(random->nextFloat(), random->nextFloat());
+		const Float *s = &wf.samples[(path * sampleBounces + bounce) 
+			* WAVEFRONT_BOUNCE_DIMS + offset];
+		return Point2(s[0], s[1]);
+	}
+
+	/// Return a 1D sample of the current bounce of a path in wavefront mode
+	inline Float sample1D(const PathWavefront &wf, uint32_t path, int offset, 
+			int sampleBounces, Random *random) const {
+		int bounce = wf.depth[path] - 1;
+		if (bounce >= sampleBounces)
+			return random->nextFloat();
+		return wf.samples[(path * sampleBounces + bounce) 
+			* WAVEFRONT_BOUNCE_DIMS + offset];
+	}
+
+	/**
+	 * \brief Generate the camera rays of all samples of a pixel and 
+	 * draw the sample dimensions of their first bounces
+	 */
+	void generatePaths(const Camera *camera, Sampler *sampler, const Point2i &offset,
+			size_t firstSample, size_t sampleCount, uint32_t base, int sampleBounces,
+			PathWavefront &wf) const {
+		bool needsLensSample = camera->needsLensSample();
+		bool needsTimeSample = camera->needsTimeSample();
+		Float scaleFactor = 1.0f/std::sqrt((Float) sampler->getSampleCount());
+		Point2 lensSample;
+		Float timeSample = 0;
+
+		sampler->generate();
+		for (size_t k=0; k<sampleCount; ++k) {
+			const uint32_t path = base + (uint32_t) k;
+			sampler->setSampleIndex(firstSample + k);
+			if (needsLensSample)
+				lensSample = sampler->next2D();
+			if (needsTimeSample)
+				timeSample = sampler->next1D();
+			Point2 sample = sampler->next2D();
+			sample.x += offset.x; sample.y += offset.y;
+			camera->generateRayDifferential(sample, lensSample, timeSample, wf.ray[path]);
+			wf.ray[path].scaleDifferential(scaleFactor);
+
+			/* Per bounce: luminaire sample, BSDF sample, russian roulette */
+			Float *s = &wf.samples[path * sampleBounces * WAVEFRONT_BOUNCE_DIMS];
+			for (int i=0; i<sampleBounces; ++i) {
+				Point2 lumSample = sampler->next2D(), bsdfSample = sampler->next2D();
+				s[0] = lumSample.x; s[1] = lumSample.y;
+				s[2] = bsdfSample.x; s[3] = bsdfSample.y;
+				s[4] = sampler->next1D();
+				s += WAVEFRONT_BOUNCE_DIMS;
+			}
+
+			wf.filmSample[path] = sample;
+			wf.throughput[path] = Spectrum(1.0f);
+			wf.radiance[path] = Spectrum(0.0f);
+			wf.alpha[path] = 0.0f;
+			wf.bsdfPdf[path] = 0.0f;
+			wf.sampledDelta[path] = false;
+			wf.depth[path] = 1;
+			wf.active.push_back(path);
+		}
+	}
+
+	/**
+	 * \brief Advance all active paths of a wavefront by one bounce. This 
+	 * is equivalent to one iteration of the loop in \ref Li()
+	 */
+	void traceBounce(const Scene *scene, Sampler *sampler, Random *random,
+			int sampleBounces, PathWavefront &wf) const {
+		const AABB &aabb = scene->getAABB();
+		const Vector extents = aabb.getExtents();
+		const Vector invExtents(
+			extents.x > 0 ? 1 / extents.x : 0,
+			extents.y > 0 ? 1 / extents.y : 0,
+			extents.z > 0 ? 1 / extents.z : 0);
+		const size_t activeCount = wf.active.size();
+
+		avgWavefrontSize.incrementBase();
+		avgWavefrontSize += activeCount;
+
+		/* Sort the ray batch by direction octant and origin cell and trace it */
+		for (size_t k=0; k<activeCount; ++k) {
+			uint32_t path = wf.active[k];
+			wf.keys[k] = ((uint64_t) rayKey(wf.ray[path], aabb, invExtents) << 32) | path;
+		}
+		std::sort(wf.keys.begin(), wf.keys.begin() + activeCount);
+		for (size_t k=0; k<activeCount; ++k)
+			wf.rays[k] = wf.ray[(uint32_t) wf.keys[k]];
+		scene->rayIntersect(&wf.rays[0], &wf.its[0], activeCount);
+
+		/* Account for emission found by the previous bounce and
+		   group the remaining shading work by BSDF */
+		wf.shadingOrder.clear();
+		for (size_t k=0; k<activeCount; ++k) {
+			const uint32_t path = (uint32_t) wf.keys[k];
+			const RayDifferential &ray = wf.ray[path];
+			Intersection &its = wf.its[k];
+			const int depth = wf.depth[path];
+			Spectrum &Li = wf.radiance[path];
+			const Spectrum &throughput = wf.throughput[path];
+
+			if (depth == 1)
+				wf.alpha[path] = its.isValid() ? 1.0f : 0.0f;
+
+			if (!its.isValid()) {
+				/* If no intersection could be found, potentially return 
+				   radiance from a background luminaire if it exists */
+				if (depth == 1) {
+					Li += throughput * scene->LeBackground(ray);
+				} else if (scene->hasBackgroundLuminaire()) {
+					LuminaireSamplingRecord lRec;
+					lRec.luminaire = scene->getBackgroundLuminaire();
+					lRec.value = lRec.luminaire->Le(ray);
+					lRec.d = -ray.d;
+					addEmission(scene, wf, path, lRec);
+				}
+				continue;
+			}
+
+			const BSDF *bsdf = its.getBSDF(ray);
+
+			if (depth > 1 && its.isLuminaire()) {
+				/* Intersected a luminaire using BSDF sampling */
+				LuminaireSamplingRecord lRec(its, -ray.d);
+				lRec.value = its.Le(-ray.d);
+				addEmission(scene, wf, path, lRec);
+			}
+
+			if (EXPECT_NOT_TAKEN(bsdf == NULL))
+				continue;
+
+			if (depth == 1 && its.isLuminaire())
+				Li += throughput * its.Le(-ray.d);
+
+			if (its.hasSubsurface())
+				Li += throughput * its.LoSub(scene, sampler, -ray.d, depth);
+
+			if (m_maxDepth > 0 && depth >= m_maxDepth)
+				continue;
+
+			/* Prevent light leaks due to the use of shading normals */
+			Float wiDotGeoN = -dot(its.geoFrame.n, ray.d),
+				  wiDotShN  = Frame::cosTheta(its.wi);
+			if (wiDotGeoN * wiDotShN < 0 && m_strictNormals) 
+				continue;
+
+			wf.bsdfs[k] = bsdf;
+			wf.shadingOrder.push_back(std::make_pair((size_t) bsdf, (uint32_t) k));
+		}
+		std::sort(wf.shadingOrder.begin(), wf.shadingOrder.end());
+
+		/* Luminaire and BSDF sampling */
+		size_t shadowCount = 0;
+		wf.nextActive.clear();
+		for (size_t i=0; i<wf.shadingOrder.size(); ++i) {
+			const uint32_t k = wf.shadingOrder[i].second,
+				  path = (uint32_t) wf.keys[k];
+			const Intersection &its = wf.its[k];
+			const BSDF *bsdf = wf.bsdfs[k];
+			Spectrum &throughput = wf.throughput[path];
+			const Float time = wf.ray[path].time;
+
+			/* Sample a point on a luminaire -- visibility is tested in batch below */
+			LuminaireSamplingRecord lRec;
+			if (scene->sampleLuminaire(its.p, time, lRec, 
+					sample2D(wf, path, 0, sampleBounces, random), false)) {
+				const Vector wo = -lRec.d;
+				const BSDFQueryRecord bRec(its, its.toLocal(wo));
+				const Spectrum bsdfVal = bsdf->fCos(bRec);
+				Float woDotGeoN = dot(its.geoFrame.n, wo);
+
+				if (!bsdfVal.isZero() && (!m_strictNormals
+						|| woDotGeoN * Frame::cosTheta(bRec.wo) > 0)) {
+					Float bsdfPdf = (lRec.luminaire->isIntersectable() 
+							|| lRec.luminaire->isBackgroundLuminaire()) ? 
+						bsdf->pdf(bRec) : 0;
+					const Float weight = miWeight(lRec.pdf, bsdfPdf);
+					wf.shadowRays[shadowCount] = Ray(its.p, lRec.sRec.p - its.p,
+						ShadowEpsilon, 1-ShadowEpsilon, time);
+					wf.shadowValue[shadowCount] = throughput * lRec.value * bsdfVal * weight;
+					wf.shadowPath[shadowCount] = path;
+					++shadowCount;
+				}
+			}
+
+			/* Sample BSDF * cos(theta) */
+			BSDFQueryRecord bRec(its);
+			Float bsdfPdf;
+			Spectrum bsdfVal = bsdf->sampleCos(bRec, bsdfPdf, 
+				sample2D(wf, path, 2, sampleBounces, random));
+			if (bsdfVal.isZero()) 
+				continue;
+			bsdfVal /= bsdfPdf;
+
+			/* Prevent light leaks due to the use of shading normals */
+			const Vector wo = its.toWorld(bRec.wo);
+			Float woDotGeoN = dot(its.geoFrame.n, wo);
+			if (woDotGeoN * Frame::cosTheta(bRec.wo) <= 0 && m_strictNormals)
+				continue;
+
+			/* Russian roulette -- unlike \ref Li(), this happens before tracing
+			   the next ray, so that terminated paths are not traced any further */
+			if (wf.depth[path] >= m_rrDepth && !(bRec.sampledType & BSDF::ETransmission)) {
+				Float approxAlbedo = std::min((Float) 0.9f, bsdfVal.max());
+				if (sample1D(wf, path, 4, sampleBounces, random) > approxAlbedo) 
+					continue;
+				else
+					throughput /= approxAlbedo;
+			}
+
+			throughput *= bsdfVal;
+			wf.bsdfPdf[path] = bsdfPdf;
+			wf.sampledDelta[path] = (bRec.sampledType & BSDF::EDelta) ? 1 : 0;
+			wf.ray[path] = RayDifferential(its.p, wo, time);
+			wf.depth[path]++;
+			wf.nextActive.push_back(path);
+		}
+
+		/* Trace the shadow rays as a sorted batch */
+		for (size_t k=0; k<shadowCount; ++k)
+			wf.keys[k] = ((uint64_t) rayKey(wf.shadowRays[k], aabb, invExtents) << 32) | k;
+		std::sort(wf.keys.begin(), wf.keys.begin() + shadowCount);
+		for (size_t k=0; k<shadowCount; ++k)
+			wf.sortedShadowRays[k] = wf.shadowRays[(uint32_t) wf.keys[k]];
+		scene->isOccluded(&wf.sortedShadowRays[0], shadowCount, wf.occluded);
+		for (size_t k=0; k<shadowCount; ++k) {
+			if (wf.occluded[k])
+				continue;
+			uint32_t index = (uint32_t) wf.keys[k];
+			wf.radiance[wf.shadowPath[index]] += wf.shadowValue[index];
+		}
+
+		wf.active.swap(wf.nextActive);
+	}
+
+	/**
+	 * \brief Add the radiance of a luminaire that was hit by the last
+	 * BSDF sample of a path, weighted using the power heuristic
+	 */
+	inline void addEmission(const Scene *scene, PathWavefront &wf, uint32_t path,
+			const LuminaireSamplingRecord &lRec) const {
+		/* Prob. of having generated this sample using luminaire sampling */
+		const Float lumPdf = !wf.sampledDelta[path] ?
+			scene->pdfLuminaire(wf.ray[path].o, lRec) : 0;
+		const Float weight = miWeight(wf.bsdfPdf[path], lumPdf);
+		wf.radiance[path] += wf.throughput[path] * lRec.value * weight;
+	}
+private:
+	bool m_wavefront;
+	size_t m_wavefrontSize;
 };
 
 MTS_IMPLEMENT_CLASS_S(MIPathTracer, false, MonteCarloIntegrator)
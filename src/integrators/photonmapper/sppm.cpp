@@ -20,30 +20,349 @@
 #include <mitsuba/core/bitmap.h>
 #include <mitsuba/render/gatherproc.h>
 #include <mitsuba/render/renderqueue.h>
+#include <mitsuba/core/atomic.h>
 #if !defined(__OSX__) && defined(_OPENMP)
 #include <omp.h>
 #endif
 
 MTS_NAMESPACE_BEGIN
 
+struct GatherPoint {
+	Intersection its;
+	Float radius;
+	Spectrum weight;
+	Spectrum flux;
+	Spectrum emission;
+	Float N;
+	int depth;
+	Point2i pos;
+
+	/* Photon contributions splatted during the current pass
+	   (only used when gathering with the hash grid) */
+	Spectrum splatFlux;
+	int32_t splatCount;
+
+	inline GatherPoint() : weight(0.0f), flux(0.0f), emission(0.0f), N(0.0f),
+		splatFlux(0.0f), splatCount(0) {
+	}
+};
+
+/**
+ * \brief Spatial hash grid over the gather points of a pass
+ *
+ * Each gather point is registered in all grid cells that overlap its
+ * search sphere, hence a photon only has to visit the entries of the 
+ * cell containing it. The cell size is twice the largest search 
+ * radius, and cells are mapped to a hash table with as many buckets
+ * as there are gather points.
+ */
+class GatherPointGrid {
+public:
+	inline GatherPointGrid() : m_invCellSize(0), m_bucketCount(0) { }
+
+	/// Rebuild the grid for the current gather point radii
+	void build(std::vector<std::vector<GatherPoint> > &gatherBlocks) {
+		Float maxRadius = 0;
+		size_t gatherPointCount = 0;
+		m_aabb.reset();
+		for (size_t i=0; i<gatherBlocks.size(); ++i) {
+			for (size_t j=0; j<gatherBlocks[i].size(); ++j) {
+				const GatherPoint &gp = gatherBlocks[i][j];
+				if (gp.depth == -1)
+					continue;
+				m_aabb.expandBy(gp.its.p);
+				maxRadius = std::max(maxRadius, gp.radius);
+				++gatherPointCount;
+			}
+		}
+
+		m_cellStart.clear();
+		m_entries.clear();
+		m_bucketCount = gatherPointCount;
+		if (gatherPointCount == 0)
+			return;
+
+		m_aabb.min -= Vector(maxRadius);
+		m_aabb.max += Vector(maxRadius);
+		m_invCellSize = 1.0f / (2 * maxRadius);
+
+		/* Counting sort of the gather points into the hash table buckets */
+		m_cellStart.resize(m_bucketCount + 2, 0);
+		for (int pass=0; pass<2; ++pass) {
+			for (size_t i=0; i<gatherBlocks.size(); ++i) {
+				for (size_t j=0; j<gatherBlocks[i].size(); ++j) {
+					GatherPoint &gp = gatherBlocks[i][j];
+					if (gp.depth == -1)
+						continue;
+					Point3i minCell = getCell(gp.its.p - Vector(gp.radius)),
+							maxCell = getCell(gp.its.p + Vector(gp.radius));
+
+					/* The search sphere overlaps at most 2x2x2 cells (3x3x3 
+					   with round-off), which may map to the same bucket. 
+					   Register the gather point only once per bucket, since
+					   it would otherwise receive the same photon twice */
+					size_t buckets[27];
+					int bucketCount = 0;
+					for (int z=minCell.z; z<=maxCell.z; ++z) {
+						for (int y=minCell.y; y<=maxCell.y; ++y) {
+							for (int x=minCell.x; x<=maxCell.x; ++x) {
+								size_t bucket = hash(Point3i(x, y, z));
+								bool duplicate = false;
+								for (int k=0; k<bucketCount; ++k)
+									duplicate |= (buckets[k] == bucket);
+								if (!duplicate)
+									buckets[bucketCount++] = bucket;
+							}
+						}
+					}
+
+					for (int k=0; k<bucketCount; ++k) {
+						if (pass == 0)
+							m_cellStart[buckets[k] + 2]++;
+						else
+							m_entries[m_cellStart[buckets[k] + 1]++] = &gp;
+					}
+				}
+			}
+			if (pass == 0) {
+				/* Convert the bucket sizes into offsets (shifted by one
+				   entry, which the second pass uses as insertion cursor) */
+				for (size_t i=2; i<m_cellStart.size(); ++i)
+					m_cellStart[i] += m_cellStart[i-1];
+				m_entries.resize(m_cellStart[m_cellStart.size()-1]);
+			}
+		}
+		m_cellStart.pop_back();
+	}
+
+	/**
+	 * \brief Return the gather points that potentially contain the 
+	 * given position. Due to hash collisions, the list may include
+	 * other gather points as well.
+	 */
+	inline GatherPoint * const *lookup(const Point &p, size_t &count) const {
+		if (m_cellStart.empty() || !m_aabb.contains(p)) {
+			count = 0;
+			return NULL;
+		}
+		size_t bucket = hash(getCell(p));
+		count = m_cellStart[bucket+1] - m_cellStart[bucket];
+		return &m_entries[0] + m_cellStart[bucket];
+	}
+
+	/// Return the memory usage of the grid
+	inline size_t getMemoryUsage() const {
+		return m_cellStart.size() * sizeof(size_t)
+			+ m_entries.size() * sizeof(GatherPoint *);
+	}
+protected:
+	inline Point3i getCell(const Point &p) const {
+		Vector rel = (p - m_aabb.min) * m_invCellSize;
+		return Point3i(
+			std::max(0, (int) rel.x), 
+			std::max(0, (int) rel.y),
+			std::max(0, (int) rel.z));
+	}
+
+	inline size_t hash(const Point3i &cell) const {
+		return (size_t) (((uint32_t) cell.x * 73856093u) ^ 
+			((uint32_t) cell.y * 19349663u) ^ ((uint32_t) cell.z * 83492791u))
+			% m_bucketCount;
+	}
+private:
+	AABB m_aabb;
+	Float m_invCellSize;
+	size_t m_bucketCount;
+	std::vector<size_t> m_cellStart;
+	std::vector<GatherPoint *> m_entries;
+};
+
+/// Number of traced particles and recorded photons of a splatting work unit
+class SplatResult : public WorkResult {
+public:
+	inline SplatResult() : m_particleCount(0), m_photonCount(0) { }
+
+	inline void load(Stream *stream) {
+		m_particleCount = stream->readSize();
+		m_photonCount = stream->readSize();
+	}
+
+	inline void save(Stream *stream) const {
+		stream->writeSize(m_particleCount);
+		stream->writeSize(m_photonCount);
+	}
+
+	inline std::string toString() const {
+		return formatString("SplatResult[particleCount=" SIZE_T_FMT 
+			", photonCount=" SIZE_T_FMT "]", m_particleCount, m_photonCount);
+	}
+
+	size_t m_particleCount, m_photonCount;
+
+	MTS_DECLARE_CLASS()
+protected:
+	virtual ~SplatResult() { }
+};
+
+/**
+ * Traces photons and directly splats them into the gather points 
+ * of a \ref GatherPointGrid instead of storing them in a photon map.
+ * The contributions are identical to those computed by 
+ * \ref PhotonMap::estimateRadianceRaw().
+ */
+class SplatPhotonWorker : public ParticleTracer {
+public:
+	SplatPhotonWorker(const GatherPointGrid *grid, int maxDepth, int rrDepth) 
+		: ParticleTracer(maxDepth-1, rrDepth), m_grid(grid), 
+		  m_gatherMaxDepth(maxDepth) { }
+
+	ref<WorkProcessor> clone() const {
+		return new SplatPhotonWorker(m_grid, m_gatherMaxDepth, m_rrDepth);
+	}
+
+	void serialize(Stream *stream, InstanceManager *manager) const {
+		Log(EError, "Network rendering is not supported!");
+	}
+
+	ref<WorkResult> createWorkResult() const {
+		return new SplatResult();
+	}
+
+	void process(const WorkUnit *workUnit, WorkResult *workResult, 
+		const bool &stop) {
+		m_workResult = static_cast<SplatResult *>(workResult);
+		m_workResult->m_particleCount = m_workResult->m_photonCount = 0;
+		ParticleTracer::process(workUnit, workResult, stop);
+		m_workResult = NULL;
+	}
+
+	void handleEmission(const EmissionRecord &eRec,
+			const Medium *medium, Float time) {
+		m_workResult->m_particleCount++;
+	}
+
+	void handleSurfaceInteraction(int depth, bool caustic,
+			const Intersection &its, const Medium *medium,
+			const Spectrum &weight) {
+		int bsdfType = its.shape->getBSDF()->getType();
+		if (!(bsdfType & BSDF::EDiffuseReflection) && !(bsdfType & BSDF::EGlossyReflection))
+			return;
+		m_workResult->m_photonCount++;
+
+		size_t count;
+		GatherPoint * const *entries = m_grid->lookup(its.p, count);
+		if (count == 0)
+			return;
+
+		Normal photonNormal(its.geoFrame.n);
+		Vector wiWorld = its.toWorld(its.wi);
+		Float cosPhoton = dot(photonNormal, wiWorld);
+		if (cosPhoton < 1e-2)
+			return;
+
+		for (size_t i=0; i<count; ++i) {
+			GatherPoint &gp = *entries[i];
+			if (distanceSquared(gp.its.p, its.p) >= gp.radius*gp.radius
+				|| depth > m_gatherMaxDepth - gp.depth
+				|| dot(photonNormal, gp.its.shFrame.n) < .1)
+				continue;
+
+			Vector wiLocal = gp.its.toLocal(wiWorld);
+			BSDFQueryRecord bRec(gp.its, wiLocal);
+			bRec.quantity = EImportance;
+			std::swap(bRec.wi, bRec.wo);
+
+			/* Account for non-symmetry due to shading normals */
+			Spectrum value = weight * gp.its.shape->getBSDF()->f(bRec) *
+				std::abs(Frame::cosTheta(wiLocal) / cosPhoton);
+
+			for (int k=0; k<SPECTRUM_SAMPLES; ++k)
+				atomicAdd(&gp.splatFlux[k], value[k]);
+			atomicAdd(&gp.splatCount, 1);
+		}
+	}
+
+	MTS_DECLARE_CLASS()
+protected:
+	virtual ~SplatPhotonWorker() { }
+private:
+	const GatherPointGrid *m_grid;
+	int m_gatherMaxDepth;
+	ref<SplatResult> m_workResult;
+};
+
+/**
+ * Photon tracing pass that splats into a \ref GatherPointGrid. Like
+ * \ref GatherPhotonProcess, it runs until the requested number of
+ * photons has been recorded.
+ */
+class SplatPhotonProcess : public ParticleProcess {
+public:
+	SplatPhotonProcess(const GatherPointGrid *grid, size_t photonCount,
+		size_t granularity, int maxDepth, int rrDepth, bool autoCancel,
+		const void *progressReporterPayload)
+		: ParticleProcess(ParticleProcess::EGather, photonCount, granularity,
+		  "Splatting photons", progressReporterPayload), m_grid(grid),
+		  m_photonCount(photonCount), m_maxDepth(maxDepth), m_rrDepth(rrDepth),
+		  m_autoCancel(autoCancel), m_numShot(0) { }
+
+	inline size_t getShotParticles() const { return m_numShot; }
+
+	bool isLocal() const {
+		return true;
+	}
+
+	ref<WorkProcessor> createWorkProcessor() const {
+		return new SplatPhotonWorker(m_grid, m_maxDepth, m_rrDepth);
+	}
+
+	void processResult(const WorkResult *wr, bool cancelled) {
+		if (cancelled)
+			return;
+		const SplatResult *result = static_cast<const SplatResult *>(wr);
+		m_resultMutex->lock();
+		m_numShot += result->m_particleCount;
+		m_resultMutex->unlock();
+		increaseResultCount(result->m_photonCount);
+	}
+
+	EStatus generateWork(WorkUnit *unit, int worker) {
+		/* Same auto canceling criterion as GatherPhotonProcess */
+		if (m_autoCancel && m_numShot > 500000 && m_receivedResultCount < m_photonCount
+			&& (m_receivedResultCount == 0 || m_receivedResultCount < m_numShot/1024)) {
+			Log(EInfo, "Not enough photons could be collected, giving up");
+			return EFailure;
+		}
+
+		return ParticleProcess::generateWork(unit, worker);
+	}
+
+	MTS_DECLARE_CLASS()
+protected:
+	virtual ~SplatPhotonProcess() { }
+private:
+	const GatherPointGrid *m_grid;
+	size_t m_photonCount;
+	int m_maxDepth, m_rrDepth;
+	bool m_autoCancel;
+	size_t m_numShot;
+};
+
 /**
  * Stochastic progressive photon mapping implementation. Only handles surface
  * interactions. Parallelization is limited to the local cores.
+ *
+ * With the default gather mode (\c photonmap), the photons of each pass are
+ * stored in a photon map that is balanced and then queried once per gather 
+ * point. The \c hashgrid mode instead builds a spatial hash grid over the 
+ * gather points and splats photons into them while they are traced. This
+ * converges to the same result, but avoids storing and balancing photons.
  */
 class StochasticProgressivePhotonMapIntegrator : public Integrator {
 public:
-	struct GatherPoint {
-		Intersection its;
-		Float radius;
-		Spectrum weight;
-		Spectrum flux;
-		Spectrum emission;
-		Float N;
-		int depth;
-		Point2i pos;
-
-		inline GatherPoint() : weight(0.0f), flux(0.0f), emission(0.0f), N(0.0f) {
-		}
+	enum EGatherMode {
+		EPhotonMap = 0,
+		EHashGrid
 	};
 
 	StochasticProgressivePhotonMapIntegrator(const Properties &props) : Integrator(props) {
@@ -66,6 +385,14 @@ public:
 		m_blockSize = props.getInteger("blockSize", 32);
 		/* Indicates if the gathering steps should be canceled if not enough photons are generated. */
 		m_autoCancelGathering = props.getBoolean("autoCancelGathering", true);
+		/* Photon gathering method ("photonmap" or "hashgrid") */
+		std::string gatherMode = props.getString("gatherMode", "photonmap");
+		if (gatherMode == "photonmap")
+			m_gatherMode = EPhotonMap;
+		else if (gatherMode == "hashgrid")
+			m_gatherMode = EHashGrid;
+		else
+			Log(EError, "Unknown gather mode specified (must be 'photonmap' or 'hashgrid')");
 		m_mutex = new Mutex();
 #if defined(__OSX__)
 		Log(EError, "Stochastic progressive photon mapping currently doesn't work "
@@ -184,7 +511,7 @@ public:
 		/* Process the image in parallel using blocks for better memory locality */
 		Log(EInfo, "Creating %i gather points", cropSize.x*cropSize.y);
 		#pragma omp parallel for schedule(dynamic)
-		for (int i=-1; i<(int) m_gatherBlocks.size(); ++i) {
+		for (int i=0; i<(int) m_gatherBlocks.size(); ++i) {
 			std::vector<GatherPoint> &gatherPoints = m_gatherBlocks[i];
 #if !defined(__OSX__) && defined(_OPENMP)
 			Sampler *sampler = static_cast<Sampler *>(samplers[omp_get_thread_num()]);
@@ -264,26 +591,51 @@ public:
 		Log(EInfo, "Performing a photon mapping pass %i", it);
 		ref<Scheduler> sched = Scheduler::getInstance();
 
-		/* Generate the global photon map */
-		ref<GatherPhotonProcess> proc = new GatherPhotonProcess(
-			GatherPhotonProcess::EAllSurfacePhotons, m_photonCount,
-			m_granularity, m_maxDepth-1, m_rrDepth, true,
-			m_autoCancelGathering, job);
-
-		proc->bindResource("scene", sceneResID);
-		proc->bindResource("camera", cameraResID);
-		proc->bindResource("sampler", samplerResID);
-
-		sched->schedule(proc);
-		sched->wait(proc);
-
-		ref<PhotonMap> photonMap = proc->getPhotonMap();
-		photonMap->balance();
-		Log(EDebug, "Photon map full. Shot " SIZE_T_FMT " particles, excess photons due to parallelism: " 
-			SIZE_T_FMT, proc->getShotParticles(), proc->getExcessPhotons());
+		ref<PhotonMap> photonMap;
+		size_t shotParticles;
+
+		if (m_gatherMode == EHashGrid) {
+			/* Splat photons directly into the gather points */
+			m_grid.build(m_gatherBlocks);
+			Log(EDebug, "Built a gather point hash grid (%s)",
+				memString(m_grid.getMemoryUsage()).c_str());
+
+			ref<SplatPhotonProcess> proc = new SplatPhotonProcess(
+				&m_grid, m_photonCount, m_granularity, m_maxDepth, 
+				m_rrDepth, m_autoCancelGathering, job);
+
+			proc->bindResource("scene", sceneResID);
+			proc->bindResource("camera", cameraResID);
+			proc->bindResource("sampler", samplerResID);
+
+			sched->schedule(proc);
+			sched->wait(proc);
+
+			shotParticles = proc->getShotParticles();
+			Log(EDebug, "Splatting done. Shot " SIZE_T_FMT " particles", shotParticles);
+		} else {
+			/* Generate the global photon map */
+			ref<GatherPhotonProcess> proc = new GatherPhotonProcess(
+				GatherPhotonProcess::EAllSurfacePhotons, m_photonCount,
+				m_granularity, m_maxDepth-1, m_rrDepth, true,
+				m_autoCancelGathering, job);
+
+			proc->bindResource("scene", sceneResID);
+			proc->bindResource("camera", cameraResID);
+			proc->bindResource("sampler", samplerResID);
+
+			sched->schedule(proc);
+			sched->wait(proc);
+
+			photonMap = proc->getPhotonMap();
+			photonMap->balance();
+			shotParticles = proc->getShotParticles();
+			Log(EDebug, "Photon map full. Shot " SIZE_T_FMT " particles, excess photons due to parallelism: " 
+				SIZE_T_FMT, shotParticles, proc->getExcessPhotons());
+		}
 
 		Log(EInfo, "Gathering ..");
-		m_totalEmitted += proc->getShotParticles();
+		m_totalEmitted += shotParticles;
 		film->clear();
 		#pragma omp parallel for schedule(dynamic)
 		for (int blockIdx = 0; blockIdx<(int) m_gatherBlocks.size(); ++blockIdx) {
@@ -295,12 +647,17 @@ public:
 				Float M, N = gp.N;
 				Spectrum flux, contrib;
 
-				if (gp.depth != -1) {
+				if (gp.depth == -1) {
+					M = 0;
+					flux = Spectrum(0.0f);
+				} else if (photonMap) {
 					M = (Float) photonMap->estimateRadianceRaw(
 						gp.its, gp.radius, flux, m_maxDepth-gp.depth);
 				} else {
-					M = 0;
-					flux = Spectrum(0.0f);
+					M = (Float) gp.splatCount;
+					flux = gp.splatFlux;
+					gp.splatCount = 0;
+					gp.splatFlux = Spectrum(0.0f);
 				}
 
 				if (N+M == 0) {
@@ -308,7 +665,7 @@ public:
 				} else {
 					Float ratio = (N + m_alpha * M) / (N + M);
 					gp.flux = (gp.flux + gp.weight * (flux + 
-						gp.emission * (Float) proc->getShotParticles() * M_PI * gp.radius*gp.radius)) * ratio;
+						gp.emission * (Float) shotParticles * M_PI * gp.radius*gp.radius)) * ratio;
 					gp.radius = gp.radius * std::sqrt(ratio);
 					gp.N = N + m_alpha * M;
 					contrib = gp.flux / ((Float) m_totalEmitted * gp.radius*gp.radius * M_PI);
@@ -333,6 +690,8 @@ public:
 	MTS_DECLARE_CLASS()
 private:
 	std::vector<std::vector<GatherPoint> > m_gatherBlocks;
+	GatherPointGrid m_grid;
+	EGatherMode m_gatherMode;
 	std::vector<Point2i> m_offset;
 	ref<Mutex> m_mutex;
 	ref<Bitmap> m_bitmap;
@@ -345,6 +704,9 @@ private:
 	bool m_autoCancelGathering;
 };
 
+MTS_IMPLEMENT_CLASS(SplatResult, false, WorkResult)
+MTS_IMPLEMENT_CLASS(SplatPhotonWorker, false, ParticleTracer)
+MTS_IMPLEMENT_CLASS(SplatPhotonProcess, false, ParticleProcess)
 MTS_IMPLEMENT_CLASS_S(StochasticProgressivePhotonMapIntegrator, false, Integrator)
 MTS_EXPORT_PLUGIN(StochasticProgressivePhotonMapIntegrator, "Stochastic progressive photon mapper");
 MTS_NAMESPACE_END
@@ -0,0 +1,306 @@
+/*
+    This file is part of Mitsuba, a physically based rendering system.
+
+    Copyright (c) 2007-2011 by Wenzel Jakob and others.
+
+    Mitsuba is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Mitsuba is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <mitsuba/core/sched.h>
+#include <mitsuba/core/timer.h>
+#include "vpltree.h"
+
+MTS_NAMESPACE_BEGIN
+
+/**
+ * CPU-based virtual point light renderer, which scales to a large
+ * number of VPLs by evaluating them through a light tree. At each
+ * shading point, a cut through the tree is chosen adaptively so that
+ * every cluster in the cut has a bounded relative error. This is
+ * based on "Lightcuts: a scalable approach to illumination" by
+ * Bruce Walter et al. (Proceedings of SIGGRAPH 2005).
+ *
+ * The VPLs are generated by the same code as in the hardware-based
+ * 'vpl' integrator. Direct illumination from luminaires which cannot
+ * be represented by VPLs (e.g. spot, directional and environment
+ * sources) is computed using standard luminaire sampling. Chains of
+ * purely specular surfaces are followed until a non-specular surface
+ * is found.
+ */
+class LightcutsIntegrator : public SampleIntegrator {
+public:
+	LightcutsIntegrator(const Properties &props) : SampleIntegrator(props) {
+		/* Number of virtual point lights */
+		m_vplCount = props.getSize("vplCount", 10000);
+		/* Max. depth (expressed as path length) */
+		m_maxDepth = props.getInteger("maxDepth", 5);
+		/* Reject VPLs that are unlikely to be seen from the camera? */
+		m_pruneVPLs = props.getBoolean("pruneVPLs", true);
+		/* Maximum relative error of every cluster in a light cut */
+		m_maxError = props.getFloat("maxError", 0.02f);
+		/* Maximum number of clusters in a light cut */
+		m_maxCutSize = props.getSize("maxCutSize", 1000);
+		/* Distance (relative to the scene size), below which the inverse-square
+		   falloff of VPLs is clamped. This avoids bright splotches near VPLs */
+		m_clampingRel = props.getFloat("clamping", 0.005f);
+		/* Number of samples for luminaires which are not represented by VPLs */
+		m_directSamples = props.getInteger("directSamples", 1);
+		/* Maximum number of specular bounces before a path is terminated */
+		m_maxSpecularDepth = props.getInteger("maxSpecularDepth", 6);
+
+		if (m_maxDepth <= 1)
+			Log(EError, "maxDepth must be set to 2 or higher!");
+		if (m_maxError <= 0)
+			Log(EError, "maxError must be positive!");
+		if (m_maxCutSize == 0)
+			Log(EError, "maxCutSize must be positive!");
+		m_clamping = 0;
+		m_vplTreeID = -1;
+	}
+
+	/// Unserialize from a binary data stream
+	LightcutsIntegrator(Stream *stream, InstanceManager *manager)
+	 : SampleIntegrator(stream, manager) {
+		m_vplCount = stream->readSize();
+		m_maxDepth = stream->readInt();
+		m_pruneVPLs = stream->readBool();
+		m_maxError = stream->readFloat();
+		m_maxCutSize = stream->readSize();
+		m_clampingRel = stream->readFloat();
+		m_clamping = stream->readFloat();
+		m_directSamples = stream->readInt();
+		m_maxSpecularDepth = stream->readInt();
+		m_vplTreeID = -1;
+		size_t count = stream->readSize();
+		if (count > 0) {
+			m_directLuminaires.resize(count);
+			stream->readUIntArray(&m_directLuminaires[0], count);
+			for (size_t i=0; i<count; ++i)
+				m_directPDF.put(stream->readFloat());
+			m_directPDF.build();
+		}
+	}
+
+	void serialize(Stream *stream, InstanceManager *manager) const {
+		SampleIntegrator::serialize(stream, manager);
+		stream->writeSize(m_vplCount);
+		stream->writeInt(m_maxDepth);
+		stream->writeBool(m_pruneVPLs);
+		stream->writeFloat(m_maxError);
+		stream->writeSize(m_maxCutSize);
+		stream->writeFloat(m_clampingRel);
+		stream->writeFloat(m_clamping);
+		stream->writeInt(m_directSamples);
+		stream->writeInt(m_maxSpecularDepth);
+		stream->writeSize(m_directLuminaires.size());
+		if (!m_directLuminaires.empty())
+			stream->writeUIntArray(&m_directLuminaires[0], m_directLuminaires.size());
+		for (size_t i=0; i<m_directLuminaires.size(); ++i)
+			stream->writeFloat(m_directPDF[i]);
+	}
+
+	void configureSampler(Sampler *sampler) {
+		if (m_directSamples > 1)
+			sampler->request2DArray(m_directSamples);
+	}
+
+	bool preprocess(const Scene *scene, RenderQueue *queue, const RenderJob *job,
+		int sceneResID, int cameraResID, int samplerResID) {
+		SampleIntegrator::preprocess(scene, queue, job, sceneResID, cameraResID, samplerResID);
+		m_clamping = m_clampingRel * scene->getBSphere().radius;
+
+		ref<Scheduler> sched = Scheduler::getInstance();
+		if (m_vplTree.get() == NULL) {
+			ref<Random> random = new Random();
+			ref<Timer> timer = new Timer();
+			std::deque<VPL> vpls;
+			Float normalization = (Float) 1 / generateVPLs(scene, random,
+					0, m_vplCount, m_maxDepth, m_pruneVPLs, vpls);
+			for (size_t i=0; i<vpls.size(); ++i)
+				vpls[i].P *= normalization;
+
+			m_vplTree = new VPLTree(vpls, random);
+			Log(EInfo, "Generated " SIZE_T_FMT " virtual point lights, created a light "
+				"tree over " SIZE_T_FMT " of them (" SIZE_T_FMT " nodes, %i ms)",
+				vpls.size(), m_vplTree->getLightCount(), m_vplTree->getNodeCount(),
+				timer->getMilliseconds());
+		}
+
+		/* The tree is kept for subsequent renderings, but it is
+		   only registered with the scheduler while rendering */
+		if (m_vplTreeID == -1)
+			m_vplTreeID = sched->registerResource(m_vplTree);
+
+		/* Luminaires that are not represented by VPLs must be sampled directly */
+		m_directLuminaires.clear();
+		m_directPDF = DiscretePDF();
+		const std::vector<Luminaire *> &luminaires = scene->getLuminaires();
+		for (size_t i=0; i<luminaires.size(); ++i) {
+			if (VPLTree::isSupported(luminaires[i]))
+				continue;
+			m_directLuminaires.push_back((uint32_t) i);
+			m_directPDF.put(luminaires[i]->getSamplingWeight());
+		}
+		if (!m_directLuminaires.empty())
+			m_directPDF.build();
+
+		return true;
+	}
+
+	void postprocess(const Scene *scene, RenderQueue *queue, const RenderJob *job,
+			int sceneResID, int cameraResID, int samplerResID) {
+		SampleIntegrator::postprocess(scene, queue, job, sceneResID, cameraResID, samplerResID);
+		if (m_vplTreeID != -1) {
+			Scheduler::getInstance()->unregisterResource(m_vplTreeID);
+			m_vplTreeID = -1;
+		}
+	}
+
+	/// Specify globally shared resources
+	void bindUsedResources(ParallelProcess *proc) const {
+		if (m_vplTreeID != -1)
+			proc->bindResource("vplTree", m_vplTreeID);
+	}
+
+	/// Connect to globally shared resources
+	void wakeup(std::map<std::string, SerializableObject *> &params) {
+		if (!m_vplTree.get() && params.find("vplTree") != params.end())
+			m_vplTree = static_cast<VPLTree *>(params["vplTree"]);
+	}
+
+	Spectrum Li(const RayDifferential &r, RadianceQueryRecord &rRec) const {
+		/* Some aliases and local variables */
+		const Scene *scene = rRec.scene;
+		Intersection &its = rRec.its;
+		RayDifferential ray(r);
+		Spectrum Li(0.0f), throughput(1.0f);
+
+		/* Perform the first ray intersection (or ignore if the
+		   intersection has already been provided). */
+		if (!rRec.rayIntersect(ray)) {
+			if (rRec.type & RadianceQueryRecord::EEmittedRadiance)
+				Li += scene->LeBackground(ray);
+			return Li;
+		}
+
+		for (int depth=0; ; ++depth) {
+			/* Possibly include emitted radiance */
+			if (its.isLuminaire() && (rRec.type & RadianceQueryRecord::EEmittedRadiance))
+				Li += throughput * its.Le(-ray.d);
+
+			const BSDF *bsdf = its.getBSDF(ray);
+			if (!bsdf)
+				break;
+
+			int type = bsdf->getType();
+			if ((type & BSDF::EDelta) && !(type & (BSDF::EDiffuse | BSDF::EGlossy))) {
+				/* Follow purely specular interactions */
+				if (depth >= m_maxSpecularDepth)
+					break;
+				BSDFQueryRecord bRec(its);
+				Spectrum bsdfVal = bsdf->sampleCos(bRec, rRec.nextSample2D());
+				if (bsdfVal.isZero())
+					break;
+				throughput *= bsdfVal;
+				ray = RayDifferential(its.p, its.toWorld(bRec.wo), ray.time);
+
+				if (!scene->rayIntersect(ray, its)) {
+					if (rRec.type & RadianceQueryRecord::EEmittedRadiance)
+						Li += throughput * scene->LeBackground(ray);
+					break;
+				}
+				continue;
+			}
+
+			if (rRec.type & RadianceQueryRecord::EDirectSurfaceRadiance) {
+				size_t cutSize;
+				Li += throughput * (m_vplTree->estimate(scene, its, bsdf,
+					m_maxError, m_maxCutSize, m_clamping, cutSize)
+					+ sampleDirect(scene, its, bsdf, rRec));
+			}
+			break;
+		}
+
+		return Li;
+	}
+
+	/// Sample the luminaires which are not represented in the light tree
+	Spectrum sampleDirect(const Scene *scene, const Intersection &its,
+			const BSDF *bsdf, RadianceQueryRecord &rRec) const {
+		if (m_directLuminaires.empty())
+			return Spectrum(0.0f);
+
+		Point2 *sampleArray, sample;
+		if (m_directSamples > 1) {
+			sampleArray = rRec.sampler->next2DArray(m_directSamples);
+		} else {
+			sample = rRec.nextSample2D();
+			sampleArray = &sample;
+		}
+
+		const std::vector<Luminaire *> &luminaires = scene->getLuminaires();
+		LuminaireSamplingRecord lRec;
+		Spectrum result(0.0f);
+
+		for (int i=0; i<m_directSamples; ++i) {
+			Point2 lumSample(sampleArray[i]);
+			Float lumPdf;
+			const Luminaire *luminaire = luminaires[m_directLuminaires[
+				m_directPDF.sampleReuse(lumSample.x, lumPdf)]];
+			luminaire->sample(its.p, lRec, lumSample);
+			if (lRec.pdf == 0 || scene->isOccluded(its.p, lRec.sRec.p, its.time))
+				continue;
+
+			const BSDFQueryRecord bRec(its, its.toLocal(-lRec.d));
+			result += lRec.value * bsdf->fCos(bRec) / (lRec.pdf * lumPdf);
+		}
+
+		return result / (Float) m_directSamples;
+	}
+
+	std::string toString() const {
+		std::ostringstream oss;
+		oss << "LightcutsIntegrator[" << std::endl
+			<< "  vplCount = " << m_vplCount << "," << std::endl
+			<< "  maxDepth = " << m_maxDepth << "," << std::endl
+			<< "  pruneVPLs = " << m_pruneVPLs << "," << std::endl
+			<< "  maxError = " << m_maxError << "," << std::endl
+			<< "  maxCutSize = " << m_maxCutSize << "," << std::endl
+			<< "  clamping = " << m_clampingRel << "," << std::endl
+			<< "  directSamples = " << m_directSamples << "," << std::endl
+			<< "  maxSpecularDepth = " << m_maxSpecularDepth << std::endl
+			<< "]";
+		return oss.str();
+	}
+
+	MTS_DECLARE_CLASS()
+protected:
+	virtual ~LightcutsIntegrator() {
+		/* In case postprocess() was never called */
+		if (m_vplTreeID != -1)
+			Scheduler::getInstance()->unregisterResource(m_vplTreeID);
+	}
+private:
+	ref<VPLTree> m_vplTree;
+	int m_vplTreeID;
+	size_t m_vplCount, m_maxCutSize;
+	int m_maxDepth, m_directSamples, m_maxSpecularDepth;
+	Float m_maxError, m_clampingRel, m_clamping;
+	bool m_pruneVPLs;
+	std::vector<uint32_t> m_directLuminaires;
+	DiscretePDF m_directPDF;
+};
+
+MTS_IMPLEMENT_CLASS_S(LightcutsIntegrator, false, SampleIntegrator)
+MTS_EXPORT_PLUGIN(LightcutsIntegrator, "Lightcuts integrator");
+MTS_NAMESPACE_END
@@ -0,0 +1,421 @@
+/*
+    This file is part of Mitsuba, a physically based rendering system.
+
+    Copyright (c) 2007-2011 by Wenzel Jakob and others.
+
+    Mitsuba is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Mitsuba is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <mitsuba/core/statistics.h>
+#include "vpltree.h"
+
+/// Number of bins per axis used to find splits during construction
+#define MTS_VPLTREE_BINS 16
+
+MTS_NAMESPACE_BEGIN
+
+static StatsCounter avgCutSize("Lightcuts", "Average cut size", EAverage);
+static StatsCounter avgShadowRays("Lightcuts", "Shadow rays per cut", EAverage);
+
+/* Clamped angle differences, given the sines and cosines of both angles */
+static inline Float cosDiffClamped(Float sinA, Float cosA, Float sinB, Float cosB) {
+	return (cosA > cosB) ? 1.0f : (cosA * cosB + sinA * sinB);
+}
+
+static inline Float sinDiffClamped(Float sinA, Float cosA, Float sinB, Float cosB) {
+	return (cosA > cosB) ? 0.0f : (sinA * cosB - cosA * sinB);
+}
+
+/// Partitions light indices by the bin of their position along an axis
+template <typename LightType> struct VPLBinPredicate {
+	const LightType *lights;
+	int axis, split;
+	Float min, scale;
+
+	inline VPLBinPredicate(const LightType *lights, int axis, int split, Float min, Float scale)
+		: lights(lights), axis(axis), split(split), min(min), scale(scale) { }
+
+	inline bool operator()(uint32_t index) const {
+		int bin = std::min((int) ((lights[index].p[axis] - min) * scale),
+			MTS_VPLTREE_BINS - 1);
+		return bin < split;
+	}
+};
+
+/// Entry of the priority queue of clusters in a light cut
+struct CutEntry {
+	uint32_t node;
+	Float error;
+	/// Contribution of the representative light per unit intensity
+	Spectrum unit;
+
+	inline CutEntry(uint32_t node, Float error, const Spectrum &unit)
+		: node(node), error(error), unit(unit) { }
+
+	inline bool operator<(const CutEntry &entry) const {
+		return error < entry.error;
+	}
+};
+
+VPLTree::VPLTree(const std::deque<VPL> &vpls, Random *random) {
+	m_lights.reserve(vpls.size());
+	AABB aabb;
+
+	for (size_t i=0; i<vpls.size(); ++i) {
+		const VPL &vpl = vpls[i];
+		LightPoint light;
+		light.p = vpl.its.p;
+		light.n = vpl.its.shFrame.n;
+		light.omni = false;
+
+		if (vpl.type == ELuminaireVPL) {
+			if (!isSupported(vpl.luminaire))
+				continue;
+			if (vpl.luminaire->getType() & Luminaire::EOnSurface) {
+				/* Diffuse area luminaire */
+				light.intensity = vpl.P * INV_PI;
+			} else {
+				/* Isotropic point luminaire */
+				light.intensity = vpl.P * (1 / (4 * M_PI));
+				light.omni = true;
+			}
+		} else {
+			const BSDF *bsdf = vpl.its.shape->getBSDF();
+			if (!bsdf)
+				continue;
+			/* Reflect the light towards the side it arrived from */
+			if (Frame::cosTheta(vpl.its.wi) < 0)
+				light.n = -light.n;
+			light.intensity = vpl.P * bsdf->getDiffuseReflectance(vpl.its) * INV_PI;
+		}
+
+		if (!(light.intensity.getLuminance() > 0))
+			continue;
+
+		m_lights.push_back(light);
+		aabb.expandBy(light.p);
+	}
+
+	if (m_lights.empty())
+		return;
+
+	std::vector<uint32_t> indices(m_lights.size());
+	for (size_t i=0; i<indices.size(); ++i)
+		indices[i] = (uint32_t) i;
+
+	m_nodes.reserve(2 * m_lights.size() - 1);
+	m_nodes.push_back(Node());
+	build(indices, 0, 0, indices.size(),
+		aabb.getExtents().lengthSquared(), random);
+}
+
+VPLTree::VPLTree(Stream *stream, InstanceManager *manager) {
+	m_lights.resize(stream->readSize());
+	for (size_t i=0; i<m_lights.size(); ++i) {
+		LightPoint &light = m_lights[i];
+		light.p = Point(stream);
+		light.n = Vector(stream);
+		light.intensity = Spectrum(stream);
+		light.omni = stream->readBool();
+	}
+	m_nodes.resize(stream->readSize());
+	for (size_t i=0; i<m_nodes.size(); ++i) {
+		Node &node = m_nodes[i];
+		node.aabb = AABB(stream);
+		node.axis = Vector(stream);
+		node.cosThetaO = stream->readFloat();
+		node.sinThetaO = stream->readFloat();
+		node.intensity = Spectrum(stream);
+		node.rep = stream->readUInt();
+		node.index = stream->readUInt();
+		node.leaf = stream->readBool();
+	}
+}
+
+void VPLTree::serialize(Stream *stream, InstanceManager *manager) const {
+	stream->writeSize(m_lights.size());
+	for (size_t i=0; i<m_lights.size(); ++i) {
+		const LightPoint &light = m_lights[i];
+		light.p.serialize(stream);
+		light.n.serialize(stream);
+		light.intensity.serialize(stream);
+		stream->writeBool(light.omni);
+	}
+	stream->writeSize(m_nodes.size());
+	for (size_t i=0; i<m_nodes.size(); ++i) {
+		const Node &node = m_nodes[i];
+		node.aabb.serialize(stream);
+		node.axis.serialize(stream);
+		stream->writeFloat(node.cosThetaO);
+		stream->writeFloat(node.sinThetaO);
+		node.intensity.serialize(stream);
+		stream->writeUInt(node.rep);
+		stream->writeUInt(node.index);
+		stream->writeBool(node.leaf);
+	}
+}
+
+bool VPLTree::isSupported(const Luminaire *luminaire) {
+	int type = luminaire->getType();
+	if (!(type & Luminaire::EDiffuseDirection) || luminaire->isBackgroundLuminaire())
+		return false;
+	/* Area luminaires and point luminaires */
+	return (luminaire->isIntersectable() && (type & Luminaire::EOnSurface))
+		|| (type & Luminaire::EDeltaPosition);
+}
+
+void VPLTree::Bounds::expandBy(const Bounds &bounds) {
+	if (bounds.isEmpty())
+		return;
+	if (isEmpty()) {
+		*this = bounds;
+		return;
+	}
+	aabb.expandBy(bounds.aabb);
+	LightTree::mergeCone(axis, thetaO, bounds.axis, bounds.thetaO);
+	luminance += bounds.luminance;
+}
+
+Float VPLTree::Bounds::getCost(Float diagonal2) const {
+	/* Cluster size metric from the Lightcuts paper */
+	Float coneTerm = 1 - std::cos(thetaO);
+	return luminance * (aabb.getExtents().lengthSquared()
+		+ diagonal2 * coneTerm * coneTerm);
+}
+
+VPLTree::Bounds VPLTree::getBounds(const LightPoint &light) const {
+	Bounds bounds;
+	bounds.aabb = AABB(light.p);
+	bounds.axis = light.n;
+	bounds.thetaO = light.omni ? M_PI : 0.0f;
+	bounds.luminance = light.intensity.getLuminance();
+	return bounds;
+}
+
+VPLTree::Bounds VPLTree::build(std::vector<uint32_t> &indices, uint32_t nodeIndex,
+		size_t start, size_t end, Float diagonal2, Random *random) {
+	if (end - start == 1) {
+		const LightPoint &light = m_lights[indices[start]];
+		Bounds bounds = getBounds(light);
+		Node &node = m_nodes[nodeIndex];
+		node.aabb = bounds.aabb;
+		node.axis = bounds.axis;
+		node.cosThetaO = std::cos(bounds.thetaO);
+		node.sinThetaO = std::sin(bounds.thetaO);
+		node.intensity = light.intensity;
+		node.rep = node.index = indices[start];
+		node.leaf = true;
+		return bounds;
+	}
+
+	AABB aabb;
+	for (size_t i=start; i<end; ++i)
+		aabb.expandBy(m_lights[indices[i]].p);
+	Vector extents = aabb.getExtents();
+
+	/* Find the binned split, which minimizes the summed size of the children */
+	Float bestCost = std::numeric_limits<Float>::infinity();
+	int bestAxis = -1, bestSplit = -1;
+	for (int axis=0; axis<3; ++axis) {
+		if (extents[axis] <= 0)
+			continue;
+		Float scale = MTS_VPLTREE_BINS / extents[axis];
+		Bounds bins[MTS_VPLTREE_BINS];
+
+		for (size_t i=start; i<end; ++i) {
+			const LightPoint &light = m_lights[indices[i]];
+			int bin = std::min((int) ((light.p[axis] - aabb.min[axis]) * scale),
+				MTS_VPLTREE_BINS - 1);
+			bins[bin].expandBy(getBounds(light));
+		}
+
+		Bounds right[MTS_VPLTREE_BINS];
+		right[MTS_VPLTREE_BINS-1] = bins[MTS_VPLTREE_BINS-1];
+		for (int i=MTS_VPLTREE_BINS-2; i>0; --i) {
+			right[i] = right[i+1];
+			right[i].expandBy(bins[i]);
+		}
+
+		Bounds left;
+		for (int split=1; split<MTS_VPLTREE_BINS; ++split) {
+			left.expandBy(bins[split-1]);
+			if (left.isEmpty() || right[split].isEmpty())
+				continue;
+			Float cost = left.getCost(diagonal2) + right[split].getCost(diagonal2);
+			if (cost < bestCost) {
+				bestCost = cost;
+				bestAxis = axis;
+				bestSplit = split;
+			}
+		}
+	}
+
+	size_t mid = (start + end) / 2;
+	if (bestAxis != -1) {
+		mid = std::partition(indices.begin() + start, indices.begin() + end,
+			VPLBinPredicate<LightPoint>(&m_lights[0], bestAxis, bestSplit,
+			aabb.min[bestAxis], MTS_VPLTREE_BINS / extents[bestAxis])) - indices.begin();
+		if (mid == start || mid == end)
+			mid = (start + end) / 2;
+	}
+
+	uint32_t child = (uint32_t) m_nodes.size();
+	m_nodes.resize(m_nodes.size() + 2);
+
+	Bounds bounds = build(indices, child, start, mid, diagonal2, random);
+	Bounds rightBounds = build(indices, child + 1, mid, end, diagonal2, random);
+	bounds.expandBy(rightBounds);
+
+	const Node &left = m_nodes[child], &right = m_nodes[child+1];
+	Node &node = m_nodes[nodeIndex];
+	node.aabb = bounds.aabb;
+	node.axis = bounds.axis;
+	node.cosThetaO = std::cos(bounds.thetaO);
+	node.sinThetaO = std::sin(bounds.thetaO);
+	node.intensity = left.intensity + right.intensity;
+	node.index = child;
+	node.leaf = false;
+
+	/* Choose the representative proportional to the intensity */
+	Float leftLum = left.intensity.getLuminance(),
+		  rightLum = right.intensity.getLuminance();
+	node.rep = (random->nextFloat() * (leftLum + rightLum) < leftLum)
+		? left.rep : right.rep;
+
+	return bounds;
+}
+
+Spectrum VPLTree::evalLight(const Scene *scene, const Intersection &its,
+		const BSDF *bsdf, const LightPoint &light, Float minDist2) const {
+	Vector d = light.p - its.p;
+	Float dist2 = d.lengthSquared();
+	if (dist2 == 0)
+		return Spectrum(0.0f);
+	d /= std::sqrt(dist2);
+
+	Float emission = light.omni ? 1.0f : -dot(light.n, d);
+	if (emission <= 0)
+		return Spectrum(0.0f);
+
+	BSDFQueryRecord bRec(its, its.toLocal(d));
+	Spectrum value = bsdf->fCos(bRec);
+	if (value.isZero())
+		return Spectrum(0.0f);
+
+	++avgShadowRays;
+	if (scene->isOccluded(its.p, light.p, its.time))
+		return Spectrum(0.0f);
+
+	return value * (emission / std::max(dist2, minDist2));
+}
+
+Float VPLTree::errorBound(const Node &node, const Intersection &its,
+		const BSDF *bsdf, Float diffuse, Float minDist2) const {
+	Float dist2 = std::max(node.aabb.squaredDistanceTo(its.p), minDist2);
+	if (dist2 <= 0)
+		return std::numeric_limits<Float>::infinity();
+
+	Vector w = node.aabb.getCenter() - its.p;
+	Float centerDist2 = w.lengthSquared(),
+		  radius2 = 0.25f * node.aabb.getExtents().lengthSquared(),
+		  emission = 1.0f, cosine = 1.0f, material = diffuse;
+	if (centerDist2 == 0)
+		return node.intensity.getLuminance() * material / dist2;
+	w /= std::sqrt(centerDist2);
+
+	/* The BSDF is bounded by its diffuse part, and by its value towards
+	   the cluster center (exact for diffuse materials, and only an
+	   approximation for glossy ones) */
+	BSDFQueryRecord bRec(its, its.toLocal(w));
+	Float cosTheta = std::abs(Frame::cosTheta(bRec.wo));
+	if (cosTheta > Epsilon)
+		material = std::max(material, bsdf->fCos(bRec).getLuminance() / cosTheta);
+
+	if (centerDist2 > radius2) {
+		/* Angle subtended by the cluster's bounding sphere */
+		Float sinThetaB2 = radius2 / centerDist2,
+			  sinThetaB = std::sqrt(sinThetaB2),
+			  cosThetaB = std::sqrt(std::max((Float) 0, 1 - sinThetaB2));
+
+		/* Bound the emission towards the shading point using the normal cone */
+		Float cosThetaW = std::min((Float) 1, std::max((Float) -1, -dot(node.axis, w))),
+			  sinThetaW = std::sqrt(std::max((Float) 0, 1 - cosThetaW*cosThetaW)),
+			  cosThetaX = cosDiffClamped(sinThetaW, cosThetaW, node.sinThetaO, node.cosThetaO),
+			  sinThetaX = sinDiffClamped(sinThetaW, cosThetaW, node.sinThetaO, node.cosThetaO);
+		emission = std::max((Float) 0, cosDiffClamped(sinThetaX, cosThetaX, sinThetaB, cosThetaB));
+
+		/* Bound the cosine factor at the shading point */
+		Float cosThetaN = std::min((Float) 1, std::abs(dot(its.shFrame.n, w))),
+			  sinThetaN = std::sqrt(std::max((Float) 0, 1 - cosThetaN*cosThetaN));
+		cosine = cosDiffClamped(sinThetaN, cosThetaN, sinThetaB, cosThetaB);
+	}
+
+	return node.intensity.getLuminance() * emission * cosine * material / dist2;
+}
+
+Spectrum VPLTree::estimate(const Scene *scene, const Intersection &its,
+		const BSDF *bsdf, Float maxError, size_t maxCutSize,
+		Float minDist, size_t &cutSize) const {
+	cutSize = 0;
+	if (m_nodes.empty())
+		return Spectrum(0.0f);
+
+	Float minDist2 = minDist * minDist,
+		  diffuse = bsdf->getDiffuseReflectance(its).getLuminance() * INV_PI;
+	const Node &root = m_nodes[0];
+	Spectrum unit = evalLight(scene, its, bsdf, m_lights[root.rep], minDist2),
+			 total = root.intensity * unit;
+	avgShadowRays.incrementBase();
+	avgCutSize.incrementBase();
+	cutSize = 1;
+
+	std::vector<CutEntry> heap;
+	if (!root.leaf)
+		heap.push_back(CutEntry(0, errorBound(root, its, bsdf, diffuse, minDist2), unit));
+
+	while (!heap.empty() && cutSize < maxCutSize) {
+		/* Refine the cluster with the largest error bound */
+		if (heap.front().error <= maxError * total.getLuminance())
+			break;
+		std::pop_heap(heap.begin(), heap.end());
+		CutEntry entry = heap.back();
+		heap.pop_back();
+
+		const Node &node = m_nodes[entry.node];
+		total -= node.intensity * entry.unit;
+
+		for (uint32_t i=0; i<2; ++i) {
+			uint32_t childIndex = node.index + i;
+			const Node &child = m_nodes[childIndex];
+
+			/* One of the children shares the representative light */
+			Spectrum childUnit = (child.rep == node.rep) ? entry.unit
+				: evalLight(scene, its, bsdf, m_lights[child.rep], minDist2);
+			total += child.intensity * childUnit;
+
+			if (!child.leaf) {
+				heap.push_back(CutEntry(childIndex,
+					errorBound(child, its, bsdf, diffuse, minDist2), childUnit));
+				std::push_heap(heap.begin(), heap.end());
+			}
+		}
+		++cutSize;
+	}
+
+	avgCutSize += cutSize;
+	total.clampNegative();
+	return total;
+}
+
+MTS_IMPLEMENT_CLASS_S(VPLTree, false, SerializableObject)
+MTS_NAMESPACE_END
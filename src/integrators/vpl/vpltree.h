@@ -0,0 +1,149 @@
+/*
+    This file is part of Mitsuba, a physically based rendering system.
+
+    Copyright (c) 2007-2011 by Wenzel Jakob and others.
+
+    Mitsuba is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Mitsuba is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#if !defined(__VPL_TREE_H)
+#define __VPL_TREE_H
+
+#include <mitsuba/render/vpl.h>
+
+MTS_NAMESPACE_BEGIN
+
+/**
+ * Light tree over a large number of virtual point lights, which
+ * is used to compute their contribution at a surface point using
+ * an adaptively chosen cut through the tree. Each cluster in the
+ * cut is approximated by a single representative VPL. Clusters are
+ * refined until the (approximate) upper bound on their error is
+ * below a fraction of the total estimate.
+ *
+ * Implements the technique described in "Lightcuts: a scalable
+ * approach to illumination" by Bruce Walter, Sebastian Fernandez,
+ * Adam Arbree, Kavita Bala, Michael Donikian and Donald P. Greenberg
+ * (Proceedings of SIGGRAPH 2005).
+ *
+ * Surface VPLs are converted into oriented (cosine-weighted) point
+ * lights using the diffuse reflectance at their position, as is done
+ * in the paper. VPLs on area luminaires are oriented point lights, and
+ * VPLs of point luminaires are omnidirectional. Other luminaire VPLs
+ * cannot be represented and are skipped (see \ref isSupported()).
+ */
+class VPLTree : public SerializableObject {
+public:
+	/**
+	 * \brief Create a light tree from a list of VPLs, whose
+	 * power has already been normalized
+	 */
+	VPLTree(const std::deque<VPL> &vpls, Random *random);
+
+	/// Unserialize a light tree from a binary data stream
+	VPLTree(Stream *stream, InstanceManager *manager);
+
+	/// Serialize to a binary data stream
+	void serialize(Stream *stream, InstanceManager *manager) const;
+
+	/**
+	 * \brief Estimate the reflected radiance due to all VPLs at a surface
+	 * point using a light cut
+	 *
+	 * \param maxError
+	 *    Maximum relative error bound of every cluster in the cut
+	 * \param maxCutSize
+	 *    Maximum number of clusters in the cut
+	 * \param minDist
+	 *    The inverse-square falloff is clamped below this distance
+	 * \param cutSize
+	 *    Will be set to the size of the resulting cut
+	 */
+	Spectrum estimate(const Scene *scene, const Intersection &its,
+		const BSDF *bsdf, Float maxError, size_t maxCutSize,
+		Float minDist, size_t &cutSize) const;
+
+	/// Can VPLs of the given luminaire be stored in the light tree?
+	static bool isSupported(const Luminaire *luminaire);
+
+	/// Return the number of VPLs in the tree
+	inline size_t getLightCount() const { return m_lights.size(); }
+
+	/// Return the number of nodes in the tree
+	inline size_t getNodeCount() const { return m_nodes.size(); }
+
+	MTS_DECLARE_CLASS()
+protected:
+	/// Virtual destructor
+	virtual ~VPLTree() { }
+
+	/// Point light with a cosine-weighted or uniform emission profile
+	struct LightPoint {
+		Point p;
+		Vector n;
+		Spectrum intensity;
+		bool omni;
+	};
+
+	/// Light tree node
+	struct Node {
+		AABB aabb;
+		/// Cone bounding the normals of oriented lights
+		Vector axis;
+		Float cosThetaO, sinThetaO;
+		/// Total intensity of all lights in the cluster
+		Spectrum intensity;
+		/// Index of the representative light
+		uint32_t rep;
+		/// First child (inner nodes) or light index (leaves)
+		uint32_t index;
+		bool leaf;
+	};
+
+	/// Intermediate cluster bounds used during construction
+	struct Bounds {
+		AABB aabb;
+		Vector axis;
+		Float thetaO, luminance;
+
+		inline Bounds() : axis(0.0f), thetaO(-1), luminance(0) { }
+		inline bool isEmpty() const { return thetaO < 0; }
+		void expandBy(const Bounds &bounds);
+		Float getCost(Float diagonal2) const;
+	};
+
+	/// Recursively build the subtree at \c nodeIndex and return its bounds
+	Bounds build(std::vector<uint32_t> &indices, uint32_t nodeIndex,
+		size_t start, size_t end, Float diagonal2, Random *random);
+
+	/// Return the bounds of a single light
+	Bounds getBounds(const LightPoint &light) const;
+
+	/**
+	 * \brief Compute the contribution of a light per unit intensity
+	 * (including visibility)
+	 */
+	Spectrum evalLight(const Scene *scene, const Intersection &its,
+		const BSDF *bsdf, const LightPoint &light, Float minDist2) const;
+
+	/// Compute an approximate upper bound on the error of a cluster
+	Float errorBound(const Node &node, const Intersection &its,
+		const BSDF *bsdf, Float diffuse, Float minDist2) const;
+private:
+	std::vector<LightPoint> m_lights;
+	std::vector<Node> m_nodes;
+};
+
+MTS_NAMESPACE_END
+
+#endif /* __VPL_TREE_H */
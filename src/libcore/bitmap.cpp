@@ -26,6 +26,7 @@
 
 #include <ImfRgba.h>
 #include <ImfRgbaFile.h>
+#include <ImfTiledRgbaFile.h>
 #include <ImfIO.h>
 #include <ImathBox.h>
 
@@ -791,5 +792,86 @@ std::string Bitmap::toString() const {
 	return oss.str();
 }
 
+/* ========================== *
+ *       TiledEXRWriter       *
+ * ========================== */
+
+struct TiledEXRWriter::EXRFile {
+	EXROStream ostream;
+	Imf::TiledRgbaOutputFile file;
+	std::vector<Imf::Rgba> buffer;
+
+	EXRFile(Stream *stream, const Imf::Header &header, bool alpha, int tileSize)
+		: ostream(stream), file(ostream, header, alpha ? Imf::WRITE_RGBA 
+		  : Imf::WRITE_RGB, tileSize, tileSize, Imf::ONE_LEVEL),
+		  buffer(tileSize * tileSize) { }
+};
+
+TiledEXRWriter::TiledEXRWriter(Stream *stream, const Vector2i &size, 
+		int tileSize, bool alpha) : m_stream(stream), m_size(size),
+		m_tileSize(tileSize), m_tilesWritten(0) {
+	m_tileCount = Vector2i(
+		(size.x + tileSize - 1) / tileSize,
+		(size.y + tileSize - 1) / tileSize);
+	m_written.resize(m_tileCount.x * m_tileCount.y, false);
+
+	Log(EDebug, "Writing a %ix%i tiled EXR file (%ix%i tiles)", 
+		size.x, size.y, m_tileCount.x, m_tileCount.y);
+
+	/* Tiles are written in the order in which they become available */
+	Imf::Header header(size.x, size.y);
+	header.lineOrder() = Imf::RANDOM_Y;
+	m_file = new EXRFile(stream, header, alpha, tileSize);
+}
+
+TiledEXRWriter::~TiledEXRWriter() {
+	close();
+}
+
+void TiledEXRWriter::writeTile(const Point2i &tile, const float *data) {
+	if (!m_file)
+		Log(EError, "writeTile(): the file has already been closed!");
+	size_t index = tile.x + tile.y * m_tileCount.x;
+	if (m_written[index])
+		Log(EError, "writeTile(): tile (%i, %i) was already written!", tile.x, tile.y);
+
+	Point2i offset(tile.x * m_tileSize, tile.y * m_tileSize);
+	Vector2i size(
+		std::min(m_tileSize, m_size.x - offset.x),
+		std::min(m_tileSize, m_size.y - offset.y));
+
+	Imf::Rgba *buffer = &m_file->buffer[0];
+	size_t nPixels = size.x * size.y;
+	if (data) {
+		for (size_t i=0; i<nPixels; ++i)
+			buffer[i] = Imf::Rgba(data[4*i], data[4*i+1], data[4*i+2], data[4*i+3]);
+	} else {
+		for (size_t i=0; i<nPixels; ++i)
+			buffer[i] = Imf::Rgba(0.0f, 0.0f, 0.0f, 0.0f);
+	}
+
+	/* The frame buffer is addressed using absolute pixel coordinates */
+	m_file->file.setFrameBuffer(buffer - offset.x - offset.y * size.x, 1, size.x);
+	m_file->file.writeTile(tile.x, tile.y);
+	m_written[index] = true;
+	++m_tilesWritten;
+}
+
+void TiledEXRWriter::close() {
+	if (!m_file)
+		return;
+
+	for (int y=0; y<m_tileCount.y; ++y)
+		for (int x=0; x<m_tileCount.x; ++x)
+			if (!m_written[x + y * m_tileCount.x])
+				writeTile(Point2i(x, y), NULL);
+
+	/* Writes the tile offset table */
+	delete m_file;
+	m_file = NULL;
+	m_stream->flush();
+}
+
 MTS_IMPLEMENT_CLASS(Bitmap, false, Object)
+MTS_IMPLEMENT_CLASS(TiledEXRWriter, false, Object)
 MTS_NAMESPACE_END
@@ -7,7 +7,8 @@
 
 MTS_NAMESPACE_BEGIN
 
-MemoryMappedFile::MemoryMappedFile(const fs::path &filename) : m_filename(filename) {
+MemoryMappedFile::MemoryMappedFile(const fs::path &filename, bool copyOnWrite)
+		: m_filename(filename) {
 	if (!fs::exists(filename))
 		Log(EError, "The file \"%s\" does not exist!", filename.file_string().c_str());
 	m_size = (size_t) fs::file_size(filename);
@@ -17,7 +18,8 @@ MemoryMappedFile::MemoryMappedFile(const fs::path &filename) : m_filename(filena
 	int fd = open(filename.file_string().c_str(), O_RDONLY);
 	if (fd == -1)
 		Log(EError, "Could not open \"%s\"!", m_filename.file_string().c_str());
-	m_data = mmap(NULL, m_size, PROT_READ, MAP_SHARED, fd, 0);
+	m_data = mmap(NULL, m_size, copyOnWrite ? (PROT_READ | PROT_WRITE) : PROT_READ, 
+		copyOnWrite ? MAP_PRIVATE : MAP_SHARED, fd, 0);
 	if (m_data == NULL)
 		Log(EError, "Could not map \"%s\" to memory!", m_filename.file_string().c_str());
 	if (close(fd) != 0)
@@ -29,11 +31,13 @@ MemoryMappedFile::MemoryMappedFile(const fs::path &filename) : m_filename(filena
 	if (m_file == INVALID_HANDLE_VALUE)
 		Log(EError, "Could not open \"%s\": %s", m_filename.file_string().c_str(),
 			lastErrorText().c_str());
-	m_fileMapping = CreateFileMapping(m_file, NULL, PAGE_READONLY, 0, 0, NULL);
+	m_fileMapping = CreateFileMapping(m_file, NULL, 
+		copyOnWrite ? PAGE_WRITECOPY : PAGE_READONLY, 0, 0, NULL);
 	if (m_fileMapping == NULL)
 		Log(EError, "CreateFileMapping: Could not map \"%s\" to memory: %s", 
 			m_filename.file_string().c_str(), lastErrorText().c_str());
-	m_data = (void *) MapViewOfFile(m_fileMapping, FILE_MAP_READ, 0, 0, 0);
+	m_data = (void *) MapViewOfFile(m_fileMapping, 
+		copyOnWrite ? FILE_MAP_COPY : FILE_MAP_READ, 0, 0, 0);
 	if (m_data == NULL)
 		Log(EError, "MapViewOfFile: Could not map \"%s\" to memory: %s", 
 			m_filename.file_string().c_str(), lastErrorText().c_str());
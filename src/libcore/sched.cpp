@@ -19,6 +19,8 @@
 #include <mitsuba/core/sched.h>
 #include <mitsuba/core/plugin.h>
 #include <mitsuba/core/mstream.h>
+#include <mitsuba/core/statistics.h>
+#include <mitsuba/core/atomic.h>
 
 MTS_NAMESPACE_BEGIN
 
@@ -55,12 +57,25 @@ Scheduler::Scheduler() {
 	m_workAvailable = new ConditionVariable(m_mutex);
 	m_resourceCounter = 0;
 	m_processCounter = 0;
+	m_queuedUnits = 0;
+	m_prefetchCount = 4;
 	m_running = false;
+	m_workStealing = false;
 }
 
 Scheduler::~Scheduler() {
 	for (size_t i=0; i<m_workers.size(); ++i)
 		m_workers[i]->decRef();
+	for (size_t i=0; i<m_workQueues.size(); ++i)
+		delete m_workQueues[i];
+}
+
+void Scheduler::setWorkStealing(bool enabled, int prefetchCount) {
+	Assert(!m_running);
+	if (prefetchCount < 1)
+		Log(EError, "setWorkStealing(): the prefetch count must be positive!");
+	m_workStealing = enabled;
+	m_prefetchCount = prefetchCount;
 }
 
 void Scheduler::registerWorker(Worker *worker) {
@@ -122,12 +137,8 @@ int Scheduler::registerResource(SerializableObject *object) {
 	m_mutex->lock();
 	int resourceID = m_resourceCounter++;
 	ResourceRecord *rec = new ResourceRecord(object);
-	if (hasRemoteWorkers()) {
-		ref<InstanceManager> manager = new InstanceManager();
-		rec->stream = new MemoryStream();
-		rec->stream->setByteOrder(Stream::ENetworkByteOrder);
-		manager->serialize(rec->stream, rec->resources[0]);
-	}
+	if (hasRemoteWorkers())
+		serializeResource(rec);
 	m_resources[resourceID] = rec;
 	object->incRef();
 #if defined(DEBUG_SCHED)
@@ -237,16 +248,40 @@ const MemoryStream *Scheduler::getResourceStream(int id) {
 		Log(EError, "getResourceStream(): only standard resource lookups are permitted!");
 	}
 
-	if (!rec->stream) {
-		ref<InstanceManager> manager = new InstanceManager();
-		rec->stream = new MemoryStream();
-		rec->stream->setByteOrder(Stream::ENetworkByteOrder);
-		manager->serialize(rec->stream, rec->resources[0]);
-	}
+	if (!rec->stream)
+		serializeResource(rec);
 	m_mutex->unlock();
 	return rec->stream;
 }
 
+std::string Scheduler::getResourceHash(int id) {
+	m_mutex->lock();
+	std::map<int, ResourceRecord *>::iterator it = m_resources.find(id);
+	if (it == m_resources.end()) {
+		m_mutex->unlock();
+		Log(EError, "getResourceHash(): could not find the resource with ID %i!", id);
+	}
+	ResourceRecord *rec = (*it).second;
+	if ((*it).second->manifold) {
+		m_mutex->unlock();
+		Log(EError, "getResourceHash(): only standard resource lookups are permitted!");
+	}
+
+	if (!rec->stream)
+		serializeResource(rec);
+	std::string hash = rec->hash;
+	m_mutex->unlock();
+	return hash;
+}
+
+void Scheduler::serializeResource(ResourceRecord *rec) {
+	ref<InstanceManager> manager = new InstanceManager();
+	rec->stream = new MemoryStream();
+	rec->stream->setByteOrder(Stream::ENetworkByteOrder);
+	manager->serialize(rec->stream, rec->resources[0]);
+	rec->hash = hashBuffer(rec->stream->getData(), rec->stream->getPos());
+}
+
 int Scheduler::getResourceID(const SerializableObject *obj) const {
 	m_mutex->lock();
 	std::map<int, ResourceRecord *>::const_iterator it = m_resources.begin();
@@ -413,6 +448,9 @@ bool Scheduler::cancel(ParallelProcess *process, bool reduceInflight) {
 	m_remoteQueue.erase(std::remove(m_remoteQueue.begin(), m_remoteQueue.end(), rec->id), 
 		m_remoteQueue.end());
 
+	/* Drop any work units that were prefetched but not yet started */
+	discardQueuedWork(rec);
+
 	/* Ensure that the process won't be considered 'done' when the
 	   last in-flight work unit is returned */
 	rec->morework = true;
@@ -456,6 +494,14 @@ bool Scheduler::cancel(ParallelProcess *process, bool reduceInflight) {
 
 Scheduler::EStatus Scheduler::acquireWork(Item &item, 
 		bool local, bool onlyTry, bool keepLock) {
+	bool stealing = local && m_workStealing && !keepLock
+		&& item.workerIndex < (int) m_workQueues.size()
+		&& m_workQueues[item.workerIndex] != NULL;
+
+	/* In work stealing mode, first try to avoid the central lock */
+	if (stealing && acquireQueuedWork(item))
+		return EOK;
+
 	m_mutex->lock();
 	std::deque<int> &queue = local ? m_localQueue : m_remoteQueue;
 	while (true) {
@@ -466,9 +512,22 @@ Scheduler::EStatus Scheduler::acquireWork(Item &item,
 
 		/* Wait until work is available and return false 
 		   if stop() is called */
-		while (queue.size() == 0 && m_running) 
+		while (queue.size() == 0 && m_running && 
+				!(stealing && m_queuedUnits > 0))
 			m_workAvailable->wait();
 
+		if (stealing && m_queuedUnits > 0 && 
+				(queue.size() == 0 || !m_running)) {
+			/* Other workers still have queued work units. Take one 
+			   of them -- also when shutting down, since any scheduled
+			   work units must still be completed */
+			m_mutex->unlock();
+			if (acquireQueuedWork(item))
+				return EOK;
+			m_mutex->lock();
+			continue;
+		}
+
 		if (!m_running) {
 			m_mutex->unlock();
 			return EStop;
@@ -518,13 +577,155 @@ Scheduler::EStatus Scheduler::acquireWork(Item &item,
 	item.rec->inflight++;
 	item.stop = false;
 
+	if (stealing && m_prefetchCount > 1)
+		prefetchWork(item);
+
 	if (!keepLock)
 		m_mutex->unlock();
 
 	sched_yield();
 	return EOK;
 }
-		
+
+void Scheduler::prefetchWork(Item &item) {
+	static StatsCounter prefetchedUnits("Scheduler", "Prefetched work units");
+	std::vector<QueuedUnit> units;
+	units.reserve(m_prefetchCount - 1);
+
+	for (int i=0; i<m_prefetchCount - 1; ++i) {
+		/* Stop when the process is no longer at the front of the queue */
+		if (m_localQueue.size() == 0 || m_localQueue.front() != item.id)
+			break;
+
+		ref<WorkUnit> workUnit = item.wp->createWorkUnit();
+		ParallelProcess::EStatus wStatus;
+		try {
+			wStatus = item.proc->generateWork(workUnit, item.workerIndex);
+		} catch (const std::exception &) {
+			/* Leave it to the next regular acquireWork() call to
+			   deal with the failure (cancelling the process here 
+			   would deadlock, since 'item' is still in flight) */
+			break;
+		}
+
+		if (wStatus == ParallelProcess::ESuccess) {
+			units.push_back(QueuedUnit(item.id, workUnit));
+			item.rec->inflight++;
+		} else {
+			/* 'item' is in flight, hence there is no need to check 
+			   for process termination here */
+			if (wStatus == ParallelProcess::EFailure)
+				item.rec->morework = false;
+			item.rec->active = false;
+			m_localQueue.pop_front();
+			break;
+		}
+	}
+
+	if (units.size() == 0)
+		return;
+
+	WorkQueue *wq = m_workQueues[item.workerIndex];
+	wq->mutex->lock();
+	for (size_t i=0; i<units.size(); ++i)
+		wq->units.push_back(units[i]);
+	wq->mutex->unlock();
+	atomicAdd(&m_queuedUnits, (int32_t) units.size());
+	prefetchedUnits += units.size();
+
+	/* Wake up idle workers so that they can steal from this queue */
+	m_workAvailable->broadcast();
+}
+
+bool Scheduler::acquireQueuedWork(Item &item) {
+	static StatsCounter stolenUnits("Scheduler", "Stolen work units");
+
+	if (m_queuedUnits == 0)
+		return false;
+
+	QueuedUnit unit;
+	bool found = false;
+	size_t queueCount = m_workQueues.size();
+
+	/* Check the worker's own queue (LIFO), then steal from 
+	   the neighbors (FIFO) */
+	for (size_t i=0; i<queueCount && !found; ++i) {
+		WorkQueue *wq = m_workQueues[(item.workerIndex + i) % queueCount];
+		if (wq == NULL)
+			continue;
+		wq->mutex->lock();
+		if (wq->units.size() > 0) {
+			if (i == 0) {
+				unit = wq->units.back();
+				wq->units.pop_back();
+			} else {
+				unit = wq->units.front();
+				wq->units.pop_front();
+				++stolenUnits;
+			}
+			found = true;
+		}
+		wq->mutex->unlock();
+	}
+
+	if (!found)
+		return false;
+
+	atomicAdd(&m_queuedUnits, -1);
+
+	/* The unit counts as being in flight, hence the process and 
+	   its record cannot disappear in the meantime */
+	if (item.id != unit.id) {
+		try {
+			setProcessByID(item, unit.id);
+		} catch (const std::exception &ex) {
+			Log(EWarn, "Caught an exception - canceling process %i: %s",
+				unit.id, ex.what());
+			/* 'item.proc' may still refer to the previously executed process.
+			   Cancel the one that the unit belongs to, which also releases
+			   the unit's in-flight count */
+			m_mutex->lock();
+			std::map<int, ParallelProcess *>::iterator it = 
+				m_idToProcess.find(unit.id);
+			ParallelProcess *proc = (it != m_idToProcess.end()) ? (*it).second : NULL;
+			m_mutex->unlock();
+			if (proc)
+				cancel(proc, true);
+			return false;
+		}
+	}
+
+	item.workUnit = unit.workUnit;
+	/* Benign race: a cancellation that slips through here is still 
+	   caught by signalProcessCancellation() or simply waited for */
+	item.stop = item.rec->cancelled;
+	return true;
+}
+
+void Scheduler::discardQueuedWork(ProcessRecord *rec) {
+	for (size_t i=0; i<m_workQueues.size(); ++i) {
+		WorkQueue *wq = m_workQueues[i];
+		if (wq == NULL)
+			continue;
+		int discarded = 0;
+		wq->mutex->lock();
+		for (std::deque<QueuedUnit>::iterator it = wq->units.begin(); 
+				it != wq->units.end();) {
+			if ((*it).id == rec->id) {
+				it = wq->units.erase(it);
+				++discarded;
+			} else {
+				++it;
+			}
+		}
+		wq->mutex->unlock();
+		if (discarded > 0) {
+			atomicAdd(&m_queuedUnits, -discarded);
+			rec->inflight -= discarded;
+		}
+	}
+}
+
 void Scheduler::signalProcessTermination(ParallelProcess *proc, ProcessRecord *rec) {
 #if defined(DEBUG_SCHED)
 	Log(rec->logLevel, "Process %i is complete.", rec->id);
@@ -559,6 +760,20 @@ void Scheduler::start() {
 	if (m_workers.size() == 0)
 		Log(EError, "Cannot start the scheduler - there are no registered workers!");
 
+	/* (Re-)create the per-worker queues used in work stealing mode.
+	   These are always empty here, since pause() drains them */
+	Assert(m_queuedUnits == 0);
+	for (size_t i=0; i<m_workQueues.size(); ++i)
+		delete m_workQueues[i];
+	m_workQueues.clear();
+	if (m_workStealing) {
+		m_workQueues.resize(m_workers.size(), NULL);
+		for (size_t i=0; i<m_workers.size(); ++i) {
+			if (!m_workers[i]->isRemoteWorker())
+				m_workQueues[i] = new WorkQueue();
+		}
+	}
+
 	int coreIndex = 0;
 	for (size_t i=0; i<m_workers.size(); ++i) {
 		m_workers[i]->start(this, (int) i, coreIndex);
@@ -576,7 +791,8 @@ void Scheduler::pause() {
 	/* Wake up any workers waiting for work units */
 	m_workAvailable->broadcast();
 	m_mutex->unlock();
-	/* Return when all of them have finished */
+	/* Return when all of them have finished (in work stealing 
+	   mode, this includes the processing of all queued units) */
 	for (size_t i=0; i<m_workers.size(); ++i)
 		m_workers[i]->join();
 	/* Decrement reference counts to any referenced objects */
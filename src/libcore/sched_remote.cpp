@@ -20,6 +20,14 @@
 #include <mitsuba/core/sstream.h>
 #include <mitsuba/core/mstream.h>
 #include <mitsuba/core/plugin.h>
+#include <mitsuba/core/fstream.h>
+#include <boost/filesystem/operations.hpp>
+#include <zlib.h>
+#include <ctime>
+
+#if !defined(WIN32)
+#include <unistd.h>
+#endif
 
 MTS_NAMESPACE_BEGIN
 
@@ -37,7 +45,12 @@ private:
 	ref<ParallelProcess> m_proc;
 };
 
-RemoteWorker::RemoteWorker(const std::string &name, Stream *stream) : Worker(name), m_stream(stream) {
+RemoteWorker::RemoteWorker(const std::string &name, Stream *stream, int compressionLevel) 
+		: Worker(name), m_stream(stream), m_compressionLevel(compressionLevel) {
+	if (compressionLevel < 0 || compressionLevel > 9)
+		Log(EError, "Invalid compression level %i (must be in the range 0-9)!", 
+			compressionLevel);
+
 	const size_t dataLength = strlen(MTS_VERSION)+3;
 	char *data = (char *) alloca(dataLength);
 	strncpy(data, MTS_VERSION, strlen(MTS_VERSION)+1);
@@ -60,12 +73,27 @@ RemoteWorker::RemoteWorker(const std::string &name, Stream *stream) : Worker(nam
 	m_nodeName = m_stream->readString();
 	m_mutex = new Mutex();
 	m_finishCond = new ConditionVariable(m_mutex);
+	m_resourceCond = new ConditionVariable(m_mutex);
 	m_memStream = new MemoryStream();
 	m_memStream->setByteOrder(Stream::ENetworkByteOrder);
 	m_reader = new RemoteWorkerReader(this);
 	m_reader->start();
 	m_inFlight = 0;
 	m_isRemote = true;
+	m_resourceStatusReady = false;
+	m_resourceHits = m_resourceMisses = 0;
+	m_resourceBytesSent = m_resourceBytesTotal = 0;
+	m_timer = new Timer();
+	m_rtt = m_unitTime = 0;
+	m_lastPing = m_lastCompletion = 0;
+	m_pingPending = false;
+	m_backlog = m_continue = 0;
+	updateBacklog();
+	if (m_compressionLevel != 0) {
+		/* Sent along with the first batch of work */
+		m_memStream->writeShort(StreamBackend::ESetCompression);
+		m_memStream->writeInt(m_compressionLevel);
+	}
 	Log(EDebug, "Connection to \"%s\" established (%i cores).", 
 		m_nodeName.c_str(), m_coreCount);
 }
@@ -74,6 +102,7 @@ RemoteWorker::~RemoteWorker() {
 	Log(EDebug, "Shutting down");
 	m_mutex->lock();
 	m_reader->shutdown();
+	m_pingPending = true; /* Don't send any further measurements */
 	m_memStream->writeShort(StreamBackend::EQuit);
 	try {
 		flush();
@@ -82,6 +111,19 @@ RemoteWorker::~RemoteWorker() {
 	}
 	m_mutex->unlock();
 	m_reader->join();
+
+	size_t resourceCount = m_resourceHits + m_resourceMisses;
+	if (resourceCount > 0)
+		Log(EInfo, "Resource transfer statistics for \"%s\": %i/%i cache hits (%.1f%%), "
+			"sent %s of %s", m_nodeName.c_str(), (int) m_resourceHits, (int) resourceCount,
+			100.0f * m_resourceHits / (Float) resourceCount, memString(m_resourceBytesSent).c_str(),
+			memString(m_resourceBytesTotal).c_str());
+
+	if (m_reader->m_compressedBytes > 0)
+		Log(EInfo, "Work result compression for \"%s\": received %s instead of %s (%.1f%%)",
+			m_nodeName.c_str(), memString(m_reader->m_compressedBytes).c_str(),
+			memString(m_reader->m_uncompressedBytes).c_str(), 100.0f * 
+			m_reader->m_compressedBytes / (Float) m_reader->m_uncompressedBytes);
 }
 	
 void RemoteWorker::start(Scheduler *scheduler, int workerIndex, int coreOffset) {
@@ -89,7 +131,59 @@ void RemoteWorker::start(Scheduler *scheduler, int workerIndex, int coreOffset)
 	m_reader->m_schedItem.coreOffset = coreOffset;
 }
 
+void RemoteWorker::signalCompletion() {
+	m_mutex->lock();
+	unsigned int now = m_timer->getMicroseconds();
+	if (m_inFlight > m_coreCount && m_lastCompletion != 0) {
+		/* All cores of the node were busy, hence the time between 
+		   two completions reflects the node's processing rate */
+		Float unitTime = (now - m_lastCompletion) * 1e-6f * m_coreCount;
+		m_unitTime = (m_unitTime == 0) ? unitTime 
+			: 0.9f * m_unitTime + 0.1f * unitTime;
+		updateBacklog();
+	}
+	m_lastCompletion = now;
+	m_inFlight--;
+	m_finishCond->signal();
+	m_mutex->unlock();
+}
+
+void RemoteWorker::signalPong(unsigned int token) {
+	m_mutex->lock();
+	Float rtt = (m_timer->getMicroseconds() - token) * 1e-6f;
+	m_rtt = (m_rtt == 0) ? rtt : 0.75f * m_rtt + 0.25f * rtt;
+	m_pingPending = false;
+	updateBacklog();
+	m_mutex->unlock();
+}
+
+void RemoteWorker::updateBacklog() {
+	/* Each core needs enough queued work units to bridge the time
+	   until the next batch arrives (Little's law) */
+	size_t factor = BACKLOG_FACTOR;
+	if (m_unitTime > 0 && m_rtt > 0)
+		factor = std::max(factor, (size_t) std::ceil(m_rtt / m_unitTime) + 2);
+	factor = std::min(factor, (size_t) MAX_BACKLOG_FACTOR);
+	size_t backlog = factor * m_coreCount;
+	if (backlog != m_backlog && m_unitTime > 0)
+		Log(EDebug, "Adjusting the backlog of \"%s\" to %i work units (rtt=%.2f ms, "
+			"unit time=%.2f ms)", m_nodeName.c_str(), (int) backlog, m_rtt * 1000, 
+			m_unitTime * 1000);
+	m_backlog = backlog;
+	m_continue = (factor - (BACKLOG_FACTOR - CONTINUE_FACTOR)) * m_coreCount;
+}
+
 void RemoteWorker::flush() {
+	unsigned int now = m_timer->getMicroseconds();
+	if (!m_pingPending && (m_rtt == 0 || now - m_lastPing >= PING_INTERVAL * 1000)) {
+		/* Periodically measure the round-trip latency. Since the answer
+		   is queued behind any pending work results, this also accounts
+		   for the time needed to transfer them */
+		m_lastPing = now;
+		m_memStream->writeShort(StreamBackend::EPing);
+		m_memStream->writeInt((int) m_lastPing);
+		m_pingPending = true;
+	}
 	m_memStream->setPos(0);
 	m_memStream->copyTo(m_stream);
 	m_memStream->reset();
@@ -113,6 +207,7 @@ void RemoteWorker::run() {
 			   all information required to receive and execute work 
 			   units on the other side */
 			std::vector<std::pair<int, const MemoryStream *> > resources;
+			std::vector<std::string> resourceHashes;
 			std::vector<std::pair<int, const SerializableObject *> > manifoldResources;
 
 			/* First, look up all resources required by this process (the scheduler lock
@@ -126,6 +221,7 @@ void RemoteWorker::run() {
 					if (!m_scheduler->isManifoldResource(resID)) {
 						resources.push_back(std::pair<int, const MemoryStream *>(resID, 
 							m_scheduler->getResourceStream(resID)));
+						resourceHashes.push_back(m_scheduler->getResourceHash(resID));
 					} else {
 						for (size_t i=0; i<m_coreCount; ++i)
 							manifoldResources.push_back(std::pair<int, const SerializableObject *>(resID, 
@@ -157,15 +253,45 @@ void RemoteWorker::run() {
 			manager->serialize(m_memStream, m_schedItem.wp);
 			m_processes.insert(id);
 
+			if (resources.size() > 0) {
+				/* Only send the content hashes at first and wait for the
+				   node to report which resources it has in its cache */
+				m_memStream->writeShort(StreamBackend::EQueryResources);
+				m_memStream->writeInt((int) resources.size());
+				for (size_t i=0; i<resources.size(); ++i) {
+					m_memStream->writeInt(resources[i].first);
+					m_memStream->writeString(resourceHashes[i]);
+					m_memStream->writeSize(resources[i].second->getPos());
+				}
+				m_resourceStatusReady = false;
+				flush();
+				while (!m_resourceStatusReady)
+					m_resourceCond->wait();
+				if (m_resourceStatus.size() != resources.size()) {
+					m_mutex->unlock();
+					Log(EError, "Lost the connection to \"%s\" while querying "
+						"its resource cache!", m_nodeName.c_str());
+				}
+			}
+
 			for (size_t i=0; i<resources.size(); ++i) {
 				int resID = resources[i].first;
 				const MemoryStream *resStream = resources[i].second;
+				m_resourceBytesTotal += resStream->getPos();
+				if (m_resourceStatus[i]) {
+					Log(EDebug, "Resource %i is cached on \"%s\"", resID, m_nodeName.c_str());
+					m_resourceHits++;
+					continue;
+				}
 				Log(EDebug, "Sending resource %i to \"%s\" (%i KB)", resID, m_nodeName.c_str(),
 					resStream->getPos() / 1024);
 				m_memStream->writeShort(StreamBackend::ENewResource);
 				m_memStream->writeInt(resID);
-				m_memStream->writeUInt((unsigned int) resStream->getPos());
+				m_memStream->writeString(resourceHashes[i]);
+				m_memStream->writeSize(resStream->getPos());
 				m_memStream->write(resStream->getData(), resStream->getPos());
+				m_resourceBytesSent += resStream->getPos();
+				m_resourceMisses++;
 			}
 			
 			for (size_t i=0; i<manifoldResources.size(); i += m_coreCount) {
@@ -198,12 +324,12 @@ void RemoteWorker::run() {
 		m_memStream->writeInt(id);
 		m_schedItem.workUnit->save(m_memStream);
 
-		if (++m_inFlight == BACKLOG_FACTOR * m_coreCount) {
+		if (++m_inFlight >= m_backlog) {
 			flush();
 			/* There are now too many packets in transit. Wait
 			   until this clears up a bit before attempting to
 			   send more work */
-			while (m_inFlight > CONTINUE_FACTOR * m_coreCount) 
+			while (m_inFlight > m_continue) 
 				m_finishCond->wait();
 		}
 
@@ -266,6 +392,10 @@ RemoteWorkerReader::RemoteWorkerReader(RemoteWorker *worker)
  : Thread(formatString("%s_r", worker->getName().c_str())), 
  	m_parent(worker), m_shutdown(false), m_currentID(-1) {
 	m_stream = m_parent->m_stream;
+	m_compressed = new MemoryStream();
+	m_inflated = new MemoryStream();
+	m_inflated->setByteOrder(Stream::ENetworkByteOrder);
+	m_compressedBytes = m_uncompressedBytes = 0;
 	setCritical(true);
 }
 
@@ -276,6 +406,19 @@ void RemoteWorkerReader::run() {
 		try {
 			msg = m_stream->readShort();
 			id = m_stream->readInt();
+
+			if (msg == StreamBackend::EResourceStatus) {
+				/* Response to a resource cache query. Here, the 
+				   'id' field contains the number of resources */
+				std::vector<bool> status(id);
+				for (int i=0; i<id; ++i)
+					status[i] = m_stream->readBool();
+				m_parent->signalResourceStatus(status);
+				continue;
+			} else if (msg == StreamBackend::EPong) {
+				m_parent->signalPong((unsigned int) id);
+				continue;
+			}
 	
 			if (id != m_currentID) {
 				m_parent->setProcessByID(m_schedItem, id);
@@ -289,6 +432,28 @@ void RemoteWorkerReader::run() {
 					m_parent->releaseWork(m_schedItem);
 					m_parent->signalCompletion();
 					break;
+				case StreamBackend::ECompressedWorkResult: {
+						uint32_t uncompressedSize = m_stream->readUInt(),
+								 compressedSize = m_stream->readUInt();
+						m_compressed->reset();
+						m_compressed->setPos(compressedSize);
+						m_stream->read(m_compressed->getData(), compressedSize);
+						m_inflated->reset();
+						m_inflated->setPos(uncompressedSize);
+						uLongf size = uncompressedSize;
+						if (uncompress(m_inflated->getData(), &size, m_compressed->getData(), 
+								compressedSize) != Z_OK || size != uncompressedSize)
+							Log(EError, "Unable to decompress a work result received from \"%s\"!",
+								m_parent->getNodeName().c_str());
+						m_inflated->setPos(0);
+						m_schedItem.workResult->load(m_inflated);
+						m_compressedBytes += compressedSize;
+						m_uncompressedBytes += uncompressedSize;
+						m_schedItem.stop = false;
+						m_parent->releaseWork(m_schedItem);
+						m_parent->signalCompletion();
+					}
+					break;
 				case StreamBackend::ECancelledWorkResult:
 					m_schedItem.stop = true;
 					m_parent->releaseWork(m_schedItem);
@@ -310,8 +475,11 @@ void RemoteWorkerReader::run() {
 					Log(EError, "Received an unknown message (type %i)", id);
 			};
 		} catch (std::runtime_error &e) {
-			if (!m_shutdown)
+			if (!m_shutdown) {
+				/* Wake up the worker if it is waiting for a response */
+				m_parent->signalResourceStatus(std::vector<bool>());
 				throw e;
+			}
 			break;
 		}
 	}
@@ -326,8 +494,9 @@ void RemoteWorkerReader::run() {
 /* ==================================================================== */
 
 StreamBackend::StreamBackend(const std::string &thrName, Scheduler *scheduler,
-		const std::string &nodeName, Stream *stream, bool detach) : Thread(thrName), 
-		m_scheduler(scheduler), m_nodeName(nodeName), m_stream(stream), m_detach(detach) {
+		const std::string &nodeName, Stream *stream, bool detach, ResourceCache *cache) 
+		: Thread(thrName), m_scheduler(scheduler), m_nodeName(nodeName), 
+		m_stream(stream), m_cache(cache), m_compressionLevel(0), m_detach(detach) {
 	m_sendMutex = new Mutex();
 	m_memStream = new MemoryStream();
 	m_memStream->setByteOrder(Stream::ENetworkByteOrder);
@@ -340,6 +509,8 @@ StreamBackend::~StreamBackend() {
 			sstream->getPeer().c_str(), (int) (sstream->getReceivedBytes() / 1024),
 			(int) (sstream->getSentBytes() / 1024));
 	}
+	if (m_cache)
+		Log(EInfo, "Resource cache: %s", m_cache->toString().c_str());
 }
 
 void StreamBackend::run() {
@@ -400,16 +571,39 @@ void StreamBackend::run() {
 						m_processes[id] = rp;
 					}
 					break;
+				case EQueryResources: {
+						int count = m_stream->readInt();
+						std::vector<bool> status(count, false);
+						for (int i=0; i<count; ++i) {
+							int id = m_stream->readInt();
+							std::string hash = m_stream->readString();
+							size_t size = m_stream->readSize();
+							if (!m_cache)
+								continue;
+							ref<MemoryStream> mstream = m_cache->get(hash, size);
+							if (!mstream)
+								continue;
+							try {
+								registerResource(id, mstream);
+								status[i] = true;
+							} catch (const std::exception &e) {
+								Log(EWarn, "Unable to load the cached resource %s (\"%s\") -- "
+									"requesting it from the client", hash.c_str(), e.what());
+							}
+						}
+						sendResourceStatus(status);
+					}
+					break;
 				case ENewResource: {
 						int id = m_stream->readInt();
-						size_t size = m_stream->readUInt();
-						ref<InstanceManager> manager = new InstanceManager();
+						std::string hash = m_stream->readString();
+						size_t size = m_stream->readSize();
 						ref<MemoryStream> mstream = new MemoryStream(size);
 						mstream->setByteOrder(Stream::ENetworkByteOrder);
 						m_stream->copyTo(mstream, size);
-						mstream->setPos(0);
-						ref<SerializableObject> res = static_cast<SerializableObject *>(manager->getInstance(mstream));
-						m_resources[id] = m_scheduler->registerResource(res);
+						if (m_cache)
+							m_cache->put(hash, mstream->getData(), size);
+						registerResource(id, mstream);
 					}
 					break;
 				case ENewManifoldResource: {
@@ -473,6 +667,16 @@ void StreamBackend::run() {
 						m_resources.erase(id);
 					}
 					break;
+				case ESetCompression: {
+						m_compressionLevel = m_stream->readInt();
+						Log(EInfo, "Compressing work results (zlib level %i)", m_compressionLevel);
+					}
+					break;
+				case EPing: {
+						int token = m_stream->readInt();
+						sendPong(token);
+					}
+					break;
 				case EQuit: running = false; break;
 				default: Log(EError, "Received an unknown message type: %i", msg);
 			}
@@ -499,6 +703,13 @@ void StreamBackend::run() {
 	}
 }
 
+void StreamBackend::registerResource(int id, MemoryStream *mstream) {
+	ref<InstanceManager> manager = new InstanceManager();
+	mstream->setPos(0);
+	ref<SerializableObject> res = static_cast<SerializableObject *>(manager->getInstance(mstream));
+	m_resources[id] = m_scheduler->registerResource(res);
+}
+
 void StreamBackend::sendCancellation(int id, int numLost) {
 	Log(EInfo, "Notifying the remote side about the cancellation of process %i", id);
 
@@ -523,18 +734,87 @@ void StreamBackend::sendCancellation(int id, int numLost) {
 }
 
 void StreamBackend::sendWorkResult(int id, const WorkResult *result, bool cancelled) {
+	/* Serialize (and possibly compress) the result before acquiring the 
+	   send lock -- this allows several cores to do so in parallel */
+	ref<MemoryStream> mstream = new MemoryStream();
+	mstream->setByteOrder(Stream::ENetworkByteOrder);
+	if (cancelled) {
+		mstream->writeShort(ECancelledWorkResult);
+		mstream->writeInt(id);
+	} else if (m_compressionLevel == 0) {
+		mstream->writeShort(EWorkResult);
+		mstream->writeInt(id);
+		result->save(mstream);
+	} else {
+		ref<MemoryStream> raw = new MemoryStream();
+		raw->setByteOrder(Stream::ENetworkByteOrder);
+		result->save(raw);
+		const size_t rawSize = raw->getPos();
+		mstream->writeShort(ECompressedWorkResult);
+		mstream->writeInt(id);
+		mstream->writeUInt((uint32_t) rawSize);
+		const size_t sizePos = mstream->getPos(), 
+			  dataPos = sizePos + sizeof(uint32_t);
+		uLongf compressedSize = compressBound((uLong) rawSize);
+		mstream->setPos(dataPos + compressedSize);
+		int retval = compress2(mstream->getData() + dataPos, &compressedSize,
+			raw->getData(), (uLong) rawSize, m_compressionLevel);
+
+		if (retval == Z_OK && compressedSize < rawSize) {
+			mstream->setPos(sizePos);
+			mstream->writeUInt((uint32_t) compressedSize);
+			mstream->setPos(dataPos + compressedSize);
+		} else {
+			/* Incompressible -- send the raw data instead */
+			mstream->reset();
+			mstream->writeShort(EWorkResult);
+			mstream->writeInt(id);
+			mstream->write(raw->getData(), rawSize);
+		}
+	}
+
+	m_sendMutex->lock();
+	try {
+		m_stream->write(mstream->getData(), mstream->getPos());
+		m_stream->flush();
+	} catch (std::exception &) {
+		Log(EWarn, "Connection error - could not submit work result");
+		/* A connection failure occurred - this will eventually be
+		   caught and handled in run() and is therefore ignored for now */
+	}
+	m_sendMutex->unlock();
+}
+
+void StreamBackend::sendPong(int token) {
 	m_sendMutex->lock();
 	m_memStream->reset();
-	m_memStream->writeShort(cancelled ? ECancelledWorkResult : EWorkResult);
-	m_memStream->writeInt(id);
-	if (!cancelled)
-		result->save(m_memStream);
+	m_memStream->writeShort(EPong);
+	m_memStream->writeInt(token);
 	try {
 		m_memStream->setPos(0);
 		m_memStream->copyTo(m_stream);
 		m_stream->flush();
 	} catch (std::exception &) {
-		Log(EWarn, "Connection error - could not submit work result");
+		Log(EWarn, "Connection error - could not answer a latency measurement");
+		/* A connection failure occurred - this will eventually be
+		   caught and handled in run() and is therefore ignored for now */
+	}
+	m_sendMutex->unlock();
+}
+
+void StreamBackend::sendResourceStatus(const std::vector<bool> &status) {
+	m_sendMutex->lock();
+	m_memStream->reset();
+	m_memStream->writeShort(EResourceStatus);
+	m_memStream->writeInt((int) status.size());
+	for (size_t i=0; i<status.size(); ++i)
+		m_memStream->writeBool(status[i]);
+	try {
+		m_memStream->setPos(0);
+		m_memStream->copyTo(m_stream);
+		m_stream->flush();
+	} catch (std::exception &) {
+		Log(EWarn, "Connection error - could not submit the resource status");
 		/* A connection failure occurred - this will eventually be
 		   caught and handled in run() and is therefore ignored for now */
 	}
@@ -598,8 +878,235 @@ void RemoteProcess::handleCancellation() {
 	m_mutex->unlock();
 }
 
+/* ==================================================================== */
+/*                            Resource cache                            */
+/* ==================================================================== */
+
+ResourceCache::ResourceCache(const fs::path &directory, size_t maxSize) 
+	: m_directory(directory), m_maxSize(maxSize), m_size(0), 
+	  m_hits(0), m_misses(0), m_tempCounter(0) {
+	m_mutex = new Mutex();
+
+	if (!fs::exists(m_directory))
+		fs::create_directories(m_directory);
+	else if (!fs::is_directory(m_directory))
+		Log(EError, "The resource cache path \"%s\" is not a directory!",
+			m_directory.file_string().c_str());
+
+	/* Restore the LRU order of the existing entries from their 
+	   modification times, which are updated on every cache hit */
+	std::vector<std::pair<std::time_t, fs::path> > files;
+	fs::directory_iterator end, it(m_directory);
+	for (; it != end; ++it) {
+		if (!fs::is_regular_file(it->status()))
+			continue;
+		const fs::path &path = it->path();
+		std::string extension = path.extension();
+		if (extension == ".tmp") {
+			/* Left behind by an interrupted transfer */
+			fs::remove(path);
+		} else if (extension == ".res") {
+			files.push_back(std::make_pair(fs::last_write_time(path), path));
+		}
+	}
+	std::sort(files.begin(), files.end());
+
+	for (size_t i=0; i<files.size(); ++i) {
+		std::string hash = files[i].second.stem();
+		if (!isValidHash(hash))
+			continue;
+		size_t size = (size_t) fs::file_size(files[i].second);
+		m_lru.push_front(hash);
+		m_entries[hash] = std::make_pair(size, m_lru.begin());
+		m_size += size;
+	}
+	evict();
+
+	Log(EInfo, "Using the resource cache \"%s\" (%i entries, %s of %s used)", 
+		m_directory.file_string().c_str(), (int) m_entries.size(), 
+		memString(m_size).c_str(), memString(m_maxSize).c_str());
+}
+
+fs::path ResourceCache::getPath(const std::string &hash) const {
+	Assert(isValidHash(hash));
+	return m_directory / (hash + ".res");
+}
+
+bool ResourceCache::isValidHash(const std::string &hash) {
+	if (hash.length() != 32)
+		return false;
+	for (size_t i=0; i<hash.length(); ++i) {
+		char c = hash[i];
+		if (!((c >= '0' && c <= '9') || (c >= 'a' && c <= 'f')))
+			return false;
+	}
+	return true;
+}
+
+ref<MemoryStream> ResourceCache::get(const std::string &hash, size_t size) {
+	if (!isValidHash(hash)) {
+		Log(EWarn, "Ignoring a lookup with the malformed resource hash \"%s\"",
+			hash.substr(0, 64).c_str());
+		return NULL;
+	}
+
+	m_mutex->lock();
+	entry_map::iterator it = m_entries.find(hash);
+	if (it == m_entries.end() || (*it).second.first != size) {
+		m_misses++;
+		m_mutex->unlock();
+		return NULL;
+	}
+	/* Mark as most recently used */
+	m_lru.splice(m_lru.begin(), m_lru, (*it).second.second);
+	m_mutex->unlock();
+
+	/* Don't hold the lock while reading from disk. Evicted files
+	   remain readable as long as they are open (except on Windows,
+	   where the removal fails and is reported as a warning) */
+	fs::path path = getPath(hash);
+	ref<MemoryStream> mstream = new MemoryStream(size);
+	mstream->setByteOrder(Stream::ENetworkByteOrder);
+	try {
+		ref<FileStream> fstream = new FileStream(path, FileStream::EReadOnly);
+		fstream->copyTo(mstream, size);
+		fstream->close();
+		if (hashBuffer(mstream->getData(), size) != hash)
+			throw std::runtime_error("checksum mismatch");
+		fs::last_write_time(path, std::time(NULL));
+	} catch (const std::exception &ex) {
+		Log(EWarn, "Discarding the cache entry \"%s\": %s", 
+			path.file_string().c_str(), ex.what());
+		m_mutex->lock();
+		it = m_entries.find(hash);
+		if (it != m_entries.end()) {
+			m_size -= (*it).second.first;
+			m_lru.erase((*it).second.second);
+			m_entries.erase(it);
+			try {
+				if (fs::exists(path))
+					fs::remove(path);
+			} catch (const std::exception &) { }
+		}
+		m_misses++;
+		m_mutex->unlock();
+		return NULL;
+	}
+
+	m_mutex->lock();
+	m_hits++;
+	m_mutex->unlock();
+	return mstream;
+}
+
+void ResourceCache::put(const std::string &hash, const void *data, size_t size) {
+	if (size > m_maxSize)
+		return;
+
+	/* Don't trust the hash sent by the peer -- it determines the
+	   file name, and a wrong hash would poison the cache */
+	if (!isValidHash(hash)) {
+		Log(EWarn, "Not caching a resource with the malformed hash \"%s\"",
+			hash.substr(0, 64).c_str());
+		return;
+	} else if (hashBuffer(data, size) != hash) {
+		Log(EWarn, "Not caching the resource %s, since its contents "
+			"don't match the hash", hash.c_str());
+		return;
+	}
+
+	/* Write to a temporary file first so that a concurrent lookup
+	   never sees a partially written entry */
+	m_mutex->lock();
+	int counter = m_tempCounter++;
+	m_mutex->unlock();
+	fs::path path = getPath(hash), tempPath = path;
+#if defined(WIN32)
+	tempPath.replace_extension(formatString(".%i.%i.tmp", 
+		(int) GetCurrentProcessId(), counter));
+#else
+	tempPath.replace_extension(formatString(".%i.%i.tmp", 
+		(int) getpid(), counter));
+#endif
+
+	try {
+		ref<FileStream> fstream = new FileStream(tempPath, FileStream::ETruncWrite);
+		fstream->write(data, size);
+		fstream->close();
+	} catch (const std::exception &ex) {
+		Log(EWarn, "Unable to write the cache entry \"%s\": %s", 
+			tempPath.file_string().c_str(), ex.what());
+		try {
+			if (fs::exists(tempPath))
+				fs::remove(tempPath);
+		} catch (const std::exception &) { }
+		return;
+	}
+
+	m_mutex->lock();
+	entry_map::iterator it = m_entries.find(hash);
+	if (it != m_entries.end()) {
+		m_size -= (*it).second.first;
+		m_lru.erase((*it).second.second);
+		m_entries.erase(it);
+	}
+	try {
+		if (fs::exists(path))
+			fs::remove(path);
+		fs::rename(tempPath, path);
+	} catch (const std::exception &ex) {
+		m_mutex->unlock();
+		Log(EWarn, "Unable to create the cache entry \"%s\": %s", 
+			path.file_string().c_str(), ex.what());
+		try {
+			if (fs::exists(tempPath))
+				fs::remove(tempPath);
+		} catch (const std::exception &) { }
+		return;
+	}
+	m_lru.push_front(hash);
+	m_entries[hash] = std::make_pair(size, m_lru.begin());
+	m_size += size;
+	evict();
+	m_mutex->unlock();
+}
+
+void ResourceCache::evict() {
+	while (m_size > m_maxSize && !m_lru.empty()) {
+		std::string hash = m_lru.back();
+		entry_map::iterator it = m_entries.find(hash);
+		m_size -= (*it).second.first;
+		m_entries.erase(it);
+		m_lru.pop_back();
+
+		fs::path path = getPath(hash);
+		try {
+			fs::remove(path);
+		} catch (const std::exception &ex) {
+			Log(EWarn, "Unable to remove the cache entry \"%s\": %s", 
+				path.file_string().c_str(), ex.what());
+		}
+	}
+}
+
+std::string ResourceCache::toString() const {
+	std::ostringstream oss;
+	m_mutex->lock();
+	oss << "ResourceCache[" << endl
+		<< "  directory = \"" << m_directory.file_string() << "\"," << endl
+		<< "  entries = " << m_entries.size() << "," << endl
+		<< "  size = " << memString(m_size) << "," << endl
+		<< "  maxSize = " << memString(m_maxSize) << "," << endl
+		<< "  hits = " << m_hits << "," << endl
+		<< "  misses = " << m_misses << endl
+		<< "]";
+	m_mutex->unlock();
+	return oss.str();
+}
+
 MTS_IMPLEMENT_CLASS(RemoteWorker, false, Worker)
 MTS_IMPLEMENT_CLASS(RemoteWorkerReader, false, Thread)
 MTS_IMPLEMENT_CLASS(StreamBackend, false, Thread)
 MTS_IMPLEMENT_CLASS(RemoteProcess, false, ParallelProcess)
+MTS_IMPLEMENT_CLASS(ResourceCache, false, Object)
 MTS_NAMESPACE_END
@@ -183,6 +183,60 @@ std::string memString(size_t size) {
 			"%.0f %s" : "%.2f %s", value, prefixes[prefix]);
 }
 
+static inline uint64_t rotl64(uint64_t value, int shift) {
+	return (value << shift) | (value >> (64 - shift));
+}
+
+static inline uint64_t fmix64(uint64_t k) {
+	k ^= k >> 33;
+	k *= 0xff51afd7ed558ccdULL;
+	k ^= k >> 33;
+	k *= 0xc4ceb9fe1a85ec53ULL;
+	k ^= k >> 33;
+	return k;
+}
+
+std::string hashBuffer(const void *_data, size_t size) {
+	const uint8_t *data = static_cast<const uint8_t *>(_data);
+	const uint64_t c1 = 0x87c37b91114253d5ULL, c2 = 0x4cf5ad432745937fULL;
+	const size_t nBlocks = size / 16;
+	uint64_t h1 = 0, h2 = 0, k1, k2;
+
+	/* Process 16-byte blocks */
+	for (size_t i=0; i<nBlocks; ++i) {
+		memcpy(&k1, data + i*16, sizeof(uint64_t));
+		memcpy(&k2, data + i*16 + 8, sizeof(uint64_t));
+
+		k1 *= c1; k1 = rotl64(k1, 31); k1 *= c2; h1 ^= k1;
+		h1 = rotl64(h1, 27); h1 += h2; h1 = h1*5 + 0x52dce729;
+		k2 *= c2; k2 = rotl64(k2, 33); k2 *= c1; h2 ^= k2;
+		h2 = rotl64(h2, 31); h2 += h1; h2 = h2*5 + 0x38495ab5;
+	}
+
+	/* Process the remaining bytes */
+	const uint8_t *tail = data + nBlocks*16;
+	k1 = k2 = 0;
+	for (int i=(int) (size & 15) - 1; i >= 8; --i)
+		k2 ^= ((uint64_t) tail[i]) << ((i-8) * 8);
+	if ((size & 15) > 8) {
+		k2 *= c2; k2 = rotl64(k2, 33); k2 *= c1; h2 ^= k2;
+	}
+	for (int i=std::min((int) (size & 15), 8) - 1; i >= 0; --i)
+		k1 ^= ((uint64_t) tail[i]) << (i * 8);
+	if ((size & 15) > 0) {
+		k1 *= c1; k1 = rotl64(k1, 31); k1 *= c2; h1 ^= k1;
+	}
+
+	/* Finalization */
+	h1 ^= (uint64_t) size; h2 ^= (uint64_t) size;
+	h1 += h2; h2 += h1;
+	h1 = fmix64(h1); h2 = fmix64(h2);
+	h1 += h2; h2 += h1;
+
+	return formatString("%016llx%016llx", 
+		(unsigned long long) h1, (unsigned long long) h2);
+}
+
 void * __restrict allocAligned(size_t size) {
 #if defined(WIN32)
 	return _aligned_malloc(size, L1_CACHE_LINE_SIZE);
@@ -86,6 +86,10 @@ void Film::addChild(const std::string &name, ConfigurableObject *child) {
 	}
 }
 
+void Film::setDestinationFile(const fs::path &fileName, int blockSize) {
+	/* Do nothing by default */
+}
+
 void Film::configure() {
 	if (m_filter == NULL) {
 		/* No reconstruction filter has been selected. Load a gaussian filter by default */
@@ -60,6 +60,10 @@ public:
 		return m_photons[index];
 	}
 
+	inline const Photon *getData() const {
+		return m_photons.empty() ? NULL : &m_photons[0];
+	}
+
 	void load(Stream *stream) {
 		clear();
 		size_t count = (size_t) stream->readUInt();
@@ -189,26 +193,26 @@ void GatherPhotonProcess::processResult(const WorkResult *wr, bool cancelled) {
 	if (cancelled)
 		return;
 	const PhotonVector &vec = *static_cast<const PhotonVector *>(wr);
-	m_resultMutex->lock();
 
-	size_t nParticles = 0;
-	for (size_t i=0; i<vec.getParticleCount(); ++i) {
-		size_t start = vec.getParticleIndex(i),
-			   end   = vec.getParticleIndex(i+1);
-		++nParticles;
-		bool full = false;
-		for (size_t j=start; j<end; ++j) {
-			if (!m_photonMap->storePhoton(vec[j])) {
-				m_excess += vec.getPhotonCount() - j;
-				full = true;
-				break;
-			}
-		}
-		if (full)
-			break;
+	/* Copy the photons of this work result into the photon map. This
+	   does not require the result lock, hence the results of multiple
+	   workers can be merged concurrently. */
+	size_t photonCount = vec.getPhotonCount(),
+		   stored = m_photonMap->storePhotons(vec.getData(), photonCount);
+
+	/* When the photon map filled up, only count the particles up to
+	   (and including) the one whose photons did not fit anymore */
+	size_t nParticles = vec.getParticleCount();
+	if (stored < photonCount) {
+		nParticles = 0;
+		while (vec.getParticleIndex(nParticles) <= stored)
+			++nParticles;
 	}
+
+	m_resultMutex->lock();
+	m_excess += photonCount - stored;
 	m_numShot += nParticles;
-	increaseResultCount(vec.getPhotonCount());
+	increaseResultCount(photonCount);
 	m_resultMutex->unlock();
 }
 
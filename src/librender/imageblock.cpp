@@ -29,7 +29,8 @@ ImageBlock::ImageBlock(const Vector2i &maxBlockSize, int borderSize,
 	bool supportStatistics) : border(borderSize), 
 	  maxBlockSize(maxBlockSize), alpha(NULL), weights(NULL), 
 	  variances(NULL), nSamples(NULL), pixelSnapshot(NULL), 
-	  weightSnapshot(NULL), alphaSnapshot(NULL), extra(0) {
+	  weightSnapshot(NULL), alphaSnapshot(NULL), extra(0),
+	  varianceEstimate(0) {
 
 	int maxArraySize = (maxBlockSize.x + 2*border)
 		*(maxBlockSize.y + 2*border);
@@ -84,6 +85,7 @@ void ImageBlock::clear() {
 		memset(nSamples, 0, sizeof(int) * numEntries);
 	}
 	extra = 0;
+	varianceEstimate = 0;
 }
 
 void ImageBlock::load(Stream *stream) {
@@ -103,6 +105,7 @@ void ImageBlock::load(Stream *stream) {
 		stream->readUIntArray(nSamples, nEntries);
 	}
 	extra = stream->readInt();
+	varianceEstimate = stream->readFloat();
 }
 
 void ImageBlock::save(Stream *stream) const {
@@ -120,6 +123,7 @@ void ImageBlock::save(Stream *stream) const {
 		stream->writeUIntArray(nSamples, nEntries);
 	}
 	stream->writeInt(extra);
+	stream->writeFloat(varianceEstimate);
 }
 
 void ImageBlock::add(const ImageBlock *block) {
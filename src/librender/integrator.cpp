@@ -41,13 +41,38 @@ void Integrator::serialize(Stream *stream, InstanceManager *manager) const {
 const Integrator *Integrator::getSubIntegrator() const { return NULL; }
 
 SampleIntegrator::SampleIntegrator(const Properties &props)
- : Integrator(props) { }
+ : Integrator(props) { 
+	/* When set to true, the image is rendered in several passes. After 
+	   a uniform base pass, the remaining samples are distributed over 
+	   the image blocks so that their relative variance is equalized. */
+	m_adaptive = props.getBoolean("adaptive", false);
+
+	/* Average number of samples per pixel in adaptive mode, specified
+	   as a fraction of the sampler's sample count (which is used as 
+	   the per-pixel maximum) */
+	m_adaptiveBudget = props.getFloat("adaptiveBudget", 0.25f);
+
+	/* Number of adaptive passes following the base pass */
+	m_adaptivePasses = props.getInteger("adaptivePasses", 3);
+
+	if (m_adaptiveBudget <= 0 || m_adaptiveBudget > 1)
+		Log(EError, "The 'adaptiveBudget' parameter must be in (0, 1]!");
+	if (m_adaptivePasses < 1)
+		Log(EError, "The 'adaptivePasses' parameter must be positive!");
+}
 
 SampleIntegrator::SampleIntegrator(Stream *stream, InstanceManager *manager)
- : Integrator(stream, manager) { }
+ : Integrator(stream, manager) { 
+	m_adaptive = stream->readBool();
+	m_adaptiveBudget = stream->readFloat();
+	m_adaptivePasses = stream->readInt();
+}
 
 void SampleIntegrator::serialize(Stream *stream, InstanceManager *manager) const {
 	Integrator::serialize(stream, manager);
+	stream->writeBool(m_adaptive);
+	stream->writeFloat(m_adaptiveBudget);
+	stream->writeInt(m_adaptivePasses);
 }
 
 Spectrum SampleIntegrator::E(const Scene *scene, const Point &p, const Normal &n, Float time,
@@ -101,8 +126,20 @@ bool SampleIntegrator::render(Scene *scene,
 		nCores == 1 ? "core" : "cores");
 
 	/* This is a sampling-based integrator - parallelize */
-	ref<ParallelProcess> proc = new BlockedRenderProcess(job, 
+	ref<BlockedRenderProcess> proc = new BlockedRenderProcess(job, 
 		queue, scene->getBlockSize());
+	if (m_adaptive && sampleCount > 1) {
+		proc->setAdaptiveSampling(sampleCount, m_adaptiveBudget, m_adaptivePasses);
+	} else {
+		if (m_adaptive)
+			Log(EWarn, "Adaptive sampling requires more than one sample per pixel -- disabling it");
+		/* Each image block is submitted exactly once, which allows 
+		   the film to stream out finished regions */
+		film->setDestinationFile(scene->getDestinationFile(), scene->getBlockSize());
+	}
+	if (!scene->getCheckpointFile().empty())
+		proc->setCheckpoint(scene->getCheckpointFile(), 
+			scene->getResumeCheckpoint(), sampleCount);
 	int integratorResID = sched->registerResource(this);
 	proc->bindResource("integrator", integratorResID);
 	proc->bindResource("scene", sceneResID);
@@ -131,140 +168,113 @@ void SampleIntegrator::wakeup(std::map<std::string, SerializableObject *> &) {
 void SampleIntegrator::renderBlock(const Scene *scene,
 	const Camera *camera, Sampler *sampler, ImageBlock *block, 
 	const bool &stop, const std::vector<Point2i> *points) const {
-	Point2 sample, lensSample;
-	RayDifferential eyeRay;
-	Float timeSample = 0;
-	Spectrum spec;
+	renderSampleRange(scene, camera, sampler, block, stop, points, 
+		0, sampler->getSampleCount());
+}
 
+void SampleIntegrator::renderSampleRange(const Scene *scene,
+	const Camera *camera, Sampler *sampler, ImageBlock *block, 
+	const bool &stop, const std::vector<Point2i> *points,
+	size_t firstSample, size_t sampleCount) const {
+	/* Camera rays of the same pixel are generated and intersected in 
+	   batches so that the kd-tree can trace them as coherent packets */
+	const size_t batchSize = 2 * MTS_KD_PACKET_SIZE;
+	Point2 samples[batchSize], lensSample;
+	RayDifferential eyeRays[batchSize];
+	Ray rays[batchSize];
+	Intersection its[batchSize];
+	Float timeSample = 0;
+	Spectrum spec, mean, meanSqr;
+	Float lumMean, lumMeanSqr, varianceSum = 0;
+	size_t varianceCount = 0;
 
 	block->clear();
 	RadianceQueryRecord rRec(scene, sampler);
 	bool needsLensSample = camera->needsLensSample();
 	bool needsTimeSample = camera->needsTimeSample();
+	bool collectStatistics = block->collectStatistics();
 	const TabulatedFilter *filter = camera->getFilm()->getTabulatedFilter();
+	const size_t endSample = firstSample + sampleCount;
 	Float scaleFactor = 1.0f/std::sqrt((Float) sampler->getSampleCount());
 
-	if (points) {
-		/* Use a prescribed traversal order (e.g. using a space-filling curve) */
-		if (!block->collectStatistics()) {
-			for (size_t i=0; i<points->size(); ++i) {
-				Point2i offset = (*points)[i] + Vector2i(block->getOffset());
-				if (stop) 
-					break;
-				sampler->generate();
-				for (size_t j = 0; j<sampler->getSampleCount(); j++) {
-					rRec.newQuery(RadianceQueryRecord::ECameraRay, camera->getMedium());
-					if (needsLensSample)
-						lensSample = rRec.nextSample2D();
-					if (needsTimeSample)
-						timeSample = rRec.nextSample1D();
-					sample = rRec.nextSample2D();
-					sample.x += offset.x; sample.y += offset.y;
-					camera->generateRayDifferential(sample, 
-						lensSample, timeSample, eyeRay);
-					eyeRay.scaleDifferential(scaleFactor);
-					spec = Li(eyeRay, rRec);
-					block->putSample(sample, spec, rRec.alpha, filter);
-					sampler->advance();
-				}
+	/* Use a prescribed traversal order (e.g. using a space-filling 
+	   curve) if available, otherwise a simple scanline order */
+	const Vector2i size = block->getSize();
+	const size_t pixelCount = points ? points->size() : (size_t) (size.x * size.y);
+
+	for (size_t i=0; i<pixelCount; ++i) {
+		Point2i offset = Point2i(block->getOffset()) + (points ? Vector2i((*points)[i])
+			: Vector2i((int) (i % size.x), (int) (i / size.x)));
+		if (stop) 
+			break;
+		sampler->generate();
+		if (collectStatistics)
+			mean = meanSqr = Spectrum(0.0f);
+		lumMean = lumMeanSqr = 0;
+
+		for (size_t j = firstSample; j<endSample; j += batchSize) {
+			const size_t count = std::min(batchSize, endSample - j);
+
+			/* Generate and intersect a batch of camera rays */
+			for (size_t k = 0; k<count; ++k) {
+				sampler->setSampleIndex(j+k);
+				if (needsLensSample)
+					lensSample = rRec.nextSample2D();
+				if (needsTimeSample)
+					timeSample = rRec.nextSample1D();
+				samples[k] = rRec.nextSample2D();
+				samples[k].x += offset.x; samples[k].y += offset.y;
+				camera->generateRayDifferential(samples[k], 
+					lensSample, timeSample, eyeRays[k]);
+				eyeRays[k].scaleDifferential(scaleFactor);
+				rays[k] = eyeRays[k];
 			}
-		} else {
-			Spectrum mean, meanSqr;
-			for (size_t i=0; i<points->size(); ++i) {
-				Point2i offset = (*points)[i] + Vector2i(block->getOffset());
-				if (stop) 
-					break;
-				sampler->generate();
-				mean = meanSqr = Spectrum(0.0f);
-				for (size_t j = 0; j<sampler->getSampleCount(); j++) {
-					rRec.newQuery(RadianceQueryRecord::ECameraRay, camera->getMedium());
-					if (needsLensSample)
-						lensSample = rRec.nextSample2D();
-					if (needsTimeSample)
-						timeSample = rRec.nextSample1D();
-					sample = rRec.nextSample2D();
-					sample.x += offset.x; sample.y += offset.y;
-					camera->generateRayDifferential(sample, 
-						lensSample, timeSample, eyeRay);
-					eyeRay.scaleDifferential(scaleFactor);
-					spec = Li(eyeRay, rRec);
-
-					/* Numerically robust online variance estimation using an
-						algorithm proposed by Donald Knuth (TAOCP vol.2, 3rd ed., p.232) */
+			scene->rayIntersect(rays, its, count);
+
+			for (size_t k = 0; k<count; ++k) {
+				const size_t sampleIndex = j+k - firstSample;
+
+				/* Rewind the sampler and skip the camera dimensions */
+				sampler->setSampleIndex(j+k);
+				if (needsLensSample)
+					rRec.nextSample2D();
+				if (needsTimeSample)
+					rRec.nextSample1D();
+				rRec.nextSample2D();
+
+				rRec.newQuery(RadianceQueryRecord::ECameraRay, camera->getMedium());
+				rRec.rayIntersect(eyeRays[k], its[k]);
+				spec = Li(eyeRays[k], rRec);
+				block->putSample(samples[k], spec, rRec.alpha, filter);
+
+				/* Numerically robust online variance estimation using an
+				   algorithm proposed by Donald Knuth (TAOCP vol.2, 3rd ed., p.232) */
+				const Float lum = spec.getLuminance(),
+				            lumDelta = lum - lumMean;
+				lumMean += lumDelta / ((Float) sampleIndex+1);
+				lumMeanSqr += lumDelta * (lum - lumMean);
+
+				if (collectStatistics) {
 					const Spectrum delta = spec - mean;
-					mean += delta / ((Float) j+1);
+					mean += delta / ((Float) sampleIndex+1);
 					meanSqr += delta * (spec - mean);
-					block->putSample(sample, spec, rRec.alpha, filter);
 					block->setVariance(offset.x, offset.y,
-						meanSqr / (Float) j, (int) j+1);
-					sampler->advance();
+						meanSqr / (Float) sampleIndex, (int) sampleIndex+1);
 				}
 			}
 		}
-	} else {
-		/* Simple scanline traversal order */
-		const int
-			sx = block->getOffset().x,
-			sy = block->getOffset().y,
-			ex = sx + block->getSize().x,
-			ey = sy + block->getSize().y;
-		if (!block->collectStatistics()) {
-			for (int y = sy; y < ey; y++) {
-				for (int x = sx; x < ex; x++) {
-					if (stop) 
-						break;
-					sampler->generate();
-					for (size_t j = 0; j<sampler->getSampleCount(); j++) {
-						rRec.newQuery(RadianceQueryRecord::ECameraRay, camera->getMedium());
-						if (needsLensSample)
-							lensSample = rRec.nextSample2D();
-						if (needsTimeSample)
-							timeSample = rRec.nextSample1D();
-						sample = rRec.nextSample2D();
-						sample.x += x; sample.y += y;
-						camera->generateRayDifferential(sample, 
-							lensSample, timeSample, eyeRay);
-						eyeRay.scaleDifferential(scaleFactor);
-						spec = Li(eyeRay, rRec);
-						block->putSample(sample, spec, rRec.alpha, filter);
-						sampler->advance();
-					}
-				}
-			}
-		} else {
-			Spectrum mean, meanSqr;
-			for (int y = sy; y < ey; y++) {
-				for (int x = sx; x < ex; x++) {
-					if (stop) 
-						break;
-					sampler->generate();
-					mean = meanSqr = Spectrum(0.0f);
-					for (size_t j = 0; j<sampler->getSampleCount(); j++) {
-						rRec.newQuery(RadianceQueryRecord::ECameraRay, camera->getMedium());
-						if (needsLensSample)
-							lensSample = rRec.nextSample2D();
-						if (needsTimeSample)
-							timeSample = rRec.nextSample1D();
-						sample = rRec.nextSample2D();
-						sample.x += x; sample.y += y;
-						camera->generateRayDifferential(sample, 
-							lensSample, timeSample, eyeRay);
-						eyeRay.scaleDifferential(scaleFactor);
-						spec = Li(eyeRay, rRec);
-
-						/* Numerically robust online variance estimation using an
-						   algorithm proposed by Donald Knuth (TAOCP vol.2, 3rd ed., p.232) */
-						const Spectrum delta = spec - mean;
-						mean += delta / ((Float) j+1);
-						meanSqr += delta * (spec - mean);
-						block->putSample(sample, spec, rRec.alpha, filter);
-						block->setVariance(x, y, meanSqr / (Float) j, (int) j+1);
-						sampler->advance();
-					}
-				}
-			}
+
+		if (sampleCount > 1) {
+			/* Relative variance of a single sample. The constant in the 
+			   denominator prevents black pixels from dominating */
+			varianceSum += lumMeanSqr / (Float) (sampleCount - 1)
+				/ (lumMean * lumMean + (Float) 1e-3);
+			varianceCount++;
 		}
 	}
+
+	if (varianceCount > 0)
+		block->setVarianceEstimate(varianceSum / (Float) varianceCount);
 }
 
 MonteCarloIntegrator::MonteCarloIntegrator(const Properties &props) : SampleIntegrator(props) {
@@ -18,6 +18,11 @@
 
 #include <mitsuba/render/irrcache.h>
 #include <mitsuba/core/statistics.h>
+#include <mitsuba/core/fstream.h>
+
+/// Irradiance cache file identifier and format version
+#define MTS_IRRCACHE_MAGIC   0x4352494D /* "MIRC" */
+#define MTS_IRRCACHE_VERSION 1
 
 MTS_NAMESPACE_BEGIN
 
@@ -178,6 +183,21 @@ struct clamp_neighbors_functor {
 	Float R0;
 };
 
+/* Searches for an exact copy of a record */
+struct find_record_functor {
+	find_record_functor(const IrradianceCache::Record *record) 
+		: record(record), found(false) {
+	}
+
+	void operator()(const IrradianceCache::Record *sample) {
+		if (sample->p == record->p && sample->n == record->n)
+			found = true;
+	}
+
+	const IrradianceCache::Record *record;
+	bool found;
+};
+
 /* Irradiance interpolation functor */
 struct irr_interp_functor {
 	irr_interp_functor(const Intersection &its, Float kappa, bool gradients) : its(its), 
@@ -219,7 +239,6 @@ IrradianceCache::IrradianceCache(const AABB &aabb)
  : m_octree(aabb) {
 	/* Use the longest AABB axis as an estimate of the scene dimensions */
 	m_sceneSize = (aabb.max-aabb.min)[aabb.getLargestAxis()];
-	m_mutex = new Mutex();
 
 	/* Reasonable default settings */
 	setQuality(1.0f);
@@ -231,7 +250,6 @@ IrradianceCache::IrradianceCache(const AABB &aabb)
 
 IrradianceCache::IrradianceCache(Stream *stream, InstanceManager *manager) : 
 	m_octree(AABB(stream)) {
-	m_mutex = new Mutex();
 	m_kappa = stream->readFloat();
 	m_sceneSize = stream->readFloat();
 	m_minDist = stream->readFloat();
@@ -240,21 +258,16 @@ IrradianceCache::IrradianceCache(Stream *stream, InstanceManager *manager) :
 	m_clampNeighbor = stream->readBool();
 	m_useGradients = stream->readBool();
 	size_t recordCount = stream->readSize();
-	m_records.reserve(recordCount);
-	for (size_t i=0; i<recordCount; ++i) {
-		Record *sample = new Record(stream);
-		Float validRadius = sample->R0 / (2*m_kappa);
-		m_octree.insert(sample, AABB(
-			sample->p-Vector(1,1,1)*validRadius,
-			sample->p+Vector(1,1,1)*validRadius
-		));
-		m_records.push_back(sample);
-	}
+	for (size_t i=0; i<recordCount; ++i)
+		insert(new Record(stream));
 }
 
 IrradianceCache::~IrradianceCache() {
-	for (size_t i=0; i<m_records.size(); ++i)
-		delete m_records[i];
+	const LockFreeList<Record *>::ListItem *item = m_records.head();
+	while (item) {
+		delete item->value;
+		item = item->next;
+	}
 }
 
 void IrradianceCache::serialize(Stream *stream, InstanceManager *manager) const {
@@ -266,9 +279,74 @@ void IrradianceCache::serialize(Stream *stream, InstanceManager *manager) const
 	stream->writeBool(m_clampScreen);
 	stream->writeBool(m_clampNeighbor);
 	stream->writeBool(m_useGradients);
-	stream->writeSize(m_records.size());
-	for (uint32_t i=0; i<m_records.size(); ++i)
-		m_records[i]->serialize(stream);
+
+	/* Write the records in the order of insertion */
+	std::vector<const Record *> records;
+	const LockFreeList<Record *>::ListItem *item = m_records.head();
+	while (item) {
+		records.push_back(item->value);
+		item = item->next;
+	}
+	stream->writeSize(records.size());
+	for (size_t i=records.size(); i>0; --i)
+		records[i-1]->serialize(stream);
+}
+
+size_t IrradianceCache::getRecordCount() const {
+	size_t count = 0;
+	const LockFreeList<Record *>::ListItem *item = m_records.head();
+	while (item) {
+		++count;
+		item = item->next;
+	}
+	return count;
+}
+
+size_t IrradianceCache::merge(const IrradianceCache *cache) {
+	/* The other cache may still be receiving records -- take
+	   a snapshot of its current list */
+	std::vector<const Record *> records;
+	const LockFreeList<Record *>::ListItem *item = cache->m_records.head();
+	while (item) {
+		records.push_back(item->value);
+		item = item->next;
+	}
+
+	size_t added = 0;
+	for (size_t i=records.size(); i>0; --i) {
+		const Record *record = records[i-1];
+		find_record_functor functor(record);
+		m_octree.lookup(record->p, functor);
+		if (functor.found)
+			continue;
+		insert(new Record(record));
+		++added;
+	}
+	return added;
+}
+
+void IrradianceCache::save(const fs::path &path) const {
+	ref<FileStream> stream = new FileStream(path, FileStream::ETruncWrite);
+	stream->setByteOrder(Stream::ELittleEndian);
+	stream->writeUInt(MTS_IRRCACHE_MAGIC);
+	stream->writeShort(MTS_IRRCACHE_VERSION);
+	serialize(stream, NULL);
+	stream->close();
+}
+
+ref<IrradianceCache> IrradianceCache::load(const fs::path &path) {
+	ref<FileStream> stream = new FileStream(path, FileStream::EReadOnly);
+	stream->setByteOrder(Stream::ELittleEndian);
+	if (stream->readUInt() != MTS_IRRCACHE_MAGIC)
+		Log(EError, "\"%s\" is not an irradiance cache file!", 
+			path.file_string().c_str());
+	short version = stream->readShort();
+	if (version != MTS_IRRCACHE_VERSION)
+		Log(EError, "\"%s\": unsupported irradiance cache file version %i!", 
+			path.file_string().c_str(), (int) version);
+	ref<IrradianceCache> cache = new IrradianceCache(stream, NULL);
+	stream->close();
+	return cache;
 }
 
 IrradianceCache::Record *IrradianceCache::put(const RayDifferential &ray, const Intersection &its, 
@@ -354,9 +432,7 @@ void IrradianceCache::insert(Record *record) {
 		record->p-Vector(1,1,1)*validRadius,
 		record->p+Vector(1,1,1)*validRadius
 	));
-	m_mutex->lock();
-	m_records.push_back(record);
-	m_mutex->unlock();
+	m_records.push(record);
 }
 
 static StatsCounter irradHits("Irradiance cache", "Hits");
@@ -387,7 +463,7 @@ void IrradianceCache::clampInfluence(Float min, Float max) {
 std::string IrradianceCache::toString() const {
 	std::ostringstream oss;
 	oss << "IrradianceCache[" << endl
-		<< "  records = " << m_records.size() << "," << endl
+		<< "  records = " << getRecordCount() << "," << endl
 		<< "  quality = " << m_kappa << "," << endl
 		<< "  sceneSize = " << m_sceneSize << "," << endl
 		<< "  minDist = " << m_minDist << "," << endl
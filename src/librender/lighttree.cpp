@@ -0,0 +1,379 @@
+/*
+    This file is part of Mitsuba, a physically based rendering system.
+
+    Copyright (c) 2007-2011 by Wenzel Jakob and others.
+
+    Mitsuba is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Mitsuba is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <mitsuba/render/lighttree.h>
+#include <mitsuba/core/timer.h>
+
+/// Number of bins per axis used by the construction heuristic
+#define MTS_LIGHTTREE_BINS 12
+
+MTS_NAMESPACE_BEGIN
+
+#if defined(SINGLE_PRECISION)
+static const Float OneMinusEpsilon = 0.99999994f;
+#else
+static const Float OneMinusEpsilon = 0.99999999999999989;
+#endif
+
+/// cos(max(0, a-b)), given the sines and cosines of a and b
+static inline Float cosSubClamped(Float sinA, Float cosA, Float sinB, Float cosB) {
+	if (cosA > cosB)
+		return 1.0f;
+	return cosA * cosB + sinA * sinB;
+}
+
+/// sin(max(0, a-b)), given the sines and cosines of a and b
+static inline Float sinSubClamped(Float sinA, Float cosA, Float sinB, Float cosB) {
+	if (cosA > cosB)
+		return 0.0f;
+	return sinA * cosB - cosA * sinB;
+}
+
+/// Partitions items by their centroid bin along an axis
+struct LightTreeBinPredicate {
+	int axis, split;
+	Float min, scale;
+
+	inline LightTreeBinPredicate(int axis, int split, Float min, Float scale)
+		: axis(axis), split(split), min(min), scale(scale) { }
+
+	template <typename T> inline bool operator()(const T &item) const {
+		int bin = std::min((int) ((item.aabb.getCenter()[axis] - min) * scale),
+			MTS_LIGHTTREE_BINS - 1);
+		return bin < split;
+	}
+};
+
+LightTree::LightTree(const std::vector<Luminaire *> &luminaires, bool importanceSample)
+		: m_maxDepth(0) {
+	ref<Timer> timer = new Timer();
+	std::vector<Item> items;
+	Float localWeight = 0;
+
+	for (size_t i=0; i<luminaires.size(); ++i) {
+		const Luminaire *luminaire = luminaires[i];
+		Float weight = importanceSample ? luminaire->getSamplingWeight() : 1.0f;
+		Item item;
+
+		if (!luminaire->getEmissionBounds(item.aabb, item.axis, item.thetaO, item.thetaE)) {
+			m_index[luminaire] = (uint32_t) m_infinite.size();
+			m_infinite.push_back(luminaire);
+			m_topPDF.put(weight);
+			continue;
+		}
+
+		item.power = importanceSample ?
+			(weight * luminaire->getPower().getLuminance()) : 1.0f;
+		item.index = (uint32_t) m_local.size();
+		items.push_back(item);
+		m_local.push_back(luminaire);
+		localWeight += weight;
+	}
+
+	for (size_t i=0; i<m_local.size(); ++i)
+		m_index[m_local[i]] = (uint32_t) (m_infinite.size() + i);
+
+	if (!m_local.empty()) {
+		/* The hierarchy as a whole is chosen just as often as
+		   its luminaires would be chosen without it */
+		m_topPDF.put(localWeight);
+		m_leaves.resize(m_local.size());
+		m_nodes.reserve(2 * m_local.size() - 1);
+		m_nodes.push_back(Node());
+		m_nodes[0].parent = 0;
+		build(items, 0, 0, items.size(), 1);
+	}
+	m_topPDF.build();
+
+	Log(EDebug, "Built a luminaire hierarchy over " SIZE_T_FMT " luminaires ("
+		SIZE_T_FMT " nodes, depth %i, " SIZE_T_FMT " infinite luminaires) in %i ms",
+		m_local.size(), m_nodes.size(), m_maxDepth, m_infinite.size(),
+		timer->getMilliseconds());
+}
+
+void LightTree::Item::expandBy(const Item &item) {
+	if (item.isEmpty())
+		return;
+	if (isEmpty()) {
+		*this = item;
+		return;
+	}
+	aabb.expandBy(item.aabb);
+	mergeCone(axis, thetaO, item.axis, item.thetaO);
+	thetaE = std::max(thetaE, item.thetaE);
+	power += item.power;
+}
+
+void LightTree::mergeCone(Vector &axis, Float &thetaO,
+		const Vector &axis2, Float thetaO2) {
+	Vector a = axis, b = axis2;
+	Float oa = thetaO, ob = thetaO2;
+	if (ob > oa) {
+		std::swap(a, b);
+		std::swap(oa, ob);
+	}
+
+	/* Does the wider cone already contain the other one? */
+	Float thetaD = unitAngle(a, b);
+	if (std::min(thetaD + ob, (Float) M_PI) <= oa) {
+		axis = a; thetaO = oa;
+		return;
+	}
+
+	Float o = (oa + thetaD + ob) * 0.5f;
+	Vector perp = b - a * dot(a, b);
+	Float length = perp.length();
+	if (o >= M_PI || length < 1e-6f) {
+		/* Bound all directions */
+		axis = a; thetaO = M_PI;
+		return;
+	}
+
+	/* Rotate the axis of the wider cone towards the other one */
+	Float rot = o - oa;
+	axis = normalize(a * std::cos(rot) + perp * (std::sin(rot) / length));
+	thetaO = o;
+}
+
+void LightTree::setBounds(Node &node, const Item &bounds) {
+	node.aabb = bounds.aabb;
+	node.axis = bounds.axis;
+	node.thetaO = bounds.thetaO;
+	node.thetaE = bounds.thetaE;
+	node.cosThetaO = std::cos(bounds.thetaO);
+	node.sinThetaO = std::sin(bounds.thetaO);
+	node.cosThetaE = std::cos(bounds.thetaE);
+	node.power = bounds.power;
+}
+
+Float LightTree::getCost(const Item &bounds) {
+	/* Orientation measure from the Conty Estevez/Kulla paper */
+	Float thetaO = bounds.thetaO,
+		  thetaW = std::min(bounds.thetaO + bounds.thetaE, (Float) M_PI),
+		  cosThetaO = std::cos(thetaO), sinThetaO = std::sin(thetaO);
+	Float orientation = 2 * M_PI * (1 - cosThetaO) + M_PI / 2 * (2 * thetaW * sinThetaO
+		- std::cos(thetaO - 2 * thetaW) - 2 * thetaO * sinThetaO + cosThetaO);
+
+	/* The squared diagonal is added to keep degenerate (e.g. collinear
+	   point light) clusters ordered by their size */
+	Float area = bounds.aabb.getSurfaceArea()
+		+ bounds.aabb.getExtents().lengthSquared();
+
+	return bounds.power * area * orientation;
+}
+
+void LightTree::build(std::vector<Item> &items, uint32_t nodeIndex,
+		size_t start, size_t end, int depth) {
+	Item bounds;
+	AABB centroidBounds;
+	for (size_t i=start; i<end; ++i) {
+		bounds.expandBy(items[i]);
+		centroidBounds.expandBy(items[i].aabb.getCenter());
+	}
+	setBounds(m_nodes[nodeIndex], bounds);
+	m_maxDepth = std::max(m_maxDepth, depth);
+
+	if (end - start == 1) {
+		Node &node = m_nodes[nodeIndex];
+		node.leaf = true;
+		node.index = items[start].index;
+		m_leaves[node.index] = nodeIndex;
+		return;
+	}
+
+	/* Find the best binned split according to the surface area
+	   orientation heuristic */
+	Vector extents = centroidBounds.getExtents(),
+		   boundsExtents = bounds.aabb.getExtents();
+	Float maxExtents = std::max(std::max(boundsExtents.x,
+		boundsExtents.y), boundsExtents.z);
+	Float bestCost = std::numeric_limits<Float>::infinity();
+	int bestAxis = -1, bestSplit = -1;
+
+	for (int axis=0; axis<3; ++axis) {
+		if (extents[axis] <= 0)
+			continue;
+		Float scale = MTS_LIGHTTREE_BINS / extents[axis];
+		Item bins[MTS_LIGHTTREE_BINS];
+		size_t counts[MTS_LIGHTTREE_BINS];
+		memset(counts, 0, sizeof(size_t) * MTS_LIGHTTREE_BINS);
+
+		for (size_t i=start; i<end; ++i) {
+			int bin = std::min((int) ((items[i].aabb.getCenter()[axis]
+				- centroidBounds.min[axis]) * scale), MTS_LIGHTTREE_BINS - 1);
+			bins[bin].expandBy(items[i]);
+			counts[bin]++;
+		}
+
+		/* Prefer splits along long axes */
+		Float kr = maxExtents / std::max(boundsExtents[axis],
+			std::numeric_limits<Float>::min());
+
+		for (int split=1; split<MTS_LIGHTTREE_BINS; ++split) {
+			Item left, right;
+			size_t countLeft = 0, countRight = 0;
+			for (int i=0; i<split; ++i) {
+				left.expandBy(bins[i]);
+				countLeft += counts[i];
+			}
+			for (int i=split; i<MTS_LIGHTTREE_BINS; ++i) {
+				right.expandBy(bins[i]);
+				countRight += counts[i];
+			}
+			if (countLeft == 0 || countRight == 0)
+				continue;
+
+			Float cost = kr * (getCost(left) + getCost(right));
+			if (cost < bestCost) {
+				bestCost = cost;
+				bestAxis = axis;
+				bestSplit = split;
+			}
+		}
+	}
+
+	size_t mid = (start + end) / 2;
+	if (bestAxis != -1) {
+		mid = std::partition(items.begin() + start, items.begin() + end,
+			LightTreeBinPredicate(bestAxis, bestSplit, centroidBounds.min[bestAxis],
+			MTS_LIGHTTREE_BINS / extents[bestAxis])) - items.begin();
+		if (mid == start || mid == end)
+			mid = (start + end) / 2;
+	}
+	/* Otherwise, all centroids coincide -- just split the list in half */
+
+	uint32_t left = (uint32_t) m_nodes.size();
+	m_nodes.resize(m_nodes.size() + 2);
+	m_nodes[nodeIndex].leaf = false;
+	m_nodes[nodeIndex].index = left;
+	m_nodes[left].parent = m_nodes[left+1].parent = nodeIndex;
+
+	build(items, left, start, mid, depth + 1);
+	build(items, left + 1, mid, end, depth + 1);
+}
+
+Float LightTree::importance(const Node &node, const Point &p) const {
+	Point center = node.aabb.getCenter();
+	Vector wi = p - center;
+	Float dist2 = wi.lengthSquared(),
+		  radius2 = 0.25f * node.aabb.getExtents().lengthSquared();
+
+	/* Inside the bounding sphere, any direction is possible */
+	if (dist2 <= radius2)
+		return node.power / std::max(radius2, (Float) 1e-20f);
+
+	Float dist = std::sqrt(dist2);
+	wi /= dist;
+
+	/* Angle between the cone axis and the direction to the point */
+	Float cosThetaW = std::min((Float) 1, std::max((Float) -1, dot(node.axis, wi))),
+		  sinThetaW = std::sqrt(std::max((Float) 0, 1 - cosThetaW*cosThetaW));
+
+	/* Angle subtended by the bounding sphere */
+	Float sinThetaB2 = radius2 / dist2,
+		  sinThetaB = std::sqrt(sinThetaB2),
+		  cosThetaB = std::sqrt(std::max((Float) 0, 1 - sinThetaB2));
+
+	/* Smallest possible angle between an emission direction and the point */
+	Float cosThetaX = cosSubClamped(sinThetaW, cosThetaW, node.sinThetaO, node.cosThetaO),
+		  sinThetaX = sinSubClamped(sinThetaW, cosThetaW, node.sinThetaO, node.cosThetaO),
+		  cosThetaP = cosSubClamped(sinThetaX, cosThetaX, sinThetaB, cosThetaB);
+
+	if (cosThetaP <= node.cosThetaE)
+		return 0.0f;
+
+	return node.power * cosThetaP / dist2;
+}
+
+Float LightTree::probLeft(const Node &node, const Point &p) const {
+	Float left = importance(m_nodes[node.index], p),
+		  right = importance(m_nodes[node.index+1], p),
+		  sum = left + right;
+
+	/* Both children are (conservatively) estimated to be irrelevant
+	   -- fall back to an uninformed choice */
+	if (!(sum > 0))
+		return 0.5f;
+
+	return left / sum;
+}
+
+const Luminaire *LightTree::sample(const Point &p, Float &sample, Float &pdf) const {
+	int entry = m_topPDF.sampleReuse(sample, pdf);
+	if (entry < (int) m_infinite.size())
+		return m_infinite[entry];
+
+	uint32_t index = 0;
+	sample = std::min(sample, OneMinusEpsilon);
+
+	while (!m_nodes[index].leaf) {
+		const Node &node = m_nodes[index];
+		Float pLeft = probLeft(node, p);
+
+		if (sample < pLeft) {
+			sample /= pLeft;
+			pdf *= pLeft;
+			index = node.index;
+		} else {
+			sample = (sample - pLeft) / (1 - pLeft);
+			pdf *= 1 - pLeft;
+			index = node.index + 1;
+		}
+		sample = std::min(sample, OneMinusEpsilon);
+	}
+
+	return m_local[m_nodes[index].index];
+}
+
+Float LightTree::pdf(const Point &p, const Luminaire *luminaire) const {
+	std::map<const Luminaire *, uint32_t>::const_iterator it
+		= m_index.find(luminaire);
+	if (it == m_index.end())
+		return 0.0f;
+
+	uint32_t entry = it->second;
+	if (entry < m_infinite.size())
+		return m_topPDF[entry];
+
+	/* Retrace the path from the leaf to the root */
+	Float result = m_topPDF[m_infinite.size()];
+	uint32_t index = m_leaves[entry - m_infinite.size()];
+	while (index != 0) {
+		uint32_t parentIndex = m_nodes[index].parent;
+		const Node &parent = m_nodes[parentIndex];
+		Float pLeft = probLeft(parent, p);
+		result *= (index == parent.index) ? pLeft : (1 - pLeft);
+		index = parentIndex;
+	}
+
+	return result;
+}
+
+std::string LightTree::toString() const {
+	std::ostringstream oss;
+	oss << "LightTree[" << endl
+		<< "  localLuminaires = " << m_local.size() << "," << endl
+		<< "  infiniteLuminaires = " << m_infinite.size() << "," << endl
+		<< "  nodes = " << m_nodes.size() << "," << endl
+		<< "  maxDepth = " << m_maxDepth << endl
+		<< "]";
+	return oss.str();
+}
+
+MTS_IMPLEMENT_CLASS(LightTree, false, Object)
+MTS_NAMESPACE_END
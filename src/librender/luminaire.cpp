@@ -81,6 +81,11 @@ bool Luminaire::createEmissionRecord(EmissionRecord &eRec, const Ray &ray) const
 void Luminaire::preprocess(const Scene *scene) {
 }
 
+bool Luminaire::getEmissionBounds(AABB &aabb, Vector &axis,
+		Float &thetaO, Float &thetaE) const {
+	return false;
+}
+
 bool Luminaire::isBackgroundLuminaire() const {
 	return false;
 }
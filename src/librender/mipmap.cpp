@@ -17,18 +17,243 @@
 */
 
 #include <mitsuba/core/statistics.h>
+#include <mitsuba/core/lrucache.h>
+#include <mitsuba/core/mstream.h>
+#include <mitsuba/core/zstream.h>
 #include <mitsuba/render/mipmap.h>
+#include <boost/filesystem/operations.hpp>
+#include <boost/bind.hpp>
+
+#if !defined(WIN32)
+#include <unistd.h>
+#endif
+
+/* Increase whenever the layout of tiled mip map files changes */
+#define MTS_MIPMAP_FILEFORMAT_VERSION 2
 
 MTS_NAMESPACE_BEGIN
 
 static StatsCounter mipmapLookups("Texture", "Mip-map texture lookups");
 static StatsCounter ewaLookups("Texture", "EWA texture lookups");
+static StatsCounter statsTileHitRate("Texture cache", "Tile cache hit rate", EPercentage);
+static StatsCounter statsTileLoads("Texture cache", "Tiles loaded from disk");
+static StatsCounter statsTileBytesRead("Texture cache", "Compressed tile data read", EByteCount);
+static StatsCounter statsTileResident("Texture cache", "Resident tile memory", EByteCount);
+
+/// Decompressed tile of a tiled mip map (in the texel format of the mip map)
+struct MIPMapTile : public Object {
+	uint8_t *data;
+	int width;
+	size_t size;
+
+	MIPMapTile(int width, int height, size_t texelSize) : width(width) {
+		size = texelSize * width * height;
+		data = static_cast<uint8_t *>(allocAligned(size));
+	}
+protected:
+	virtual ~MIPMapTile() {
+		freeAligned(data);
+	}
+};
+
+namespace {
+	/// Convert a single precision value into a half-precision float (rounds to nearest even)
+	inline uint16_t floatToHalf(float value) {
+		union { float f; uint32_t i; } u;
+		u.f = value;
+		const uint16_t sign = (uint16_t) ((u.i >> 16) & 0x8000);
+		const uint32_t abs = u.i & 0x7FFFFFFF;
+
+		if (abs >= 0x7F800000) /* Infinity or NaN */
+			return sign | 0x7C00 | (abs > 0x7F800000 ? 0x200 : 0);
+		else if (abs >= 0x477FF000) /* Overflows after rounding */
+			return sign | 0x7C00;
+		else if (abs < 0x38800000) { /* Denormalized half */
+			if (abs < 0x33000000)
+				return sign;
+			const uint32_t shift = 126 - (abs >> 23),
+				mantissa = (abs & 0x7FFFFF) | 0x800000,
+				remainder = mantissa & ((1u << shift) - 1),
+				halfway = 1u << (shift - 1);
+			uint32_t result = mantissa >> shift;
+			if (remainder > halfway || (remainder == halfway && (result & 1)))
+				++result;
+			return sign | (uint16_t) result;
+		} else {
+			/* Re-bias the exponent, a carry of the rounding step 
+			   correctly propagates into the exponent */
+			uint32_t result = (abs - 0x38000000) >> 13;
+			const uint32_t remainder = abs & 0x1FFF;
+			if (remainder > 0x1000 || (remainder == 0x1000 && (result & 1)))
+				++result;
+			return sign | (uint16_t) result;
+		}
+	}
+
+	/// Convert a half-precision float into a single precision value
+	inline float halfToFloat(uint16_t value) {
+		union { float f; uint32_t i; } u;
+		const uint32_t sign = (uint32_t) (value & 0x8000) << 16,
+			exponent = (value >> 10) & 0x1F, mantissa = value & 0x3FF;
+
+		if (exponent == 0) {
+			u.f = mantissa * (1.0f / 16777216.0f);
+			u.i |= sign;
+		} else if (exponent == 31) {
+			u.i = sign | 0x7F800000 | (mantissa << 13);
+		} else {
+			u.i = sign | ((exponent + 112) << 23) | (mantissa << 13);
+		}
+		return u.f;
+	}
+
+	/// Lookup table for converting 8-bit sRGB values into linear intensities
+	struct SRGBTable {
+		float values[256];
+
+		SRGBTable() {
+			for (int i=0; i<256; ++i) {
+				double value = i / 255.0;
+				values[i] = (float) ((value <= 0.04045) ? (value / 12.92)
+					: std::pow((value + 0.055) / 1.055, 2.4));
+			}
+		}
+	} srgbTable;
+
+	/// Convert a linear intensity into an 8-bit sRGB value
+	inline uint8_t toSRGB8(Float value) {
+		if (!(value > 0))
+			return 0;
+		else if (value >= 1)
+			return 255;
+		value = (value <= (Float) 0.0031308) ? (Float) 12.92 * value : 
+			(Float) 1.055 * std::pow(value, (Float) (1.0/2.4)) - (Float) 0.055;
+		return (uint8_t) (value * 255 + (Float) 0.5f);
+	}
+
+	inline size_t getTexelSize(MIPMap::ETexelFormat texelFormat) {
+		switch (texelFormat) {
+			case MIPMap::ESRGB8: return 3 * sizeof(uint8_t);
+			case MIPMap::EHalfRGB: return 3 * sizeof(uint16_t);
+			default: return sizeof(Spectrum);
+		}
+	}
+
+	/// Convert a spectrum into the given texel format
+	void encodeTexel(MIPMap::ETexelFormat texelFormat, const Spectrum &value, uint8_t *ptr) {
+		Float r, g, b;
+		switch (texelFormat) {
+			case MIPMap::ESRGB8:
+				value.toLinearRGB(r, g, b);
+				ptr[0] = toSRGB8(r); ptr[1] = toSRGB8(g); ptr[2] = toSRGB8(b);
+				break;
+			case MIPMap::EHalfRGB: {
+					uint16_t *values = reinterpret_cast<uint16_t *>(ptr);
+					value.toLinearRGB(r, g, b);
+					values[0] = floatToHalf((float) r);
+					values[1] = floatToHalf((float) g);
+					values[2] = floatToHalf((float) b);
+				}
+				break;
+			default:
+				*reinterpret_cast<Spectrum *>(ptr) = value;
+		}
+	}
+
+	/// Write texels to a tiled mip map file (spectra are always stored in single precision)
+	void writeTexels(Stream *stream, MIPMap::ETexelFormat texelFormat, 
+			const uint8_t *data, size_t count) {
+		switch (texelFormat) {
+			case MIPMap::ESRGB8:
+				stream->write(data, count * 3);
+				break;
+			case MIPMap::EHalfRGB:
+				stream->writeUShortArray(reinterpret_cast<const uint16_t *>(data), count * 3);
+				break;
+			default: {
+					const Spectrum *values = reinterpret_cast<const Spectrum *>(data);
+					std::vector<float> buffer(count * SPECTRUM_SAMPLES);
+					for (size_t i=0; i<count; ++i)
+						for (int j=0; j<SPECTRUM_SAMPLES; ++j)
+							buffer[i*SPECTRUM_SAMPLES + j] = (float) values[i][j];
+					stream->writeSingleArray(&buffer[0], buffer.size());
+				}
+		}
+	}
+
+	/// Read texels from a tiled mip map file
+	void readTexels(Stream *stream, MIPMap::ETexelFormat texelFormat, 
+			uint8_t *data, size_t count) {
+		switch (texelFormat) {
+			case MIPMap::ESRGB8:
+				stream->read(data, count * 3);
+				break;
+			case MIPMap::EHalfRGB:
+				stream->readUShortArray(reinterpret_cast<uint16_t *>(data), count * 3);
+				break;
+			default: {
+					Spectrum *values = reinterpret_cast<Spectrum *>(data);
+					std::vector<float> buffer(count * SPECTRUM_SAMPLES);
+					stream->readSingleArray(&buffer[0], buffer.size());
+					for (size_t i=0; i<count; ++i)
+						for (int j=0; j<SPECTRUM_SAMPLES; ++j)
+							values[i][j] = (Float) buffer[i*SPECTRUM_SAMPLES + j];
+				}
+		}
+	}
+
+	/// Identifies a tile of a tiled mip map within the shared cache
+	struct TileKey {
+		const MIPMap *mipmap; // Not part of the key, used for loading
+		uint32_t id;
+		uint32_t index;
+	};
+
+	struct TileKeyOrder : public std::binary_function<TileKey, TileKey, bool> {
+		inline bool operator()(const TileKey &k1, const TileKey &k2) const {
+			if (k1.id != k2.id)
+				return k1.id < k2.id;
+			return k1.index < k2.index;
+		}
+	};
+
+	typedef ShardedLRUCache<TileKey, TileKeyOrder, ref<MIPMapTile> > TileCache;
+
+	size_t hashTileKey(const TileKey &key) {
+		uint32_t hash = key.index + key.id * 0x9E3779B1u;
+		hash ^= hash >> 16; hash *= 0x85EBCA6Bu; hash ^= hash >> 13;
+		return (size_t) hash;
+	}
+
+	ref<MIPMapTile> loadCachedTile(const TileKey &key) {
+		return key.mipmap->loadTile(key.index);
+	}
+
+	void releaseTile(const ref<MIPMapTile> &tile) {
+		statsTileResident -= tile->size;
+	}
+
+	size_t tileCost(const ref<MIPMapTile> &tile) {
+		return tile->size;
+	}
+
+	/* Tile cache shared by all tiled mip maps. It is created when the 
+	   first one is opened and released together with the last one */
+	ref<Mutex> tileCacheMutex = new Mutex();
+	ref<TileCache> tileCache;
+	size_t tileCacheSize = MIPMAP_DEFAULT_CACHESIZE;
+	int tiledMIPMapCount = 0;
+	uint32_t tiledMIPMapID = 0;
+}
 
 /* Isotropic/anisotropic EWA mip-map texture map class based on PBRT */
 MIPMap::MIPMap(int width, int height, Spectrum *pixels, 
-	EFilterType filterType, EWrapMode wrapMode, Float maxAnisotropy) 
-		: m_width(width), m_height(height), m_filterType(filterType), 
-		  m_wrapMode(wrapMode), m_maxAnisotropy(maxAnisotropy) {
+	EFilterType filterType, EWrapMode wrapMode, Float maxAnisotropy,
+	ETexelFormat texelFormat) 
+		: m_width(width), m_height(height), m_texelFormat(ESpectrum),
+		  m_texelSize(sizeof(Spectrum)), m_filterType(filterType), 
+		  m_wrapMode(wrapMode), m_maxAnisotropy(maxAnisotropy), m_id(0),
+		  m_levelTileOffset(NULL), m_levelTilesX(NULL), m_tileOffsets(NULL) {
 	Spectrum *texture = pixels;
 
 	if (filterType != ENone && (!isPow2(width) || !isPow2(height))) {
@@ -92,29 +317,124 @@ MIPMap::MIPMap(int width, int height, Spectrum *pixels,
 	else
 		m_levels = 1;
 
-	m_pyramid = new Spectrum*[m_levels];
-	m_pyramid[0] = texture;
-	m_levelWidth = new int[m_levels];
-	m_levelHeight= new int[m_levels];
+	initialize();
+	m_pyramid = new uint8_t*[m_levels];
+	m_pyramid[0] = reinterpret_cast<uint8_t *>(texture);
 	m_levelWidth[0] = m_width;
 	m_levelHeight[0] = m_height;
 
-	/* Generate the mip-map hierarchy */
+	/* Generate the mip-map hierarchy at full precision */
 	for (int i=1; i<m_levels; i++) {
 		m_levelWidth[i]  = std::max(1, m_levelWidth[i-1]/2);
 		m_levelHeight[i] = std::max(1, m_levelHeight[i-1]/2);
-		m_pyramid[i] = new Spectrum[m_levelWidth[i] * m_levelHeight[i]];
+		Spectrum *level = new Spectrum[m_levelWidth[i] * m_levelHeight[i]];
 		for (int y = 0; y < m_levelHeight[i]; y++) {
 			for (int x = 0; x < m_levelWidth[i]; x++) {
-				m_pyramid[i][x+y*m_levelWidth[i]] = (
+				level[x+y*m_levelWidth[i]] = (
 					getTexel(i-1, 2*x, 2*y) + 
 					getTexel(i-1, 2*x+1, 2*y) + 
 					getTexel(i-1, 2*x, 2*y+1) + 
 					getTexel(i-1, 2*x+1, 2*y+1)) * 0.25f;
 			}
 		}
+		m_pyramid[i] = reinterpret_cast<uint8_t *>(level);
 	}
 
+	if (texelFormat != ESpectrum)
+		convertPyramid(texelFormat);
+}
+
+MIPMap::MIPMap(const fs::path &filename, Float maxAnisotropy) 
+		: m_pyramid(NULL), m_maxAnisotropy(maxAnisotropy) {
+	m_tileFile = new FileStream(filename, FileStream::EReadOnly);
+	m_tileFileMutex = new Mutex();
+
+	char magic[3];
+	m_tileFile->read(magic, 3);
+	if (magic[0] != 'M' || magic[1] != 'I' || magic[2] != 'P')
+		Log(EError, "\"%s\" is not a tiled mip map file!", 
+			filename.file_string().c_str());
+	int version = m_tileFile->readUChar();
+	if (version != MTS_MIPMAP_FILEFORMAT_VERSION)
+		Log(EError, "\"%s\": unsupported file format version %i!",
+			filename.file_string().c_str(), version);
+	int spectrumSamples = m_tileFile->readInt();
+	int tileSize = m_tileFile->readInt();
+	if (spectrumSamples != SPECTRUM_SAMPLES || tileSize != MIPMAP_TILESIZE)
+		Log(EError, "\"%s\" was created with an incompatible configuration "
+			"(%i spectral samples, tile size %i)", filename.file_string().c_str(),
+			spectrumSamples, tileSize);
+
+	m_filterType = (EFilterType) m_tileFile->readInt();
+	m_wrapMode = (EWrapMode) m_tileFile->readInt();
+	m_texelFormat = (ETexelFormat) m_tileFile->readInt();
+	m_texelSize = getTexelSize(m_texelFormat);
+	m_levels = m_tileFile->readInt();
+	initialize();
+
+	m_levelTileOffset = new uint32_t[m_levels+1];
+	m_levelTilesX = new int[m_levels];
+	m_levelTileOffset[0] = 0;
+	for (int i=0; i<m_levels; ++i) {
+		m_levelWidth[i] = m_tileFile->readInt();
+		m_levelHeight[i] = m_tileFile->readInt();
+		m_levelTilesX[i] = (m_levelWidth[i] + MIPMAP_TILESIZE - 1) / MIPMAP_TILESIZE;
+		int tilesY = (m_levelHeight[i] + MIPMAP_TILESIZE - 1) / MIPMAP_TILESIZE;
+		m_levelTileOffset[i+1] = m_levelTileOffset[i] + m_levelTilesX[i] * tilesY;
+	}
+	m_width = m_levelWidth[0];
+	m_height = m_levelHeight[0];
+
+	for (int i=0; i<SPECTRUM_SAMPLES; ++i)
+		m_maximum[i] = (Float) m_tileFile->readSingle();
+
+	uint32_t tileCount = m_tileFile->readUInt();
+	if (tileCount != m_levelTileOffset[m_levels])
+		Log(EError, "\"%s\": tile count mismatch!", filename.file_string().c_str());
+	m_tileOffsets = new uint64_t[tileCount + 1];
+	m_tileFile->readULongArray(m_tileOffsets, tileCount + 1);
+
+	tileCacheMutex->lock();
+	if (tiledMIPMapCount++ == 0) {
+		/* The budget is specified in bytes -- charge each tile
+		   its decompressed size, which depends on the texel format */
+		const size_t shardCount = 4 * (size_t) getProcessorCount();
+		tileCache = new TileCache(shardCount, 
+			std::max((size_t) 1, tileCacheSize / shardCount),
+			boost::bind(&hashTileKey, _1), boost::bind(&loadCachedTile, _1),
+			boost::bind(&releaseTile, _1), boost::bind(&tileCost, _1));
+	}
+	m_id = tiledMIPMapID++;
+	tileCacheMutex->unlock();
+
+	Log(EDebug, "Opened the tiled mip map \"%s\" (%ix%i, %i levels, %i tiles)", 
+		filename.leaf().c_str(), m_width, m_height, m_levels, tileCount);
+}
+
+MIPMap::~MIPMap() {
+	if (m_filterType == EEWA) 
+		freeAligned(m_weightLut);
+	if (m_pyramid) {
+		for (int i=0; i<m_levels; i++)
+			releaseLevel(i);
+		delete[] m_pyramid;
+	} else {
+		tileCacheMutex->lock();
+		if (--tiledMIPMapCount == 0)
+			tileCache = NULL;
+		tileCacheMutex->unlock();
+	}
+	delete[] m_levelHeight;
+	delete[] m_levelWidth;
+	delete[] m_levelTileOffset;
+	delete[] m_levelTilesX;
+	delete[] m_tileOffsets;
+}
+
+void MIPMap::initialize() {
+	m_levelWidth = new int[m_levels];
+	m_levelHeight = new int[m_levels];
+
 	if (m_filterType == EEWA) {
 		m_weightLut = static_cast<Float *>(allocAligned(sizeof(Float)*MIPMAP_LUTSIZE));
 		for (int i=0; i<MIPMAP_LUTSIZE; ++i) {
@@ -124,28 +444,268 @@ MIPMap::MIPMap(int width, int height, Spectrum *pixels,
 	}
 }
 
-MIPMap::~MIPMap() {
-	if (m_filterType == EEWA) 
-		freeAligned(m_weightLut);
-	for (int i=0; i<m_levels; i++)
-		delete[] m_pyramid[i];
-	delete[] m_levelHeight;
-	delete[] m_levelWidth;
-	delete[] m_pyramid;
+void MIPMap::releaseLevel(int level) {
+	if (m_texelFormat == ESpectrum)
+		delete[] reinterpret_cast<Spectrum *>(m_pyramid[level]);
+	else
+		delete[] m_pyramid[level];
+	m_pyramid[level] = NULL;
 }
 
-Spectrum MIPMap::getMaximum() const {
+void MIPMap::convertPyramid(ETexelFormat texelFormat) {
+	Assert(m_texelFormat == ESpectrum && !isTiled());
+	const size_t texelSize = getTexelSize(texelFormat);
+	for (int i=0; i<m_levels; ++i) {
+		size_t texelCount = (size_t) m_levelWidth[i] * (size_t) m_levelHeight[i];
+		const Spectrum *source = reinterpret_cast<const Spectrum *>(m_pyramid[i]);
+		uint8_t *target = new uint8_t[texelCount * texelSize];
+		for (size_t j=0; j<texelCount; ++j)
+			encodeTexel(texelFormat, source[j], target + j*texelSize);
+		delete[] source;
+		m_pyramid[i] = target;
+	}
+	m_texelFormat = texelFormat;
+	m_texelSize = getTexelSize(texelFormat);
+}
+
+inline Spectrum MIPMap::decodeTexel(const uint8_t *ptr) const {
+	Spectrum result;
+	switch (m_texelFormat) {
+		case ESRGB8:
+			result.fromLinearRGB(srgbTable.values[ptr[0]],
+				srgbTable.values[ptr[1]], srgbTable.values[ptr[2]]);
+			break;
+		case EHalfRGB: {
+				const uint16_t *values = reinterpret_cast<const uint16_t *>(ptr);
+				result.fromLinearRGB(halfToFloat(values[0]), 
+					halfToFloat(values[1]), halfToFloat(values[2]));
+			}
+			break;
+		default:
+			result = *reinterpret_cast<const Spectrum *>(ptr);
+	}
+	return result;
+}
+
+MIPMap::ETexelFormat MIPMap::parseTexelFormat(const std::string &name) {
+	if (name == "spectrum")
+		return ESpectrum;
+	else if (name == "srgb8")
+		return ESRGB8;
+	else if (name == "half")
+		return EHalfRGB;
+	else
+		Log(EError, "Unknown texel format '%s' -- must be "
+			"'spectrum', 'srgb8', or 'half'!", name.c_str());
+	return ESpectrum;
+}
+
+size_t MIPMap::getMemoryUsage() const {
+	if (isTiled())
+		return 0;
+	size_t result = 0;
+	for (int i=0; i<m_levels; ++i)
+		result += (size_t) m_levelWidth[i] * (size_t) m_levelHeight[i] * m_texelSize;
+	return result;
+}
+
+void MIPMap::setTileCacheSize(size_t size) {
+	tileCacheMutex->lock();
+	tileCacheSize = size;
+	tileCacheMutex->unlock();
+}
+
+size_t MIPMap::getTileCacheSize() {
+	return tileCacheSize;
+}
+
+ref<MIPMap> MIPMap::fromTiledFile(const fs::path &cacheFile, 
+		const fs::path &sourceFile, EFilterType filterType, 
+		EWrapMode wrapMode, Float maxAnisotropy, ETexelFormat texelFormat) {
+	try {
+		if (!fs::exists(cacheFile))
+			return NULL;
+		if (fs::exists(sourceFile) && fs::last_write_time(cacheFile) 
+				< fs::last_write_time(sourceFile)) {
+			Log(EInfo, "The tiled mip map \"%s\" is out of date", 
+				cacheFile.leaf().c_str());
+			return NULL;
+		}
+		ref<MIPMap> mipmap = new MIPMap(cacheFile, maxAnisotropy);
+		if (mipmap->m_filterType != filterType || mipmap->m_wrapMode != wrapMode
+				|| mipmap->m_texelFormat != texelFormat) {
+			Log(EInfo, "The tiled mip map \"%s\" was created with different "
+				"filter settings", cacheFile.leaf().c_str());
+			return NULL;
+		}
+		return mipmap;
+	} catch (const std::exception &ex) {
+		Log(EWarn, "Unable to open the tiled mip map \"%s\": %s", 
+			cacheFile.file_string().c_str(), ex.what());
+		return NULL;
+	}
+}
+
+bool MIPMap::writeTiled(const fs::path &filename) const {
+	if (isTiled())
+		Log(EError, "writeTiled(): the mip map is already tiled!");
+
+	/* Write to a temporary file first so that concurrently running 
+	   processes never see a partially written file */
+	fs::path tempFile = filename;
+#if defined(WIN32)
+	tempFile.replace_extension(formatString(".%i.tmp", (int) GetCurrentProcessId()));
+#else
+	tempFile.replace_extension(formatString(".%i.tmp", (int) getpid()));
+#endif
+
+	try {
+		ref<FileStream> stream = new FileStream(tempFile, FileStream::ETruncWrite);
+		stream->write("MIP", 3);
+		stream->writeUChar(MTS_MIPMAP_FILEFORMAT_VERSION);
+		stream->writeInt(SPECTRUM_SAMPLES);
+		stream->writeInt(MIPMAP_TILESIZE);
+		stream->writeInt(m_filterType);
+		stream->writeInt(m_wrapMode);
+		stream->writeInt(m_texelFormat);
+		stream->writeInt(m_levels);
+
+		uint32_t tileCount = 0;
+		for (int i=0; i<m_levels; ++i) {
+			stream->writeInt(m_levelWidth[i]);
+			stream->writeInt(m_levelHeight[i]);
+			tileCount += (uint32_t) (
+				((m_levelWidth[i] + MIPMAP_TILESIZE - 1) / MIPMAP_TILESIZE) *
+				((m_levelHeight[i] + MIPMAP_TILESIZE - 1) / MIPMAP_TILESIZE));
+		}
+
+		/* Store the maximum without the wrap mode adjustment */
+		Spectrum maximum = computeMaximum();
+		for (int i=0; i<SPECTRUM_SAMPLES; ++i)
+			stream->writeSingle((float) maximum[i]);
+
+		/* Tile offset table, which is filled in at the end */
+		std::vector<uint64_t> tileOffsets(tileCount + 1);
+		stream->writeUInt(tileCount);
+		size_t tableOffset = stream->getPos();
+		stream->writeULongArray(&tileOffsets[0], tileCount + 1);
+
+		/* Compress each tile separately so that it can be loaded on its own */
+		std::vector<uint8_t> buffer(MIPMAP_TILESIZE*MIPMAP_TILESIZE*m_texelSize);
+		uint32_t tileIndex = 0;
+		for (int level=0; level<m_levels; ++level) {
+			int levelWidth = m_levelWidth[level], levelHeight = m_levelHeight[level];
+			for (int ty=0; ty<levelHeight; ty += MIPMAP_TILESIZE) {
+				for (int tx=0; tx<levelWidth; tx += MIPMAP_TILESIZE) {
+					int width = std::min(MIPMAP_TILESIZE, levelWidth - tx),
+						height = std::min(MIPMAP_TILESIZE, levelHeight - ty);
+					for (int y=ty; y<ty+height; ++y)
+						memcpy(&buffer[(y-ty)*width*m_texelSize], 
+							m_pyramid[level] + (y*levelWidth + tx)*m_texelSize,
+							width*m_texelSize);
+
+					ref<MemoryStream> mStream = new MemoryStream();
+					ref<ZStream> zStream = new ZStream(mStream);
+					writeTexels(zStream, m_texelFormat, &buffer[0], width*height);
+					zStream = NULL; // Flushes the compressed data
+
+					tileOffsets[tileIndex++] = stream->getPos();
+					stream->write(mStream->getData(), mStream->getSize());
+				}
+			}
+		}
+		tileOffsets[tileCount] = stream->getPos();
+		stream->setPos(tableOffset);
+		stream->writeULongArray(&tileOffsets[0], tileCount + 1);
+		stream->close();
+
+		if (fs::exists(filename))
+			fs::remove(filename);
+		fs::rename(tempFile, filename);
+	} catch (const std::exception &ex) {
+		Log(EWarn, "Unable to write the tiled mip map \"%s\": %s", 
+			filename.file_string().c_str(), ex.what());
+		if (fs::exists(tempFile))
+			fs::remove(tempFile);
+		return false;
+	}
+
+	Log(EDebug, "Wrote the tiled mip map \"%s\"", filename.file_string().c_str());
+	return true;
+}
+
+ref<MIPMapTile> MIPMap::loadTile(uint32_t index) const {
+	Assert(isTiled() && index < m_levelTileOffset[m_levels]);
+	int level = 0;
+	while (index >= m_levelTileOffset[level+1])
+		++level;
+	int tile = (int) (index - m_levelTileOffset[level]),
+		tx = (tile % m_levelTilesX[level]) * MIPMAP_TILESIZE,
+		ty = (tile / m_levelTilesX[level]) * MIPMAP_TILESIZE,
+		width = std::min(MIPMAP_TILESIZE, m_levelWidth[level] - tx),
+		height = std::min(MIPMAP_TILESIZE, m_levelHeight[level] - ty);
+
+	/* Only the file access needs to be serialized */
+	size_t compressedSize = (size_t) (m_tileOffsets[index+1] - m_tileOffsets[index]);
+	ref<MemoryStream> mStream = new MemoryStream(compressedSize);
+	m_tileFileMutex->lock();
+	try {
+		m_tileFile->setPos((size_t) m_tileOffsets[index]);
+		m_tileFile->copyTo(mStream, compressedSize);
+	} catch (...) {
+		m_tileFileMutex->unlock();
+		throw;
+	}
+	m_tileFileMutex->unlock();
+	mStream->setPos(0);
+
+	ref<MIPMapTile> result = new MIPMapTile(width, height, m_texelSize);
+	ref<ZStream> zStream = new ZStream(mStream);
+	readTexels(zStream, m_texelFormat, result->data, width*height);
+
+	++statsTileLoads;
+	statsTileBytesRead += compressedSize;
+	statsTileResident += result->size;
+	return result;
+}
+
+Spectrum MIPMap::getTiledTexel(int level, int x, int y) const {
+	const int tx = x / MIPMAP_TILESIZE, ty = y / MIPMAP_TILESIZE;
+	TileKey key;
+	key.mipmap = this;
+	key.id = m_id;
+	key.index = m_levelTileOffset[level] + tx + ty * m_levelTilesX[level];
+
+	bool hit = false;
+	ref<MIPMapTile> tile = tileCache->get(key, hit);
+	statsTileHitRate.incrementBase();
+	if (hit)
+		++statsTileHitRate;
+
+	return decodeTexel(tile->data + ((x - tx * MIPMAP_TILESIZE) 
+		+ (y - ty * MIPMAP_TILESIZE) * tile->width) * m_texelSize);
+}
+
+Spectrum MIPMap::computeMaximum() const {
+	if (isTiled())
+		return m_maximum;
 	Spectrum max(0.0f);
 	int height = m_levelHeight[0];
 	int width = m_levelWidth[0];
-	Spectrum *pixels = m_pyramid[0];
+	const uint8_t *pixels = m_pyramid[0];
 	for (int y=0; y<height; ++y) {
 		for (int x=0; x<width; ++x) {
-			Spectrum value = *pixels++;
+			Spectrum value = decodeTexel(pixels);
+			pixels += m_texelSize;
 			for (int j=0; j<SPECTRUM_SAMPLES; ++j)
 				max[j] = std::max(max[j], value[j]);
 		}
 	}
+	return max;
+}
+
+Spectrum MIPMap::getMaximum() const {
+	Spectrum max = computeMaximum();
 	if (m_wrapMode == EWhite) {
 		for (int i=0; i<SPECTRUM_SAMPLES; ++i)
 			max[i] = std::max(max[i], (Float) 1.0f);
@@ -154,7 +714,7 @@ Spectrum MIPMap::getMaximum() const {
 }
 	
 ref<MIPMap> MIPMap::fromBitmap(Bitmap *bitmap, EFilterType filterType,
-		EWrapMode wrapMode, Float maxAnisotropy) {
+		EWrapMode wrapMode, Float maxAnisotropy, ETexelFormat texelFormat) {
 	int width = bitmap->getWidth();
 	int height = bitmap->getHeight();
 	float *data = bitmap->getFloatData();
@@ -173,7 +733,7 @@ ref<MIPMap> MIPMap::fromBitmap(Bitmap *bitmap, EFilterType filterType,
 	}
 
 	return new MIPMap(width, height, pixels,
-		filterType, wrapMode, maxAnisotropy);
+		filterType, wrapMode, maxAnisotropy, texelFormat);
 }
 
 MIPMap::ResampleWeight *MIPMap::resampleWeights(int oldRes, int newRes) const {
@@ -204,7 +764,7 @@ Spectrum MIPMap::getTexel(int level, int x, int y) const {
 	int levelWidth = m_levelWidth[level];
 	int levelHeight = m_levelHeight[level];
 
-	if (x <= 0 || y < 0 || x >= levelWidth || y >= levelHeight) {
+	if (x < 0 || y < 0 || x >= levelWidth || y >= levelHeight) {
 		switch (m_wrapMode) {
 			case ERepeat:
 				x = modulo(x, levelWidth);
@@ -221,7 +781,10 @@ Spectrum MIPMap::getTexel(int level, int x, int y) const {
 		}
 	}
 
-	return m_pyramid[level][x + levelWidth*y];
+	if (EXPECT_NOT_TAKEN(m_pyramid == NULL))
+		return getTiledTexel(level, x, y);
+
+	return decodeTexel(m_pyramid[level] + (x + levelWidth*y) * m_texelSize);
 }
 	
 Spectrum MIPMap::triangle(int level, Float x, Float y) const {
@@ -343,12 +906,11 @@ Spectrum MIPMap::EWA(Float u, Float v, Float dudx, Float dudy, Float dvdx,
 Bitmap *MIPMap::getBitmap() const {
 	Bitmap *bitmap = new Bitmap(m_width, m_height, 128);
 	float *floatData = bitmap->getFloatData();
-	Spectrum *specData = m_pyramid[0];
 
 	for (int y=0; y<m_height; ++y) {
 		for (int x=0; x<m_width; ++x) {
 			Float r, g, b;
-			(specData++)->toLinearRGB(r, g, b);
+			getTexel(0, x, y).toLinearRGB(r, g, b);
 			*floatData++ = r;
 			*floatData++ = g;
 			*floatData++ = b;
@@ -361,12 +923,11 @@ Bitmap *MIPMap::getBitmap() const {
 Bitmap *MIPMap::getLDRBitmap() const {
 	Bitmap *bitmap = new Bitmap(m_width, m_height, 24);
 	uint8_t *data = bitmap->getData();
-	Spectrum *specData = m_pyramid[0];
 
 	for (int y=0; y<m_height; ++y) {
 		for (int x=0; x<m_width; ++x) {
 			Float r, g, b;
-			(specData++)->toLinearRGB(r, g, b);
+			getTexel(0, x, y).toLinearRGB(r, g, b);
 			*data++ = (uint8_t) std::min(255, std::max(0, (int) (r*255)));
 			*data++ = (uint8_t) std::min(255, std::max(0, (int) (g*255)));
 			*data++ = (uint8_t) std::min(255, std::max(0, (int) (b*255)));
@@ -19,7 +19,11 @@
 #include <mitsuba/render/photonmap.h>
 #include <mitsuba/render/scene.h>
 #include <mitsuba/render/phase.h>
+#include <mitsuba/core/atomic.h>
 #include <fstream>
+#if defined(_OPENMP)
+#include <omp.h>
+#endif
 
 MTS_NAMESPACE_BEGIN
 
@@ -83,9 +87,7 @@ bool PhotonMap::storePhoton(const Point &pos, const Normal &normal,
 	if (m_photonCount >= m_maxPhotons)
 		return false;
 
-	/* Keep track of the volume covered by all stored photons */
-	m_aabb.expandBy(pos);
-
+	/* The volume covered by all stored photons is computed in balance() */
 	m_photons[++m_photonCount] = Photon(pos, normal, dir, power, depth);
 
 	return true;
@@ -98,13 +100,40 @@ bool PhotonMap::storePhoton(const Photon &photon) {
 	if (m_photonCount >= m_maxPhotons)
 		return false;
 
-	/* Keep track of the volume covered by all stored photons */
-	m_aabb.expandBy(Point(photon.pos[0], photon.pos[1], photon.pos[2]));
 	m_photons[++m_photonCount] = photon;
 
 	return true;
 }
 
+/// Compare-and-exchange on a size_t, which is 32 or 64 bit depending on the platform
+static inline bool atomicCompareAndExchangeSize(volatile size_t *v, size_t newValue, size_t oldValue) {
+	if (sizeof(size_t) == sizeof(int64_t))
+		return atomicCompareAndExchange((volatile int64_t *) v,
+			(int64_t) newValue, (int64_t) oldValue);
+	else
+		return atomicCompareAndExchange((volatile int32_t *) v,
+			(int32_t) newValue, (int32_t) oldValue);
+}
+
+size_t PhotonMap::storePhotons(const Photon *photons, size_t count) {
+	Assert(!m_balanced);
+
+	/* Atomically reserve a range of slots without overflowing the map */
+	volatile size_t *photonCount = &m_photonCount;
+	size_t start, granted;
+	do {
+		start = *photonCount;
+		granted = std::min(count, m_maxPhotons - start);
+		if (granted == 0)
+			return 0;
+	} while (!atomicCompareAndExchangeSize(photonCount, start + granted, start));
+
+	/* The reserved range is exclusively owned by this thread */
+	memcpy(&m_photons[start + 1], photons, granted * sizeof(Photon));
+
+	return granted;
+}
+
 /**
  * Relaxed partitioning algorithm based on code in stl_algo.h and Jensen's
  * reference implementation. This is *much* faster than std::partition
@@ -219,7 +248,7 @@ size_t PhotonMap::leftSubtreeSize(size_t treeSize) const {
 	return p - 1;
 }
 
-void PhotonMap::balance() {
+void PhotonMap::balance(int threadCount) {
 	if (m_photonCount == 0) {
 		Log(EInfo, "Photon map: no need for balancing, no photons available.");
 		m_balanced = true;
@@ -227,22 +256,59 @@ void PhotonMap::balance() {
 	}
 	Assert(!m_balanced);
 
+	if (threadCount <= 0)
+		threadCount = getProcessorCount();
+#if defined(_OPENMP)
+	threadCount = std::min(threadCount, omp_get_max_threads());
+#else
+	threadCount = 1;
+#endif
+	if (m_photonCount < PHOTONMAP_MIN_PARALLEL_PHOTONS)
+		threadCount = 1;
+
 	/* Shuffle pointers instead of copying photons back and forth */
 	std::vector<photon_ptr> photonPointers(m_photonCount + 1);
 	/* Destination for the final heap permutation. Indexed starting at 1 */
 	std::vector<size_t> heapPermutation(m_photonCount + 1);
 
-	heapPermutation[0] = 0;
-	for (size_t i=0; i<=m_photonCount; i++)
-		photonPointers[i] = &m_photons[i];
-
 	ref<Timer> timer = new Timer();
 
-	Log(EInfo, "Photon map: balancing %i photons (%s)..", m_photonCount,
-		memString(sizeof(Photon) * (m_photonCount+1)).c_str());
+	Log(EInfo, "Photon map: balancing %i photons (%s) using %i thread%s..", 
+		m_photonCount, memString(sizeof(Photon) * (m_photonCount+1)).c_str(),
+		threadCount, threadCount > 1 ? "s" : "");
 
-	balanceRecursive(photonPointers.begin(), photonPointers.begin()+1, 
-		photonPointers.end(), heapPermutation, m_aabb, 1);
+	/* Determine the volume covered by all stored photons. This is 
+	   a min/max reduction and therefore independent of the order 
+	   in which photons were stored */
+	std::vector<AABB> threadAABBs(threadCount);
+	heapPermutation[0] = 0;
+	photonPointers[0] = &m_photons[0];
+	#pragma omp parallel num_threads(threadCount)
+	{
+		AABB threadAABB;
+		#pragma omp for schedule(static)
+		for (int i=1; i<=(int) m_photonCount; i++) {
+			const Photon &photon = m_photons[i];
+			threadAABB.expandBy(Point(photon.pos[0], photon.pos[1], photon.pos[2]));
+			photonPointers[i] = &m_photons[i];
+		}
+#if defined(_OPENMP)
+		threadAABBs[omp_get_thread_num()] = threadAABB;
+#else
+		threadAABBs[0] = threadAABB;
+#endif
+	}
+	m_aabb.reset();
+	for (size_t i=0; i<threadAABBs.size(); ++i)
+		m_aabb.expandBy(threadAABBs[i]);
+
+	if (threadCount > 1) {
+		balanceParallel(photonPointers, heapPermutation, threadCount);
+	} else {
+		AABB aabb(m_aabb);
+		balanceRecursive(photonPointers.begin(), photonPointers.begin()+1, 
+			photonPointers.end(), heapPermutation, aabb, 1);
+	}
 
 	Log(EInfo, "Done (took %i ms)", timer->getMilliseconds());
 	timer->reset();
@@ -262,11 +328,11 @@ void PhotonMap::balance() {
 	m_balanced = true;
 }
 
-void PhotonMap::balanceRecursive(photon_iterator basePtr, 
+PhotonMap::photon_iterator PhotonMap::partitionNode(photon_iterator basePtr, 
 	photon_iterator sortStart,
 	photon_iterator sortEnd, 
 	std::vector<size_t> &heapPermutation,
-	AABB &aabb, size_t heapIndex) const {
+	const AABB &aabb, size_t heapIndex) const {
 
 	/* A fully left-balanced binary tree has this many nodes on its
 	   left subtree */
@@ -283,12 +349,25 @@ void PhotonMap::balanceRecursive(photon_iterator basePtr,
 	/* QUICKSORT-like partitioning iterations until the entry referenced by 
 	   'pivot' imposes an ordering wrt. all other photons in the range */
 	quickPartition(sortStart, sortEnd, pivot, splitAxis);
-	Float splitPos = (*pivot)->pos[splitAxis];
 
 	/* Update the heap permutation and record the splitting axis */
 	heapPermutation[heapIndex] = *pivot - *basePtr;
 	(*pivot)->axis = splitAxis;
 
+	return pivot;
+}
+
+void PhotonMap::balanceRecursive(photon_iterator basePtr, 
+	photon_iterator sortStart,
+	photon_iterator sortEnd, 
+	std::vector<size_t> &heapPermutation,
+	AABB &aabb, size_t heapIndex) const {
+
+	photon_iterator pivot = partitionNode(basePtr, sortStart, 
+		sortEnd, heapPermutation, aabb, heapIndex);
+	int splitAxis = (*pivot)->axis;
+	Float splitPos = (*pivot)->pos[splitAxis];
+
 	if (pivot > sortStart) {
 		if (pivot > sortStart + 1) {
 			/* There are more then two elements on the left
@@ -318,6 +397,62 @@ void PhotonMap::balanceRecursive(photon_iterator basePtr,
 	}
 }
 
+void PhotonMap::balanceParallel(std::vector<photon_ptr> &photonPointers,
+	std::vector<size_t> &heapPermutation, int threadCount) const {
+	photon_iterator basePtr = photonPointers.begin();
+	std::vector<BalanceTask> tasks, children;
+	tasks.push_back(BalanceTask(1, m_photonCount + 1, 1, m_aabb));
+
+	/* Subtrees occupy disjoint ranges of the pointer list and the heap 
+	   permutation, hence they can be processed without synchronization.
+	   Since each range is partitioned exactly like in the serial 
+	   algorithm, the resulting tree is the same. */
+	while (!tasks.empty() && tasks.size() < (size_t) (8 * threadCount)) {
+		/* Partition all nodes on the current tree level in parallel */
+		children.resize(2 * tasks.size());
+		#pragma omp parallel for schedule(dynamic) num_threads(threadCount)
+		for (int i=0; i<(int) tasks.size(); ++i) {
+			const BalanceTask &task = tasks[i];
+			BalanceTask &left = children[2*i], &right = children[2*i+1];
+			photon_iterator sortStart = basePtr + task.start,
+							sortEnd = basePtr + task.end;
+			photon_iterator pivot = partitionNode(basePtr, sortStart, 
+				sortEnd, heapPermutation, task.aabb, task.heapIndex);
+			int splitAxis = (*pivot)->axis;
+			Float splitPos = (*pivot)->pos[splitAxis];
+			size_t pivotIndex = pivot - basePtr;
+
+			left = BalanceTask(task.start, pivotIndex, 
+				leftChild(task.heapIndex), task.aabb);
+			left.aabb.max[splitAxis] = splitPos;
+			right = BalanceTask(pivotIndex + 1, task.end, 
+				rightChild(task.heapIndex), task.aabb);
+			right.aabb.min[splitAxis] = splitPos;
+
+			/* Leaf nodes - just copy. */
+			if (left.size() == 1)
+				heapPermutation[left.heapIndex] = *sortStart - *basePtr;
+			if (right.size() == 1)
+				heapPermutation[right.heapIndex] = *(sortEnd-1) - *basePtr;
+		}
+
+		tasks.clear();
+		for (size_t i=0; i<children.size(); ++i) {
+			if (children[i].size() > 1)
+				tasks.push_back(children[i]);
+		}
+	}
+
+	/* Balance the remaining subtrees independently, largest first */
+	std::sort(tasks.begin(), tasks.end());
+	#pragma omp parallel for schedule(dynamic) num_threads(threadCount)
+	for (int i=0; i<(int) tasks.size(); ++i) {
+		BalanceTask &task = tasks[i];
+		balanceRecursive(basePtr, basePtr + task.start, basePtr + task.end,
+			heapPermutation, task.aabb, task.heapIndex);
+	}
+}
+
 size_t PhotonMap::nnSearch(const Point &p, Float &searchRadiusSquared, 
 		size_t maxSize, search_result *results) const {
 	const float pos[3] = { (float) p.x, (float) p.y, (float) p.z };
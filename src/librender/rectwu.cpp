@@ -55,5 +55,38 @@ std::string RectangularWorkUnit::toString() const {
 	return oss.str();
 }
 
+/* ==================================================================== */
+/*                          SampleRangeWorkUnit                         */
+/* ==================================================================== */
+
+void SampleRangeWorkUnit::set(const WorkUnit *wu) {
+	RectangularWorkUnit::set(wu);
+	const SampleRangeWorkUnit *range = static_cast<const SampleRangeWorkUnit *>(wu);
+	m_firstSample = range->m_firstSample;
+	m_sampleCount = range->m_sampleCount;
+}
+
+void SampleRangeWorkUnit::load(Stream *stream) {
+	RectangularWorkUnit::load(stream);
+	m_firstSample = stream->readSize();
+	m_sampleCount = stream->readSize();
+}
+
+void SampleRangeWorkUnit::save(Stream *stream) const {
+	RectangularWorkUnit::save(stream);
+	stream->writeSize(m_firstSample);
+	stream->writeSize(m_sampleCount);
+}
+
+std::string SampleRangeWorkUnit::toString() const {
+	std::ostringstream oss;
+	oss << "SampleRangeWorkUnit[offset=" << getOffset().toString() 
+		<< ", size=" << getSize().toString() 
+		<< ", firstSample=" << m_firstSample
+		<< ", sampleCount=" << m_sampleCount << "]";
+	return oss.str();
+}
+
 MTS_IMPLEMENT_CLASS(RectangularWorkUnit, false, WorkUnit)
+MTS_IMPLEMENT_CLASS(SampleRangeWorkUnit, false, RectangularWorkUnit)
 MTS_NAMESPACE_END
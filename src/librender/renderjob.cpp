@@ -119,6 +119,11 @@ void RenderJob::run() {
 			}
             Log(EDebug, "Postprocessing scene \"%s\" (ID: %i)", m_scene->getSourceFile().leaf().c_str(), m_sceneResID);
 			m_scene->postprocess(m_queue, this, m_sceneResID, m_cameraResID, m_samplerResID);
+
+			/* The output image has been written -- the checkpoint is no longer needed */
+			const fs::path &checkpoint = m_scene->getCheckpointFile();
+			if (!m_cancelled && !checkpoint.empty() && fs::exists(checkpoint))
+				fs::remove(checkpoint);
 		}
 
 		if (m_testSupervisor.get()) 
@@ -21,6 +21,10 @@
 #include <mitsuba/render/renderproc.h>
 #include <mitsuba/render/rectwu.h>
 
+/// Checkpoint file identifier and format version
+#define MTS_CHECKPOINT_MAGIC   0x4B48434D /* "MCHK" */
+#define MTS_CHECKPOINT_VERSION 2
+
 MTS_NAMESPACE_BEGIN
 
 class BlockRenderer : public WorkProcessor {
@@ -36,7 +40,7 @@ public:
 	}
 
 	ref<WorkUnit> createWorkUnit() const {
-		return new RectangularWorkUnit();
+		return new SampleRangeWorkUnit();
 	}
 
 	ref<WorkResult> createWorkResult() const {
@@ -60,7 +64,7 @@ public:
 
 	void process(const WorkUnit *workUnit, WorkResult *workResult, 
 		const bool &stop) {
-		const RectangularWorkUnit *rect = static_cast<const RectangularWorkUnit *>(workUnit);
+		const SampleRangeWorkUnit *rect = static_cast<const SampleRangeWorkUnit *>(workUnit);
 		ImageBlock *block = static_cast<ImageBlock *>(workResult);
 
 #ifdef MTS_DEBUG_FP
@@ -70,8 +74,17 @@ public:
 		block->setOffset(rect->getOffset());
 		block->setSize(rect->getSize());
 		m_hilbertCurve.initialize(rect->getSize());
-		m_integrator->renderBlock(m_scene, m_camera, m_sampler, 
-			block, stop, &m_hilbertCurve.getPoints());
+		if (rect->getSampleCount() == 0) {
+			m_integrator->renderBlock(m_scene, m_camera, m_sampler, 
+				block, stop, &m_hilbertCurve.getPoints());
+		} else {
+			/* Adaptive sampling pass -- also report the sample range, 
+			   which identifies the work unit */
+			m_integrator->renderSampleRange(m_scene, m_camera, m_sampler, 
+				block, stop, &m_hilbertCurve.getPoints(), 
+				rect->getFirstSample(), rect->getSampleCount());
+			block->setExtra((int32_t) rect->getFirstSample());
+		}
 
 #ifdef MTS_DEBUG_FP
 		disableFPExceptions();
@@ -109,6 +122,28 @@ BlockedRenderProcess::BlockedRenderProcess(const RenderJob *parent, RenderQueue
 	m_parent = parent;
 	m_resultCount = 0;
 	m_resultMutex = new Mutex();
+	m_adaptive = false;
+	m_resume = false;
+	m_checkpointSampleCount = 0;
+}
+
+void BlockedRenderProcess::setAdaptiveSampling(size_t maxSampleCount, 
+		Float budget, int passCount) {
+	m_adaptive = true;
+	m_maxSampleCount = maxSampleCount;
+	m_budget = std::max((Float) 1, budget * maxSampleCount);
+	m_passCount = passCount;
+	/* Spend a quarter of the budget on the uniform base pass. At least 
+	   two samples are needed per pixel to estimate the variance */
+	m_baseSampleCount = std::min(maxSampleCount, 
+		std::max((size_t) 2, (size_t) (m_budget / 4 + 0.5f)));
+}
+
+void BlockedRenderProcess::setCheckpoint(const fs::path &path, bool resume,
+		size_t sampleCount) {
+	m_checkpointPath = path;
+	m_resume = resume;
+	m_checkpointSampleCount = sampleCount;
 }
 
 BlockedRenderProcess::~BlockedRenderProcess() {
@@ -124,15 +159,167 @@ void BlockedRenderProcess::processResult(const WorkResult *result, bool cancelle
 	const ImageBlock *block = static_cast<const ImageBlock *>(result);
 	m_resultMutex->lock();
 	m_film->putImageBlock(block);
-	m_progress->update(++m_resultCount);
+	if (m_checkpoint && !cancelled)
+		writeCheckpoint(block);
+	bool reschedule = accountResult(block, cancelled);
 	m_resultMutex->unlock();
 	m_queue->signalWorkEnd(m_parent, block);
+
+	if (reschedule)
+		Scheduler::getInstance()->schedule(this);
+}
+
+bool BlockedRenderProcess::accountResult(const ImageBlock *block, bool cancelled) {
+	if (!m_adaptive) {
+		m_progress->update(++m_resultCount);
+		return false;
+	}
+
+	++m_resultCount;
+	size_t tileIndex = getBlockIndex(block->getOffset());
+	std::map<std::pair<size_t, size_t>, size_t>::const_iterator it = 
+		m_passIndex.find(std::make_pair(tileIndex, (size_t) block->getExtra()));
+	if (it == m_passIndex.end())
+		Log(EError, "Internal error: received an image block that does "
+			"not belong to the current adaptive sampling pass!");
+	const AdaptiveWork &work = m_passWork[it->second];
+	AdaptiveTile &tile = m_tiles[tileIndex];
+	m_done[it->second] = true;
+
+	if (!cancelled && work.sampleCount > 1) {
+		/* Combine with the previous estimates (weighted by
+		   their degrees of freedom) */
+		size_t weight = work.sampleCount - 1;
+		tile.variance = (tile.variance * tile.varianceWeight
+			+ block->getVarianceEstimate() * weight)
+			/ (Float) (tile.varianceWeight + weight);
+		tile.varianceWeight += weight;
+	}
+
+	m_samplesDone += work.sampleCount;
+	m_progress->update(std::min(m_samplesDone, m_samplesTotal));
+
+	if (++m_passFinished == m_passWork.size() && !cancelled) {
+		m_finished = !planAdaptivePass();
+		/* The process may have been paused while waiting
+		   for this pass to finish -- wake it up */
+		return true;
+	}
+	return false;
+}
+
+bool BlockedRenderProcess::planAdaptivePass() {
+	m_passWork.clear();
+	m_passIndex.clear();
+	m_passGenerated = m_passFinished = 0;
+
+	Float maxVariance = 0, totalPixels = 0;
+	for (size_t i=0; i<m_tiles.size(); ++i) {
+		maxVariance = std::max(maxVariance, m_tiles[i].variance);
+		totalPixels += m_tiles[i].size.x * m_tiles[i].size.y;
+	}
+	if (maxVariance == 0)
+		return false; /* Noise-free image, nothing left to do */
+
+	const Float maxSamples = (Float) m_maxSampleCount;
+	const size_t chunkSize = std::max(m_baseSampleCount, (size_t) m_budget);
+
+	while (m_pass < m_passCount) {
+		++m_pass;
+
+		/* Total sample count after this pass */
+		Float target = totalPixels * (m_baseSampleCount + (m_budget - m_baseSampleCount)
+			* m_pass / (Float) m_passCount);
+
+		/* Equalize the relative variance of all tiles, i.e. make the
+		   sample count of each tile proportional to its per-sample
+		   variance (within the given bounds). The proportionality
+		   constant is found using a bisection search in log space */
+		Float logMin = std::log(maxVariance / maxSamples) - 30,
+			  logMax = std::log(maxVariance) + 1;
+		for (int it=0; it<60; ++it) {
+			Float logTau = (logMin + logMax) / 2, tau = std::exp(logTau),
+				  total = 0;
+			for (size_t i=0; i<m_tiles.size(); ++i) {
+				const AdaptiveTile &tile = m_tiles[i];
+				Float count = std::max((Float) tile.sampleCount,
+					std::min(maxSamples, tile.variance / tau));
+				total += count * tile.size.x * tile.size.y;
+			}
+			if (total > target)
+				logMin = logTau;
+			else
+				logMax = logTau;
+		}
+		Float tau = std::exp(logMax);
+
+		/* Generate the work units (in the spiral order of the base pass) */
+		Float totalSamples = 0;
+		for (size_t j=0; j<m_spiralOrder.size(); ++j) {
+			size_t i = m_spiralOrder[j];
+			AdaptiveTile &tile = m_tiles[i];
+			Float count = std::min(maxSamples, tile.variance / tau);
+			if (count <= tile.sampleCount)
+				continue;
+			size_t extra = (size_t) (count - tile.sampleCount + 0.5f);
+			if (extra == 0)
+				continue;
+
+			/* Split large sample counts into several work units */
+			size_t chunks = (extra + chunkSize - 1) / chunkSize;
+			for (size_t k=0; k<chunks; ++k) {
+				size_t first = extra * k / chunks,
+					   last = extra * (k+1) / chunks;
+				m_passIndex[std::make_pair(i, tile.sampleCount + first)] = m_passWork.size();
+				m_passWork.push_back(AdaptiveWork(i,
+					tile.sampleCount + first, last - first));
+			}
+			tile.sampleCount += extra;
+			totalSamples += extra * tile.size.x * tile.size.y;
+		}
+
+		if (!m_passWork.empty()) {
+			m_done.assign(m_passWork.size(), false);
+			Log(EInfo, "Adaptive sampling: starting pass %i/%i (%i work units, "
+				"%.2f additional samples per pixel on average)", m_pass, m_passCount,
+				(int) m_passWork.size(), totalSamples / totalPixels);
+			return true;
+		}
+	}
+	return false;
 }
 
 ParallelProcess::EStatus BlockedRenderProcess::generateWork(WorkUnit *unit, int worker) {
-	EStatus status = BlockedImageProcess::generateWork(unit, worker);
+	SampleRangeWorkUnit *rect = static_cast<SampleRangeWorkUnit *>(unit);
+	EStatus status;
+
+	if (!m_adaptive) {
+		/* Skip blocks that were restored from a checkpoint */
+		do {
+			status = BlockedImageProcess::generateWork(unit, worker);
+		} while (status == ESuccess && m_done[getBlockIndex(rect->getOffset())]);
+		rect->setSampleRange(0, 0);
+	} else {
+		m_resultMutex->lock();
+		while (m_passGenerated < m_passWork.size() && m_done[m_passGenerated])
+			++m_passGenerated;
+		if (m_passGenerated < m_passWork.size()) {
+			const AdaptiveWork &work = m_passWork[m_passGenerated++];
+			const AdaptiveTile &tile = m_tiles[work.tile];
+			rect->setOffset(tile.offset);
+			rect->setSize(tile.size);
+			rect->setSampleRange(work.firstSample, work.sampleCount);
+			status = ESuccess;
+		} else {
+			/* The next pass can only be planned once all results
+			   of the current one have arrived */
+			status = m_finished ? EFailure : EPause;
+		}
+		m_resultMutex->unlock();
+	}
+
 	if (status == ESuccess)
-		m_queue->signalWorkBegin(m_parent, static_cast<RectangularWorkUnit *>(unit), worker);
+		m_queue->signalWorkBegin(m_parent, rect, worker);
 	return status;
 }
 
@@ -154,10 +341,176 @@ void BlockedRenderProcess::bindResource(const std::string &name, int id) {
 		BlockedImageProcess::init(offset, size, m_blockSize);
 		if (m_progress)
 			delete m_progress;
-		m_progress = new ProgressReporter("Rendering", m_numBlocksTotal, m_parent);
+
+		if (!m_adaptive) {
+			m_progress = new ProgressReporter("Rendering", m_numBlocksTotal, m_parent);
+			m_done.assign(m_numBlocksTotal, false);
+		} else {
+			/* Enumerate the tiles in spiral order and schedule a
+			   uniform base pass */
+			ref<RectangularWorkUnit> rect = new RectangularWorkUnit();
+			m_tiles.resize(m_numBlocksTotal);
+			m_spiralOrder.clear();
+			m_passWork.clear();
+			m_passIndex.clear();
+			while (BlockedImageProcess::generateWork(rect, 0) == ESuccess) {
+				size_t index = getBlockIndex(rect->getOffset());
+				AdaptiveTile &tile = m_tiles[index];
+				tile.offset = rect->getOffset();
+				tile.size = rect->getSize();
+				tile.sampleCount = m_baseSampleCount;
+				tile.variance = 0;
+				tile.varianceWeight = 0;
+				m_spiralOrder.push_back(index);
+				m_passIndex[std::make_pair(index, (size_t) 0)] = m_passWork.size();
+				m_passWork.push_back(AdaptiveWork(index, 0, m_baseSampleCount));
+			}
+			m_done.assign(m_passWork.size(), false);
+			m_pass = 0;
+			m_passGenerated = m_passFinished = 0;
+			m_finished = false;
+			m_samplesDone = 0;
+			m_samplesTotal = (size_t) (m_budget * m_tiles.size());
+			m_progress = new ProgressReporter("Rendering", m_samplesTotal, m_parent);
+			Log(EInfo, "Adaptive sampling: base pass with " SIZE_T_FMT " samples per pixel, "
+				"%.1f on average (at most " SIZE_T_FMT ")", m_baseSampleCount, m_budget,
+				m_maxSampleCount);
+		}
+
+		if (!m_checkpointPath.empty())
+			openCheckpoint();
 	}
 	BlockedImageProcess::bindResource(name, id);
 }
+
+void BlockedRenderProcess::openCheckpoint() {
+	bool resume = m_resume && fs::exists(m_checkpointPath);
+	if (m_resume && !resume)
+		Log(EWarn, "Checkpoint file \"%s\" does not exist -- starting "
+			"from scratch", m_checkpointPath.file_string().c_str());
+
+	m_checkpoint = new FileStream(m_checkpointPath, resume ? 
+		FileStream::EReadWrite : FileStream::ETruncReadWrite);
+	m_checkpointBuffer = new MemoryStream();
+
+	/* The header stores everything that determines the work units */
+	m_checkpointBuffer->writeUInt(MTS_CHECKPOINT_MAGIC);
+	m_checkpointBuffer->writeShort(MTS_CHECKPOINT_VERSION);
+	m_film->getSize().serialize(m_checkpointBuffer);
+	m_offset.serialize(m_checkpointBuffer);
+	m_size.serialize(m_checkpointBuffer);
+	m_checkpointBuffer->writeInt(m_blockSize);
+	m_checkpointBuffer->writeInt(m_borderSize);
+	m_checkpointBuffer->writeBool(m_adaptive);
+	if (m_adaptive) {
+		m_checkpointBuffer->writeSize(m_maxSampleCount);
+		m_checkpointBuffer->writeSize(m_baseSampleCount);
+		m_checkpointBuffer->writeFloat(m_budget);
+		m_checkpointBuffer->writeInt(m_passCount);
+	} else {
+		/* Finished blocks are not re-rendered, hence their 
+		   sample count must match that of the current run */
+		m_checkpointBuffer->writeSize(m_checkpointSampleCount);
+	}
+	size_t headerSize = m_checkpointBuffer->getPos();
+
+	if (resume) {
+		std::vector<uint8_t> header(headerSize);
+		if (m_checkpoint->getSize() >= headerSize)
+			m_checkpoint->read(&header[0], headerSize);
+		if (m_checkpoint->getSize() < headerSize || memcmp(&header[0], 
+				m_checkpointBuffer->getData(), headerSize) != 0)
+			Log(EError, "Checkpoint file \"%s\" was created with different settings "
+				"(image resolution, crop window, block size, reconstruction filter, "
+				"sample count or adaptive sampling parameters) and cannot be resumed!",
+				m_checkpointPath.file_string().c_str());
+		replayCheckpoint();
+	} else {
+		m_checkpoint->write(m_checkpointBuffer->getData(), headerSize);
+		m_checkpoint->flush();
+	}
+}
+
+void BlockedRenderProcess::replayCheckpoint() {
+	ref<ImageBlock> blocks[2];
+	size_t pos = m_checkpoint->getPos(), fileSize = m_checkpoint->getSize();
+	int blockCount = 0;
+
+	/* Each record consists of its size, a statistics flag 
+	   and a serialized image block */
+	while (pos + sizeof(uint32_t) <= fileSize) {
+		size_t recordSize = m_checkpoint->readUInt();
+		if (pos + sizeof(uint32_t) + recordSize > fileSize)
+			break; /* Incomplete record */
+
+		bool statistics = m_checkpoint->readBool();
+		ref<ImageBlock> &block = blocks[statistics ? 1 : 0];
+		if (!block)
+			block = new ImageBlock(Vector2i(m_blockSize, m_blockSize), 
+				m_borderSize, true, true, false, statistics);
+		block->load(m_checkpoint);
+
+		/* Make sure that the record refers to a pending work unit */
+		const Vector2i rel = block->getOffset() - m_offset;
+		bool valid = m_checkpoint->getPos() == pos + sizeof(uint32_t) + recordSize
+			&& rel.x >= 0 && rel.y >= 0 && rel.x < m_size.x && rel.y < m_size.y
+			&& rel.x % m_blockSize == 0 && rel.y % m_blockSize == 0;
+		if (valid) {
+			size_t index = getBlockIndex(block->getOffset());
+			if (!m_adaptive) {
+				valid = !m_done[index];
+				if (valid)
+					m_done[index] = true;
+			} else {
+				std::map<std::pair<size_t, size_t>, size_t>::const_iterator it = 
+					m_passIndex.find(std::make_pair(index, (size_t) block->getExtra()));
+				valid = it != m_passIndex.end() && !m_done[it->second];
+			}
+		}
+		if (!valid) {
+			Log(EWarn, "Record %i of the checkpoint file is inconsistent with the "
+				"current render job -- discarding it and all following records", 
+				blockCount);
+			break;
+		}
+
+		m_film->putImageBlock(block);
+		accountResult(block, false);
+		pos = m_checkpoint->getPos();
+		++blockCount;
+	}
+
+	if (pos != fileSize) {
+		Log(EWarn, "Truncating the checkpoint file (discarding " SIZE_T_FMT 
+			" bytes)", fileSize - pos);
+		m_checkpoint->truncate(pos);
+	}
+	m_checkpoint->setPos(pos);
+
+	Log(EInfo, "Resumed %i image blocks from the checkpoint file \"%s\"",
+		blockCount, m_checkpointPath.file_string().c_str());
+}
+
+void BlockedRenderProcess::writeCheckpoint(const ImageBlock *block) {
+	/* Serialize into memory first so that each record is appended
+	   using a single write operation */
+	m_checkpointBuffer->reset();
+	m_checkpointBuffer->writeUInt(0);
+	m_checkpointBuffer->writeBool(block->collectStatistics());
+	block->save(m_checkpointBuffer);
+	size_t size = m_checkpointBuffer->getPos();
+	m_checkpointBuffer->setPos(0);
+	m_checkpointBuffer->writeUInt((uint32_t) (size - sizeof(uint32_t)));
+
+	try {
+		m_checkpoint->write(m_checkpointBuffer->getData(), size);
+		m_checkpoint->flush();
+	} catch (const std::exception &ex) {
+		Log(EWarn, "Could not write to the checkpoint file (%s) -- "
+			"disabling checkpoints", ex.what());
+		m_checkpoint = NULL;
+	}
+}
 		
 MTS_IMPLEMENT_CLASS(BlockedRenderProcess, false, BlockedImageProcess)
 MTS_IMPLEMENT_CLASS_S(BlockRenderer, false, WorkProcessor)
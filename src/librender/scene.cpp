@@ -23,7 +23,7 @@
 MTS_NAMESPACE_BEGIN
 
 Scene::Scene(const Properties &props)
- : NetworkedObject(props), m_blockSize(32) {
+ : NetworkedObject(props), m_resumeCheckpoint(false), m_blockSize(32) {
 	m_kdtree = new ShapeKDTree();
 	/* When test case mode is active (Mitsuba is started with the -t parameter), 
 	  this specifies the type of test performed. Mitsuba will expect a reference 
@@ -49,6 +49,10 @@ Scene::Scene(const Properties &props)
 	  dependent on the emitted power. Setting this parameter to false switches 
 	  to uniform sampling. */
 	m_importanceSampleLuminaires = props.getBoolean("importanceSampleLuminaires", true);
+	/* Choose luminaires for direct illumination sampling using a bounding
+	   volume hierarchy, which takes the position of the shading point into 
+	   account. Recommended for scenes with many localized light sources. */
+	m_useLightTree = props.getBoolean("lightTree", false);
 	/* kd-tree construction: Enable primitive clipping? Generally leads to a 
 	  significant improvement of the resulting tree. */
 	if (props.hasProperty("kdClip"))
@@ -86,6 +90,10 @@ Scene::Scene(const Properties &props)
 	   in succession before a leaf node will be created.*/
 	if (props.hasProperty("kdMaxBadRefines"))
 		m_kdtree->setMaxBadRefines(props.getInteger("kdMaxBadRefines"));
+	/* kd-tree construction: Store built trees in this directory and 
+	   reuse them when the geometry and parameters have not changed */
+	if (props.hasProperty("kdCacheDirectory"))
+		m_kdtree->setCacheDirectory(props.getString("kdCacheDirectory"));
 }
 
 Scene::Scene(Scene *scene) : NetworkedObject(Properties()) {
@@ -93,6 +101,8 @@ Scene::Scene(Scene *scene) : NetworkedObject(Properties()) {
 	m_testType = scene->m_testType;
 	m_testThresh = scene->m_testThresh;
 	m_blockSize = scene->m_blockSize;
+	m_checkpointFile = scene->m_checkpointFile;
+	m_resumeCheckpoint = scene->m_resumeCheckpoint;
 	m_aabb = scene->m_aabb;
 	m_bsphere = scene->m_bsphere;
 	m_backgroundLuminaire = scene->m_backgroundLuminaire;
@@ -102,6 +112,8 @@ Scene::Scene(Scene *scene) : NetworkedObject(Properties()) {
 	m_destinationFile = scene->m_destinationFile;
 	m_luminairePDF = scene->m_luminairePDF;
 	m_importanceSampleLuminaires = scene->m_importanceSampleLuminaires;
+	m_useLightTree = scene->m_useLightTree;
+	m_lightTree = scene->m_lightTree;
 	m_shapes = scene->m_shapes;
 	for (size_t i=0; i<m_shapes.size(); ++i)
 		m_shapes[i]->incRef();
@@ -128,7 +140,7 @@ Scene::Scene(Scene *scene) : NetworkedObject(Properties()) {
 
 
 Scene::Scene(Stream *stream, InstanceManager *manager) 
- : NetworkedObject(stream, manager) {
+ : NetworkedObject(stream, manager), m_resumeCheckpoint(false) {
 	m_kdtree = new ShapeKDTree();
 	m_kdtree->setQueryCost(stream->readFloat());
 	m_kdtree->setTraversalCost(stream->readFloat());
@@ -141,6 +153,7 @@ Scene::Scene(Stream *stream, InstanceManager *manager)
 	m_kdtree->setRetract(stream->readBool());
 	m_kdtree->setMaxBadRefines(stream->readUInt());
 	m_importanceSampleLuminaires = stream->readBool();
+	m_useLightTree = stream->readBool();
 	m_testType = (ETestType) stream->readInt();
 	m_testThresh = stream->readFloat();
 	m_blockSize = stream->readInt();
@@ -333,6 +346,9 @@ void Scene::initialize() {
 			it != m_luminaires.end(); ++it) 
 			(*it)->preprocess(this);
 	}
+
+	if (m_useLightTree && !m_lightTree)
+		m_lightTree = new LightTree(m_luminaires, m_importanceSampleLuminaires);
 }
 
 bool Scene::preprocess(RenderQueue *queue, const RenderJob *job, 
@@ -381,15 +397,20 @@ void Scene::postprocess(RenderQueue *queue, const RenderJob *job,
 Float Scene::pdfLuminaire(const Point &p,
 		const LuminaireSamplingRecord &lRec, bool delta) const {
 	const Luminaire *luminaire = lRec.luminaire;
-	Float luminance;
-
-	if (m_importanceSampleLuminaires)
-		luminance = luminaire->getSamplingWeight();
-	else 
-		luminance = 1.0f;
+	Float fraction;
 
 	/* Calculate the probability of importance sampling this luminaire */
-	const Float fraction = luminance / m_luminairePDF.getOriginalSum();
+	if (m_lightTree.get()) {
+		fraction = m_lightTree->pdf(p, luminaire);
+	} else {
+		Float luminance;
+		if (m_importanceSampleLuminaires)
+			luminance = luminaire->getSamplingWeight();
+		else 
+			luminance = 1.0f;
+		fraction = luminance / m_luminairePDF.getOriginalSum();
+	}
+
 	return luminaire->pdf(p, lRec, delta) * fraction;
 }
 
@@ -398,8 +419,7 @@ bool Scene::sampleLuminaire(const Point &p, Float time,
 		bool testVisibility) const {
 	Point2 sample(s);
 	Float lumPdf;
-	size_t index = m_luminairePDF.sampleReuse(sample.x, lumPdf);
-	const Luminaire *luminaire = m_luminaires[index];
+	const Luminaire *luminaire = chooseLuminaire(p, sample.x, lumPdf);
 	luminaire->sample(p, lRec, sample);
 
 	if (lRec.pdf != 0) {
@@ -414,6 +434,19 @@ bool Scene::sampleLuminaire(const Point &p, Float time,
 	}
 }
 
+void Scene::isOccluded(const Point &p1, const Point *p2, size_t count,
+		Float time, bool *occluded) const {
+	const size_t chunkSize = 4 * MTS_KD_PACKET_SIZE;
+	Ray rays[chunkSize];
+
+	for (size_t i=0; i<count; i += chunkSize) {
+		size_t n = std::min(count - i, chunkSize);
+		for (size_t j=0; j<n; ++j)
+			rays[j] = Ray(p1, p2[i+j]-p1, ShadowEpsilon, 1-ShadowEpsilon, time);
+		m_kdtree->rayIntersect(rays, occluded + i, n);
+	}
+}
+
 Spectrum Scene::getTransmittance(const Point &p1, const Point &p2,
 		Float time, const Medium *medium, Sampler *sampler) const {
 	if (m_media.size() == 0) {
@@ -501,8 +534,7 @@ bool Scene::sampleAttenuatedLuminaire(const Point &p, Float time,
 	const Point2 &s, Sampler *sampler) const {
 	Point2 sample(s);
 	Float lumPdf;
-	const Luminaire *luminaire = m_luminaires[
-		m_luminairePDF.sampleReuse(sample.x, lumPdf)];
+	const Luminaire *luminaire = chooseLuminaire(p, sample.x, lumPdf);
 	luminaire->sample(p, lRec, sample);
 
 	if (lRec.pdf != 0) {
@@ -522,8 +554,7 @@ bool Scene::sampleAttenuatedLuminaire(const Intersection &its,
 	const Point2 &s, Sampler *sampler) const {
 	Point2 sample(s);
 	Float lumPdf;
-	const Luminaire *luminaire = m_luminaires[
-		m_luminairePDF.sampleReuse(sample.x, lumPdf)];
+	const Luminaire *luminaire = chooseLuminaire(its.p, sample.x, lumPdf);
 	luminaire->sample(its.p, lRec, sample);
 
 	if (lRec.pdf != 0) {
@@ -720,6 +751,7 @@ void Scene::serialize(Stream *stream, InstanceManager *manager) const {
 	stream->writeBool(m_kdtree->getRetract());
 	stream->writeUInt(m_kdtree->getMaxBadRefines());
 	stream->writeBool(m_importanceSampleLuminaires);
+	stream->writeBool(m_useLightTree);
 	stream->writeInt(m_testType);
 	stream->writeFloat(m_testThresh);
 	stream->writeInt(m_blockSize);
@@ -757,6 +789,7 @@ std::string Scene::toString() const {
 		<< "  testType = " << ((m_testType == ETTest) ? "t-test" : "relerr") << ", " << endl
 		<< "  testThresh = " << m_testThresh << ", " << endl
 		<< "  importanceSampleLuminaires = " << (int) m_importanceSampleLuminaires << ", " << endl
+		<< "  lightTree = " << indent(m_lightTree.toString()) << "," << endl
 		<< "  camera = " << indent(m_camera.toString()) << "," << endl
 		<< "  sampler = " << indent(m_sampler.toString()) << "," << endl
 		<< "  integrator = " << indent(m_integrator.toString()) << "," << endl
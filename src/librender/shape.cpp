@@ -62,6 +62,18 @@ AABB Shape::getClippedAABB(const AABB &box) const {
 	return result;
 }
 
+size_t Shape::getTimeSegmentCount() const {
+	return 1;
+}
+
+size_t Shape::getTimeSegment(Float time) const {
+	return 0;
+}
+
+AABB Shape::getTimeSegmentAABB(size_t segment) const {
+	return getAABB();
+}
+
 Float Shape::sampleSolidAngle(ShapeSamplingRecord &sRec, 
 		const Point &from, const Point2 &sample) const {
 	/* Turns the area sampling routine into one that samples wrt. solid angles */
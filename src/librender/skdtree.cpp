@@ -18,6 +18,12 @@
 
 #include <mitsuba/render/skdtree.h>
 #include <mitsuba/core/statistics.h>
+#include <mitsuba/core/fstream.h>
+#include <boost/filesystem/operations.hpp>
+
+#if !defined(WIN32)
+#include <unistd.h>
+#endif
 
 MTS_NAMESPACE_BEGIN
 
@@ -30,7 +36,8 @@ ShapeKDTree::ShapeKDTree() {
 
 ShapeKDTree::~ShapeKDTree() {
 #if !defined(MTS_KD_CONSERVE_MEMORY)
-	if (m_triAccel)
+	/* Cached TriAccel records are owned by the memory mapping */
+	if (m_triAccel && !m_cacheFile)
 		freeAligned(m_triAccel);
 #endif
 	for (size_t i=0; i<m_shapes.size(); ++i)
@@ -51,9 +58,13 @@ void ShapeKDTree::addShape(const Shape *shape) {
 		m_shapeMap.push_back((size_type) 
 			static_cast<const TriMesh *>(shape)->getTriangleCount());
 		m_triangleFlag.push_back(true);
+		m_timeSegmentFlag.push_back(false);
 	} else {
-		m_shapeMap.push_back(1);
+		/* Moving shapes can be split into several time segments */
+		size_t segmentCount = shape->getTimeSegmentCount();
+		m_shapeMap.push_back((size_type) segmentCount);
 		m_triangleFlag.push_back(false);
+		m_timeSegmentFlag.push_back(segmentCount > 1);
 	}
 	shape->incRef();
 	m_shapes.push_back(shape);
@@ -63,6 +74,18 @@ void ShapeKDTree::build() {
 	for (size_t i=1; i<m_shapeMap.size(); ++i)
 		m_shapeMap[i] += m_shapeMap[i-1];
 
+	fs::path cacheFile;
+	uint64_t cacheKey = 0;
+	if (!m_cacheDirectory.empty() && getPrimitiveCount() > 0) {
+		cacheKey = getCacheKey();
+		cacheFile = m_cacheDirectory / formatString("kdtree_%08x%08x.cache",
+			(uint32_t) (cacheKey >> 32), (uint32_t) cacheKey);
+		if (fs::exists(cacheFile) && loadCache(cacheFile, cacheKey)) {
+			m_bsphere = m_aabb.getBSphere();
+			return;
+		}
+	}
+
 	SAHKDTree3D<ShapeKDTree>::buildInternal();
 		
 	m_bsphere = m_aabb.getBSphere();
@@ -92,17 +115,265 @@ void ShapeKDTree::build() {
 				++idx;
 			}
 		} else {
-			/* Create a 'fake' triangle, which redirects to a Shape */
-			memset(&m_triAccel[idx], 0, sizeof(TriAccel));
-			m_triAccel[idx].shapeIndex = i;
-			m_triAccel[idx].k = KNoTriangleFlag;
-			++idx;
+			/* Create 'fake' triangles, which redirect to a Shape
+			   (one per time segment of moving shapes) */
+			for (index_type j=0; j<m_shapeMap[i+1]-m_shapeMap[i]; ++j) {
+				memset(&m_triAccel[idx], 0, sizeof(TriAccel));
+				m_triAccel[idx].shapeIndex = i;
+				m_triAccel[idx].primIndex = j;
+				m_triAccel[idx].k = KNoTriangleFlag;
+				++idx;
+			}
 		}
 	}
 	Log(EDebug, "Finished -- took %i ms.", timer->getMilliseconds());
 	Log(EDebug, "");
 	KDAssert(idx == primCount);
 #endif
+
+	if (!cacheFile.empty())
+		saveCache(cacheFile, cacheKey);
+}
+
+/* ==================================================================== */
+/*                         On-disk kd-tree cache                        */
+/* ==================================================================== */
+
+/* Increase whenever the layout of the cache files or 
+   the tree construction algorithm changes */
+#define MTS_KD_CACHE_VERSION 2
+
+/* Alignment of the arrays stored in a cache file */
+#define MTS_KD_CACHE_ALIGNMENT 64
+
+namespace {
+	/// Header of a kd-tree cache file
+	struct KDCacheHeader {
+		char magic[4];
+		uint32_t version;
+		uint64_t key;
+		uint32_t primCount;
+		uint32_t nodeCount;
+		uint32_t indexCount;
+		uint32_t triAccelCount;
+		uint64_t nodeOffset;
+		uint64_t indexOffset;
+		uint64_t triAccelOffset;
+		AABB aabb, tightAABB;
+	};
+
+	/// Simple 64-bit hash function for the cache key (FNV-1a variant)
+	class KDCacheHash {
+	public:
+		KDCacheHash() : m_state(0xcbf29ce484222325ULL) { }
+
+		inline void put(const void *data, size_t size) {
+			const uint8_t *ptr = static_cast<const uint8_t *>(data);
+			/* Process 8 bytes at a time -- meshes can be large */
+			while (size >= sizeof(uint64_t)) {
+				uint64_t value;
+				memcpy(&value, ptr, sizeof(uint64_t));
+				m_state = (m_state ^ value) * 0x100000001b3ULL;
+				m_state ^= m_state >> 29;
+				ptr += sizeof(uint64_t); size -= sizeof(uint64_t);
+			}
+			while (size-- > 0)
+				m_state = (m_state ^ *ptr++) * 0x100000001b3ULL;
+		}
+
+		template <typename T> inline void put(const T &value) {
+			put(&value, sizeof(T));
+		}
+
+		inline uint64_t get() const { return m_state; }
+	private:
+		uint64_t m_state;
+	};
+
+	inline uint64_t alignCacheOffset(uint64_t offset) {
+		return (offset + MTS_KD_CACHE_ALIGNMENT - 1) 
+			& ~((uint64_t) MTS_KD_CACHE_ALIGNMENT - 1);
+	}
+};
+
+uint64_t ShapeKDTree::getCacheKey() const {
+	KDCacheHash hash;
+	ref<Timer> timer = new Timer();
+
+	/* Compilation settings that affect the file contents */
+	hash.put((uint32_t) MTS_KD_CACHE_VERSION);
+	hash.put((uint32_t) sizeof(Float));
+	hash.put((uint32_t) sizeof(KDNode));
+	hash.put((uint32_t) sizeof(index_type));
+	hash.put((uint32_t) 0x01020304); // byte order
+#if !defined(MTS_KD_CONSERVE_MEMORY)
+	hash.put((uint32_t) sizeof(TriAccel));
+#endif
+
+	/* Tree construction parameters */
+	hash.put(m_traversalCost);
+	hash.put(m_queryCost);
+	hash.put(m_emptySpaceBonus);
+	hash.put(m_clip);
+	hash.put(m_retract);
+	hash.put(m_maxDepth);
+	hash.put(m_stopPrims);
+	hash.put(m_maxBadRefines);
+	hash.put(m_exactPrimThreshold);
+	hash.put(m_minMaxBins);
+
+	/* Geometry */
+	for (size_t i=0; i<m_shapes.size(); ++i) {
+		const Shape *shape = m_shapes[i];
+		if (m_triangleFlag[i]) {
+			const TriMesh *mesh = static_cast<const TriMesh *>(shape);
+			hash.put((uint64_t) mesh->getTriangleCount());
+			hash.put((uint64_t) mesh->getVertexCount());
+			hash.put(mesh->getTriangles(), 
+				sizeof(Triangle) * mesh->getTriangleCount());
+			hash.put(mesh->getVertexPositions(), 
+				sizeof(Point) * mesh->getVertexCount());
+		} else {
+			/* Generic primitives are only referenced by their
+			   bounds and clipped bounds, which depend on the 
+			   shape parameters listed by toString() */
+			std::string desc = shape->toString();
+			AABB aabb = shape->getAABB();
+			hash.put(desc.c_str(), desc.length());
+			hash.put(aabb);
+			if (m_timeSegmentFlag[i]) {
+				size_t segmentCount = shape->getTimeSegmentCount();
+				hash.put((uint64_t) segmentCount);
+				for (size_t j=0; j<segmentCount; ++j)
+					hash.put(shape->getTimeSegmentAABB(j));
+			}
+		}
+	}
+
+	Log(EDebug, "Computed the kd-tree cache key in %i ms", 
+		timer->getMilliseconds());
+	return hash.get();
+}
+
+bool ShapeKDTree::loadCache(const fs::path &filename, uint64_t key) {
+	ref<MemoryMappedFile> mmap;
+	try {
+		mmap = new MemoryMappedFile(filename);
+	} catch (const std::exception &ex) {
+		Log(EWarn, "Unable to map the kd-tree cache file \"%s\": %s", 
+			filename.file_string().c_str(), ex.what());
+		return false;
+	}
+
+	uint8_t *data = static_cast<uint8_t *>(mmap->getData());
+	size_t size = mmap->getSize();
+	KDCacheHeader header;
+	if (size < sizeof(KDCacheHeader)) {
+		Log(EWarn, "The kd-tree cache file \"%s\" is truncated -- rebuilding",
+			filename.file_string().c_str());
+		return false;
+	}
+	memcpy(&header, data, sizeof(KDCacheHeader));
+
+	size_type primCount = getPrimitiveCount();
+	size_t triAccelCount = 0;
+#if !defined(MTS_KD_CONSERVE_MEMORY)
+	triAccelCount = primCount;
+#endif
+
+	if (memcmp(header.magic, "MKDC", 4) != 0 || 
+		header.version != MTS_KD_CACHE_VERSION ||
+		header.key != key || header.primCount != primCount ||
+		header.triAccelCount != triAccelCount) {
+		Log(EWarn, "The kd-tree cache file \"%s\" does not match the "
+			"current scene -- rebuilding", filename.file_string().c_str());
+		return false;
+	}
+
+	/* The node array starts with an unused node (see KDNode::getSibling) */
+	if (header.nodeOffset % MTS_KD_CACHE_ALIGNMENT != 0 ||
+		header.triAccelOffset % MTS_KD_CACHE_ALIGNMENT != 0 ||
+		header.nodeOffset + sizeof(KDNode) * (header.nodeCount+1) > size ||
+		header.indexOffset + sizeof(index_type) * header.indexCount > size ||
+		header.triAccelOffset + sizeof(TriAccel) * triAccelCount > size) {
+		Log(EWarn, "The kd-tree cache file \"%s\" is corrupted -- rebuilding",
+			filename.file_string().c_str());
+		return false;
+	}
+
+	setExternalStorage(reinterpret_cast<KDNode *>(data + header.nodeOffset) + 1,
+		header.nodeCount, reinterpret_cast<index_type *>(data + header.indexOffset),
+		header.indexCount, header.aabb, header.tightAABB);
+#if !defined(MTS_KD_CONSERVE_MEMORY)
+	m_triAccel = reinterpret_cast<TriAccel *>(data + header.triAccelOffset);
+#endif
+	m_cacheFile = mmap;
+
+	Log(EInfo, "Loaded the kd-tree from the cache file \"%s\" (%s)",
+		filename.file_string().c_str(), memString(size).c_str());
+	return true;
+}
+
+void ShapeKDTree::saveCache(const fs::path &filename, uint64_t key) const {
+	/* Value-initialize so that unused fields are zero in the file */
+	KDCacheHeader header = KDCacheHeader();
+	memcpy(header.magic, "MKDC", 4);
+	header.version = MTS_KD_CACHE_VERSION;
+	header.key = key;
+	header.primCount = getPrimitiveCount();
+	header.nodeCount = m_nodeCount;
+	header.indexCount = m_indexCount;
+	header.aabb = m_aabb;
+	header.tightAABB = m_tightAABB;
+	header.nodeOffset = alignCacheOffset(sizeof(KDCacheHeader));
+	header.indexOffset = alignCacheOffset(header.nodeOffset 
+		+ sizeof(KDNode) * (m_nodeCount + 1));
+	header.triAccelOffset = alignCacheOffset(header.indexOffset 
+		+ sizeof(index_type) * m_indexCount);
+#if !defined(MTS_KD_CONSERVE_MEMORY)
+	header.triAccelCount = header.primCount;
+#endif
+
+	/* Write to a temporary file first so that concurrently running 
+	   processes never see a partially written cache file */
+	fs::path tempFile = filename;
+#if defined(WIN32)
+	tempFile.replace_extension(formatString(".%i.tmp", (int) GetCurrentProcessId()));
+#else
+	tempFile.replace_extension(formatString(".%i.tmp", (int) getpid()));
+#endif
+
+	try {
+		if (!fs::exists(m_cacheDirectory))
+			fs::create_directories(m_cacheDirectory);
+
+		ref<FileStream> stream = new FileStream(tempFile, FileStream::ETruncWrite);
+		const uint8_t padding[MTS_KD_CACHE_ALIGNMENT] = { 0 };
+
+		stream->write(&header, sizeof(KDCacheHeader));
+		stream->write(padding, (size_t) (header.nodeOffset - stream->getPos()));
+		stream->write(m_nodes - 1, sizeof(KDNode) * (m_nodeCount + 1));
+		stream->write(padding, (size_t) (header.indexOffset - stream->getPos()));
+		stream->write(m_indices, sizeof(index_type) * m_indexCount);
+#if !defined(MTS_KD_CONSERVE_MEMORY)
+		stream->write(padding, (size_t) (header.triAccelOffset - stream->getPos()));
+		stream->write(m_triAccel, sizeof(TriAccel) * header.triAccelCount);
+#endif
+		stream->close();
+
+		if (fs::exists(filename))
+			fs::remove(filename);
+		fs::rename(tempFile, filename);
+	} catch (const std::exception &ex) {
+		Log(EWarn, "Unable to write the kd-tree cache file \"%s\": %s", 
+			filename.file_string().c_str(), ex.what());
+		if (fs::exists(tempFile))
+			fs::remove(tempFile);
+		return;
+	}
+
+	Log(EDebug, "Wrote the kd-tree cache file \"%s\"", 
+		filename.file_string().c_str());
 }
 
 bool ShapeKDTree::rayIntersect(const Ray &ray, Intersection &its) const {
@@ -198,11 +469,127 @@ bool ShapeKDTree::rayIntersect(const Ray &ray) const {
 	return false;
 }
 
-
 #if defined(MTS_HAS_COHERENT_RT)
 static StatsCounter coherentPackets("General", "Coherent ray packets");
 static StatsCounter incoherentPackets("General", "Incoherent ray packets");
 
+namespace {
+#if defined(MTS_AVX)
+	typedef RayPacket8 BatchRayPacket;
+	typedef RayInterval8 BatchRayInterval;
+	typedef Intersection8 BatchIntersection;
+#else
+	typedef RayPacket4 BatchRayPacket;
+	typedef RayInterval4 BatchRayInterval;
+	typedef Intersection4 BatchIntersection;
+#endif
+
+	/**
+	 * Prepare a packet of \ref MTS_KD_PACKET_SIZE rays for coherent tracing,
+	 * including the adaptive ray epsilon of the single-ray code paths. 
+	 * Returns \c false if the rays are not sufficiently coherent.
+	 */
+	inline bool loadBatchPacket(const Ray *rays, bool shadowRays,
+			BatchRayPacket &packet, BatchRayInterval &interval) {
+		for (int i=1; i<MTS_KD_PACKET_SIZE; ++i) {
+			if (rays[i].time != rays[0].time)
+				return false;
+		}
+		if (!packet.load(rays))
+			return false;
+		for (int i=0; i<MTS_KD_PACKET_SIZE; ++i) {
+			const Ray &ray = rays[i];
+			Float mint = ray.mint;
+			if (mint == Epsilon) {
+				Float scale = std::max(std::max(std::abs(ray.o.x), 
+					std::abs(ray.o.y)), std::abs(ray.o.z));
+				mint *= shadowRays ? scale : std::max(scale, Epsilon);
+			}
+			interval.mint.f[i] = mint;
+			interval.maxt.f[i] = ray.maxt;
+		}
+		return true;
+	}
+}
+#endif
+
+void ShapeKDTree::rayIntersect(const Ray *rays, Intersection *its, size_t count) const {
+	size_t i = 0;
+#if defined(MTS_HAS_COHERENT_RT)
+	uint8_t MM_ALIGN16 temp[MTS_KD_INTERSECTION_TEMP * MTS_KD_PACKET_SIZE];
+	BatchRayPacket packet;
+	BatchRayInterval interval;
+
+	for (; i + MTS_KD_PACKET_SIZE <= count; i += MTS_KD_PACKET_SIZE) {
+		if (!loadBatchPacket(rays + i, false, packet, interval)) {
+			for (int j=0; j<MTS_KD_PACKET_SIZE; ++j)
+				rayIntersect(rays[i+j], its[i+j]);
+			continue;
+		}
+
+		BatchIntersection packetIts;
+		rayIntersectPacket(packet, interval, packetIts, temp);
+		raysTraced += MTS_KD_PACKET_SIZE;
+
+		for (int j=0; j<MTS_KD_PACKET_SIZE; ++j) {
+			Intersection &result = its[i+j];
+			result.t = packetIts.t.f[j];
+			if (result.t == std::numeric_limits<Float>::infinity())
+				continue;
+
+			/* Convert into the format expected by fillIntersectionRecord(). 
+			   Non-triangle shapes have already stored their data at offset 8 */
+			IntersectionCache *cache = reinterpret_cast<IntersectionCache *>(
+				temp + j * MTS_KD_INTERSECTION_TEMP);
+			cache->shapeIndex = (size_type) packetIts.shapeIndex.i[j];
+			cache->primIndex = (size_type) packetIts.primIndex.i[j];
+			if (m_triangleFlag[cache->shapeIndex]) {
+				cache->u = packetIts.u.f[j];
+				cache->v = packetIts.v.f[j];
+			}
+			fillIntersectionRecord<true>(rays[i+j], cache, result);
+		}
+	}
+#endif
+	for (; i<count; ++i)
+		rayIntersect(rays[i], its[i]);
+}
+
+void ShapeKDTree::rayIntersect(const Ray *rays, bool *occluded, size_t count) const {
+	size_t i = 0;
+#if defined(MTS_HAS_COHERENT_RT)
+	uint8_t MM_ALIGN16 temp[MTS_KD_INTERSECTION_TEMP * MTS_KD_PACKET_SIZE];
+	BatchRayPacket packet;
+	BatchRayInterval interval;
+
+	for (; i + MTS_KD_PACKET_SIZE <= count; i += MTS_KD_PACKET_SIZE) {
+		if (!loadBatchPacket(rays + i, true, packet, interval)) {
+			for (int j=0; j<MTS_KD_PACKET_SIZE; ++j)
+				occluded[i+j] = rayIntersect(rays[i+j]);
+			continue;
+		}
+
+		BatchIntersection packetIts;
+		rayIntersectPacket(packet, interval, packetIts, temp);
+		shadowRaysTraced += MTS_KD_PACKET_SIZE;
+
+		/* The packet traversal finds the closest intersection with any shape.
+		   If that shape is not an occluder, fall back to a regular shadow ray */
+		for (int j=0; j<MTS_KD_PACKET_SIZE; ++j) {
+			if (packetIts.t.f[j] == std::numeric_limits<Float>::infinity())
+				occluded[i+j] = false;
+			else if (m_shapes[packetIts.shapeIndex.i[j]]->isOccluder())
+				occluded[i+j] = true;
+			else
+				occluded[i+j] = rayIntersect(rays[i+j]);
+		}
+	}
+#endif
+	for (; i<count; ++i)
+		occluded[i] = rayIntersect(rays[i]);
+}
+
+#if defined(MTS_HAS_COHERENT_RT)
 void ShapeKDTree::rayIntersectPacket(const RayPacket4 &packet, 
 		const RayInterval4 &rayInterval, Intersection4 &its, void *temp) const {
 	CoherentKDStackEntry MM_ALIGN16 stack[MTS_KD_MAXDEPTH];
@@ -281,6 +668,9 @@ void ShapeKDTree::rayIntersectPacket(const RayPacket4 &packet,
 						kdTri.rayIntersectPacket(packet, searchStart.ps, searchEnd.ps, masked.ps, its));
 				} else {
 					const Shape *shape = m_shapes[kdTri.shapeIndex];
+					if (!isTimeSegmentActive(shape, kdTri.shapeIndex, 
+							kdTri.primIndex, packet.time))
+						continue;
 
 					for (int i=0; i<4; ++i) {
 						if (masked.i[i])
@@ -291,6 +681,7 @@ void ShapeKDTree::rayIntersectPacket(const RayPacket4 &packet,
 							ray.d[axis] = packet.d[axis].f[i];
 							ray.dRcp[axis] = packet.dRcp[axis].f[i];
 						}
+						ray.time = packet.time;
 						Float t;
 
 						if (shape->rayIntersect(ray, searchStart.f[i], searchEnd.f[i], t, 
@@ -319,6 +710,134 @@ void ShapeKDTree::rayIntersectPacket(const RayPacket4 &packet,
 			_mm_cmpgt_ps(interval.mint.ps, interval.maxt.ps));
 	}
 }
+
+#if defined(MTS_AVX)
+void ShapeKDTree::rayIntersectPacket(const RayPacket8 &packet, 
+		const RayInterval8 &rayInterval, Intersection8 &its, void *temp) const {
+	CoherentKDStackEntry8 MM_ALIGN32 stack[MTS_KD_MAXDEPTH];
+	RayInterval8 MM_ALIGN32 interval;
+
+	const KDNode * __restrict currNode = m_nodes;
+	int stackIndex = 0;
+
+	++coherentPackets;
+
+	/* First, intersect with the kd-tree AABB to determine
+	   the intersection search intervals */
+	if (!m_aabb.rayIntersectPacket(packet, interval))
+		return;
+
+	interval.mint.ps = _mm256_max_ps(interval.mint.ps, rayInterval.mint.ps);
+	interval.maxt.ps = _mm256_min_ps(interval.maxt.ps, rayInterval.maxt.ps);
+
+	AVXVector itsFound, masked;
+	itsFound.ps = _mm256_cmp_ps(interval.mint.ps, interval.maxt.ps, _CMP_GT_OQ);
+	masked.ps = itsFound.ps;
+	if (_mm256_movemask_ps(itsFound.ps) == 0xFF)
+		return;
+
+	const __m256
+		om_eps = _mm256_set1_ps(1-Epsilon),
+		op_eps = _mm256_set1_ps(1+Epsilon);
+
+	while (currNode != NULL) {
+		while (EXPECT_TAKEN(!currNode->isLeaf())) {
+			const uint8_t axis = currNode->getAxis();
+
+			/* Calculate the plane intersection */
+			const __m256
+				splitVal = _mm256_set1_ps(currNode->getSplit()),
+				t = _mm256_mul_ps(_mm256_sub_ps(splitVal, packet.o[axis].ps),
+					packet.dRcp[axis].ps);
+
+			const __m256
+				startsAfterSplit = _mm256_or_ps(masked.ps, 
+					_mm256_cmp_ps(t, interval.mint.ps, _CMP_LT_OQ)),
+				endsBeforeSplit = _mm256_or_ps(masked.ps,
+					_mm256_cmp_ps(t, interval.maxt.ps, _CMP_GT_OQ));
+
+			currNode = currNode->getLeft() + packet.signs[axis][0];
+
+			/* The interval completely completely lies on one side
+			   of the split plane */
+			if (EXPECT_TAKEN(_mm256_movemask_ps(startsAfterSplit) == 0xFF)) {
+				currNode = currNode->getSibling();
+				continue;
+			}
+
+			if (EXPECT_TAKEN(_mm256_movemask_ps(endsBeforeSplit) == 0xFF)) 
+				continue;
+
+			stack[stackIndex].node = currNode->getSibling();
+			stack[stackIndex].interval.maxt =    interval.maxt;
+			stack[stackIndex].interval.mint.ps = _mm256_max_ps(t, interval.mint.ps);
+			interval.maxt.ps =                   _mm256_min_ps(t, interval.maxt.ps);
+			masked.ps = _mm256_or_ps(masked.ps, 	
+					_mm256_cmp_ps(interval.mint.ps, interval.maxt.ps, _CMP_GT_OQ));
+			stackIndex++;
+		}
+
+		/* Arrived at a leaf node - intersect against primitives */
+		const index_type primStart = currNode->getPrimStart();
+		const index_type primEnd = currNode->getPrimEnd();
+
+		if (EXPECT_NOT_TAKEN(primStart != primEnd)) {
+			AVXVector searchStart, searchEnd;
+			searchStart.ps = _mm256_max_ps(rayInterval.mint.ps, 
+				_mm256_mul_ps(interval.mint.ps, om_eps));
+			searchEnd.ps = _mm256_min_ps(rayInterval.maxt.ps, 
+				_mm256_mul_ps(interval.maxt.ps, op_eps));
+
+			for (index_type entry=primStart; entry != primEnd; entry++) {
+				const TriAccel &kdTri = m_triAccel[m_indices[entry]];
+				if (EXPECT_TAKEN(kdTri.k != KNoTriangleFlag)) {
+					itsFound.ps = _mm256_or_ps(itsFound.ps, 
+						kdTri.rayIntersectPacket(packet, searchStart.ps, searchEnd.ps, masked.ps, its));
+				} else {
+					const Shape *shape = m_shapes[kdTri.shapeIndex];
+					if (!isTimeSegmentActive(shape, kdTri.shapeIndex, 
+							kdTri.primIndex, packet.time))
+						continue;
+
+					for (int i=0; i<8; ++i) {
+						if (masked.i[i])
+							continue;
+						Ray ray;
+						for (int axis=0; axis<3; axis++) {
+							ray.o[axis] = packet.o[axis].f[i];
+							ray.d[axis] = packet.d[axis].f[i];
+							ray.dRcp[axis] = packet.dRcp[axis].f[i];
+						}
+						ray.time = packet.time;
+						Float t;
+
+						if (shape->rayIntersect(ray, searchStart.f[i], searchEnd.f[i], t, 
+								reinterpret_cast<uint8_t *>(temp)
+								+ i * MTS_KD_INTERSECTION_TEMP + 8)) {
+							its.t.f[i] = t;
+							its.shapeIndex.i[i] = kdTri.shapeIndex;
+							its.primIndex.i[i] = KNoTriangleFlag;
+							itsFound.i[i] = 0xFFFFFFFF;
+						}
+					}
+				}
+				searchEnd.ps = _mm256_min_ps(searchEnd.ps, its.t.ps);
+			}
+		}
+
+		/* Abort if the tree has been traversed or if
+		   intersections have been found for all eight rays */
+		if (_mm256_movemask_ps(itsFound.ps) == 0xFF || --stackIndex < 0)
+			break;
+
+		/* Pop from the stack */
+		currNode = stack[stackIndex].node;
+		interval = stack[stackIndex].interval;
+		masked.ps = _mm256_or_ps(itsFound.ps, 
+			_mm256_cmp_ps(interval.mint.ps, interval.maxt.ps, _CMP_GT_OQ));
+	}
+}
+#endif
 	
 void ShapeKDTree::rayIntersectPacketIncoherent(const RayPacket4 &packet, 
 		const RayInterval4 &rayInterval, Intersection4 &its4, void *temp) const {
@@ -334,6 +853,7 @@ void ShapeKDTree::rayIntersectPacketIncoherent(const RayPacket4 &packet,
 		}
 		ray.mint = rayInterval.mint.f[i];
 		ray.maxt = rayInterval.maxt.f[i];
+		ray.time = packet.time;
 		uint8_t *rayTemp = reinterpret_cast<uint8_t *>(temp) + i * MTS_KD_INTERSECTION_TEMP;
 		if (ray.mint < ray.maxt && rayIntersectHavran<false>(ray, ray.mint, ray.maxt, t, rayTemp)) {
 			const IntersectionCache *cache = reinterpret_cast<const IntersectionCache *>(rayTemp);
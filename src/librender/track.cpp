@@ -52,11 +52,31 @@ void AnimatedTransform::serialize(Stream *stream) const {
 		m_tracks[i]->serialize(stream);
 }
 
-/// Compute the transformation at the specified time value
 void AnimatedTransform::eval(Float t, Transform &trafo) const {
-	Vector translation(0.0f);
-	Vector scale(1.0f);
+	Vector translation, scale;
 	Quaternion rotation;
+	eval(t, translation, rotation, scale);
+	trafo = Transform::translate(translation) * 
+		rotation.toTransform() *
+		Transform::scale(scale);
+}
+
+void AnimatedTransform::collectKeyframes(std::vector<Float> &times) const {
+	times.clear();
+	for (size_t i=0; i<m_tracks.size(); ++i) {
+		const AbstractAnimationTrack *track = m_tracks[i];
+		for (size_t j=0; j<track->getSize(); ++j)
+			times.push_back(track->getTime(j));
+	}
+	std::sort(times.begin(), times.end());
+	times.erase(std::unique(times.begin(), times.end()), times.end());
+}
+
+void AnimatedTransform::eval(Float t, Vector &translation, 
+		Quaternion &rotation, Vector &scale) const {
+	translation = Vector(0.0f);
+	scale = Vector(1.0f);
+	rotation = Quaternion();
 
 	for (size_t i=0; i<m_tracks.size(); ++i) {
 		AbstractAnimationTrack *track = m_tracks[i];
@@ -93,9 +113,34 @@ void AnimatedTransform::eval(Float t, Transform &trafo) const {
 					"animation track type: %i!", track->getType());
 		}
 	}
-	trafo = Transform::translate(translation) * 
-		rotation.toTransform() *
-		Transform::scale(scale);
+}
+
+AnimatedTransformCache::AnimatedTransformCache(const AnimatedTransform *trafo) {
+	trafo->collectKeyframes(m_times);
+	m_keyframes.resize(m_times.size());
+
+	for (size_t i=0; i<m_times.size(); ++i) {
+		Keyframe &key = m_keyframes[i];
+		trafo->eval(m_times[i], key.translation, key.rotation, key.scale);
+	}
+
+	for (size_t i=0; i<m_times.size(); ++i) {
+		Keyframe &key = m_keyframes[i];
+		key.theta = 0;
+		key.invDuration = 0;
+		if (i+1 == m_times.size())
+			continue;
+		key.invDuration = 1 / (m_times[i+1] - m_times[i]);
+
+		/* Precompute the parameters of slerp() (without the
+		   linear interpolation fallback, indicated by theta=0) */
+		const Quaternion &q1 = key.rotation, &q2 = m_keyframes[i+1].rotation;
+		Float cosTheta = dot(q1, q2);
+		if (cosTheta <= .9995f) {
+			key.theta = std::acos(clamp(cosTheta, (Float) -1, (Float) 1));
+			key.rotationPerp = normalize(q2 - q1 * cosTheta);
+		}
+	}
 }
 
 MTS_IMPLEMENT_CLASS(AbstractAnimationTrack, true, Object)
@@ -20,6 +20,7 @@
 #include <mitsuba/core/random.h>
 #include <mitsuba/core/plugin.h>
 #include <mitsuba/core/zstream.h>
+#include <mitsuba/core/mstream.h>
 #include <mitsuba/core/timer.h>
 #include <mitsuba/core/properties.h>
 #include <mitsuba/render/subsurface.h>
@@ -29,6 +30,10 @@
 
 #define MTS_FILEFORMAT_HEADER 0x041C
 #define MTS_FILEFORMAT_VERSION_V3 0x03
+#define MTS_FILEFORMAT_VERSION_V4 0x04
+
+/* Alignment of the attribute arrays in the uncompressed (V4) format */
+#define MTS_FILEFORMAT_ALIGNMENT 16
 
 MTS_NAMESPACE_BEGIN
 
@@ -153,49 +158,155 @@ static void readHelper(Stream *stream, bool fileDoublePrecision,
 	}
 }
 
-TriMesh::TriMesh(Stream *_stream, int index)
+/// Skip the padding in front of an array of the uncompressed format
+static void skipPadding(Stream *stream) {
+	size_t pos = stream->getPos();
+	stream->setPos(pos + (MTS_FILEFORMAT_ALIGNMENT - pos % MTS_FILEFORMAT_ALIGNMENT)
+		% MTS_FILEFORMAT_ALIGNMENT);
+}
+
+/// Write the padding in front of an array of the uncompressed format
+static void writePadding(Stream *stream) {
+	static const uint8_t zeros[MTS_FILEFORMAT_ALIGNMENT] = { 0 };
+	size_t pos = stream->getPos();
+	stream->write(zeros, (MTS_FILEFORMAT_ALIGNMENT - pos % MTS_FILEFORMAT_ALIGNMENT)
+		% MTS_FILEFORMAT_ALIGNMENT);
+}
+
+/**
+ * Ensure that a mapped array of \c count elements (following the padding at 
+ * the current position) lies within the memory region of \c stream
+ */
+static void checkMappedArray(MemoryStream *stream, size_t count, size_t elementSize) {
+	size_t pos = stream->getPos();
+	pos += (MTS_FILEFORMAT_ALIGNMENT - pos % MTS_FILEFORMAT_ALIGNMENT)
+		% MTS_FILEFORMAT_ALIGNMENT;
+	if (pos > stream->getSize() || count > (stream->getSize() - pos) / elementSize)
+		SLog(EError, "Unable to unserialize mesh: the file is truncated!");
+}
+
+/**
+ * Read an attribute array of the uncompressed format. When \c mapped
+ * is set, the returned pointer refers directly to the memory region
+ * underlying the (memory) stream.
+ */
+template <typename T> static T *readAlignedArray(Stream *stream, 
+		bool fileDoublePrecision, size_t count, bool mapped) {
+	if (mapped)
+		checkMappedArray(static_cast<MemoryStream *>(stream), count, sizeof(T));
+	skipPadding(stream);
+	if (mapped) {
+		MemoryStream *mstream = static_cast<MemoryStream *>(stream);
+		T *result = reinterpret_cast<T *>(mstream->getCurrentData());
+		mstream->setPos(mstream->getPos() + sizeof(T) * count);
+		return result;
+	}
+	T *result = new T[count];
+	readHelper(stream, fileDoublePrecision, reinterpret_cast<Float *>(result),
+		count, sizeof(T)/sizeof(Float));
+	return result;
+}
+
+/// Read and verify the header of a serialized mesh, returns the version
+static short readFileHeader(Stream *stream) {
+	short format = stream->readShort();
+	if (format == 0x1C04)
+		SLog(EError, "Encountered a geometry file generated by an old "
+			"version of Mitsuba. Please re-import the scene to update this file "
+			"to the current format.");
+
+	if (format != MTS_FILEFORMAT_HEADER)
+		SLog(EError, "Encountered an invalid file format!");
+
+	short version = stream->readShort();
+	if (version != MTS_FILEFORMAT_VERSION_V3 && version != MTS_FILEFORMAT_VERSION_V4)
+		SLog(EError, "Encountered an incompatible file version!");
+	return version;
+}
+
+TriMesh::TriMesh(Stream *stream, int index)
 		: Shape(Properties()), m_tangents(NULL) {
+	uint32_t flags = loadSerialized(stream, index);
+	m_faceNormals = flags & EFaceNormals;
+	m_flipNormals = false;
+}
+
+uint32_t TriMesh::loadSerialized(Stream *_stream, int index, bool mapped) {
 	ref<Stream> stream = _stream;
 
+	if (stream->getByteOrder() != Stream::ELittleEndian) 
+		Log(EError, "Tried to unserialize a shape from a stream, "
+		"which was not previously set to little endian byte order!");
+
+	short version = readFileHeader(stream);
+
 	if (index != 0) {
 		/* Determine the position of the requested substream. This
-		   is stored at the end of the file */
+		   is stored at the end of the file (using 64 bit offsets
+		   in the case of the uncompressed format) */
+		size_t offsetSize = (version == MTS_FILEFORMAT_VERSION_V4)
+			? sizeof(uint64_t) : sizeof(uint32_t);
 		stream->setPos(stream->getSize() - sizeof(uint32_t));
 		uint32_t count = stream->readUInt();
-		if (index < 0 || index > (int) count) {
+		if (index < 0 || index >= (int) count) {
 			Log(EError, "Unable to unserialize mesh, "
 				"shape index is out of range! (requested %i out of 0..%i)",
 				index, count-1);
 		}
-		stream->setPos(stream->getSize() - sizeof(uint32_t) * (1+count-index));
+		stream->setPos(stream->getSize() - sizeof(uint32_t) 
+			- offsetSize * (count-index));
 		// Seek to the correct position
-		stream->setPos(stream->readUInt());
+		if (version == MTS_FILEFORMAT_VERSION_V4)
+			stream->setPos((size_t) stream->readULong());
+		else
+			stream->setPos(stream->readUInt());
+		if (readFileHeader(stream) != version)
+			Log(EError, "Encountered a file containing meshes with different format versions!");
 	}
 
-	if (stream->getByteOrder() != Stream::ELittleEndian) 
-		Log(EError, "Tried to unserialize a shape from a stream, "
-		"which was not previously set to little endian byte order!");
-
-	short format = stream->readShort();
-	if (format == 0x1C04)
-		Log(EError, "Encountered a geometry file generated by an old "
-			"version of Mitsuba. Please re-import the scene to update this file "
-			"to the current format.");
-
-	if (format != MTS_FILEFORMAT_HEADER)
-		Log(EError, "Encountered an invalid file format!");
-
-	short version = stream->readShort();
-	if (version != MTS_FILEFORMAT_VERSION_V3)
-		Log(EError, "Encountered an incompatible file version!");
-	stream = new ZStream(stream);
+	if (version == MTS_FILEFORMAT_VERSION_V3)
+		stream = new ZStream(stream);
 
 	uint32_t flags = stream->readUInt();
 	m_vertexCount = stream->readSize();
 	m_triangleCount = stream->readSize();
 	
 	bool fileDoublePrecision = flags & EDoublePrecision;
-	m_faceNormals = flags & EFaceNormals;
+
+	if (version == MTS_FILEFORMAT_VERSION_V4) {
+		/* Arrays can only be used in-place if their layout
+		   exactly matches the in-memory representation */
+#if defined(SINGLE_PRECISION)
+		bool hostDoublePrecision = false;
+#else
+		bool hostDoublePrecision = true;
+#endif
+		mapped = mapped && fileDoublePrecision == hostDoublePrecision
+			&& stream->getHostByteOrder() == Stream::ELittleEndian;
+
+		m_positions = readAlignedArray<Point>(stream, 
+			fileDoublePrecision, m_vertexCount, mapped);
+		m_normals = (flags & EHasNormals) ? readAlignedArray<Normal>(
+			stream, fileDoublePrecision, m_vertexCount, mapped) : NULL;
+		m_texcoords = (flags & EHasTexcoords) ? readAlignedArray<Point2>(
+			stream, fileDoublePrecision, m_vertexCount, mapped) : NULL;
+		m_colors = (flags & EHasColors) ? readAlignedArray<Spectrum>(
+			stream, fileDoublePrecision, m_vertexCount, mapped) : NULL;
+
+		if (mapped)
+			checkMappedArray(static_cast<MemoryStream *>(stream.get()),
+				m_triangleCount, sizeof(Triangle));
+		skipPadding(stream);
+		if (mapped) {
+			m_triangles = reinterpret_cast<Triangle *>(
+				static_cast<MemoryStream *>(stream.get())->getCurrentData());
+		} else {
+			m_triangles = new Triangle[m_triangleCount];
+			stream->readUIntArray(reinterpret_cast<uint32_t *>(m_triangles), 
+				m_triangleCount * sizeof(Triangle)/sizeof(uint32_t));
+		}
+		return flags;
+	}
 
 	m_positions = new Point[m_vertexCount];
 	readHelper(stream, fileDoublePrecision,
@@ -233,22 +344,37 @@ TriMesh::TriMesh(Stream *_stream, int index)
 	stream->readUIntArray(reinterpret_cast<uint32_t *>(m_triangles), 
 		m_triangleCount * sizeof(Triangle)/sizeof(uint32_t));
 
-	m_flipNormals = false;
+	return flags;
+}
+
+uint32_t TriMesh::loadSerialized(const fs::path &filename, int index) {
+	ref<MemoryMappedFile> file = new MemoryMappedFile(filename, true);
+	const uint8_t *data = static_cast<const uint8_t *>(file->getData());
+
+	/* The format version of the first mesh (little endian) 
+	   determines the format of the whole file */
+	if (file->getSize() >= 2*sizeof(short) && (data[2] | (data[3] << 8))
+			== MTS_FILEFORMAT_VERSION_V4) {
+		m_mappedFile = file;
+		ref<MemoryStream> stream = new MemoryStream(file->getData(), file->getSize());
+		stream->setByteOrder(Stream::ELittleEndian);
+		return loadSerialized(stream, index, true);
+	} else {
+		file = NULL;
+		ref<FileStream> stream = new FileStream(filename, FileStream::EReadOnly);
+		stream->setByteOrder(Stream::ELittleEndian);
+		return loadSerialized(stream, index);
+	}
 }
 
 TriMesh::~TriMesh() {
-	if (m_positions)
-		delete[] m_positions;
-	if (m_normals)
-		delete[] m_normals;
-	if (m_texcoords)
-		delete[] m_texcoords;
+	releaseArray(m_positions);
+	releaseArray(m_normals);
+	releaseArray(m_texcoords);
+	releaseArray(m_colors);
+	releaseArray(m_triangles);
 	if (m_tangents)
 		delete[] m_tangents;
-	if (m_colors)
-		delete[] m_colors;
-	if (m_triangles)
-		delete[] m_triangles;
 }
 	
 std::string TriMesh::getName() const {
@@ -349,10 +475,7 @@ void TriMesh::rebuildTopology(Float maxAngle) {
 	typedef std::pair<Vertex, TopoData> MPair;
 	const Float dpThresh = std::cos(degToRad(maxAngle));
 
-	if (m_normals) {
-		delete[] m_normals;
-		m_normals = NULL;
-	}
+	releaseArray(m_normals);
 
 	if (m_tangents) {
 		delete[] m_tangents;
@@ -443,21 +566,21 @@ void TriMesh::rebuildTopology(Float maxAngle) {
 		for (int j=0; j<3; ++j)
 			Assert(newTriangles[i].idx[j] != 0xFFFFFFFFU);
 
-	delete[] m_triangles;
+	releaseArray(m_triangles);
 	m_triangles = newTriangles;
 
-	delete[] m_positions;
+	releaseArray(m_positions);
 	m_positions = new Point[newPositions.size()];
 	memcpy(m_positions, &newPositions[0], sizeof(Point) * newPositions.size());
 
 	if (m_texcoords) {
-		delete[] m_texcoords;
+		releaseArray(m_texcoords);
 		m_texcoords = new Point2[newTexcoords.size()];
 		memcpy(m_texcoords, &newTexcoords[0], sizeof(Point2) * newTexcoords.size());
 	}
 
 	if (m_colors) {
-		delete[] m_colors;
+		releaseArray(m_colors);
 		m_colors = new Spectrum[newColors.size()];
 		memcpy(m_colors, &newColors[0], sizeof(Spectrum) * newColors.size());
 	}
@@ -473,10 +596,7 @@ void TriMesh::rebuildTopology(Float maxAngle) {
 void TriMesh::computeNormals() {
 	int invalidNormals = 0;
 	if (m_faceNormals) {
-		if (m_normals) {
-			delete[] m_normals;
-			m_normals = NULL;
-		}
+		releaseArray(m_normals);
 
 		if (m_flipNormals) {
 			/* Change the winding order */
@@ -790,6 +910,56 @@ void TriMesh::serialize(Stream *_stream) const {
 		m_triangleCount * sizeof(Triangle)/sizeof(uint32_t));
 }
 
+void TriMesh::serializeMappable(Stream *stream) const {
+	if (stream->getByteOrder() != Stream::ELittleEndian) 
+		Log(EError, "Tried to serialize a shape to a stream, "
+			"which was not previously set to little endian byte order!");
+
+	stream->writeShort(MTS_FILEFORMAT_HEADER);
+	stream->writeShort(MTS_FILEFORMAT_VERSION_V4);
+
+#if defined(SINGLE_PRECISION)
+	uint32_t flags = ESinglePrecision;
+#else
+	uint32_t flags = EDoublePrecision;
+#endif
+
+	if (m_normals)
+		flags |= EHasNormals;
+	if (m_texcoords)
+		flags |= EHasTexcoords;
+	if (m_colors)
+		flags |= EHasColors;
+	if (m_faceNormals)
+		flags |= EFaceNormals;
+
+	stream->writeUInt(flags);
+	stream->writeSize(m_vertexCount);
+	stream->writeSize(m_triangleCount);
+
+	writePadding(stream);
+	stream->writeFloatArray(reinterpret_cast<Float *>(m_positions), 
+		m_vertexCount * sizeof(Point)/sizeof(Float));
+	if (m_normals) {
+		writePadding(stream);
+		stream->writeFloatArray(reinterpret_cast<Float *>(m_normals), 
+			m_vertexCount * sizeof(Normal)/sizeof(Float));
+	}
+	if (m_texcoords) {
+		writePadding(stream);
+		stream->writeFloatArray(reinterpret_cast<Float *>(m_texcoords), 
+			m_vertexCount * sizeof(Point2)/sizeof(Float));
+	}
+	if (m_colors) {
+		writePadding(stream);
+		stream->writeFloatArray(reinterpret_cast<Float *>(m_colors), 
+			m_vertexCount * sizeof(Spectrum)/sizeof(Float));
+	}
+	writePadding(stream);
+	stream->writeUIntArray(reinterpret_cast<uint32_t *>(m_triangles), 
+		m_triangleCount * sizeof(Triangle)/sizeof(uint32_t));
+}
+
 std::string TriMesh::toString() const {
 	std::ostringstream oss;
 	oss << getClass()->getName() << "[" << endl
@@ -54,6 +54,13 @@ Vector VolumeDataSource::lookupVector(const Point &p) const {
 	return Vector();
 }
 
+void VolumeDataSource::getMaximumFloatValues(const Vector3i &res, Float *maxima) const {
+	size_t cellCount = (size_t) res.x * (size_t) res.y * (size_t) res.z;
+	Float value = getMaximumFloatValue();
+	for (size_t i=0; i<cellCount; ++i)
+		maxima[i] = value;
+}
+
 bool VolumeDataSource::supportsFloatLookups() const {
 	return false;
 }
@@ -59,6 +59,62 @@ public:
 		return m_intensity * m_shape->getSurfaceArea() * M_PI;
 	}
 
+	bool getEmissionBounds(AABB &aabb, Vector &axis,
+			Float &thetaO, Float &thetaE) const {
+		aabb = m_shape->getAABB();
+		axis = Vector(0, 0, 1);
+		thetaO = M_PI;
+		thetaE = M_PI / 2;
+
+		if (!m_shape->getClass()->derivesFrom(MTS_CLASS(TriMesh)))
+			return true;
+
+		/* Bound the face normals and (if present) the vertex normals, 
+		   which are interpolated when sampling the surface */
+		const TriMesh *mesh = static_cast<const TriMesh *>(m_shape);
+		const Triangle *triangles = mesh->getTriangles();
+		const Point *positions = mesh->getVertexPositions();
+		const Normal *normals = mesh->getVertexNormals();
+		std::vector<Vector> directions;
+		directions.reserve(mesh->getTriangleCount() + 
+			(normals ? mesh->getVertexCount() : 0));
+		Vector sum(0.0f);
+
+		for (size_t i=0; i<mesh->getTriangleCount(); ++i) {
+			const Triangle &tri = triangles[i];
+			Vector n = cross(positions[tri.idx[1]] - positions[tri.idx[0]],
+				positions[tri.idx[2]] - positions[tri.idx[0]]);
+			Float length = n.length();
+			if (length == 0)
+				continue;
+			sum += n;
+			directions.push_back(n / length);
+		}
+		if (normals) {
+			for (size_t i=0; i<mesh->getVertexCount(); ++i) {
+				Float length = normals[i].length();
+				if (length != 0)
+					directions.push_back(Vector(normals[i]) / length);
+			}
+		}
+
+		Float length = sum.length();
+		if (length == 0 || directions.empty())
+			return true;
+		axis = sum / length;
+
+		Float maxAngle = 0;
+		for (size_t i=0; i<directions.size(); ++i)
+			maxAngle = std::max(maxAngle, unitAngle(axis, directions[i]));
+
+		/* Interpolated normals are only guaranteed to stay 
+		   inside cones that are narrower than a hemisphere */
+		if (maxAngle < M_PI / 2)
+			thetaO = maxAngle;
+
+		return true;
+	}
+
 	Spectrum Le(const ShapeSamplingRecord &sRec, const Vector &d) const {
 		if (dot(d, sRec.n) <= 0)
 			return Spectrum(0.0f);
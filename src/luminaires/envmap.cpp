@@ -30,15 +30,26 @@
 MTS_NAMESPACE_BEGIN
 
 /**
- * Basic environment map implementation without importance sampling.
+ * Environment map implementation with importance sampling.
  * Uses the scene's bounding sphere to simulate an infinitely far-away
  * light source. Expects an EXR image in latitude-longitude 
  * (equirectangular) format.
+ *
+ * Directions are sampled proportional to the luminance of the pixels 
+ * (weighted by their solid angle) using a marginal/conditional 
+ * distribution. By default, this distribution is built from the full-
+ * resolution image, which matters for maps containing small and very
+ * bright features such as the sun. The 'samplingLevel' parameter 
+ * selects a coarser MIP map level to reduce memory usage.
  */
 class EnvMapLuminaire : public Luminaire {
 public:
 	EnvMapLuminaire(const Properties &props) : Luminaire(props) {
 		m_intensityScale = props.getFloat("intensityScale", 1);
+		/* MIP map level used to construct the sampling density */
+		m_samplingLevel = props.getInteger("samplingLevel", 0);
+		if (m_samplingLevel < 0)
+			Log(EError, "The 'samplingLevel' parameter must be nonnegative!");
 		m_path = Thread::getThread()->getFileResolver()->resolve(props.getString("filename"));
 		Log(EInfo, "Loading environment map \"%s\"", m_path.leaf().c_str());
 		ref<Stream> is = new FileStream(m_path, FileStream::EReadOnly);
@@ -52,6 +63,7 @@ public:
 	EnvMapLuminaire(Stream *stream, InstanceManager *manager) 
 		: Luminaire(stream, manager) {
 		m_intensityScale = stream->readFloat();
+		m_samplingLevel = stream->readInt();
 		m_path = stream->readString();
 		m_bsphere = BSphere(stream);
 		Log(EInfo, "Unserializing environment map \"%s\"", m_path.leaf().c_str());
@@ -79,6 +91,7 @@ public:
 	void serialize(Stream *stream, InstanceManager *manager) const {
 		Luminaire::serialize(stream, manager);
 		stream->writeFloat(m_intensityScale);
+		stream->writeInt(m_samplingLevel);
 		stream->writeString(m_path.file_string());
 		m_bsphere.serialize(stream);
 
@@ -93,22 +106,26 @@ public:
 	}
 
 	void configure() {
-		int mipMapLevel = std::min(3, m_mipmap->getLevels()-1);
+		int mipMapLevel = std::min(m_samplingLevel, m_mipmap->getLevels()-1);
 		m_pdfResolution = m_mipmap->getLevelResolution(mipMapLevel);
 		m_pdfInvResolution = Vector2(1.0f / m_pdfResolution.x, 1.0f / m_pdfResolution.y);
 
 		Log(EDebug, "Creating a %ix%i sampling density", m_pdfResolution.x, m_pdfResolution.y);
-		const Spectrum *coarseImage = m_mipmap->getImageData(mipMapLevel);
-		int index = 0;
-		m_pdf = DiscretePDF(m_pdfResolution.x * m_pdfResolution.y);
+		const Spectrum *image = m_mipmap->getImageData(mipMapLevel);
+		m_pdf = DiscretePDF2D(m_pdfResolution);
 		for (int y=0; y<m_pdfResolution.y; ++y) {
-			float sinFactor = std::sin(M_PI * (y + .5f) / m_pdfResolution.y);
+			/* Solid angle covered by the pixels of this row (up to a constant) */
+			Float solidAngle = std::cos(M_PI * y / m_pdfResolution.y) 
+				- std::cos(M_PI * (y+1) / m_pdfResolution.y);
 
 			for (int x=0; x<m_pdfResolution.x; ++x)
-				m_pdf[index++] = coarseImage[x + y * m_pdfResolution.x].getLuminance() * sinFactor;
+				m_pdf(x, y) = std::max((Float) 0.0f, image[x + y * m_pdfResolution.x]
+					.getLuminance()) * solidAngle;
 		}
 		m_pdfPixelSize = Vector2(2 * M_PI / m_pdfResolution.x, M_PI / m_pdfResolution.y);
-		m_pdf.build();
+		if (m_pdf.build() == 0)
+			Log(EError, "The environment map \"%s\" does not emit any light!", 
+				m_path.leaf().c_str());
 	}
 
 	void preprocess(const Scene *scene) {
@@ -138,10 +155,8 @@ public:
 		value = Le(-d);
 		return d;
 #else
-		int idx = m_pdf.sampleReuse(sample.x, pdf);
-		int row = idx / m_pdfResolution.x;
-		int col = idx - m_pdfResolution.x * row;
-		Float x = col + sample.x, y = row + sample.y;
+		Point2i cell = m_pdf.sampleReuse(sample, pdf);
+		Float x = cell.x + sample.x, y = cell.y + sample.y;
 		value = m_mipmap->triangle(0, x * m_pdfInvResolution.x, y * m_pdfInvResolution.y) 
 			* m_intensityScale;
 		Float theta = m_pdfPixelSize.y * y, phi = m_pdfPixelSize.x * x - M_PI;
@@ -191,7 +206,7 @@ public:
 		int xPos = std::min(std::max((int) std::floor(x), 0), m_pdfResolution.x-1);
 		int yPos = std::min(std::max((int) std::floor(y), 0), m_pdfResolution.y-1);
 
-		Float pdf = m_pdf[xPos + yPos * m_pdfResolution.x];
+		Float pdf = m_pdf.pdf(xPos, yPos);
 		Float sinTheta = std::sqrt(std::max((Float) Epsilon, 1-d.y*d.y));
 
 		return pdf / (m_pdfPixelSize.x * m_pdfPixelSize.y * sinTheta);
@@ -335,12 +350,13 @@ private:
 	Spectrum m_average;
 	BSphere m_bsphere;
 	Float m_intensityScale;
+	int m_samplingLevel;
 	Float m_surfaceArea;
 	Float m_invSurfaceArea;
 	fs::path m_path;
 	ref<MIPMap> m_mipmap;
 	ref<MemoryStream> m_stream;
-	DiscretePDF m_pdf;
+	DiscretePDF2D m_pdf;
 	Vector2i m_pdfResolution;
 	Vector2 m_pdfInvResolution;
 	Vector2 m_pdfPixelSize;
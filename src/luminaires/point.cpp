@@ -47,6 +47,15 @@ public:
 		return m_intensity * 4 * M_PI;
 	}
 
+	bool getEmissionBounds(AABB &aabb, Vector &axis,
+			Float &thetaO, Float &thetaE) const {
+		aabb = AABB(m_position);
+		axis = Vector(0, 0, 1);
+		thetaO = M_PI;
+		thetaE = M_PI / 2;
+		return true;
+	}
+
 	Float pdf(const Point &p, const LuminaireSamplingRecord &lRec, bool delta) const {
 		/* PDF is a delta function - zero probability when a sample point was not
 		   generated using sample() */
@@ -80,6 +80,15 @@ public:
 				(m_cutoffAngle - m_beamWidth)));
 	}
 
+	bool getEmissionBounds(AABB &aabb, Vector &axis,
+			Float &thetaO, Float &thetaE) const {
+		aabb = AABB(m_position);
+		axis = normalize(m_luminaireToWorld(Vector(0, 0, 1)));
+		thetaO = 0;
+		thetaE = m_cutoffAngle;
+		return true;
+	}
+
     Float getAperture() const {
         return radToDeg(m_cutoffAngle);
     }
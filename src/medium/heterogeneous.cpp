@@ -33,6 +33,9 @@ MTS_NAMESPACE_BEGIN
 /// Generate a few statistics related to the implementation?
 // #define HETVOL_STATISTICS 1
 
+/// Maximum resolution of the majorant grid along each axis (when chosen automatically)
+#define HETVOL_MAX_MAJORANT_RES 64
+
 #if defined(HETVOL_STATISTICS)
 static StatsCounter avgNewtonIterations("Heterogeneous volume", 
 		"Avg. # of Newton-Bisection iterations", EAverage);
@@ -42,6 +45,8 @@ static StatsCounter avgRayMarchingStepsSampling("Heterogeneous volume",
 		"Avg. # of ray marching steps (sampling)", EAverage);
 static StatsCounter earlyExits("Heterogeneous volume", 
 		"Number of early exits", EPercentage);
+static StatsCounter nullCollisions("Heterogeneous volume", 
+		"Rejected Woodcock tracking collisions", EPercentage);
 #endif
 
 /**
@@ -63,6 +68,14 @@ static StatsCounter earlyExits("Heterogeneous volume",
  * which contains local particle orientation that will be passed to
  * scattering models such as a the Micro-flake or Kajiya-Kay phase functions.
  *
+ * Woodcock tracking uses a coarse grid of local density maxima (majorants), 
+ * which is traversed using a 3D-DDA. This avoids most rejected collisions
+ * in media with a strongly varying density. Cells with a majorant of zero 
+ * are also skipped by the Simpson quadrature. The resolution of this grid 
+ * along each axis can be set using the 'majorantResolution' parameter 
+ * (by default, a cell roughly covers 8^3 voxels of the density volume; 
+ * a value of 1 reverts to a single global majorant).
+ *
  * \author Wenzel Jakob
  */
 class HeterogeneousMedium : public Medium {
@@ -86,6 +99,7 @@ public:
 	HeterogeneousMedium(const Properties &props) 
 		: Medium(props) {
 		m_stepSize = props.getFloat("stepSize", 0);
+		m_majorantRes = props.getInteger("majorantResolution", 0);
 		if (props.hasProperty("sigmaS") || props.hasProperty("sigmaA"))
 			Log(EError, "The 'sigmaS' and 'sigmaA' properties are only supported by "
 				"homogeneous media. Please use nested volume instances to supply "
@@ -108,6 +122,7 @@ public:
 		m_albedo = static_cast<VolumeDataSource *>(manager->getInstance(stream));
 		m_orientation = static_cast<VolumeDataSource *>(manager->getInstance(stream));
 		m_stepSize = stream->readFloat();
+		m_majorantRes = stream->readInt();
 		configure();
 	}
 
@@ -119,6 +134,7 @@ public:
 		manager->serialize(stream, m_albedo.get());
 		manager->serialize(stream, m_orientation.get());
 		stream->writeFloat(m_stepSize);
+		stream->writeInt(m_majorantRes);
 	}
 
 	void configure() {
@@ -131,13 +147,6 @@ public:
 		m_anisotropicMedium = 
 			m_phaseFunction->needsDirectionallyVaryingCoefficients();
 
-		/* Assumes that the density medium does not 
-		   contain values greater than one! */
-		m_maxDensity = m_densityMultiplier * m_density->getMaximumFloatValue();
-		if (m_anisotropicMedium)
-			m_maxDensity *= m_phaseFunction->sigmaDirMax();
-		m_invMaxDensity = 1.0f/m_maxDensity;
-
 		if (m_stepSize == 0) {
 			m_stepSize = std::min(
 				m_density->getStepSize(), m_albedo->getStepSize());
@@ -154,6 +163,57 @@ public:
 		if (m_anisotropicMedium && m_orientation.get() == NULL)
 			Log(EError, "Cannot use anisotropic phase function: "
 				"did not specify a particle orientation field!");
+
+		buildMajorantGrid();
+	}
+
+	/// Compute the grid of local density maxima used by Woodcock tracking
+	void buildMajorantGrid() {
+		Vector extents = m_densityAABB.getExtents();
+		Float densityStepSize = m_density->getStepSize();
+
+		for (int i=0; i<3; ++i) {
+			int res = m_majorantRes;
+			if (res <= 0) {
+				/* Use cells covering about 8^3 voxels (the step 
+				   size is half of the voxel size) */
+				res = 1;
+				if (densityStepSize != std::numeric_limits<Float>::infinity())
+					res = (int) std::ceil(extents[i] / (16 * densityStepSize));
+				res = std::min(res, HETVOL_MAX_MAJORANT_RES);
+			}
+			if (!(extents[i] > 0))
+				res = 1;
+			m_majorantGridRes[i] = std::max(res, 1);
+			m_cellSize[i] = extents[i] / m_majorantGridRes[i];
+			m_invCellSize[i] = m_cellSize[i] > 0 ? 1 / m_cellSize[i] : 0;
+		}
+
+		size_t cellCount = (size_t) m_majorantGridRes.x 
+			* (size_t) m_majorantGridRes.y * (size_t) m_majorantGridRes.z;
+		m_majorants.resize(cellCount);
+		m_density->getMaximumFloatValues(m_majorantGridRes, &m_majorants[0]);
+
+		Float scale = m_densityMultiplier;
+		if (m_anisotropicMedium)
+			scale *= m_phaseFunction->sigmaDirMax();
+
+		size_t emptyCells = 0;
+		Float avgMajorant = 0;
+		m_maxDensity = 0;
+		for (size_t i=0; i<cellCount; ++i) {
+			m_majorants[i] = std::max((Float) 0, m_majorants[i] * scale);
+			m_maxDensity = std::max(m_maxDensity, m_majorants[i]);
+			avgMajorant += m_majorants[i];
+			if (m_majorants[i] == 0)
+				++emptyCells;
+		}
+		avgMajorant /= cellCount;
+
+		Log(EDebug, "Majorant grid: %ix%ix%i cells, %.1f%% empty, "
+			"max. majorant=%f, avg. majorant=%f", m_majorantGridRes.x, 
+			m_majorantGridRes.y, m_majorantGridRes.z, 
+			100 * emptyCells / (Float) cellCount, m_maxDensity, avgMajorant);
 	}
 
 	void addChild(const std::string &name, ConfigurableObject *child) {
@@ -204,6 +264,10 @@ public:
 
 		mint = std::max(mint, ray.mint);
 		maxt = std::min(maxt, ray.maxt);
+
+		/* Skip empty space */
+		if (!clipToMajorants(ray, mint, maxt))
+			return 0.0f;
 		Float length = maxt-mint, maxComp = 0;
 
 		Point p = ray(mint), pLast = ray(maxt);
@@ -326,6 +390,11 @@ public:
 			return false;
 		mint = std::max(mint, ray.mint);
 		maxt = std::min(maxt, ray.maxt);
+
+		/* Skip empty space. This does not affect 'densityAtMinT', 
+		   since the density vanishes within empty cells */
+		if (!clipToMajorants(ray, mint, maxt))
+			return false;
 		Float length = maxt - mint, maxComp = 0;
 		Point p = ray(mint), pLast = ray(maxt);
 
@@ -452,32 +521,14 @@ public:
 				return Spectrum(1.0f);
 			mint = std::max(mint, ray.mint);
 			maxt = std::min(maxt, ray.maxt);
-			
-			#if defined(HETVOL_STATISTICS)
-				avgRayMarchingStepsTransmittance.incrementBase();
-			#endif
+
 			int nSamples = 2; /// XXX make configurable
 			Float result = 0;
 
 			for (int i=0; i<nSamples; ++i) {
-				Float t = mint;
-				while (true) {
-					t -= std::log(1-sampler->next1D()) * m_invMaxDensity;
-					if (t >= maxt) {
-						result += 1;
-						break;
-					}
-				
-					Point p = ray(t);
-					Float density = lookupDensity(p, ray.d) * m_densityMultiplier;
-					
-					#if defined(HETVOL_STATISTICS)
-						++avgRayMarchingStepsTransmittance;
-					#endif
-
-					if (density * m_invMaxDensity > sampler->next1D()) 
-						break;
-				}
+				Float t, densityAtT;
+				if (!woodcockTracking(ray, mint, maxt, sampler, t, densityAtT))
+					result += 1;
 			}
 			return Spectrum(result/nSamples);
 		}
@@ -514,10 +565,6 @@ public:
 			mRec.pdfSuccess = 1.0f;
 			mRec.pdfSuccessRev = 1.0f;
 			mRec.transmittance = Spectrum(1.0f);
-			
-			#if defined(HETVOL_STATISTICS)
-				avgRayMarchingStepsSampling.incrementBase();
-			#endif
 
 			Float mint, maxt;
 			if (!m_densityAABB.rayIntersect(ray, mint, maxt))
@@ -525,30 +572,19 @@ public:
 			mint = std::max(mint, ray.mint);
 			maxt = std::min(maxt, ray.maxt);
 
-			Float t = mint, densityAtT = 0;
-			while (true) {
-				t -= std::log(1-sampler->next1D()) * m_invMaxDensity;
-				if (t >= maxt)
-					break;
-
+			Float t, densityAtT;
+			if (woodcockTracking(ray, mint, maxt, sampler, t, densityAtT)) {
 				Point p = ray(t);
-				densityAtT = lookupDensity(p, ray.d) * m_densityMultiplier;
-				#if defined(HETVOL_STATISTICS)
-					++avgRayMarchingStepsSampling;
-				#endif
-				if (densityAtT * m_invMaxDensity > sampler->next1D()) {
-					mRec.t = t;
-					mRec.p = p;
-					Spectrum albedo = m_albedo->lookupSpectrum(p);
-					mRec.sigmaS = albedo * densityAtT;
-					mRec.sigmaA = Spectrum(densityAtT) - mRec.sigmaS;
-					mRec.albedo = albedo.max();
-					mRec.transmittance = albedo/mRec.sigmaS;
-					mRec.orientation = m_orientation != NULL 
-						? m_orientation->lookupVector(p) : Vector(0.0f);
-					success = true;
-					break;
-				}
+				mRec.t = t;
+				mRec.p = p;
+				Spectrum albedo = m_albedo->lookupSpectrum(p);
+				mRec.sigmaS = albedo * densityAtT;
+				mRec.sigmaA = Spectrum(densityAtT) - mRec.sigmaS;
+				mRec.albedo = albedo.max();
+				mRec.transmittance = albedo/mRec.sigmaS;
+				mRec.orientation = m_orientation != NULL 
+					? m_orientation->lookupVector(p) : Vector(0.0f);
+				success = true;
 			}
 		}
 
@@ -581,6 +617,7 @@ public:
 			<< "  albedo = " << indent(m_albedo.toString()) << "," << endl
 			<< "  orientation = " << indent(m_orientation.toString()) << "," << endl
 			<< "  stepSize = " << m_stepSize << "," << endl
+			<< "  majorantGridRes = " << m_majorantGridRes.toString() << "," << endl
 			<< "  densityMultiplier = " << m_densityMultiplier << endl
 			<< "]";
 		return oss.str();
@@ -588,6 +625,146 @@ public:
 
 	MTS_DECLARE_CLASS()
 protected:
+	/// State of a 3D-DDA traversal of the majorant grid
+	struct MajorantTraversal {
+		int cell[3], step[3];
+		Float tNext[3], tDelta[3];
+	};
+
+	/**
+	 * \brief Prepare a traversal of the majorant grid along \c ray,
+	 * starting at the distance \c mint (which should lie within
+	 * the bounding box of the density volume)
+	 */
+	inline void initTraversal(const Ray &ray, Float mint, MajorantTraversal &tr) const {
+		const Point p = ray(mint);
+		for (int i=0; i<3; ++i) {
+			int cell = floorToInt((p[i] - m_densityAABB.min[i]) * m_invCellSize[i]);
+			cell = std::max(0, std::min(m_majorantGridRes[i] - 1, cell));
+			tr.cell[i] = cell;
+
+			if (ray.d[i] > 0) {
+				Float invD = 1 / ray.d[i];
+				tr.step[i] = 1;
+				tr.tNext[i] = (m_densityAABB.min[i] + (cell+1) * m_cellSize[i] - ray.o[i]) * invD;
+				tr.tDelta[i] = m_cellSize[i] * invD;
+			} else if (ray.d[i] < 0) {
+				Float invD = 1 / ray.d[i];
+				tr.step[i] = -1;
+				tr.tNext[i] = (m_densityAABB.min[i] + cell * m_cellSize[i] - ray.o[i]) * invD;
+				tr.tDelta[i] = -m_cellSize[i] * invD;
+			} else {
+				tr.step[i] = 0;
+				tr.tNext[i] = tr.tDelta[i] = std::numeric_limits<Float>::infinity();
+			}
+		}
+	}
+
+	/// Return the distance, at which the traversal leaves the current cell
+	inline Float getCellExit(const MajorantTraversal &tr) const {
+		return std::min(std::min(tr.tNext[0], tr.tNext[1]), tr.tNext[2]);
+	}
+
+	/// Return the majorant of the current cell
+	inline Float getMajorant(const MajorantTraversal &tr) const {
+		return m_majorants[(tr.cell[2] * m_majorantGridRes.y + tr.cell[1])
+			* m_majorantGridRes.x + tr.cell[0]];
+	}
+
+	/// Step to the next cell, returns \c false when leaving the grid
+	inline bool nextCell(MajorantTraversal &tr) const {
+		int axis = (tr.tNext[0] < tr.tNext[1])
+			? (tr.tNext[0] < tr.tNext[2] ? 0 : 2)
+			: (tr.tNext[1] < tr.tNext[2] ? 1 : 2);
+		tr.cell[axis] += tr.step[axis];
+		if (tr.cell[axis] < 0 || tr.cell[axis] >= m_majorantGridRes[axis])
+			return false;
+		tr.tNext[axis] += tr.tDelta[axis];
+		return true;
+	}
+
+	/**
+	 * \brief Shrink the ray segment <tt>[mint, maxt]</tt> (which must lie
+	 * within the density bounding box) to the part passing through cells 
+	 * with a nonzero majorant. Returns \c false if there is no such part.
+	 */
+	bool clipToMajorants(const Ray &ray, Float &mint, Float &maxt) const {
+		MajorantTraversal tr;
+		initTraversal(ray, mint, tr);
+		Float t = mint, first = 0, last = 0;
+		bool found = false;
+
+		while (true) {
+			Float exit = std::min(getCellExit(tr), maxt);
+			if (getMajorant(tr) > 0) {
+				if (!found) {
+					first = t;
+					found = true;
+				}
+				last = exit;
+			}
+			t = exit;
+			if (t >= maxt || !nextCell(tr))
+				break;
+		}
+
+		if (!found)
+			return false;
+		mint = std::max(mint, first);
+		maxt = std::min(maxt, last);
+		return mint < maxt;
+	}
+
+	/**
+	 * \brief Sample a collision within the ray segment <tt>[mint, maxt]</tt>
+	 * using Woodcock tracking with the local majorants of the majorant grid
+	 *
+	 * \param t
+	 *    Upon success, stores the distance of the collision
+	 * \param densityAtT
+	 *    Upon success, stores the density at the collision
+	 * \return
+	 *    \c true if a (real) collision was found
+	 */
+	bool woodcockTracking(const Ray &ray, Float mint, Float maxt,
+			Sampler *sampler, Float &t, Float &densityAtT) const {
+		MajorantTraversal tr;
+		initTraversal(ray, mint, tr);
+
+		/* Remaining optical depth (w.r.t. the majorant) 
+		   until the next tentative collision */
+		Float tau = -std::log(1-sampler->next1D());
+		t = mint;
+
+		while (true) {
+			Float exit = std::min(getCellExit(tr), maxt),
+				  majorant = getMajorant(tr);
+
+			if (majorant > 0) {
+				Float tCollision = t + tau / majorant;
+				if (tCollision < exit) {
+					t = tCollision;
+					densityAtT = lookupDensity(ray(t), ray.d) * m_densityMultiplier;
+					#if defined(HETVOL_STATISTICS)
+						nullCollisions.incrementBase();
+					#endif
+					if (densityAtT > majorant * sampler->next1D())
+						return true;
+					#if defined(HETVOL_STATISTICS)
+						++nullCollisions;
+					#endif
+					tau = -std::log(1-sampler->next1D());
+					continue;
+				}
+				tau -= (exit - t) * majorant;
+			}
+
+			t = exit;
+			if (t >= maxt || !nextCell(tr))
+				return false;
+		}
+	}
+
 	inline Float lookupDensity(const Point &p, const Vector &d) const {
 		Float density = m_density->lookupFloat(p);
 		if (m_anisotropicMedium && density != 0) {
@@ -608,7 +785,10 @@ protected:
 	Float m_stepSize;
 	AABB m_densityAABB;
 	Float m_maxDensity;
-	Float m_invMaxDensity;
+	int m_majorantRes;
+	Vector3i m_majorantGridRes;
+	Vector m_cellSize, m_invCellSize;
+	std::vector<Float> m_majorants;
 };
 
 MTS_IMPLEMENT_CLASS_S(HeterogeneousMedium, false, Medium)
@@ -59,6 +59,9 @@ void help() {
 	cout <<  "                       out -- by default, \"~/mitsuba\" is used)" << endl << endl;
 	cout <<  "   -s file     Connect to additional Mitsuba servers specified in a file" << endl;
 	cout <<  "               with one name per line (same format as in -c)" << endl<< endl;
+	cout <<  "   -C level    Let network nodes compress their work results using zlib with" << endl;
+	cout <<  "               the given level (1: fastest, 9: best). Reduces the bandwidth" << endl;
+	cout <<  "               requirements of large image blocks (default: 0, disabled)" << endl << endl;
 	cout <<  "   -j count    Simultaneously schedule several scenes. Can sometimes accelerate" << endl;
 	cout <<  "               rendering when large amounts of processing power are available" << endl;
 	cout <<  "               (e.g. when running Mitsuba on a cluster. Default: 1)" << endl << endl;
@@ -66,8 +69,16 @@ void help() {
 	cout <<  "   -t          Test case mode (see Mitsuba docs for more information)" << endl << endl;
 	cout <<  "   -x          Skip rendering of files where output already exists" << endl << endl;
 	cout <<  "   -r sec      Write (partial) output images every 'sec' seconds" << endl << endl;
+	cout <<  "   -K          Incrementally write the rendering progress to a checkpoint file" << endl;
+	cout <<  "               named <output file>.mtschk, which is removed once the output" << endl;
+	cout <<  "               image has been written. Only applies to some integrators." << endl << endl;
+	cout <<  "   -R          Resume an interrupted rendering from its checkpoint file without" << endl;
+	cout <<  "               redoing any finished image blocks (implies -K)" << endl << endl;
 	cout <<  "   -b res      Specify the block resolution used to split images into parallel" << endl;
 	cout <<  "               workloads (default: 32). Only applies to some integrators." << endl << endl;
+	cout <<  "   -k count    Enable work stealing between local workers, each of which" << endl;
+	cout <<  "               prefetches up to 'count' work units at a time. Reduces lock" << endl;
+	cout <<  "               contention on machines with many cores (default: disabled)" << endl << endl;
 	cout <<  "   -v          Be more verbose" << endl << endl;
 	cout <<  "   -w          Treat warnings as errors" << endl << endl;
 	cout <<  "   -z          Disable progress bars" << endl << endl;
@@ -124,6 +135,9 @@ int ubi_main(int argc, char **argv) {
 		std::map<std::string, std::string> parameters;
 		int blockSize = 32;
 		int flushTimer = -1;
+		int prefetchCount = 0;
+		int compressionLevel = 0;
+		bool checkpoint = false, resume = false;
 
 		if (argc < 2) {
 			help();
@@ -132,7 +146,7 @@ int ubi_main(int argc, char **argv) {
 
 		optind = 1;
 		/* Parse command-line arguments */
-		while ((optchar = getopt(argc, argv, "a:c:D:s:j:n:o:r:b:p:qhzvtwx")) != -1) {
+		while ((optchar = getopt(argc, argv, "a:c:C:D:s:j:n:o:r:b:p:k:qhzvtwxKR")) != -1) {
 			switch (optchar) {
 				case 'a': {
 						std::vector<std::string> paths = tokenize(optarg, ";");
@@ -143,6 +157,11 @@ int ubi_main(int argc, char **argv) {
 				case 'c':
 					networkHosts = networkHosts + std::string(";") + std::string(optarg);
 					break;
+				case 'C':
+					compressionLevel = strtol(optarg, &end_ptr, 10);
+					if (*end_ptr != '\0' || compressionLevel < 0 || compressionLevel > 9)
+						SLog(EError, "Could not parse the compression level (should be in the range 0-9)!");
+					break;
 				case 'w':
 					treatWarningsAsErrors = true;
 					break;
@@ -180,6 +199,12 @@ int ubi_main(int argc, char **argv) {
 				case 'x':
 					skipExisting = true;
 					break;
+				case 'K':
+					checkpoint = true;
+					break;
+				case 'R':
+					checkpoint = resume = true;
+					break;
 				case 'p':
 					nprocs = strtol(optarg, &end_ptr, 10);
 					if (*end_ptr != '\0')
@@ -202,6 +227,11 @@ int ubi_main(int argc, char **argv) {
 					if (blockSize < 2 || blockSize > 64)
 						SLog(EError, "Invalid block size (should be in the range 2-64)");
 					break;
+				case 'k':
+					prefetchCount = strtol(optarg, &end_ptr, 10);
+					if (*end_ptr != '\0' || prefetchCount < 1)
+						SLog(EError, "Could not parse the prefetch count!");
+					break;
 				case 'z':
 					progressBars = false;
 					break;
@@ -242,6 +272,8 @@ int ubi_main(int argc, char **argv) {
 		Scheduler *scheduler = Scheduler::getInstance();
 		for (int i=0; i<nprocs; ++i)
 			scheduler->registerWorker(new LocalWorker(formatString("wrk%i", i)));
+		if (prefetchCount > 0)
+			scheduler->setWorkStealing(true, prefetchCount);
 		std::vector<std::string> hosts = tokenize(networkHosts, ";");
 
 		/* Establish network connections to nested servers */ 
@@ -273,7 +305,7 @@ int ubi_main(int argc, char **argv) {
 				stream = new SSHStream(tokens[0], tokens[1], cmdLine);
 			}
 			try {
-				scheduler->registerWorker(new RemoteWorker(formatString("net%i", i), stream));
+				scheduler->registerWorker(new RemoteWorker(formatString("net%i", i), stream, compressionLevel));
 			} catch (std::runtime_error &e) {
 				if (hostName.find("@") != std::string::npos) {
 #if defined(WIN32)
@@ -357,6 +389,9 @@ int ubi_main(int argc, char **argv) {
 			scene->setDestinationFile(destFile.length() > 0 ? 
 				fs::path(destFile) : (filePath / baseName));
 			scene->setBlockSize(blockSize);
+			if (checkpoint)
+				scene->setCheckpointFile(scene->getDestinationFile().file_string() 
+					+ ".mtschk", resume);
 
 			if (scene->destinationExists() && skipExisting)
 				continue;
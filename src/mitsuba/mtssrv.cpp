@@ -101,10 +101,12 @@ int ubi_main(int argc, char **argv) {
 		std::string hostName = getFQDN();
 		FileResolver *fileResolver = Thread::getThread()->getFileResolver();
 		bool hostNameSet = false;
+		std::string cacheDirectory = "";
+		size_t cacheSize = MTS_RESOURCE_CACHE_DEFAULT_SIZE;
 
 		optind = 1;
 		/* Parse command-line arguments */
-		while ((optchar = getopt(argc, argv, "a:c:s:n:p:i:l:qhv")) != -1) {
+		while ((optchar = getopt(argc, argv, "a:c:s:n:p:i:l:r:R:qhv")) != -1) {
 			switch (optchar) {
 				case 'a': {
 						std::vector<std::string> paths = tokenize(optarg, ";");
@@ -152,6 +154,14 @@ int ubi_main(int argc, char **argv) {
 							SLog(EError, "Could not parse the port number");
 					}
 					break;
+				case 'r':
+					cacheDirectory = optarg;
+					break;
+				case 'R':
+					cacheSize = (size_t) strtol(optarg, &end_ptr, 10) * 1024 * 1024;
+					if (*end_ptr != '\0')
+						SLog(EError, "Could not parse the resource cache size!");
+					break;
 				case 'q':
 					quietMode = true;
 					break;
@@ -179,6 +189,11 @@ int ubi_main(int argc, char **argv) {
 					cout <<  "   -l port     Listen for connections on a certain port (Default: " << MTS_DEFAULT_PORT << ")." << endl;
 					cout <<  "               To listen on stdin, specify \"-ls\" (implies -q)" << endl << endl;
 					cout <<  "   -n name     Assign a node name to this instance (Default: host name)" << endl << endl;
+					cout <<  "   -r dir      Keep resources submitted by clients (scenes, meshes, textures..)" << endl;
+					cout <<  "               in an on-disk cache, so that they do not have to be transmitted" << endl;
+					cout <<  "               again when they are used by a later rendering job" << endl << endl;
+					cout <<  "   -R size     Maximum size of the resource cache in MB (Default: "
+						<< MTS_RESOURCE_CACHE_DEFAULT_SIZE / (1024 * 1024) << ")" << endl << endl;
 					cout <<  "   -v          Be more verbose" << endl << endl;
 					cout <<  " The README file included with the distribution contains further information." << endl;
 					return 0;
@@ -261,9 +276,13 @@ int ubi_main(int argc, char **argv) {
 		}
 		scheduler->start();
 
+		ref<ResourceCache> resourceCache;
+		if (cacheDirectory != "")
+			resourceCache = new ResourceCache(cacheDirectory, cacheSize);
+
 		if (listenPort == -1) {
 			ref<StreamBackend> backend = new StreamBackend("con0", 
-					scheduler, nodeName, new ConsoleStream(), false);
+					scheduler, nodeName, new ConsoleStream(), false, resourceCache);
 			backend->start();
 			backend->join();
 			return 0;
@@ -357,7 +376,7 @@ int ubi_main(int argc, char **argv) {
 			}
 
 			ref<StreamBackend> backend = new StreamBackend(formatString("con%i", connectionIndex++), 
-				scheduler, nodeName, new SocketStream(newSocket), true);
+				scheduler, nodeName, new SocketStream(newSocket), true, resourceCache);
 			backend->start();
 		}
 #if defined(WIN32)
@@ -59,6 +59,9 @@ void help() {
 	cout <<  "                       out -- by default, \"~/mitsuba\" is used)" << endl << endl;
 	cout <<  "   -s file     Connect to additional Mitsuba servers specified in a file" << endl;
 	cout <<  "               with one name per line (same format as in -c)" << endl<< endl;
+	cout <<  "   -C level    Let network nodes compress their work results using zlib with" << endl;
+	cout <<  "               the given level (1: fastest, 9: best). Reduces the bandwidth" << endl;
+	cout <<  "               requirements of large image blocks (default: 0, disabled)" << endl << endl;
 	cout <<  "   -n name     Assign a node name to this instance (Default: host name)" << endl << endl;
 	cout <<  "   -t          Execute all testcases" << endl << endl;
 	cout <<  "   -v          Be more verbose" << endl << endl;
@@ -135,6 +138,7 @@ int mtsutil(int argc, char **argv) {
 		ELogLevel logLevel = EInfo;
 		FileResolver *fileResolver = Thread::getThread()->getFileResolver();
 		bool testCaseMode = false;
+		int compressionLevel = 0;
 
 		if (argc < 2) {
 			help();
@@ -143,7 +147,7 @@ int mtsutil(int argc, char **argv) {
 
 		optind = 1;
 		/* Parse command-line arguments */
-		while ((optchar = getopt(argc, argv, "+a:c:s:n:p:qhvt")) != -1) {
+		while ((optchar = getopt(argc, argv, "+a:c:C:s:n:p:qhvt")) != -1) {
 			switch (optchar) {
 				case 'a': {
 						std::vector<std::string> paths = tokenize(optarg, ";");
@@ -154,6 +158,11 @@ int mtsutil(int argc, char **argv) {
 				case 'c':
 					networkHosts = networkHosts + std::string(";") + std::string(optarg);
 					break;
+				case 'C':
+					compressionLevel = strtol(optarg, &end_ptr, 10);
+					if (*end_ptr != '\0' || compressionLevel < 0 || compressionLevel > 9)
+						SLog(EError, "Could not parse the compression level (should be in the range 0-9)!");
+					break;
 				case 't':
 					testCaseMode = true;
 					break;
@@ -245,7 +254,7 @@ int mtsutil(int argc, char **argv) {
 				stream = new SSHStream(tokens[0], tokens[1], cmdLine);
 			}
 			try {
-				scheduler->registerWorker(new RemoteWorker(formatString("net%i", i), stream));
+				scheduler->registerWorker(new RemoteWorker(formatString("net%i", i), stream, compressionLevel));
 			} catch (std::runtime_error &e) {
 				if (hostName.find("@") != std::string::npos) {
 #if defined(WIN32)
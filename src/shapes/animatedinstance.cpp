@@ -23,6 +23,12 @@
 
 MTS_NAMESPACE_BEGIN
 
+/**
+ * Instance of a shape group, whose transformation is specified by an
+ * animation track file. To let kd-trees cull rays efficiently, even
+ * when the instance moves far during the shutter interval, it is split 
+ * into a number of time segments with individual bounding boxes.
+ */
 class AnimatedInstance : public Shape {
 public:
 	AnimatedInstance(const Properties &props) : Shape(props) {
@@ -34,12 +40,18 @@ public:
 		ref<FileStream> fs = new FileStream(path, FileStream::EReadOnly);
 		m_occluder = true;
 		m_transform = new AnimatedTransform(fs);
+
+		/* Number of time segments with separate bounding boxes */
+		m_segmentCount = props.getInteger("timeSegments", 16);
+		if (m_segmentCount < 1)
+			Log(EError, "The number of time segments must be positive!");
 	}
 
 	AnimatedInstance(Stream *stream, InstanceManager *manager) 
 		: Shape(stream, manager) {
 		m_shapeGroup = static_cast<ShapeGroup *>(manager->getInstance(stream));
 		m_transform = new AnimatedTransform(stream);
+		m_segmentCount = stream->readInt();
 		m_occluder = true;
 		configure();
 	}
@@ -48,6 +60,7 @@ public:
 		Shape::serialize(stream, manager);
 		manager->serialize(stream, m_shapeGroup.get());
 		m_transform->serialize(stream);
+		stream->writeInt(m_segmentCount);
 	}
 
 	void configure() {
@@ -58,15 +71,52 @@ public:
 		Float minT, maxT;
 		m_transform->computeTimeBounds(minT, maxT);
 
-		/* Compute approximate bounds */
-		int nSteps = 100;
-		Float step = (maxT-minT) / (nSteps-1);
+		/* Pre-sample the animation for efficient per-ray evaluation */
+		m_cache = AnimatedTransformCache(m_transform);
+
+		int segmentCount = m_segmentCount;
+		if (!(maxT > minT))
+			segmentCount = 1;
+		m_minT = minT;
+		m_invSegmentLength = segmentCount > 1 ? segmentCount / (maxT-minT) : 0;
+
+		/* Compute approximate bounds of every time segment by sampling 
+		   the keyframes and a number of intermediate steps */
+		std::vector<Float> keyframes;
+		m_transform->collectKeyframes(keyframes);
+		int nSteps = std::max(2, 100 / segmentCount);
 		Transform objectToWorld;
+		m_segmentAABBs.clear();
+		m_segmentAABBs.resize(segmentCount);
+		m_aabb.reset();
+
+		for (int i=0; i<segmentCount; ++i) {
+			Float start = minT + (maxT-minT) * i / segmentCount,
+				  end = minT + (maxT-minT) * (i+1) / segmentCount;
+			std::vector<Float> times;
+			for (int j=0; j<=nSteps; ++j)
+				times.push_back(start + (end-start) * j / nSteps);
+			for (size_t j=0; j<keyframes.size(); ++j) {
+				if (keyframes[j] > start && keyframes[j] < end)
+					times.push_back(keyframes[j]);
+			}
+
+			AABB &segmentAABB = m_segmentAABBs[i];
+			for (size_t j=0; j<times.size(); ++j) {
+				m_cache.eval(times[j], objectToWorld);
+				for (int k=0; k<8; ++k)
+					segmentAABB.expandBy(objectToWorld(aabb.getCorner(k)));
+			}
+			m_aabb.expandBy(segmentAABB);
+		}
 
-		for (int i=0; i<nSteps; ++i) {
-			m_transform->eval(minT + step * i, objectToWorld);
-			for (int j=0; j<8; ++j)
-				m_aabb.expandBy(objectToWorld(aabb.getCorner(j)));
+		if (segmentCount > 1 && m_aabb.getVolume() > 0) {
+			Float volume = 0;
+			for (int i=0; i<segmentCount; ++i)
+				volume += m_segmentAABBs[i].getVolume();
+			Log(EDebug, "\"%s\": split into %i time segments (avg. bounding box volume: "
+				"%.1f%% of the full animation)", m_name.c_str(), segmentCount, 
+				100 * volume / (segmentCount * m_aabb.getVolume()));
 		}
 	}
 
@@ -74,6 +124,20 @@ public:
 		return m_aabb;
 	}
 
+	size_t getTimeSegmentCount() const {
+		return m_segmentAABBs.size();
+	}
+
+	size_t getTimeSegment(Float time) const {
+		int segment = (int) ((time - m_minT) * m_invSegmentLength);
+		return (size_t) std::max(0, std::min(segment, 
+			(int) m_segmentAABBs.size() - 1));
+	}
+
+	AABB getTimeSegmentAABB(size_t segment) const {
+		return m_segmentAABBs[segment];
+	}
+
 	std::string getName() const {
 		return m_name;
 	}
@@ -96,20 +160,18 @@ public:
 			Float maxt, Float &t, void *temp) const {
 		const ShapeKDTree *kdtree = m_shapeGroup->getKDTree();
 		Ray ray;
-		Transform objectToWorld, worldToObject;
-		m_transform->eval(_ray.time, objectToWorld);
-		worldToObject = objectToWorld.inverse();
-		worldToObject(_ray, ray);
+		Transform objectToWorld;
+		m_cache.eval(_ray.time, objectToWorld);
+		objectToWorld.inverse()(_ray, ray);
 		return kdtree->rayIntersect(ray, mint, maxt, t, temp);
 	}
 
 	bool rayIntersect(const Ray &_ray, Float mint, Float maxt) const {
 		const ShapeKDTree *kdtree = m_shapeGroup->getKDTree();
 		Ray ray;
-		Transform objectToWorld, worldToObject;
-		m_transform->eval(_ray.time, objectToWorld);
-		worldToObject = objectToWorld.inverse();
-		worldToObject(_ray, ray);
+		Transform objectToWorld;
+		m_cache.eval(_ray.time, objectToWorld);
+		objectToWorld.inverse()(_ray, ray);
 		return kdtree->rayIntersect(ray, mint, maxt);
 	}
 
@@ -117,7 +179,7 @@ public:
 		const void *temp, Intersection &its) const {
 		const ShapeKDTree *kdtree = m_shapeGroup->getKDTree();
 		Transform objectToWorld;
-		m_transform->eval(ray.time, objectToWorld);
+		m_cache.eval(ray.time, objectToWorld);
 		kdtree->fillIntersectionRecord<false>(ray, temp, its);
 		its.shFrame.n = normalize(objectToWorld(its.shFrame.n));
 		its.shFrame.s = normalize(objectToWorld(its.shFrame.s));
@@ -132,6 +194,10 @@ public:
 private:
 	ref<ShapeGroup> m_shapeGroup;
 	ref<AnimatedTransform> m_transform;
+	AnimatedTransformCache m_cache;
+	std::vector<AABB> m_segmentAABBs;
+	Float m_minT, m_invSegmentLength;
+	int m_segmentCount;
 	AABB m_aabb;
 	std::string m_name;
 };
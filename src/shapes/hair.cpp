@@ -24,7 +24,14 @@
 #include <mitsuba/render/trimesh.h>
 #include <mitsuba/core/properties.h>
 #include <mitsuba/core/fstream.h>
+#include <mitsuba/core/mstream.h>
+#include <mitsuba/core/mmap.h>
 #include <mitsuba/core/fresolver.h>
+#include <mitsuba/core/timer.h>
+
+#if defined(_OPENMP)
+#include <omp.h>
+#endif
 
 #define MTS_HAIR_USE_FANCY_CLIPPING 1
 
@@ -32,10 +39,9 @@ MTS_NAMESPACE_BEGIN
 
 /**
  * \brief Space-efficient acceleration structure for cylindrical hair
- * segments with miter joints. This class expects an ASCII file containing
- * a list of hairs made from segments. Each line should contain an X,
- * Y and Z coordinate separated by a space. An empty line indicates
- * the start of a new hair.
+ * segments with miter joints. The radius is either shared by all 
+ * segments or specified for each vertex (where the radius of the
+ * first vertex applies to the whole segment).
  */
 class HairKDTree : public SAHKDTree3D<HairKDTree> {
 	friend class GenericKDTree<AABB, SurfaceAreaHeuristic, HairKDTree>;
@@ -45,11 +51,13 @@ public:
 	using SAHKDTree3D<HairKDTree>::size_type;
 
 	HairKDTree(std::vector<Point> &vertices, 
-			std::vector<bool> &vertexStartsFiber, Float radius)
-			: m_radius(radius) {
-		/* Take the supplied vertex & start fiber arrays (without copying) */
+			std::vector<bool> &vertexStartsFiber, 
+			std::vector<Float> &radii, Float radius,
+			bool parallelBuild = true) : m_radius(radius) {
+		/* Take the supplied vertex, start fiber & radius arrays (without copying) */
 		m_vertices.swap(vertices);
 		m_vertexStartsFiber.swap(vertexStartsFiber);
+		m_radii.swap(radii);
 		m_hairCount = 0;
 
 		/* Compute the index of the first vertex in each segment. */
@@ -72,18 +80,21 @@ public:
 		setStopPrims(0);
 		setTraversalCost(10);
 		setQueryCost(30);
+		setParallelBuild(parallelBuild);
 		buildInternal();
 
 		Log(EDebug, "Total amount of storage (kd-tree & vertex data): %s",
 			memString(m_nodeCount * sizeof(KDNode) 
 			+ m_indexCount * sizeof(index_type)
-			+ vertices.size() * sizeof(Point)
-			+ vertexStartsFiber.size() / 8).c_str());
+			+ m_vertices.size() * sizeof(Point)
+			+ m_radii.size() * sizeof(Float)
+			+ m_vertexStartsFiber.size() / 8).c_str());
 
 		/* Optimization: replace all primitive indices by the
 		   associated vertex indices (this avoids an extra 
 		   indirection during traversal later on) */
-		for (size_type i=0; i<m_indexCount; ++i)
+		#pragma omp parallel for schedule(static) if (parallelBuild)
+		for (int i=0; i<(int) m_indexCount; ++i)
 			m_indices[i] = m_segIndex[m_indices[i]];
 
 		/* Free the segIndex array, it is not needed anymore */
@@ -108,11 +119,16 @@ public:
 		return m_vertexStartsFiber;
 	}
 
-	/// Return the radius of the hairs stored in the kd-tree
+	/// Return the default radius of the hairs stored in the kd-tree
 	inline Float getRadius() const {
 		return m_radius;
 	}
 
+	/// Return the per-vertex radii (or an empty list when all hairs use the default)
+	inline const std::vector<Float> &getRadii() const {
+		return m_radii;
+	}
+
 	/// Return the total number of segments
 	inline size_t getSegmentCount() const {
 		return m_segmentCount;
@@ -223,7 +239,7 @@ public:
 	 */
 	AABB intersectCylFace(int axis,
 			const Point &min, const Point &max,
-			const Point &cylPt, const Vector &cylD) const {
+			const Point &cylPt, const Vector &cylD, Float radius) const {
 		int axis1 = (axis + 1) % 3;
 		int axis2 = (axis + 2) % 3;
 
@@ -235,7 +251,7 @@ public:
 		Float ellipseLengths[2];
 
 		AABB aabb;
-		if (!intersectCylPlane(min, planeNrml, cylPt, cylD, m_radius, 
+		if (!intersectCylPlane(min, planeNrml, cylPt, cylD, radius, 
 			ellipseCenter, ellipseAxes, ellipseLengths)) {
 			/* Degenerate case -- return an invalid AABB. This is
 			   not a problem, since one of the other faces will provide
@@ -303,7 +319,7 @@ public:
 		Float lengths[2];
 
 		bool success = intersectCylPlane(firstVertex(iv), firstMiterNormal(iv), 
-			firstVertex(iv), tangent(iv), m_radius, center, axes, lengths);
+			firstVertex(iv), tangent(iv), radius(iv), center, axes, lengths);
 		Assert(success);
 
 		AABB result;
@@ -315,7 +331,7 @@ public:
 		}
 
 		success = intersectCylPlane(secondVertex(iv), secondMiterNormal(iv), 
-			secondVertex(iv), tangent(iv), m_radius, center, axes, lengths);
+			secondVertex(iv), tangent(iv), radius(iv), center, axes, lengths);
 		Assert(success);
 
 		axes[0] *= lengths[0]; axes[1] *= lengths[1];
@@ -336,6 +352,7 @@ public:
 
 		Point cylPt = firstVertex(iv);
 		Vector cylD = tangent(iv);
+		Float cylR = radius(iv);
 
 		/* Now forget about the cylinder ends and 
 		   intersect an infinite cylinder with each AABB face */
@@ -343,32 +360,32 @@ public:
 		clippedAABB.expandBy(intersectCylFace(0, 
 				Point(base.min.x, base.min.y, base.min.z),
 				Point(base.min.x, base.max.y, base.max.z),
-				cylPt, cylD));
+				cylPt, cylD, cylR));
 
 		clippedAABB.expandBy(intersectCylFace(0,
 				Point(base.max.x, base.min.y, base.min.z),
 				Point(base.max.x, base.max.y, base.max.z),
-				cylPt, cylD));
+				cylPt, cylD, cylR));
 
 		clippedAABB.expandBy(intersectCylFace(1, 
 				Point(base.min.x, base.min.y, base.min.z),
 				Point(base.max.x, base.min.y, base.max.z),
-				cylPt, cylD));
+				cylPt, cylD, cylR));
 
 		clippedAABB.expandBy(intersectCylFace(1,
 				Point(base.min.x, base.max.y, base.min.z),
 				Point(base.max.x, base.max.y, base.max.z),
-				cylPt, cylD));
+				cylPt, cylD, cylR));
 
 		clippedAABB.expandBy(intersectCylFace(2, 
 				Point(base.min.x, base.min.y, base.min.z),
 				Point(base.max.x, base.max.y, base.min.z),
-				cylPt, cylD));
+				cylPt, cylD, cylR));
 
 		clippedAABB.expandBy(intersectCylFace(2,
 				Point(base.min.x, base.min.y, base.max.z),
 				Point(base.max.x, base.max.y, base.max.z),
-				cylPt, cylD));
+				cylPt, cylD, cylR));
 
 		clippedAABB.clip(base);
 		return clippedAABB;
@@ -382,7 +399,7 @@ public:
 		const Float cos0 = dot(firstMiterNormal(iv), tangent(iv));
 		const Float cos1 = dot(secondMiterNormal(iv), tangent(iv));
 		const Float maxInvCos = 1.0 / std::min(cos0, cos1);
-		const Vector expandVec(m_radius * maxInvCos);
+		const Vector expandVec(radius(iv) * maxInvCos);
 
 		const Point a = firstVertex(iv);
 		const Point b = secondVertex(iv);
@@ -422,7 +439,8 @@ public:
 		// Quadratic to intersect circle in projection
 		const Float A = projDirection.lengthSquared();
 		const Float B = 2 * dot(projOrigin, projDirection);
-		const Float C = projOrigin.lengthSquared() - m_radius*m_radius;
+		const Float r = radius(iv);
+		const Float C = projOrigin.lengthSquared() - r*r;
 
 		if (!solveQuadratic(A, B, C, nearT, farT))
 			return false;
@@ -465,6 +483,8 @@ public:
 	inline Point prevVertex(index_type iv) const { return m_vertices[iv-1]; }
 	inline Point nextVertex(index_type iv) const { return m_vertices[iv+2]; }
 
+	inline Float radius(index_type iv) const { return m_radii.empty() ? m_radius : m_radii[iv]; }
+
 	inline bool prevSegmentExists(index_type iv) const { return !m_vertexStartsFiber[iv]; }
 	inline bool nextSegmentExists(index_type iv) const { return !m_vertexStartsFiber[iv+2]; }
 
@@ -490,57 +510,52 @@ public:
 protected:
 	std::vector<Point> m_vertices;
 	std::vector<bool> m_vertexStartsFiber;
+	std::vector<Float> m_radii;
 	std::vector<index_type> m_segIndex;
 	size_t m_segmentCount;
 	size_t m_hairCount;
 	Float m_radius;
 };
 
-HairShape::HairShape(const Properties &props) : Shape(props) {
-	fs::path path = Thread::getThread()->getFileResolver()->resolve(
-		props.getString("filename"));
-	Float radius = props.getFloat("radius", 0.05f);
-	/* Skip segments, whose tangent differs by less than one degree
-		compared to the previous one */
-	Float angleThreshold = degToRad(props.getFloat("angleThreshold", 1.0f));
-	Float dpThresh = std::cos(angleThreshold);
-
-	/* Object-space -> World-space transformation */
-	Transform objectToWorld = props.getTransform("toWorld", Transform());
-
-	Log(EInfo, "Loading hair geometry from \"%s\" ..", path.leaf().c_str());
-
-	fs::ifstream is(path);
-	if (is.fail())
-		Log(EError, "Could not open \"%s\"!", path.file_string().c_str());
-
-	std::string line;
-	bool newFiber = true;
-	Point p, lastP(0.0f);
+/**
+ * \brief Hair vertices after the transformation to world space and
+ * the removal of degenerate and low-curvature segments
+ */
+struct HairStrands {
 	std::vector<Point> vertices;
 	std::vector<bool> vertexStartsFiber;
-	Vector tangent(0.0f);
-	size_t nDegenerate = 0, nSkipped = 0;
+	/// Per-vertex radii (only used when the strands have different radii)
+	std::vector<Float> radii;
+	/// Per-vertex texture coordinates (optional)
+	std::vector<Point2> texcoords;
+	size_t nDegenerate, nSkipped;
 
-	while (is.good()) {
-		std::getline(is, line);
-		if (line.length() > 0 && line[0] == '#') {
-			newFiber = true;
-			continue;
-		}
-		std::istringstream iss(line);
-		iss >> p.x >> p.y >> p.z;
-		if (!iss.fail()) {
-			p = objectToWorld(p);
+	HairStrands() : nDegenerate(0), nSkipped(0) { }
+
+	/**
+	 * \brief Append a strand
+	 *
+	 * \param radius
+	 *    Radius of the strand (ignored when \c hasRadius is \c false)
+	 * \param texcoords
+	 *    Per-vertex texture coordinates or \c NULL
+	 */
+	void addStrand(const Point *positions, const Point2 *texcoords, 
+			size_t count, bool hasRadius, Float radius, 
+			const Transform &objectToWorld, Float dpThresh) {
+		bool newFiber = true;
+		Point lastP(0.0f);
+		Vector tangent(0.0f);
+
+		for (size_t i=0; i<count; ++i) {
+			Point p = objectToWorld(positions[i]);
 			if (newFiber) {
-				vertices.push_back(p);
-				vertexStartsFiber.push_back(newFiber);
+				addVertex(p, texcoords, i, true, hasRadius, radius);
 				lastP = p;
 				tangent = Vector(0.0f);
 			} else if (p != lastP) {
 				if (tangent.isZero()) {
-					vertices.push_back(p);
-					vertexStartsFiber.push_back(newFiber);
+					addVertex(p, texcoords, i, false, hasRadius, radius);
 					tangent = normalize(p - lastP);
 					lastP = p;
 				} else {
@@ -550,10 +565,11 @@ HairShape::HairShape(const Properties &props) : Shape(props) {
 							just overwrite the previous vertex by the current one */
 						tangent = normalize(p - vertices[vertices.size()-2]);
 						vertices[vertices.size()-1] = p;
+						if (texcoords)
+							this->texcoords[this->texcoords.size()-1] = texcoords[i];
 						++nSkipped;
 					} else {
-						vertices.push_back(p);
-						vertexStartsFiber.push_back(newFiber);
+						addVertex(p, texcoords, i, false, hasRadius, radius);
 						tangent = nextTangent;
 					}
 					lastP = p;
@@ -562,21 +578,211 @@ HairShape::HairShape(const Properties &props) : Shape(props) {
 				nDegenerate++;
 			}
 			newFiber = false;
+		}
+	}
+
+	/// Append the strands of another instance
+	void append(const HairStrands &other) {
+		vertices.insert(vertices.end(), other.vertices.begin(), other.vertices.end());
+		vertexStartsFiber.insert(vertexStartsFiber.end(), 
+			other.vertexStartsFiber.begin(), other.vertexStartsFiber.end());
+		radii.insert(radii.end(), other.radii.begin(), other.radii.end());
+		texcoords.insert(texcoords.end(), other.texcoords.begin(), other.texcoords.end());
+		nDegenerate += other.nDegenerate;
+		nSkipped += other.nSkipped;
+	}
+
+private:
+	inline void addVertex(const Point &p, const Point2 *texcoords, size_t i,
+			bool startsFiber, bool hasRadius, Float radius) {
+		vertices.push_back(p);
+		vertexStartsFiber.push_back(startsFiber);
+		if (hasRadius)
+			radii.push_back(radius);
+		if (texcoords)
+			this->texcoords.push_back(texcoords[i]);
+	}
+};
+
+/**
+ * Return a pointer to an array of 4-byte values stored in a memory stream
+ * and advance the stream position. When the byte order of the stream does
+ * not match the host, the array is converted into \c storage instead.
+ */
+template <typename T> static const T *mapArray(MemoryStream *stream,
+		size_t count, std::vector<T> &storage) {
+	if (stream->getSize() - stream->getPos() < count * sizeof(T))
+		SLog(EError, "The hair file is truncated!");
+	if (count == 0)
+		return NULL;
+	if (stream->getByteOrder() == stream->getHostByteOrder()) {
+		const T *result = reinterpret_cast<const T *>(stream->getCurrentData());
+		stream->setPos(stream->getPos() + count * sizeof(T));
+		return result;
+	}
+	storage.resize(count);
+	if (sizeof(T) == sizeof(uint32_t) && !std::numeric_limits<T>::is_integer)
+		stream->readSingleArray(reinterpret_cast<float *>(&storage[0]), count);
+	else
+		stream->readUIntArray(reinterpret_cast<uint32_t *>(&storage[0]), count);
+	return &storage[0];
+}
+
+/// Load a file using the ASCII hair format
+static void loadASCII(const fs::path &path, const Transform &objectToWorld,
+		Float radius, Float dpThresh, HairStrands &strands) {
+	fs::ifstream is(path);
+	if (is.fail())
+		SLog(EError, "Could not open \"%s\"!", path.file_string().c_str());
+
+	std::string line;
+	std::vector<Point> strand;
+	Point p;
+
+	while (is.good()) {
+		std::getline(is, line);
+		if (line.length() > 0 && line[0] == '#') {
+			strands.addStrand(strand.empty() ? NULL : &strand[0], NULL, 
+				strand.size(), false, radius, objectToWorld, dpThresh);
+			strand.clear();
+			continue;
+		}
+		std::istringstream iss(line);
+		iss >> p.x >> p.y >> p.z;
+		if (!iss.fail()) {
+			strand.push_back(p);
 		} else {
-			newFiber = true;
+			strands.addStrand(strand.empty() ? NULL : &strand[0], NULL, 
+				strand.size(), false, radius, objectToWorld, dpThresh);
+			strand.clear();
 		}
 	}
+	strands.addStrand(strand.empty() ? NULL : &strand[0], NULL, 
+		strand.size(), false, radius, objectToWorld, dpThresh);
+}
 
-	if (nDegenerate > 0)
-		Log(EInfo, "Encountered " SIZE_T_FMT 
-			" degenerate segments!", nDegenerate);
-	if (nSkipped > 0)
-		Log(EInfo, "Skipped " SIZE_T_FMT 
-			" low-curvature segments.", nSkipped);
+/// Load a file using the binary hair format
+static void loadBinary(const fs::path &path, const Transform &objectToWorld,
+		Float radius, Float dpThresh, HairStrands &strands) {
+	ref<MemoryMappedFile> mmap = new MemoryMappedFile(path);
+	ref<MemoryStream> stream = new MemoryStream(mmap->getData(), mmap->getSize());
+	stream->setByteOrder(Stream::ELittleEndian);
+
+	stream->setPos(sizeof(MTS_HAIR_FORMAT_HEADER));
+	uint16_t version = stream->readUShort(), flags = stream->readUShort();
+	if (version != MTS_HAIR_FORMAT_VERSION)
+		SLog(EError, "\"%s\": encountered an incompatible file version (%i)!", 
+			path.leaf().c_str(), version);
+	size_t strandCount = stream->readUInt(), vertexCount = stream->readUInt();
+
+	std::vector<uint32_t> countStorage;
+	std::vector<float> positionStorage, radiusStorage, texcoordStorage;
+	const uint32_t *counts = mapArray(stream.get(), strandCount, countStorage);
+	const float *positions = mapArray(stream.get(), vertexCount * 3, positionStorage);
+	const float *radii = (flags & HairShape::EHasRadius) ? 
+		mapArray(stream.get(), strandCount, radiusStorage) : NULL;
+	const float *texcoords = (flags & HairShape::EHasTexcoords) ? 
+		mapArray(stream.get(), vertexCount * 2, texcoordStorage) : NULL;
+
+	/* Compute the index of the first vertex of each strand */
+	std::vector<size_t> offsets(strandCount + 1);
+	offsets[0] = 0;
+	for (size_t i=0; i<strandCount; ++i)
+		offsets[i+1] = offsets[i] + counts[i];
+	if (offsets[strandCount] != vertexCount)
+		SLog(EError, "\"%s\": the strand vertex counts do not add up to the "
+			"total number of vertices!", path.leaf().c_str());
+
+	/* Transform and simplify groups of strands in parallel, and 
+	   concatenate the results in order afterwards */
+	int threadCount = 1;
+#if defined(_OPENMP)
+	threadCount = omp_get_max_threads();
+#endif
+	size_t chunkCount = std::max((size_t) 1, std::min(strandCount,
+		(size_t) threadCount * 4));
+	std::vector<HairStrands> chunks(chunkCount);
+
+	#pragma omp parallel for schedule(dynamic, 1)
+	for (int chunk=0; chunk<(int) chunkCount; ++chunk) {
+		size_t start = strandCount * chunk / chunkCount,
+			   end = strandCount * (chunk+1) / chunkCount;
+		HairStrands &result = chunks[chunk];
+		std::vector<Point> points;
+		std::vector<Point2> uvs;
+
+		for (size_t i=start; i<end; ++i) {
+			size_t offset = offsets[i], count = counts[i];
+			points.resize(count);
+			for (size_t j=0; j<count; ++j)
+				points[j] = Point(positions[3*(offset+j)], 
+					positions[3*(offset+j)+1], positions[3*(offset+j)+2]);
+			if (texcoords) {
+				uvs.resize(count);
+				for (size_t j=0; j<count; ++j)
+					uvs[j] = Point2(texcoords[2*(offset+j)], texcoords[2*(offset+j)+1]);
+			}
+			result.addStrand(count > 0 ? &points[0] : NULL, 
+				(texcoords && count > 0) ? &uvs[0] : NULL, count, radii != NULL, 
+				radii ? (Float) radii[i] : radius, objectToWorld, dpThresh);
+		}
+	}
 
-	vertexStartsFiber.push_back(true);
+	for (size_t i=0; i<chunkCount; ++i) {
+		strands.append(chunks[i]);
+		chunks[i] = HairStrands();
+	}
+}
 
-	m_kdtree = new HairKDTree(vertices, vertexStartsFiber, radius);
+HairShape::HairShape(const Properties &props) : Shape(props) {
+	fs::path path = Thread::getThread()->getFileResolver()->resolve(
+		props.getString("filename"));
+	Float radius = props.getFloat("radius", 0.05f);
+	/* Skip segments, whose tangent differs by less than one degree
+		compared to the previous one */
+	Float angleThreshold = degToRad(props.getFloat("angleThreshold", 1.0f));
+	Float dpThresh = std::cos(angleThreshold);
+	/* Build the kd-tree in parallel? */
+	bool parallelBuild = props.getBoolean("kdParallelBuild", true);
+
+	/* Object-space -> World-space transformation */
+	Transform objectToWorld = props.getTransform("toWorld", Transform());
+
+	Log(EInfo, "Loading hair geometry from \"%s\" ..", path.leaf().c_str());
+	ref<Timer> timer = new Timer();
+
+	/* Check for the binary format */
+	char header[sizeof(MTS_HAIR_FORMAT_HEADER)];
+	memset(header, 0, sizeof(header));
+	fs::ifstream is(path, std::ios::binary);
+	if (is.fail())
+		Log(EError, "Could not open \"%s\"!", path.file_string().c_str());
+	is.read(header, sizeof(header));
+	is.close();
+
+	HairStrands strands;
+	if (memcmp(header, MTS_HAIR_FORMAT_HEADER, sizeof(header)) == 0)
+		loadBinary(path, objectToWorld, radius, dpThresh, strands);
+	else
+		loadASCII(path, objectToWorld, radius, dpThresh, strands);
+
+	if (strands.nDegenerate > 0)
+		Log(EInfo, "Encountered " SIZE_T_FMT 
+			" degenerate segments!", strands.nDegenerate);
+	if (strands.nSkipped > 0)
+		Log(EInfo, "Skipped " SIZE_T_FMT 
+			" low-curvature segments.", strands.nSkipped);
+	if (strands.vertices.empty())
+		Log(EError, "\"%s\" does not contain any hair vertices!", 
+			path.leaf().c_str());
+	Log(EInfo, "Loaded " SIZE_T_FMT " hair vertices in %i ms.", 
+		strands.vertices.size(), timer->getMilliseconds());
+
+	strands.vertexStartsFiber.push_back(true);
+	m_texcoords.swap(strands.texcoords);
+
+	m_kdtree = new HairKDTree(strands.vertices, strands.vertexStartsFiber,
+		strands.radii, radius, parallelBuild);
 }
 
 HairShape::HairShape(Stream *stream, InstanceManager *manager) 
@@ -586,13 +792,23 @@ HairShape::HairShape(Stream *stream, InstanceManager *manager)
 
 	std::vector<Point> vertices(vertexCount);
 	std::vector<bool> vertexStartsFiber(vertexCount+1);
+	std::vector<Float> radii;
 	stream->readFloatArray((Float *) &vertices[0], vertexCount * 3);
 
 	for (size_t i=0; i<vertexCount; ++i) 
 		vertexStartsFiber[i] = stream->readBool();
 	vertexStartsFiber[vertexCount] = true;
 
-	m_kdtree = new HairKDTree(vertices, vertexStartsFiber, radius);
+	if (stream->readBool()) {
+		radii.resize(vertexCount);
+		stream->readFloatArray(&radii[0], vertexCount);
+	}
+	if (stream->readBool()) {
+		m_texcoords.resize(vertexCount);
+		stream->readFloatArray((Float *) &m_texcoords[0], vertexCount * 2);
+	}
+
+	m_kdtree = new HairKDTree(vertices, vertexStartsFiber, radii, radius);
 }
 
 void HairShape::serialize(Stream *stream, InstanceManager *manager) const {
@@ -600,12 +816,20 @@ void HairShape::serialize(Stream *stream, InstanceManager *manager) const {
 
 	const std::vector<Point> &vertices = m_kdtree->getVertices();
 	const std::vector<bool> &vertexStartsFiber = m_kdtree->getStartFiber();
+	const std::vector<Float> &radii = m_kdtree->getRadii();
 
 	stream->writeFloat(m_kdtree->getRadius());
 	stream->writeSize(vertices.size());
 	stream->writeFloatArray((Float *) &vertices[0], vertices.size() * 3);
 	for (size_t i=0; i<vertices.size(); ++i)
 		stream->writeBool(vertexStartsFiber[i]);
+
+	stream->writeBool(!radii.empty());
+	if (!radii.empty())
+		stream->writeFloatArray(&radii[0], radii.size());
+	stream->writeBool(!m_texcoords.empty());
+	if (!m_texcoords.empty())
+		stream->writeFloatArray((Float *) &m_texcoords[0], m_texcoords.size() * 2);
 }
 
 bool HairShape::rayIntersect(const Ray &ray, Float mint, 
@@ -621,8 +845,6 @@ void HairShape::fillIntersectionRecord(const Ray &ray,
 	const void *temp, Intersection &its) const {
 	its.p = ray(its.t);
 
-	/* No UV coordinates for now */
-	its.uv = Point2(0,0);
 	its.dpdu = Vector(0,0,0);
 	its.dpdv = Vector(0,0,0);
 
@@ -631,6 +853,16 @@ void HairShape::fillIntersectionRecord(const Ray &ray,
 	HairKDTree::index_type iv = *storage;
 
 	const Vector axis = m_kdtree->tangent(iv);
+
+	if (!m_texcoords.empty()) {
+		/* Interpolate the texture coordinates along the segment */
+		Vector segment = m_kdtree->secondVertex(iv) - m_kdtree->firstVertex(iv);
+		Float alpha = std::max((Float) 0, std::min((Float) 1, 
+			dot(its.p - m_kdtree->firstVertex(iv), segment) / segment.lengthSquared()));
+		its.uv = m_texcoords[iv] * (1-alpha) + m_texcoords[iv+1] * alpha;
+	} else {
+		its.uv = Point2(0,0);
+	}
 	its.geoFrame.s = axis;
 	const Vector relHitPoint = its.p - m_kdtree->firstVertex(iv);
 	its.geoFrame.n = Normal(normalize(relHitPoint - dot(axis, relHitPoint) * axis));
@@ -657,7 +889,6 @@ ref<TriMesh> HairShape::createTriMesh() {
 	
 	const std::vector<Point> &hairVertices = m_kdtree->getVertices();
 	const std::vector<bool> &vertexStartsFiber = m_kdtree->getStartFiber();
-	const Float radius = m_kdtree->getRadius();
 	Float *cosPhi = new Float[phiSteps];
 	Float *sinPhi = new Float[phiSteps];
 	for (size_t i=0; i<phiSteps; ++i) {
@@ -668,6 +899,7 @@ ref<TriMesh> HairShape::createTriMesh() {
 	uint32_t hairIdx = 0;
 	for (HairKDTree::index_type iv=0; iv<(HairKDTree::index_type) hairVertices.size()-1; iv++) {
 		if (!vertexStartsFiber[iv+1]) {
+			const Float radius = m_kdtree->radius(iv);
 			for (uint32_t phi=0; phi<phiSteps; ++phi) {
 				Vector tangent = m_kdtree->tangent(iv);
 				Vector dir = Frame(tangent).toWorld(
@@ -737,7 +969,9 @@ std::string HairShape::toString() const {
 		<< "   numVertices = " << m_kdtree->getVertexCount() << ","
 		<< "   numSegments = " << m_kdtree->getSegmentCount() << ","
 		<< "   numHairs = " << m_kdtree->getHairCount() << ","
-		<< "   radius = " << m_kdtree->getRadius()
+		<< "   radius = " << m_kdtree->getRadius() << ","
+		<< "   perStrandRadius = " << (m_kdtree->getRadii().empty() ? "no" : "yes") << ","
+		<< "   hasTexcoords = " << (m_texcoords.empty() ? "no" : "yes")
 		<< "]";
 	return oss.str();
 }
@@ -21,6 +21,11 @@
 
 #include <mitsuba/render/shape.h>
 
+/// Identifies files using the binary hair format
+#define MTS_HAIR_FORMAT_HEADER "MTSHAIR"
+/// Current version of the binary hair format
+#define MTS_HAIR_FORMAT_VERSION 1
+
 MTS_NAMESPACE_BEGIN
 	
 class HairKDTree;
@@ -31,9 +36,34 @@ class HairKDTree;
  * a list of hairs made from segments. Each line should contain an X,
  * Y and Z coordinate separated by a space. An empty line indicates
  * the start of a new hair.
+ *
+ * Alternatively, the hair can be stored in a compact binary format, 
+ * which is memory-mapped when loading and which can additionally specify 
+ * a radius for each strand and a texture coordinate for each vertex
+ * (<tt>mtsutil hairconv</tt> converts ASCII files). All values are 
+ * stored in little endian byte order:
+ * <pre>
+ * char[8]   MTS_HAIR_FORMAT_HEADER
+ * uint16    MTS_HAIR_FORMAT_VERSION
+ * uint16    flags (see \ref EBinaryFlags)
+ * uint32    number of strands
+ * uint32    number of vertices
+ * uint32    number of vertices of each strand
+ * float32   X, Y and Z coordinate of each vertex
+ * float32   radius of each strand (if \ref EHasRadius is set)
+ * float32   U and V coordinate of each vertex (if \ref EHasTexcoords is set)
+ * </pre>
  */
 class HairShape : public Shape {
 public:
+	/// Flags of the binary hair format
+	enum EBinaryFlags {
+		/// The file specifies a radius for every strand
+		EHasRadius    = 0x0001,
+		/// The file specifies a texture coordinate for every vertex
+		EHasTexcoords = 0x0002
+	};
+
 	/// Construct a new HairShape instance given a properties object
 	HairShape(const Properties &props);
 	
@@ -88,6 +118,7 @@ public:
 	MTS_DECLARE_CLASS()
 private:
 	ref<HairKDTree> m_kdtree;
+	std::vector<Point2> m_texcoords;
 };
 
 MTS_NAMESPACE_END
@@ -20,15 +20,191 @@
 #include <mitsuba/core/plugin.h>
 #include <mitsuba/core/fresolver.h>
 #include <mitsuba/core/timer.h>
+#include <mitsuba/core/mmap.h>
 #include <mitsuba/render/luminaire.h>
 #include <mitsuba/render/bsdf.h>
 #include <mitsuba/render/subsurface.h>
 #include <mitsuba/render/medium.h>
-#include <boost/lexical_cast.hpp>
 #include <set>
 
+#if defined(_OPENMP)
+#include <omp.h>
+#endif
+
 MTS_NAMESPACE_BEGIN
 
+/* ==================================================================== */
+/*                      Fast OBJ tokenizer helpers                      */
+/* ==================================================================== */
+
+/// Is this a whitespace character (within a line)?
+static inline bool isBlank(char c) {
+	return c == ' ' || c == '\t' || c == '\r';
+}
+
+/// Skip whitespace within a line, including backslash line continuations
+static inline const char *skipBlanks(const char *ptr, const char *end) {
+	while (ptr < end) {
+		if (isBlank(*ptr)) {
+			++ptr;
+		} else if (*ptr == '\\') {
+			const char *next = ptr + 1;
+			while (next < end && isBlank(*next))
+				++next;
+			if (next < end && *next == '\n')
+				ptr = next + 1;
+			else
+				break;
+		} else {
+			break;
+		}
+	}
+	return ptr;
+}
+
+/// Return the position of the newline terminating the current (possibly continued) line
+static const char *findLineEnd(const char *ptr, const char *end) {
+	while (ptr < end) {
+		const char *nl = (const char *) memchr(ptr, '\n', end - ptr);
+		if (!nl)
+			return end;
+		const char *last = nl;
+		while (last > ptr && isBlank(last[-1]))
+			--last;
+		if (last > ptr && last[-1] == '\\') {
+			ptr = nl + 1;
+			continue;
+		}
+		return nl;
+	}
+	return end;
+}
+
+/// Return the start of the first (non-continued) line at or after \c ptr
+static const char *findLineStart(const char *start, const char *ptr, const char *end) {
+	if (ptr == start)
+		return ptr;
+	/* Find the beginning of the line containing 'ptr-1' */
+	const char *lineStart = ptr - 1;
+	while (lineStart > start && lineStart[-1] != '\n')
+		--lineStart;
+	const char *lineEnd = findLineEnd(lineStart, end);
+	return lineEnd == end ? end : lineEnd + 1;
+}
+
+/// Parse a signed integer
+static inline bool parseInt(const char *&ptr, const char *end, int &result) {
+	bool negative = false;
+	if (ptr < end && (*ptr == '-' || *ptr == '+'))
+		negative = *ptr++ == '-';
+	if (ptr == end || *ptr < '0' || *ptr > '9')
+		return false;
+	int value = 0;
+	while (ptr < end && *ptr >= '0' && *ptr <= '9')
+		value = value * 10 + (*ptr++ - '0');
+	result = negative ? -value : value;
+	return true;
+}
+
+/**
+ * \brief Locale-independent floating point parser, which is considerably
+ * faster than <tt>operator&gt;&gt;</tt> and \c strtod(). Falls back to the
+ * latter for special values (e.g. "nan").
+ */
+static inline bool parseFloat(const char *&ptr, const char *end, Float &result) {
+	static const double powersOfTen[] = {
+		1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+		1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+	};
+
+	ptr = skipBlanks(ptr, end);
+	const char *start = ptr;
+	bool negative = false, digits = false;
+	if (ptr < end && (*ptr == '-' || *ptr == '+'))
+		negative = *ptr++ == '-';
+
+	uint64_t mantissa = 0;
+	int exponent = 0, nDigits = 0;
+	while (ptr < end && *ptr >= '0' && *ptr <= '9') {
+		if (nDigits < 19) {
+			mantissa = mantissa * 10 + (*ptr - '0');
+			if (mantissa) ++nDigits;
+		} else {
+			++exponent;
+		}
+		++ptr; digits = true;
+	}
+	if (ptr < end && *ptr == '.') {
+		++ptr;
+		while (ptr < end && *ptr >= '0' && *ptr <= '9') {
+			if (nDigits < 19) {
+				mantissa = mantissa * 10 + (*ptr - '0');
+				if (mantissa) ++nDigits;
+				--exponent;
+			}
+			++ptr; digits = true;
+		}
+	}
+	if (digits && ptr < end && (*ptr == 'e' || *ptr == 'E')) {
+		const char *expStart = ptr++;
+		int value;
+		if (parseInt(ptr, end, value))
+			exponent += value;
+		else
+			ptr = expStart;
+	}
+
+	if (!digits || (ptr < end && !isBlank(*ptr) && *ptr != '\n' && *ptr != '/' && *ptr != '\\')) {
+		/* Special value or garbage -- let strtod() deal with it */
+		char buf[64];
+		size_t length = 0;
+		ptr = start;
+		while (ptr < end && !isBlank(*ptr) && *ptr != '\n' && length < sizeof(buf)-1)
+			buf[length++] = *ptr++;
+		buf[length] = '\0';
+		char *endPtr = NULL;
+		result = (Float) strtod(buf, &endPtr);
+		return length > 0 && *endPtr == '\0';
+	}
+
+	double value = (double) mantissa;
+	if (exponent < 0)
+		value = exponent >= -22 ? value / powersOfTen[-exponent] : value * std::pow(10.0, exponent);
+	else if (exponent > 0)
+		value = exponent <= 22 ? value * powersOfTen[exponent] : value * std::pow(10.0, exponent);
+	result = (Float) (negative ? -value : value);
+	return true;
+}
+
+/// Sort a range using several threads (merge sort of per-thread sorted blocks)
+template <typename Iterator, typename Compare> static void parallelSort(
+		Iterator begin, Iterator end, Compare comp) {
+	size_t size = end - begin;
+	int nBlocks = 1;
+#if defined(_OPENMP)
+	nBlocks = omp_get_max_threads();
+#endif
+	if (nBlocks == 1 || size < 65536) {
+		std::sort(begin, end, comp);
+		return;
+	}
+
+	std::vector<size_t> bounds(nBlocks+1);
+	for (int i=0; i<=nBlocks; ++i)
+		bounds[i] = size * i / nBlocks;
+
+	#pragma omp parallel for schedule(static, 1)
+	for (int i=0; i<nBlocks; ++i)
+		std::sort(begin + bounds[i], begin + bounds[i+1], comp);
+
+	for (int step=1; step<nBlocks; step *= 2) {
+		#pragma omp parallel for schedule(static, 1)
+		for (int i=0; i<nBlocks-step; i += 2*step)
+			std::inplace_merge(begin + bounds[i], begin + bounds[i+step],
+				begin + bounds[std::min(i + 2*step, nBlocks)], comp);
+	}
+}
+
 /**
  * Wavefront OBJ triangle mesh loader
  */
@@ -40,29 +216,30 @@ public:
 		unsigned int uv[3];
 	};
 
-	bool fetch_line(std::istream &is, std::string &line) {
-		/// Fetch a line from the stream, while handling line breaks with backslashes
-		if (!std::getline(is, line))
-			return false;
-		if (line == "")
-			return true;
-		int lastCharacter = (int) line.size() - 1;
-		while (lastCharacter >= 0 && 
-				(line[lastCharacter] == '\r' ||
-					line[lastCharacter] == '\n' ||
-					line[lastCharacter] == '\t' ||
-					line[lastCharacter] == ' '))
-			lastCharacter--;
-
-		if (lastCharacter >= 0 && line[lastCharacter] == '\\') {
-			std::string nextLine;
-			fetch_line(is, nextLine);
-			line = line.substr(0, lastCharacter) + nextLine;
-		} else {
-			line.resize(lastCharacter+1);
-		}
-		return true;
-	}
+	/// Statement that affects the grouping of faces (g, usemtl, mtllib)
+	struct OBJStatement {
+		/// Number of faces in the chunk before this statement
+		size_t triangleCount;
+		/// Were there normals/texture coordinates since the previous statement?
+		bool hasNormals, hasTexcoords;
+		std::string keyword, line;
+	};
+
+	/// Parsed contents of a contiguous range of lines
+	struct OBJChunk {
+		std::vector<Point> vertices;
+		std::vector<Normal> normals;
+		std::vector<Point2> texcoords;
+		std::vector<OBJTriangle> triangles;
+		std::vector<OBJStatement> statements;
+		/// Number of faces (retained after the above have been merged)
+		size_t triangleCount;
+		/// Were there normals/texture coordinates after the last statement?
+		bool hasNormals, hasTexcoords;
+		std::string error;
+
+		inline OBJChunk() : triangleCount(0), hasNormals(false), hasTexcoords(false) { }
+	};
 
 	WavefrontOBJ(const Properties &props) : Shape(props) {
 		FileResolver *fResolver = Thread::getThread()->getFileResolver();
@@ -90,120 +267,128 @@ public:
 
 		/* Load the geometry */
 		Log(EInfo, "Loading geometry from \"%s\" ..", path.leaf().c_str());
-		fs::ifstream is(path);
-		if (is.bad() || is.fail())
+		if (!fs::exists(path))
 			Log(EError, "Geometry file '%s' not found!", path.file_string().c_str());
 
 		ref<Timer> timer = new Timer();
-		std::string buf;
+		std::vector<OBJChunk> chunks;
+		ref<MemoryMappedFile> mmap;
+		if (fs::file_size(path) > 0) {
+			mmap = new MemoryMappedFile(path);
+			parseChunks((const char *) mmap->getData(), mmap->getSize(), chunks);
+		}
+
+		/* Concatenate the vertex data of all chunks */
 		std::vector<Point> vertices;
 		std::vector<Normal> normals;
 		std::vector<Point2> texcoords;
 		std::vector<OBJTriangle> triangles;
+		size_t nVertices = 0, nNormals = 0, nTexcoords = 0, nTriangles = 0;
+		for (size_t i=0; i<chunks.size(); ++i) {
+			nVertices += chunks[i].vertices.size();
+			nNormals += chunks[i].normals.size();
+			nTexcoords += chunks[i].texcoords.size();
+			nTriangles += chunks[i].triangles.size();
+		}
+		vertices.reserve(nVertices);
+		normals.reserve(nNormals);
+		texcoords.reserve(nTexcoords);
+		triangles.reserve(nTriangles);
+		for (size_t i=0; i<chunks.size(); ++i) {
+			OBJChunk &chunk = chunks[i];
+			vertices.insert(vertices.end(), chunk.vertices.begin(), chunk.vertices.end());
+			normals.insert(normals.end(), chunk.normals.begin(), chunk.normals.end());
+			texcoords.insert(texcoords.end(), chunk.texcoords.begin(), chunk.texcoords.end());
+			triangles.insert(triangles.end(), chunk.triangles.begin(), chunk.triangles.end());
+			std::vector<Point>().swap(chunk.vertices);
+			std::vector<Normal>().swap(chunk.normals);
+			std::vector<Point2>().swap(chunk.texcoords);
+			std::vector<OBJTriangle>().swap(chunk.triangles);
+		}
+		mmap = NULL;
+		Log(EDebug, "Parsed " SIZE_T_FMT " vertices, " SIZE_T_FMT " normals, " SIZE_T_FMT 
+			" texture coordinates and " SIZE_T_FMT " triangles (%i chunks, %i ms)", 
+			nVertices, nNormals, nTexcoords, nTriangles, (int) chunks.size(),
+			timer->getMilliseconds());
+
+		/* Replay the grouping statements in file order */
 		bool hasNormals = false, hasTexcoords = false;
-		bool firstVertex = true;
 		BSDF *currentMaterial = NULL;
-		std::string name = m_name, line;
+		std::string name = m_name;
 		std::set<std::string> geomNames;
 		int geomIdx = 0;
 		bool nameBeforeGeometry = false;
-
-		while (is.good() && !is.eof() && fetch_line(is, line)) {
-			std::istringstream iss(line);
-			if (!(iss >> buf))
-				continue;
-
-			if (buf == "v") {
-				/* Parse + transform vertices */
-				Point p;
-				iss >> p.x >> p.y >> p.z;
-				vertices.push_back(p);
-			} else if (buf == "vn") {
-				Normal n;
-				iss >> n.x >> n.y >> n.z;
-				normals.push_back(n);
-				hasNormals = true;
-			} else if (buf == "g") {
-				std::string targetName;
-				std::string newName = trim(line.substr(1, line.length()-1));
-
-				/* There appear to be two different conventions
-				   for specifying object names in OBJ file -- try
-				   to detect which one is being used */
-				if (nameBeforeGeometry)
-					// Save geometry under the previously specified name
-					targetName = name;
-				else
-					targetName = newName;
-
-				if (triangles.size() > 0) {
-					/// make sure that we have unique names
-					if (geomNames.find(targetName) != geomNames.end())
-						name = formatString("%s_%i", targetName.c_str(), geomIdx);
-					generateGeometry(targetName, vertices, normals, texcoords, 
-						triangles, hasNormals, hasTexcoords, currentMaterial,
-						objectToWorld);
-					triangles.clear();
-					geomNames.insert(name);
-					geomIdx++;
-					hasNormals = false;
-					hasTexcoords = false;
-					firstVertex = false;
-				} else {
-					nameBeforeGeometry = true;
-				}
-				name = newName;
-			} else if (buf == "usemtl") {
-				std::string materialName = trim(line.substr(6, line.length()-1));
-				if (m_materials.find(materialName) != m_materials.end()) {
-					currentMaterial = m_materials[materialName];
-				} else {
-					Log(EWarn, "Unable to find material %s", materialName.c_str());
-					currentMaterial = NULL;
-				}
-			} else if (buf == "mtllib") {
-				ref<FileResolver> frClone = fResolver->clone();
-				frClone->addPath(fs::complete(path).parent_path());
-				fs::path mtlName = frClone->resolve(trim(line.substr(6, line.length()-1)));
-				if (fs::exists(mtlName))
-					parseMaterials(mtlName);
-				else
-					Log(EWarn, "Could not find referenced material library '%s'", 
-						mtlName.file_string().c_str());
-			} else if (buf == "vt") {
-				Float u, v, w;
-				iss >> u >> v >> w;
-				texcoords.push_back(Point2(u, v));
-				hasTexcoords = true;
-			} else if (buf == "f") {
-				std::string  tmp;
-				firstVertex = true;
-				OBJTriangle t;
-				iss >> tmp; parse(t, 0, tmp);
-				iss >> tmp; parse(t, 1, tmp);
-				iss >> tmp; parse(t, 2, tmp);
-				triangles.push_back(t);
-				if (iss >> tmp) {
-					parse(t, 1, tmp);
-					std::swap(t.p[0], t.p[1]);
-					std::swap(t.uv[0], t.uv[1]);
-					std::swap(t.n[0], t.n[1]);
-					triangles.push_back(t);
+		size_t groupStart = 0, chunkStart = 0;
+
+		for (size_t i=0; i<chunks.size(); ++i) {
+			const OBJChunk &chunk = chunks[i];
+			for (size_t j=0; j<chunk.statements.size(); ++j) {
+				const OBJStatement &stmt = chunk.statements[j];
+				const std::string &line = stmt.line;
+				size_t groupEnd = chunkStart + stmt.triangleCount;
+				hasNormals |= stmt.hasNormals;
+				hasTexcoords |= stmt.hasTexcoords;
+
+				if (stmt.keyword == "g") {
+					std::string targetName;
+					std::string newName = trim(line.substr(1, line.length()-1));
+
+					/* There appear to be two different conventions
+					   for specifying object names in OBJ file -- try
+					   to detect which one is being used */
+					if (nameBeforeGeometry)
+						// Save geometry under the previously specified name
+						targetName = name;
+					else
+						targetName = newName;
+
+					if (groupEnd > groupStart) {
+						/// make sure that we have unique names
+						if (geomNames.find(targetName) != geomNames.end())
+							name = formatString("%s_%i", targetName.c_str(), geomIdx);
+						generateGeometry(targetName, vertices, normals, texcoords, 
+							&triangles[groupStart], groupEnd - groupStart, hasNormals, 
+							hasTexcoords, currentMaterial, objectToWorld);
+						groupStart = groupEnd;
+						geomNames.insert(name);
+						geomIdx++;
+						hasNormals = false;
+						hasTexcoords = false;
+					} else {
+						nameBeforeGeometry = true;
+					}
+					name = newName;
+				} else if (stmt.keyword == "usemtl") {
+					std::string materialName = trim(line.substr(6, line.length()-1));
+					if (m_materials.find(materialName) != m_materials.end()) {
+						currentMaterial = m_materials[materialName];
+					} else {
+						Log(EWarn, "Unable to find material %s", materialName.c_str());
+						currentMaterial = NULL;
+					}
+				} else if (stmt.keyword == "mtllib") {
+					ref<FileResolver> frClone = fResolver->clone();
+					frClone->addPath(fs::complete(path).parent_path());
+					fs::path mtlName = frClone->resolve(trim(line.substr(6, line.length()-1)));
+					if (fs::exists(mtlName))
+						parseMaterials(mtlName);
+					else
+						Log(EWarn, "Could not find referenced material library '%s'", 
+							mtlName.file_string().c_str());
 				}
-				if (iss >> tmp)
-					Log(EError, "Encountered an n-gon (with n>4)! Only "
-						"triangles and quads are supported by the OBJ loader.");
-			} else {
-				/* Ignore */
 			}
+			hasNormals |= chunk.hasNormals;
+			hasTexcoords |= chunk.hasTexcoords;
+			chunkStart += chunk.triangleCount;
 		}
 		if (geomNames.find(name) != geomNames.end())
 			/// make sure that we have unique names
 			name = formatString("%s_%i", m_name.c_str(), geomIdx);
 
-		generateGeometry(name, vertices, normals, texcoords, 
-			triangles, hasNormals, hasTexcoords, currentMaterial,
-			objectToWorld);
+		if (triangles.size() > groupStart)
+			generateGeometry(name, vertices, normals, texcoords, 
+				&triangles[groupStart], triangles.size() - groupStart, 
+				hasNormals, hasTexcoords, currentMaterial, objectToWorld);
 
 		Log(EInfo, "Done with \"%s\" (took %i ms)", path.leaf().c_str(), timer->getMilliseconds());
 	}
@@ -230,25 +415,150 @@ public:
 			manager->serialize(stream, m_meshes[i]);
 	}
 
-	void parse(OBJTriangle &t, int i, const std::string &str) {
-		std::vector<std::string> tokens = tokenize(str, "/");
-		if (tokens.size() == 1) {
-			t.p[i] = boost::lexical_cast<int>(tokens[0].c_str())-1;
-		} else if (tokens.size() == 2) {
-			if (str.find("//") == std::string::npos) {
-				t.p[i]  = boost::lexical_cast<int>(tokens[0].c_str())-1;
-				t.uv[i] = boost::lexical_cast<int>(tokens[1].c_str())-1;
+	/// Split the file into chunks of lines and parse them in parallel
+	void parseChunks(const char *data, size_t size, std::vector<OBJChunk> &chunks) {
+		const char *end = data + size;
+		int nThreads = 1;
+#if defined(_OPENMP)
+		nThreads = omp_get_max_threads();
+#endif
+		/* Use a few chunks per thread for load balancing */
+		size_t nChunks = std::max((size_t) 1, std::min((size_t) (4 * nThreads), 
+			size / (1024 * 1024)));
+
+		std::vector<const char *> bounds(nChunks + 1);
+		bounds[0] = data;
+		bounds[nChunks] = end;
+		for (size_t i=1; i<nChunks; ++i)
+			bounds[i] = std::max(bounds[i-1], 
+				findLineStart(data, data + size * i / nChunks, end));
+
+		chunks.resize(nChunks);
+		#pragma omp parallel for schedule(dynamic)
+		for (int i=0; i<(int) nChunks; ++i)
+			parseChunk(bounds[i], bounds[i+1], chunks[i]);
+
+		for (size_t i=0; i<nChunks; ++i) {
+			if (!chunks[i].error.empty())
+				Log(EError, "%s", chunks[i].error.c_str());
+		}
+	}
+
+	/// Parse a face vertex of the form p, p/uv, p//n or p/uv/n
+	static inline bool parseFaceVertex(const char *&ptr, const char *end, 
+			OBJTriangle &t, int i) {
+		int value;
+		t.uv[i] = t.n[i] = 0;
+		if (!parseInt(ptr, end, value))
+			return false;
+		t.p[i] = value - 1;
+		if (ptr < end && *ptr == '/') {
+			++ptr;
+			if (ptr < end && *ptr != '/') {
+				if (!parseInt(ptr, end, value))
+					return false;
+				t.uv[i] = value - 1;
+			}
+			if (ptr < end && *ptr == '/') {
+				++ptr;
+				if (!parseInt(ptr, end, value))
+					return false;
+				t.n[i] = value - 1;
+			}
+		}
+		return ptr == end || isBlank(*ptr) || *ptr == '\n' || *ptr == '\\';
+	}
+
+	/// Parse a range of complete lines (runs in parallel, must not throw)
+	void parseChunk(const char *ptr, const char *end, OBJChunk &chunk) {
+		bool hasNormals = false, hasTexcoords = false;
+
+		while (ptr < end) {
+			const char *lineEnd = findLineEnd(ptr, end),
+				  *cur = skipBlanks(ptr, lineEnd), *keyword = cur;
+			while (cur < lineEnd && !isBlank(*cur) && *cur != '\\')
+				++cur;
+			size_t keywordLength = cur - keyword;
+			bool success = true;
+
+			if (keywordLength == 1 && keyword[0] == 'v') {
+				/* Parse + transform vertices */
+				Point p;
+				success = parseFloat(cur, lineEnd, p.x) && parseFloat(cur, lineEnd, p.y)
+					&& parseFloat(cur, lineEnd, p.z);
+				chunk.vertices.push_back(p);
+			} else if (keywordLength == 2 && keyword[0] == 'v' && keyword[1] == 'n') {
+				Normal n;
+				success = parseFloat(cur, lineEnd, n.x) && parseFloat(cur, lineEnd, n.y)
+					&& parseFloat(cur, lineEnd, n.z);
+				chunk.normals.push_back(n);
+				hasNormals = true;
+			} else if (keywordLength == 2 && keyword[0] == 'v' && keyword[1] == 't') {
+				Point2 uv;
+				success = parseFloat(cur, lineEnd, uv.x) && parseFloat(cur, lineEnd, uv.y);
+				chunk.texcoords.push_back(uv);
+				hasTexcoords = true;
+			} else if (keywordLength == 1 && keyword[0] == 'f') {
+				OBJTriangle t;
+				int count = 0;
+				while (success) {
+					cur = skipBlanks(cur, lineEnd);
+					if (cur == lineEnd)
+						break;
+					if (count == 4) {
+						chunk.error = "Encountered an n-gon (with n>4)! Only "
+							"triangles and quads are supported by the OBJ loader.";
+						return;
+					}
+					success = parseFaceVertex(cur, lineEnd, t, std::min(count, 2));
+					if (success && count == 2) {
+						chunk.triangles.push_back(t);
+					} else if (success && count == 3) {
+						/* Quad: also add the triangle (v3, v0, v2) */
+						const OBJTriangle &first = chunk.triangles.back();
+						OBJTriangle second;
+						second.p[0] = t.p[2]; second.p[1] = first.p[0]; second.p[2] = first.p[2];
+						second.uv[0] = t.uv[2]; second.uv[1] = first.uv[0]; second.uv[2] = first.uv[2];
+						second.n[0] = t.n[2]; second.n[1] = first.n[0]; second.n[2] = first.n[2];
+						chunk.triangles.push_back(second);
+					}
+					++count;
+				}
+				if (success && count < 3) {
+					chunk.error = "Invalid OBJ face format!";
+					return;
+				}
+			} else if ((keywordLength == 1 && keyword[0] == 'g') ||
+					   (keywordLength == 6 && (strncmp(keyword, "usemtl", 6) == 0
+					   || strncmp(keyword, "mtllib", 6) == 0))) {
+				const char *last = lineEnd;
+				while (last > keyword && isBlank(last[-1]))
+					--last;
+				OBJStatement stmt;
+				stmt.triangleCount = chunk.triangles.size();
+				stmt.hasNormals = hasNormals;
+				stmt.hasTexcoords = hasTexcoords;
+				stmt.keyword = std::string(keyword, keywordLength);
+				stmt.line = std::string(keyword, last);
+				chunk.statements.push_back(stmt);
+				hasNormals = hasTexcoords = false;
 			} else {
-				t.p[i] = boost::lexical_cast<int>(tokens[0].c_str())-1;
-				t.n[i] = boost::lexical_cast<int>(tokens[1].c_str())-1;
+				/* Ignore */
 			}
-		} else if (tokens.size() == 3) {
-			t.p[i] = boost::lexical_cast<int>(tokens[0].c_str())-1;
-			t.uv[i] = boost::lexical_cast<int>(tokens[1].c_str())-1;
-			t.n[i] = boost::lexical_cast<int>(tokens[2].c_str())-1;
-		} else {
-			Log(EError, "Invalid OBJ face format!");
+
+			if (!success) {
+				const char *last = lineEnd;
+				while (last > ptr && isBlank(last[-1]))
+					--last;
+				chunk.error = formatString("Could not parse the OBJ statement \"%s\"!",
+					std::string(ptr, std::min(last, ptr + 100)).c_str());
+				return;
+			}
+			ptr = lineEnd + 1;
 		}
+		chunk.triangleCount = chunk.triangles.size();
+		chunk.hasNormals = hasNormals;
+		chunk.hasTexcoords = hasTexcoords;
 	}
 
 	void parseMaterials(const fs::path &mtlPath) {
@@ -292,34 +602,53 @@ public:
 		m_materials[name] = bsdf;
 	}
 
-	struct Vertex {
-		Point p;
-		Normal n;
-		Point2 uv;
-	};
+	/**
+	 * \brief Orders the triangle corners of a mesh by their attribute 
+	 * values. Ties are broken using the corner index, which makes the 
+	 * order (and thus the merged vertex numbering) deterministic.
+	 */
+	struct CornerOrder {
+		const std::vector<Point> &vertices;
+		const std::vector<Normal> &normals;
+		const std::vector<Point2> &texcoords;
+		const OBJTriangle *triangles;
+		bool hasNormals, hasTexcoords;
+
+		CornerOrder(const std::vector<Point> &vertices, const std::vector<Normal> &normals,
+			const std::vector<Point2> &texcoords, const OBJTriangle *triangles,
+			bool hasNormals, bool hasTexcoords) : vertices(vertices), normals(normals),
+			texcoords(texcoords), triangles(triangles), hasNormals(hasNormals),
+			hasTexcoords(hasTexcoords) { }
+
+		/// Compare the attributes of two corners (-1, 0 or 1)
+		inline int compare(uint32_t c1, uint32_t c2) const {
+			const OBJTriangle &t1 = triangles[c1 / 3], &t2 = triangles[c2 / 3];
+			int i1 = c1 % 3, i2 = c2 % 3;
+			const Point &p1 = vertices[t1.p[i1]], &p2 = vertices[t2.p[i2]];
+			for (int i=0; i<3; ++i) {
+				if (p1[i] != p2[i])
+					return p1[i] < p2[i] ? -1 : 1;
+			}
+			if (hasNormals) {
+				const Normal &n1 = normals[t1.n[i1]], &n2 = normals[t2.n[i2]];
+				for (int i=0; i<3; ++i) {
+					if (n1[i] != n2[i])
+						return n1[i] < n2[i] ? -1 : 1;
+				}
+			}
+			if (hasTexcoords) {
+				const Point2 &uv1 = texcoords[t1.uv[i1]], &uv2 = texcoords[t2.uv[i2]];
+				for (int i=0; i<2; ++i) {
+					if (uv1[i] != uv2[i])
+						return uv1[i] < uv2[i] ? -1 : 1;
+				}
+			}
+			return 0;
+		}
 
-	/// For using vertices as keys in an associative structure
-	struct vertex_key_order : public 
-		std::binary_function<Vertex, Vertex, bool> {
-	public:
-		bool operator()(const Vertex &v1, const Vertex &v2) const {
-			if (v1.p.x < v2.p.x) return true;
-			else if (v1.p.x > v2.p.x) return false;
-			if (v1.p.y < v2.p.y) return true;
-			else if (v1.p.y > v2.p.y) return false;
-			if (v1.p.z < v2.p.z) return true;
-			else if (v1.p.z > v2.p.z) return false;
-			if (v1.n.x < v2.n.x) return true;
-			else if (v1.n.x > v2.n.x) return false;
-			if (v1.n.y < v2.n.y) return true;
-			else if (v1.n.y > v2.n.y) return false;
-			if (v1.n.z < v2.n.z) return true;
-			else if (v1.n.z > v2.n.z) return false;
-			if (v1.uv.x < v2.uv.x) return true;
-			else if (v1.uv.x > v2.uv.x) return false;
-			if (v1.uv.y < v2.uv.y) return true;
-			else if (v1.uv.y > v2.uv.y) return false;
-			return false;
+		inline bool operator()(uint32_t c1, uint32_t c2) const {
+			int result = compare(c1, c2);
+			return result < 0 || (result == 0 && c1 < c2);
 		}
 	};
 
@@ -327,90 +656,110 @@ public:
 			const std::vector<Point> &vertices,
 			const std::vector<Normal> &normals,
 			const std::vector<Point2> &texcoords,
-			const std::vector<OBJTriangle> &triangles,
+			const OBJTriangle *triangles, size_t triangleCount,
 			bool hasNormals, bool hasTexcoords,
 			BSDF *currentMaterial,
 			const Transform &objectToWorld) {
-		if (triangles.size() == 0)
+		if (triangleCount == 0)
 			return;
 		Log(EInfo, "Loading mesh \"%s\"", name.c_str());
 
-		std::map<Vertex, int, vertex_key_order> vertexMap;
-		std::vector<Vertex> vertexBuffer;
-		size_t numMerged = 0;
+		size_t nCorners = 3 * triangleCount;
+		if (nCorners > (size_t) 0xFFFFFFFFu)
+			Log(EError, "%s: too many triangles!", name.c_str());
+
+		/* Validate the indices */
+		int invalid = 0;
+		#pragma omp parallel for reduction(+:invalid)
+		for (int i=0; i<(int) triangleCount; ++i) {
+			const OBJTriangle &t = triangles[i];
+			for (int j=0; j<3; ++j) {
+				if (t.p[j] >= vertices.size() || (hasNormals && t.n[j] >= normals.size())
+					|| (hasTexcoords && t.uv[j] >= texcoords.size()))
+					invalid++;
+			}
+		}
+		if (invalid)
+			Log(EError, "%s: encountered an out-of-range vertex, normal or "
+				"texture coordinate index!", name.c_str());
+
 		Vector translate(0.0f);
 		Float scale = 0.0f;
 
 		if (m_recenter) {
 			AABB aabb;
-			for (unsigned int i=0; i<triangles.size(); i++) {
+			for (size_t i=0; i<triangleCount; i++) {
 				for (unsigned int j=0; j<3; j++) {
 					unsigned int vertexId = triangles[i].p[j];
-					aabb.expandBy(vertices.at(vertexId));
+					aabb.expandBy(vertices[vertexId]);
 				}
 			}
 			scale = 2/aabb.getExtents()[aabb.getLargestAxis()];
 			translate = -Vector(aabb.getCenter());
 		}
 
-		/* Collapse the mesh into a more usable form */
-		Triangle *triangleArray = new Triangle[triangles.size()];
-		for (unsigned int i=0; i<triangles.size(); i++) {
-			Triangle tri;
-			for (unsigned int j=0; j<3; j++) {
-				unsigned int vertexId = triangles[i].p[j];
-				unsigned int normalId = triangles[i].n[j];
-				unsigned int uvId = triangles[i].uv[j];
-				int key;
-
-				Vertex vertex;
-
-				if (m_recenter)
-					vertex.p = objectToWorld((vertices.at(vertexId) + translate)*scale);
-				else
-					vertex.p = objectToWorld(vertices.at(vertexId));
-
-				if (hasNormals && normals.at(normalId) != Normal(0.0f))
-					vertex.n = normalize(objectToWorld(normals.at(normalId)));
-				else
-					vertex.n = Normal(0.0f);
-
-				if (hasTexcoords)
-					vertex.uv = texcoords.at(uvId);
-				else
-					vertex.uv = Point2(0.0f);
-
-				if (vertexMap.find(vertex) != vertexMap.end()) {
-					key = vertexMap[vertex];
-					numMerged++;
-				} else {
-					key = (int) vertexBuffer.size();
-					vertexMap[vertex] = (int) key;
-					vertexBuffer.push_back(vertex);
-				}
+		/* Collapse the mesh into a more usable form: sort the triangle
+		   corners by their attributes to find identical vertices */
+		CornerOrder order(vertices, normals, texcoords, triangles, 
+			hasNormals, hasTexcoords);
+		std::vector<uint32_t> corners(nCorners), vertexIndex(nCorners);
+		for (size_t i=0; i<nCorners; ++i)
+			corners[i] = (uint32_t) i;
+		parallelSort(corners.begin(), corners.end(), order);
+
+		/* Each corner is represented by the first corner with 
+		   identical attributes (the first element of its run) */
+		std::vector<uint32_t> representative(nCorners);
+		uint32_t current = corners[0];
+		for (size_t i=0; i<nCorners; ++i) {
+			if (i > 0 && order.compare(corners[i-1], corners[i]) != 0)
+				current = corners[i];
+			representative[corners[i]] = current;
+		}
+		std::vector<uint32_t>().swap(corners);
 
-				tri.idx[j] = key;
-			}
-			triangleArray[i] = tri;
+		/* Number the vertices in order of their first occurrence */
+		size_t vertexCount = 0;
+		for (size_t i=0; i<nCorners; ++i) {
+			uint32_t rep = representative[i];
+			vertexIndex[i] = (rep == i) ? (uint32_t) vertexCount++ : vertexIndex[rep];
 		}
+		size_t numMerged = nCorners - vertexCount;
 
 		ref<TriMesh> mesh = new TriMesh(name,
-			triangles.size(), vertexBuffer.size(),
+			triangleCount, vertexCount,
 			hasNormals, hasTexcoords, false,
 			m_flipNormals, m_faceNormals);
 
-		std::copy(triangleArray, triangleArray+triangles.size(), mesh->getTriangles());
-
+		Triangle *target_triangles = mesh->getTriangles();
 		Point    *target_positions = mesh->getVertexPositions();
 		Normal   *target_normals   = mesh->getVertexNormals();
 		Point2   *target_texcoords = mesh->getVertexTexcoords();
 
-		for (size_t i=0; i<vertexBuffer.size(); i++) {
-			*target_positions++ = vertexBuffer[i].p;
-			if (hasNormals)
-				*target_normals++ = vertexBuffer[i].n;
-			if (hasTexcoords)
-				*target_texcoords++ = vertexBuffer[i].uv;
+		#pragma omp parallel for
+		for (int i=0; i<(int) triangleCount; ++i) {
+			const OBJTriangle &t = triangles[i];
+			for (int j=0; j<3; ++j) {
+				size_t corner = 3*i + j;
+				uint32_t key = vertexIndex[corner];
+				target_triangles[i].idx[j] = key;
+				if (representative[corner] != corner)
+					continue;
+
+				if (m_recenter)
+					target_positions[key] = objectToWorld((vertices[t.p[j]] + translate)*scale);
+				else
+					target_positions[key] = objectToWorld(vertices[t.p[j]]);
+
+				if (hasNormals) {
+					const Normal &n = normals[t.n[j]];
+					target_normals[key] = (n != Normal(0.0f)) 
+						? normalize(objectToWorld(n)) : Normal(0.0f);
+				}
+
+				if (hasTexcoords)
+					target_texcoords[key] = texcoords[t.uv[j]];
+			}
 		}
 
 		mesh->incRef();
@@ -419,7 +768,7 @@ public:
 		m_meshes.push_back(mesh);
 		Log(EInfo, "%s: Loaded " SIZE_T_FMT " triangles, " SIZE_T_FMT 
 			" vertices (merged " SIZE_T_FMT " vertices).", name.c_str(),
-			triangles.size(), vertexBuffer.size(), numMerged);
+			triangleCount, vertexCount, numMerged);
 		mesh->configure();
 	}
 
@@ -21,6 +21,7 @@
 #include <mitsuba/core/properties.h>
 #include <mitsuba/core/fstream.h>
 #include <mitsuba/core/timer.h>
+#include <mitsuba/core/mmap.h>
 #include <ply/ply_parser.hpp>
 
 #if defined(__clang__)
@@ -52,6 +53,10 @@
 #endif
 #endif
 
+#if defined(_OPENMP)
+#include <omp.h>
+#endif
+
 using namespace std::tr1::placeholders;
 
 MTS_NAMESPACE_BEGIN
@@ -59,6 +64,10 @@ MTS_NAMESPACE_BEGIN
 /**
  * PLY mesh loader using libply by Ares Lagae
  * (http://people.cs.kuleuven.be/~ares.lagae/libply/)
+ *
+ * Binary little endian triangle meshes are instead loaded by a fast path, 
+ * which memory-maps the file and copies the vertex and face records 
+ * (in parallel) straight into the mesh arrays.
  */
 class PLYLoader : public TriMesh {
 public:
@@ -83,7 +92,23 @@ public:
 		m_hasNormals = false;
 		m_hasTexCoords = false;
 		memset(&m_triangle, 0, sizeof(Triangle));
-		loadPLY(filePath);
+
+		ref<Timer> timer = new Timer();
+		if (!loadBinaryPLY(filePath))
+			loadPLY(filePath);
+
+		size_t vertexSize = sizeof(Point);
+		if (m_normals)
+			vertexSize += sizeof(Normal);
+		if (m_colors)
+			vertexSize += sizeof(Spectrum);
+		if (m_texcoords)
+			vertexSize += sizeof(Point2);
+
+		Log(EInfo, "\"%s\": Loaded " SIZE_T_FMT " triangles, " SIZE_T_FMT 
+				" vertices (%s in %i ms).", m_name.c_str(), m_triangleCount, m_vertexCount,
+				memString(sizeof(uint32_t) * m_triangleCount * 3 + vertexSize * m_vertexCount).c_str(),
+				timer->getMilliseconds());
 		if (m_triangleCount == 0 || m_vertexCount == 0)
 			Log(EError, "Unable to load \"%s\" (no triangles or vertices found)!");
 
@@ -95,6 +120,13 @@ public:
 
 	void loadPLY(const fs::path &path);
 
+	/**
+	 * \brief Fast path for binary little endian triangle meshes. Returns 
+	 * \c false if the file uses a different format or layout, in which
+	 * case the generic parser should be used.
+	 */
+	bool loadBinaryPLY(const fs::path &path);
+
 	void info_callback(const std::string& filename, std::size_t line_number,
 			const std::string& message) {
 		Log(EInfo, "\"%s\" [line %i] info: %s", filename.c_str(), line_number,
@@ -428,21 +460,235 @@ void PLYLoader::loadPLY(const fs::path &path) {
 	ply_parser.scalar_property_definition_callbacks(scalar_property_definition_callbacks);
 	ply_parser.list_property_definition_callbacks(list_property_definition_callbacks);
 
-	ref<Timer> timer = new Timer();
 	ply_parser.parse(path.file_string());
+}
+
+/// Return the size of a PLY scalar type (or 0 if unknown)
+static size_t plyTypeSize(const std::string &type) {
+	if (type == "char" || type == "uchar" || type == "int8" || type == "uint8")
+		return 1;
+	else if (type == "short" || type == "ushort" || type == "int16" || type == "uint16")
+		return 2;
+	else if (type == "int" || type == "uint" || type == "int32" || type == "uint32"
+		|| type == "float" || type == "float32")
+		return 4;
+	else if (type == "double" || type == "float64")
+		return 8;
+	return 0;
+}
+
+/// Read an unaligned scalar from a binary little endian record
+template <typename T> static inline T plyRead(const uint8_t *ptr) {
+	T value;
+	memcpy(&value, ptr, sizeof(T));
+	return value;
+}
+
+/// Read a floating point vertex attribute of type float32 or float64
+static inline Float plyReadFloat(const uint8_t *ptr, size_t size) {
+	return (Float) (size == 4 ? plyRead<float>(ptr) : plyRead<double>(ptr));
+}
+
+/// Scalar vertex property of a binary PLY file
+struct PLYProperty {
+	std::string name;
+	size_t offset, size;
+	bool isFloat;
+};
+
+bool PLYLoader::loadBinaryPLY(const fs::path &path) {
+	const uint16_t endianTest = 1;
+	if (*((const uint8_t *) &endianTest) != 1)
+		return false; /* Not supported on big endian machines */
+
+	ref<MemoryMappedFile> mmap = new MemoryMappedFile(path);
+	const char *data = (const char *) mmap->getData(), *end = data + mmap->getSize();
+
+	/* Parse the header */
+	const char *ptr = data;
+	std::vector<PLYProperty> vertexProps;
+	std::string indexProperty, countType, indexType, current;
+	size_t vertexCount = 0, faceCount = 0, vertexStride = 0;
+	int elementIdx = 0, faceProps = 0;
+	bool binary = false, header = true, first = true;
+
+	while (header) {
+		const char *lineEnd = (const char *) memchr(ptr, '\n', end - ptr);
+		if (!lineEnd)
+			return false;
+		std::vector<std::string> tokens = tokenize(std::string(ptr, lineEnd), " \t\r");
+		ptr = lineEnd + 1;
+
+		if (first) {
+			if (tokens.size() != 1 || tokens[0] != "ply")
+				return false;
+			first = false;
+		} else if (tokens.empty() || tokens[0] == "comment" || tokens[0] == "obj_info") {
+			continue;
+		} else if (tokens[0] == "format") {
+			binary = tokens.size() == 3 && tokens[1] == "binary_little_endian";
+		} else if (tokens[0] == "element" && tokens.size() == 3) {
+			current = tokens[1];
+			size_t count = (size_t) strtoul(tokens[2].c_str(), NULL, 10);
+			/* Only meshes consisting of a vertex and a face element */
+			if (elementIdx == 0 && current == "vertex")
+				vertexCount = count;
+			else if (elementIdx == 1 && current == "face")
+				faceCount = count;
+			else
+				return false;
+			elementIdx++;
+		} else if (tokens[0] == "property" && current == "vertex" && tokens.size() == 3) {
+			PLYProperty prop;
+			prop.name = tokens[2];
+			prop.offset = vertexStride;
+			prop.size = plyTypeSize(tokens[1]);
+			prop.isFloat = tokens[1] == "float" || tokens[1] == "float32"
+				|| tokens[1] == "double" || tokens[1] == "float64";
+			if (prop.size == 0)
+				return false;
+			vertexStride += prop.size;
+			vertexProps.push_back(prop);
+		} else if (tokens[0] == "property" && current == "face" && tokens.size() == 5 
+				&& tokens[1] == "list") {
+			countType = tokens[2];
+			indexType = tokens[3];
+			indexProperty = tokens[4];
+			faceProps++;
+		} else if (tokens[0] == "end_header") {
+			header = false;
+		} else {
+			return false;
+		}
+	}
+
+	if (!binary || elementIdx != 2 || faceProps != 1 || vertexCount == 0 || faceCount == 0
+		|| (indexProperty != "vertex_indices" && indexProperty != "vertex_index"))
+		return false;
+
+	size_t countSize = plyTypeSize(countType), indexSize = plyTypeSize(indexType);
+	if ((countSize != 1 && countSize != 4) || indexSize != 4 
+		|| indexType == "float" || indexType == "float32")
+		return false;
+
+	/* Locate the supported vertex attributes */
+	const PLYProperty *position[3] = { NULL, NULL, NULL }, *normal[3] = { NULL, NULL, NULL },
+		*uv[2] = { NULL, NULL }, *color[3] = { NULL, NULL, NULL };
+	for (size_t i=0; i<vertexProps.size(); ++i) {
+		const PLYProperty &prop = vertexProps[i];
+		const PLYProperty **target = NULL;
+		if (prop.name == "x") target = &position[0];
+		else if (prop.name == "y") target = &position[1];
+		else if (prop.name == "z") target = &position[2];
+		else if (prop.name == "nx") target = &normal[0];
+		else if (prop.name == "ny") target = &normal[1];
+		else if (prop.name == "nz") target = &normal[2];
+		else if (prop.name == "u") target = &uv[0];
+		else if (prop.name == "v") target = &uv[1];
+		else if (prop.name == "red" || prop.name == "diffuse_red") target = &color[0];
+		else if (prop.name == "green" || prop.name == "diffuse_green") target = &color[1];
+		else if (prop.name == "blue" || prop.name == "diffuse_blue") target = &color[2];
+		else continue;
+
+		/* Colors may be stored as uint8 or floats, everything else as floats */
+		if (!prop.isFloat && !(target >= &color[0] && target <= &color[2] && prop.size == 1))
+			return false;
+		*target = &prop;
+	}
+	if (!position[0] || !position[1] || !position[2])
+		return false;
+	bool hasNormals = normal[0] && normal[1] && normal[2],
+		 hasTexcoords = uv[0] && uv[1],
+		 hasColors = color[0] && color[1] && color[2];
+
+	size_t faceStride = countSize + 3 * indexSize;
+	const uint8_t *vertexData = (const uint8_t *) ptr,
+		  *faceData = vertexData + vertexStride * vertexCount;
+	/* Polygonal faces change the record size -- leave those
+	   (and truncated files) to the generic parser */
+	if ((size_t) (end - (const char *) vertexData) < 
+			vertexStride * vertexCount + faceStride * faceCount)
+		return false;
+
+	Log(EDebug, "\"%s\": using the fast binary loader", m_name.c_str());
+	m_vertexCount = vertexCount;
+	m_triangleCount = faceCount;
+	m_positions = new Point[m_vertexCount];
+	m_triangles = new Triangle[m_triangleCount];
+	if (hasNormals)
+		m_normals = new Normal[m_vertexCount];
+	if (hasTexcoords)
+		m_texcoords = new Point2[m_vertexCount];
+	if (hasColors)
+		m_colors = new Spectrum[m_vertexCount];
+
+	bool identity = m_objectToWorld.isIdentity();
+	if (identity && sizeof(Point) == 3 * sizeof(float) && vertexStride == 3 * sizeof(float)
+		&& position[0]->size == 4 && position[0]->offset == 0
+		&& position[1]->offset == 4 && position[2]->offset == 8) {
+		/* The vertex records only consist of positions -- copy them directly */
+		memcpy(m_positions, vertexData, vertexStride * vertexCount);
+	} else {
+		#pragma omp parallel for schedule(static)
+		for (int i=0; i<(int) vertexCount; ++i) {
+			const uint8_t *record = vertexData + vertexStride * i;
+			Point p;
+			for (int j=0; j<3; ++j)
+				p[j] = plyReadFloat(record + position[j]->offset, position[j]->size);
+			m_positions[i] = identity ? p : m_objectToWorld(p);
+
+			if (hasNormals) {
+				Normal n;
+				for (int j=0; j<3; ++j)
+					n[j] = plyReadFloat(record + normal[j]->offset, normal[j]->size);
+				m_normals[i] = identity ? n : m_objectToWorld(n);
+			}
+
+			if (hasTexcoords) {
+				m_texcoords[i] = Point2(
+					plyReadFloat(record + uv[0]->offset, uv[0]->size),
+					plyReadFloat(record + uv[1]->offset, uv[1]->size));
+			}
+
+			if (hasColors) {
+				Float rgb[3];
+				for (int j=0; j<3; ++j) {
+					if (color[j]->size == 1)
+						rgb[j] = record[color[j]->offset] / 255.0f;
+					else
+						rgb[j] = plyReadFloat(record + color[j]->offset, color[j]->size);
+				}
+				if (m_sRGB)
+					m_colors[i].fromSRGB(rgb[0], rgb[1], rgb[2]);
+				else
+					m_colors[i].fromLinearRGB(rgb[0], rgb[1], rgb[2]);
+			}
+		}
+	}
+
+	/* Copy the faces, which must all be triangles */
+	int invalid = 0;
+	#pragma omp parallel for schedule(static) reduction(+:invalid)
+	for (int i=0; i<(int) faceCount; ++i) {
+		const uint8_t *record = faceData + faceStride * i;
+		uint32_t count = countSize == 1 ? (uint32_t) record[0] : plyRead<uint32_t>(record);
+		if (count != 3) {
+			invalid++;
+			continue;
+		}
+		memcpy(m_triangles[i].idx, record + countSize, 3 * sizeof(uint32_t));
+		for (int j=0; j<3; ++j) {
+			if (m_triangles[i].idx[j] >= vertexCount)
+				invalid++;
+		}
+	}
+	if (invalid)
+		Log(EError, "\"%s\": encountered non-triangular faces or out-of-range "
+			"vertex indices. Only triangle PLY meshes are supported for now.", m_name.c_str());
 
-	size_t vertexSize = sizeof(Point);
-	if (m_normals)
-		vertexSize += sizeof(Normal);
-	if (m_colors)
-		vertexSize += sizeof(Spectrum);
-	if (m_texcoords)
-		vertexSize += sizeof(Point2);
-
-	Log(EInfo, "\"%s\": Loaded " SIZE_T_FMT " triangles, " SIZE_T_FMT 
-			" vertices (%s in %i ms).", m_name.c_str(), m_triangleCount, m_vertexCount,
-			memString(sizeof(uint32_t) * m_triangleCount * 3 + vertexSize * m_vertexCount).c_str(),
-			timer->getMilliseconds());
+	m_vertexCtr = m_vertexCount;
+	m_triangleCtr = m_triangleCount;
+	return true;
 }
 
 
@@ -18,7 +18,6 @@
 
 #include <mitsuba/render/trimesh.h>
 #include <mitsuba/core/properties.h>
-#include <mitsuba/core/fstream.h>
 #include <mitsuba/core/fresolver.h>
 
 MTS_NAMESPACE_BEGIN
@@ -41,34 +40,11 @@ public:
 		m_name = (props.getID() != "unnamed") ? props.getID() 
 			: formatString("%s@%i", filePath.stem().c_str(), shapeIndex); 
 
-		/* Load the geometry */
+		/* Load the geometry. Files using the uncompressed format are
+		   memory-mapped, in which case the attribute arrays directly
+		   refer to the (copy-on-write) mapping */
 		Log(EInfo, "Loading shape %i from \"%s\" ..", shapeIndex, filePath.leaf().c_str());
-		ref<FileStream> stream = new FileStream(filePath, FileStream::EReadOnly);
-		stream->setByteOrder(Stream::ELittleEndian);
-		ref<TriMesh> mesh = new TriMesh(stream, shapeIndex);
-		m_triangleCount = mesh->getTriangleCount();
-		m_vertexCount = mesh->getVertexCount();
-
-		m_positions = new Point[m_vertexCount];
-		memcpy(m_positions, mesh->getVertexPositions(), sizeof(Point) * m_vertexCount);
-
-		if (mesh->hasVertexNormals()) {
-			m_normals = new Normal[m_vertexCount];
-			memcpy(m_normals, mesh->getVertexNormals(), sizeof(Normal) * m_vertexCount);
-		}
-
-		if (mesh->hasVertexTexcoords()) {
-			m_texcoords = new Point2[m_vertexCount];
-			memcpy(m_texcoords, mesh->getVertexTexcoords(), sizeof(Point2) * m_vertexCount);
-		}
-
-		if (mesh->hasVertexColors()) {
-			m_colors = new Spectrum[m_vertexCount];
-			memcpy(m_colors, mesh->getVertexColors(), sizeof(Spectrum) * m_vertexCount);
-		}
-
-		m_triangles = new Triangle[m_triangleCount];
-		memcpy(m_triangles, mesh->getTriangles(), sizeof(Triangle) * m_triangleCount);
+		loadSerialized(filePath, shapeIndex);
 
 		if (!objectToWorld.isIdentity()) {
 			for (size_t i=0; i<m_vertexCount; ++i)
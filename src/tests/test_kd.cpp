@@ -29,6 +29,7 @@ public:
 	MTS_DECLARE_TEST(test01_sutherlandHodgman)
 	MTS_DECLARE_TEST(test02_bunnyBenchmark)
 	MTS_DECLARE_TEST(test03_pointKDTree)
+	MTS_DECLARE_TEST(test04_parallelBuild)
 	MTS_END_TESTCASE()
 
 	void test01_sutherlandHodgman() {
@@ -182,6 +183,39 @@ public:
 			Log(EInfo, "Average number of traversals for a radius=0.05 search query = " SIZE_T_FMT, nTraversals / nTries);
 		}
 	}
+
+	void test04_parallelBuild() {
+		Properties bunnyProps("ply");
+		bunnyProps.setString("filename", "data/tests/bunny.ply");
+
+		ref<TriMesh> mesh = static_cast<TriMesh *> (PluginManager::getInstance()->
+				createObject(MTS_CLASS(TriMesh), bunnyProps));
+		mesh->configure();
+
+		/* Build the same tree serially and in parallel. A low exact primitive 
+		   threshold ensures that the builder threads are actually used */
+		ref<ShapeKDTree> trees[2];
+		for (int i=0; i<2; ++i) {
+			trees[i] = new ShapeKDTree();
+			trees[i]->addShape(mesh);
+			trees[i]->setParallelBuild(i == 1);
+			trees[i]->setExactPrimitiveThreshold(4096);
+			trees[i]->build();
+		}
+
+		if (!trees[1]->getParallelBuild())
+			Log(EWarn, "Only a single core is available -- the parallel build was not exercised");
+
+		/* The resulting node and index arrays must be bit-identical */
+		assertTrue(trees[0]->getNodeCount() == trees[1]->getNodeCount());
+		assertTrue(trees[0]->getIndexCount() == trees[1]->getIndexCount());
+		if (trees[0]->getNodeCount() == trees[1]->getNodeCount())
+			assertTrue(memcmp(trees[0]->getRoot(), trees[1]->getRoot(),
+				sizeof(ShapeKDTree::KDNode) * trees[0]->getNodeCount()) == 0);
+		if (trees[0]->getIndexCount() == trees[1]->getIndexCount())
+			assertTrue(memcmp(trees[0]->getIndices(), trees[1]->getIndices(),
+				sizeof(ShapeKDTree::index_type) * trees[0]->getIndexCount()) == 0);
+	}
 };
 
 MTS_EXPORT_TESTCASE(TestKDTree, "Testcase for kd-tree related code")
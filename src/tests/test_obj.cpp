@@ -0,0 +1,79 @@
+/*
+    This file is part of Mitsuba, a physically based rendering system.
+
+    Copyright (c) 2007-2011 by Wenzel Jakob and others.
+
+    Mitsuba is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Mitsuba is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <mitsuba/core/plugin.h>
+#include <mitsuba/core/fstream.h>
+#include <mitsuba/render/testcase.h>
+#include <mitsuba/render/trimesh.h>
+
+MTS_NAMESPACE_BEGIN
+
+class TestOBJ : public TestCase {
+public:
+	MTS_BEGIN_TESTCASE()
+	MTS_DECLARE_TEST(test01_quadFaces)
+	MTS_END_TESTCASE()
+
+	void test01_quadFaces() {
+		/* A single quad with texture coordinates, which must be split
+		   into the triangles (v0, v1, v2) and (v3, v0, v2) */
+		const fs::path filename("test_obj_quad.obj");
+		ref<FileStream> stream = new FileStream(filename, FileStream::ETruncWrite);
+		stream->writeLine("v 0 0 0");
+		stream->writeLine("v 1 0 0");
+		stream->writeLine("v 1 1 0");
+		stream->writeLine("v 0 1 0");
+		stream->writeLine("vt 0 0");
+		stream->writeLine("vt 1 0");
+		stream->writeLine("vt 1 1");
+		stream->writeLine("vt 0 1");
+		stream->writeLine("f 1/1 2/2 3/3 4/4");
+		stream->close();
+
+		Properties props("obj");
+		props.setString("filename", filename.file_string());
+		ref<Shape> shape = static_cast<Shape *> (PluginManager::getInstance()->
+				createObject(MTS_CLASS(Shape), props));
+		shape->configure();
+		fs::remove(filename);
+
+		assertTrue(shape->isCompound());
+		TriMesh *mesh = static_cast<TriMesh *>(shape->getElement(0));
+		assertTrue(mesh != NULL && shape->getElement(1) == NULL);
+		assertTrue(mesh->getTriangleCount() == 2);
+
+		const Point expected[2][3] = {
+			{ Point(0, 0, 0), Point(1, 0, 0), Point(1, 1, 0) },
+			{ Point(0, 1, 0), Point(0, 0, 0), Point(1, 1, 0) }
+		};
+
+		const Triangle *triangles = mesh->getTriangles();
+		const Point *positions = mesh->getVertexPositions();
+		const Point2 *texcoords = mesh->getVertexTexcoords();
+		for (int i=0; i<2; ++i) {
+			for (int j=0; j<3; ++j) {
+				uint32_t idx = triangles[i].idx[j];
+				assertEquals(expected[i][j], positions[idx]);
+				assertEquals(Point2(expected[i][j].x, expected[i][j].y), texcoords[idx]);
+			}
+		}
+	}
+};
+
+MTS_EXPORT_TESTCASE(TestOBJ, "Testcase for the Wavefront OBJ loader")
+MTS_NAMESPACE_END
@@ -0,0 +1,85 @@
+/*
+    This file is part of Mitsuba, a physically based rendering system.
+
+    Copyright (c) 2007-2011 by Wenzel Jakob and others.
+
+    Mitsuba is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Mitsuba is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <mitsuba/render/testcase.h>
+#include <mitsuba/core/pdf.h>
+
+MTS_NAMESPACE_BEGIN
+
+class TestPDF : public TestCase {
+public:
+	MTS_BEGIN_TESTCASE()
+	MTS_DECLARE_TEST(test01_discretePDF2D)
+	MTS_END_TESTCASE()
+
+	void test01_discretePDF2D() {
+		const int width = 7, height = 5;
+		const size_t sampleCount = 1000000;
+		ref<Random> random = new Random();
+
+		/* Random cell values, including some empty cells and two rows 
+		   without any mass (one of them at the boundary) */
+		DiscretePDF2D pdf(Vector2i(width, height));
+		for (int y=0; y<height; ++y) {
+			for (int x=0; x<width; ++x) {
+				if (y == 0 || y == 3 || (x + y) % 4 == 0)
+					pdf(x, y) = 0.0f;
+				else
+					pdf(x, y) = random->nextFloat() + 0.1f;
+			}
+		}
+		pdf.build();
+
+		Float sum = 0;
+		for (int y=0; y<height; ++y)
+			for (int x=0; x<width; ++x)
+				sum += pdf.pdf(x, y);
+		assertEqualsEpsilon((Float) 1, sum, 1e-5f);
+
+		std::vector<size_t> histogram(width * height, 0);
+		for (size_t i=0; i<sampleCount; ++i) {
+			Point2 sample(random->nextFloat(), random->nextFloat());
+			Float samplePdf;
+			Point2i cell = pdf.sampleReuse(sample, samplePdf);
+			assertTrue(cell.x >= 0 && cell.x < width && cell.y >= 0 && cell.y < height);
+			assertTrue(sample.x >= 0 && sample.x <= 1 && sample.y >= 0 && sample.y <= 1);
+			assertEqualsEpsilon(pdf.pdf(cell.x, cell.y), samplePdf, 1e-6f);
+			histogram[cell.y * width + cell.x]++;
+		}
+
+		/* The observed frequencies must match pdf() within 5 standard deviations,
+		   and cells without mass must never be sampled */
+		for (int y=0; y<height; ++y) {
+			for (int x=0; x<width; ++x) {
+				Float expected = pdf.pdf(x, y), 
+					  observed = histogram[y * width + x] / (Float) sampleCount;
+				if (expected == 0) {
+					assertTrue(histogram[y * width + x] == 0);
+					continue;
+				}
+				Float stddev = std::sqrt(expected * (1 - expected) / sampleCount);
+				if (std::abs(observed - expected) > 5 * stddev)
+					failAndContinue(formatString("Cell (%i, %i): expected a frequency of %f, "
+						"but observed %f", x, y, expected, observed));
+			}
+		}
+	}
+};
+
+MTS_EXPORT_TESTCASE(TestPDF, "Testcase for discrete probability distributions")
+MTS_NAMESPACE_END
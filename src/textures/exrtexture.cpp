@@ -28,18 +28,37 @@ MTS_NAMESPACE_BEGIN
 
 /**
  * Simple linear (i.e. not gamma corrected) bitmap texture
- * using the EXR file format
+ * using the EXR file format. 
+ *
+ * When the parameter \c tiled is set to \c true, the mip map is 
+ * converted into a tiled file next to the image ("<filename>.mip"), 
+ * whose tiles are then loaded on demand into a bounded cache. The 
+ * tiled file is reused as long as it is newer than the image.
+ *
+ * The parameter \c texelFormat selects the storage format of the 
+ * mip map: "spectrum" (default) or "half" (half-precision RGB, which 
+ * is sufficient for most HDR textures and needs half the memory
+ * in RGB mode).
  */
 class EXRTexture : public Texture2D {
 public:
 	EXRTexture(const Properties &props) : Texture2D(props) {
 		m_filename = Thread::getThread()->getFileResolver()->resolve(
 			props.getString("filename"));
+		m_tiled = props.getBoolean("tiled", false);
+		m_texelFormat = MIPMap::parseTexelFormat(
+			props.getString("texelFormat", "spectrum"));
 		Log(EInfo, "Loading texture \"%s\"", m_filename.leaf().c_str());
 
-		ref<FileStream> fs = new FileStream(m_filename, FileStream::EReadOnly);
-		ref<Bitmap> bitmap = new Bitmap(Bitmap::EEXR, fs);
-		m_mipmap = MIPMap::fromBitmap(bitmap);
+		if (m_tiled)
+			m_mipmap = MIPMap::fromTiledFile(getTiledFilename(), m_filename,
+				MIPMap::EEWA, MIPMap::ERepeat, 8.0f, m_texelFormat);
+
+		if (m_mipmap == NULL) {
+			ref<FileStream> fs = new FileStream(m_filename, FileStream::EReadOnly);
+			ref<Bitmap> bitmap = new Bitmap(Bitmap::EEXR, fs);
+			initializeFrom(bitmap);
+		}
 		m_average = m_mipmap->triangle(m_mipmap->getLevels()-1, 0, 0);
 		m_maximum = m_mipmap->getMaximum();
 	}
@@ -47,20 +66,49 @@ public:
 	EXRTexture(Stream *stream, InstanceManager *manager) 
 	 : Texture2D(stream, manager) {
 		m_filename = stream->readString();
+		m_tiled = stream->readBool();
+		m_texelFormat = (MIPMap::ETexelFormat) stream->readInt();
 		Log(EInfo, "Unserializing texture \"%s\"", m_filename.leaf().c_str());
 		size_t size = stream->readSize();
 		ref<MemoryStream> mStream = new MemoryStream(size);
 		stream->copyTo(mStream, size);
 		mStream->setPos(0);
-		ref<Bitmap> bitmap = new Bitmap(Bitmap::EEXR, mStream);
-		m_mipmap = MIPMap::fromBitmap(bitmap);
+
+		/* Use the tiled file if it is accessible on this machine */
+		if (m_tiled)
+			m_mipmap = MIPMap::fromTiledFile(getTiledFilename(), m_filename,
+				MIPMap::EEWA, MIPMap::ERepeat, 8.0f, m_texelFormat);
+
+		if (m_mipmap == NULL) {
+			ref<Bitmap> bitmap = new Bitmap(Bitmap::EEXR, mStream);
+			m_mipmap = MIPMap::fromBitmap(bitmap, MIPMap::EEWA, 
+				MIPMap::ERepeat, 8.0f, m_texelFormat);
+		}
 		m_average = m_mipmap->triangle(m_mipmap->getLevels()-1, 0, 0);
 		m_maximum = m_mipmap->getMaximum();
 	}
 
+	void initializeFrom(Bitmap *bitmap) {
+		m_mipmap = MIPMap::fromBitmap(bitmap, MIPMap::EEWA, 
+			MIPMap::ERepeat, 8.0f, m_texelFormat);
+
+		if (m_tiled) {
+			/* Replace the in-memory pyramid by the tiled version */
+			fs::path tiledFilename = getTiledFilename();
+			if (m_mipmap->writeTiled(tiledFilename))
+				m_mipmap = new MIPMap(tiledFilename);
+		}
+	}
+
+	inline fs::path getTiledFilename() const {
+		return fs::path(m_filename.file_string() + ".mip");
+	}
+
 	void serialize(Stream *stream, InstanceManager *manager) const {
 		Texture2D::serialize(stream, manager);
 		stream->writeString(m_filename.file_string());
+		stream->writeBool(m_tiled);
+		stream->writeInt(m_texelFormat);
 		ref<Stream> is = new FileStream(m_filename, FileStream::EReadOnly);
 		stream->writeSize(is->getSize());
 		is->copyTo(stream);
@@ -106,6 +154,8 @@ protected:
 	ref<MIPMap> m_mipmap;
 	fs::path m_filename;
 	Spectrum m_average, m_maximum;
+	MIPMap::ETexelFormat m_texelFormat;
+	bool m_tiled;
 };
 
 MTS_IMPLEMENT_CLASS_S(EXRTexture, false, Texture2D)
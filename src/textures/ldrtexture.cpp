@@ -32,6 +32,17 @@ MTS_NAMESPACE_BEGIN
 
 /**
  * Gamma-corrected bitmap texture using the JPG, PNG, TGA or BMP
+ *
+ * When the parameter \c tiled is set to \c true, the mip map is
+ * converted into a tiled file next to the image ("<filename>.mip"),
+ * whose tiles are then loaded on demand into a bounded cache. The 
+ * tiled file is reused as long as it is newer than the image.
+ *
+ * The parameter \c texelFormat selects the storage format of the 
+ * mip map: "spectrum" (default), "srgb8" (8-bit sRGB) or "half"
+ * (half-precision RGB). The compact formats need 1/4 and 1/2 of the 
+ * memory in RGB mode and even less with more spectral samples.
+ * "srgb8" clamps values to [0, 1].
  */
 class LDRTexture : public Texture2D {
 public:
@@ -70,6 +81,9 @@ public:
 				"'repeat', 'clamp', 'black', or 'white'!", filterType.c_str());
 	
 		m_maxAnisotropy = props.getFloat("maxAnisotropy", 8);
+		m_tiled = props.getBoolean("tiled", false);
+		m_texelFormat = MIPMap::parseTexelFormat(
+			props.getString("texelFormat", "spectrum"));
 
 		if (extension == ".jpg" || extension == ".jpeg")
 			m_format = Bitmap::EJPEG;
@@ -82,8 +96,16 @@ public:
 		else
 			Log(EError, "Cannot deduce the file type of '%s'!", m_filename.file_string().c_str());
 
-		ref<Bitmap> bitmap = new Bitmap(m_format, fs);
-		initializeFrom(bitmap);
+		if (m_tiled)
+			m_mipmap = MIPMap::fromTiledFile(getTiledFilename(), m_filename,
+				m_filterType, m_wrapMode, m_maxAnisotropy, m_texelFormat);
+
+		if (m_mipmap == NULL) {
+			ref<Bitmap> bitmap = new Bitmap(m_format, fs);
+			initializeFrom(bitmap);
+		}
+		m_average = m_mipmap->triangle(m_mipmap->getLevels()-1, 0, 0);
+		m_maximum = m_mipmap->getMaximum();
 	}
 
 	LDRTexture(Stream *stream, InstanceManager *manager) 
@@ -95,12 +117,24 @@ public:
 		m_filterType = (MIPMap::EFilterType) stream->readInt();
 		m_wrapMode = (MIPMap::EWrapMode) stream->readUInt();
 		m_maxAnisotropy = stream->readFloat();
+		m_tiled = stream->readBool();
+		m_texelFormat = (MIPMap::ETexelFormat) stream->readInt();
 		uint32_t size = stream->readUInt();
 		ref<MemoryStream> mStream = new MemoryStream(size);
 		stream->copyTo(mStream, size);
 		mStream->setPos(0);
-		ref<Bitmap> bitmap = new Bitmap(m_format, mStream);
-		initializeFrom(bitmap);
+
+		/* Use the tiled file if it is accessible on this machine */
+		if (m_tiled)
+			m_mipmap = MIPMap::fromTiledFile(getTiledFilename(), m_filename,
+				m_filterType, m_wrapMode, m_maxAnisotropy, m_texelFormat);
+
+		if (m_mipmap == NULL) {
+			ref<Bitmap> bitmap = new Bitmap(m_format, mStream);
+			initializeFrom(bitmap, false);
+		}
+		m_average = m_mipmap->triangle(m_mipmap->getLevels()-1, 0, 0);
+		m_maximum = m_mipmap->getMaximum();
 
 		if (Scheduler::getInstance()->hasRemoteWorkers()
 			&& !fs::exists(m_filename)) {
@@ -120,7 +154,16 @@ public:
 			/ (Float) (1.0 + 0.055), (Float) 2.4);
 	}
 
-	void initializeFrom(Bitmap *bitmap) {
+	/// Return the name of the tiled mip map file (depends on the gamma value)
+	inline fs::path getTiledFilename() const {
+		if (m_gamma == -1)
+			return fs::path(m_filename.file_string() + ".mip");
+		else
+			return fs::path(formatString("%s.gamma%.4f.mip", 
+				m_filename.file_string().c_str(), m_gamma));
+	}
+
+	void initializeFrom(Bitmap *bitmap, bool allowTiling = true) {
 		ref<Bitmap> corrected = new Bitmap(bitmap->getWidth(), bitmap->getHeight(), 128);
 
 		float tbl[256];
@@ -202,9 +245,14 @@ public:
 		}
 
 		m_mipmap = MIPMap::fromBitmap(corrected, m_filterType,
-				m_wrapMode, m_maxAnisotropy);
-		m_average = m_mipmap->triangle(m_mipmap->getLevels()-1, 0, 0);
-		m_maximum = m_mipmap->getMaximum();
+				m_wrapMode, m_maxAnisotropy, m_texelFormat);
+
+		if (m_tiled && allowTiling) {
+			/* Replace the in-memory pyramid by the tiled version */
+			fs::path tiledFilename = getTiledFilename();
+			if (m_mipmap->writeTiled(tiledFilename))
+				m_mipmap = new MIPMap(tiledFilename, m_maxAnisotropy);
+		}
 	}
 
 	void serialize(Stream *stream, InstanceManager *manager) const {
@@ -215,6 +263,8 @@ public:
 		stream->writeInt(m_filterType);
 		stream->writeUInt(m_wrapMode);
 		stream->writeFloat(m_maxAnisotropy);
+		stream->writeBool(m_tiled);
+		stream->writeInt(m_texelFormat);
 
 		if (m_stream.get()) {
 			stream->writeUInt((uint32_t) m_stream->getSize());
@@ -278,6 +328,8 @@ protected:
 	Float m_gamma;
 	MIPMap::EWrapMode m_wrapMode;
 	Float m_maxAnisotropy;
+	MIPMap::ETexelFormat m_texelFormat;
+	bool m_tiled;
 };
 
 // ================ Hardware shader implementation ================ 
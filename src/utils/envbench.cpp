@@ -0,0 +1,181 @@
+/*
+    This file is part of Mitsuba, a physically based rendering system.
+
+    Copyright (c) 2007-2011 by Wenzel Jakob and others.
+
+    Mitsuba is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Mitsuba is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <mitsuba/render/util.h>
+#include <mitsuba/render/scene.h>
+#include <mitsuba/core/timer.h>
+#include <mitsuba/core/random.h>
+#include <mitsuba/core/plugin.h>
+#if defined(WIN32)
+#include <mitsuba/core/getopt.h>
+#endif
+
+MTS_NAMESPACE_BEGIN
+
+class EnvBench : public Utility {
+public:
+	void help() {
+		cout << endl;
+		cout << "Synopsis: Environment map sampling benchmark. Estimates the irradiance due" << endl;
+		cout << "to an environment map for a set of random surface normals using luminaire" << endl;
+		cout << "sampling, and reports the variance per unit time when the sampling density" << endl;
+		cout << "is built from the full-resolution image and from a coarser MIP map level." << endl;
+		cout << endl;
+		cout << "Usage: mtsutil envbench [options] <EXR environment map>" << endl;
+		cout << "Options/Arguments:" << endl;
+		cout << "   -h             Display this help text" << endl << endl;
+		cout << "   -n count       Number of samples per normal (default: 100000)" << endl << endl;
+		cout << "   -d count       Number of random normals (default: 64)" << endl << endl;
+		cout << "   -l level       MIP map level of the coarse sampling density, which" << endl;
+		cout << "                  corresponds to the previous implementation (default: 3)" << endl << endl;
+	}
+
+	/// Create a scene containing the environment map and a unit sphere
+	ref<Scene> createScene(const std::string &filename, int samplingLevel) {
+		PluginManager *pluginManager = PluginManager::getInstance();
+		Properties lumProps("envmap");
+		lumProps.setString("filename", filename);
+		lumProps.setInteger("samplingLevel", samplingLevel);
+		ref<Luminaire> luminaire = static_cast<Luminaire *> (
+			pluginManager->createObject(MTS_CLASS(Luminaire), lumProps));
+		luminaire->configure();
+
+		ref<Shape> shape = static_cast<Shape *> (
+			pluginManager->createObject(MTS_CLASS(Shape), Properties("sphere")));
+		shape->configure();
+
+		ref<Scene> scene = new Scene(Properties());
+		scene->addChild("", shape);
+		scene->addChild("", luminaire);
+		scene->configure();
+		scene->initialize();
+		return scene;
+	}
+
+	/**
+	 * Estimate the irradiance for each normal and return the average
+	 * relative variance of a single-sample estimate. The time spent
+	 * per sample is stored in \c timePerSample (in seconds).
+	 */
+	Float runBenchmark(const Luminaire *luminaire, const std::vector<Normal> &normals,
+			size_t sampleCount, Float &timePerSample) {
+		ref<Random> random = new Random();
+		LuminaireSamplingRecord lRec;
+		Float relVariance = 0;
+		size_t validNormals = 0;
+		const Point p(0.0f);
+
+		ref<Timer> timer = new Timer();
+		for (size_t i=0; i<normals.size(); ++i) {
+			const Normal &n = normals[i];
+			/* Numerically robust online variance estimation */
+			double mean = 0, meanSqr = 0;
+			for (size_t j=0; j<sampleCount; ++j) {
+				Point2 sample(random->nextFloat(), random->nextFloat());
+				luminaire->sample(p, lRec, sample);
+				Float value = 0;
+				if (lRec.pdf > 0)
+					value = lRec.value.getLuminance() *
+						std::max((Float) 0, dot(n, -lRec.d)) / lRec.pdf;
+				const double delta = value - mean;
+				mean += delta / (double) (j+1);
+				meanSqr += delta * (value - mean);
+			}
+			if (mean > 0) {
+				relVariance += (Float) (meanSqr / (sampleCount - 1) / (mean*mean));
+				++validNormals;
+			}
+		}
+		timePerSample = timer->getMicroseconds() * 1e-6f
+			/ (normals.size() * sampleCount);
+
+		return validNormals > 0 ? relVariance / validNormals : 0.0f;
+	}
+
+	int run(int argc, char **argv) {
+		char optchar, *end_ptr = NULL;
+		size_t sampleCount = 100000, normalCount = 64;
+		int coarseLevel = 3;
+		optind = 1;
+
+		/* Parse command-line arguments */
+		while ((optchar = getopt(argc, argv, "n:d:l:h")) != -1) {
+			switch (optchar) {
+				case 'h': {
+						help();
+						return 0;
+					}
+					break;
+				case 'n':
+					sampleCount = (size_t) strtol(optarg, &end_ptr, 10);
+					if (*end_ptr != '\0' || sampleCount < 2)
+						SLog(EError, "Could not parse the sample count!");
+					break;
+				case 'd':
+					normalCount = (size_t) strtol(optarg, &end_ptr, 10);
+					if (*end_ptr != '\0' || normalCount < 1)
+						SLog(EError, "Could not parse the normal count!");
+					break;
+				case 'l':
+					coarseLevel = strtol(optarg, &end_ptr, 10);
+					if (*end_ptr != '\0' || coarseLevel < 0)
+						SLog(EError, "Could not parse the MIP map level!");
+					break;
+			};
+		}
+
+		if (optind == argc || optind+1 < argc) {
+			help();
+			return 0;
+		}
+
+		ref<Random> random = new Random();
+		std::vector<Normal> normals(normalCount);
+		for (size_t i=0; i<normalCount; ++i)
+			normals[i] = Normal(squareToSphere(Point2(
+				random->nextFloat(), random->nextFloat())));
+
+		int levels[2] = { coarseLevel, 0 };
+		Float efficiency[2];
+
+		Log(EInfo, "Estimating the irradiance for " SIZE_T_FMT " normals using "
+			SIZE_T_FMT " samples each", normalCount, sampleCount);
+		Log(EInfo, "%6s %16s %16s %16s", "level", "time/sample [ns]",
+			"rel. variance", "efficiency");
+
+		for (int i=0; i<2; ++i) {
+			ref<Scene> scene = createScene(argv[optind], levels[i]);
+			const Luminaire *luminaire = scene->getLuminaires()[0];
+			Float timePerSample, variance = runBenchmark(luminaire,
+				normals, sampleCount, timePerSample);
+			efficiency[i] = 1.0f / (variance * timePerSample);
+			Log(EInfo, "%6i %16.2f %16.6f %16.4e", levels[i],
+				timePerSample * 1e9f, variance, efficiency[i]);
+		}
+
+		Log(EInfo, "Variance per unit time improved by a factor of %.2f",
+			efficiency[1] / efficiency[0]);
+
+		return 0;
+	}
+
+	MTS_DECLARE_UTILITY()
+};
+
+MTS_EXPORT_UTILITY(EnvBench, "Environment map sampling benchmark")
+MTS_NAMESPACE_END
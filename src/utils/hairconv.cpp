@@ -0,0 +1,155 @@
+/*
+    This file is part of Mitsuba, a physically based rendering system.
+
+    Copyright (c) 2007-2011 by Wenzel Jakob and others.
+
+    Mitsuba is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Mitsuba is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <mitsuba/render/util.h>
+#include <mitsuba/core/fstream.h>
+#include <mitsuba/core/timer.h>
+#include <fstream>
+#include "../shapes/hair.h"
+#if defined(WIN32)
+#include <mitsuba/core/getopt.h>
+#endif
+
+MTS_NAMESPACE_BEGIN
+
+class HairConverter : public Utility {
+public:
+	void help() {
+		cout << endl;
+		cout << "Synopsis: Converts an ASCII hair file into the compact binary format, which" << endl;
+		cout << "can be loaded much faster by the 'hair' shape plugin." << endl;
+		cout << endl;
+		cout << "Usage: mtsutil hairconv [options] <ASCII hair file> <binary hair file>" << endl;
+		cout << "Options/Arguments:" << endl;
+		cout << "   -h             Display this help text" << endl << endl;
+		cout << "   -r             Each vertex line contains an additional radius column" << endl;
+		cout << "                  after the X, Y and Z coordinates. The radius of the" << endl;
+		cout << "                  first vertex is used for the whole strand." << endl << endl;
+		cout << "   -t             Each vertex line contains two additional texture" << endl;
+		cout << "                  coordinate columns (after the radius, if present)" << endl << endl;
+		cout << "The input format matches the ASCII format of the 'hair' shape plugin: one" << endl;
+		cout << "vertex per line, where empty lines and comments (starting with '#')" << endl;
+		cout << "separate the strands." << endl << endl;
+	}
+
+	int run(int argc, char **argv) {
+		char optchar;
+		bool hasRadius = false, hasTexcoords = false;
+		optind = 1;
+
+		/* Parse command-line arguments */
+		while ((optchar = getopt(argc, argv, "rth")) != -1) {
+			switch (optchar) {
+				case 'h': {
+						help();
+						return 0;
+					}
+					break;
+				case 'r':
+					hasRadius = true;
+					break;
+				case 't':
+					hasTexcoords = true;
+					break;
+			};
+		}
+
+		if (argc-optind != 2) {
+			help();
+			return 0;
+		}
+
+		std::ifstream is(argv[optind]);
+		if (is.fail())
+			Log(EError, "Could not open \"%s\"!", argv[optind]);
+
+		ref<Timer> timer = new Timer();
+		std::vector<uint32_t> counts;
+		std::vector<float> positions, radii, texcoords;
+		std::string line;
+		bool newStrand = true;
+		int columns = 3 + (hasRadius ? 1 : 0) + (hasTexcoords ? 2 : 0);
+		float values[6];
+
+		while (std::getline(is, line)) {
+			const char *ptr = line.c_str();
+			char *end_ptr = NULL;
+			int i = 0;
+			if (line.length() > 0 && line[0] != '#') {
+				for (; i<columns; ++i) {
+					values[i] = (float) strtod(ptr, &end_ptr);
+					if (end_ptr == ptr)
+						break;
+					ptr = end_ptr;
+				}
+			}
+			if (i == 0) {
+				newStrand = true;
+				continue;
+			} else if (i != columns) {
+				Log(EError, "Could not parse the line \"%s\" (expected %i values)",
+					line.c_str(), columns);
+			}
+
+			if (newStrand) {
+				counts.push_back(0);
+				if (hasRadius)
+					radii.push_back(values[3]);
+				newStrand = false;
+			}
+			counts.back()++;
+			positions.insert(positions.end(), values, values + 3);
+			if (hasTexcoords)
+				texcoords.insert(texcoords.end(), values + columns - 2, values + columns);
+		}
+
+		size_t vertexCount = positions.size() / 3;
+		if (vertexCount > (size_t) std::numeric_limits<uint32_t>::max())
+			Log(EError, "The hair file contains too many vertices!");
+
+		ref<FileStream> fs = new FileStream(argv[optind+1], FileStream::ETruncReadWrite);
+		fs->setByteOrder(Stream::ELittleEndian);
+		fs->write(MTS_HAIR_FORMAT_HEADER, sizeof(MTS_HAIR_FORMAT_HEADER));
+		fs->writeUShort(MTS_HAIR_FORMAT_VERSION);
+		fs->writeUShort((hasRadius ? HairShape::EHasRadius : 0) 
+			| (hasTexcoords ? HairShape::EHasTexcoords : 0));
+		fs->writeUInt((uint32_t) counts.size());
+		fs->writeUInt((uint32_t) vertexCount);
+		if (!counts.empty()) {
+			fs->writeUIntArray(&counts[0], counts.size());
+			fs->writeSingleArray(&positions[0], positions.size());
+			if (hasRadius)
+				fs->writeSingleArray(&radii[0], radii.size());
+			if (hasTexcoords)
+				fs->writeSingleArray(&texcoords[0], texcoords.size());
+		}
+		size_t fileSize = fs->getSize();
+		fs->close();
+
+		Log(EInfo, "Converted " SIZE_T_FMT " strands with " SIZE_T_FMT 
+			" vertices in %i ms (%s)", counts.size(), vertexCount, 
+			timer->getMilliseconds(), memString(fileSize).c_str());
+
+		return 0;
+	}
+
+	MTS_DECLARE_UTILITY()
+};
+
+MTS_EXPORT_UTILITY(HairConverter, "Convert ASCII hair files into the binary format")
+MTS_NAMESPACE_END
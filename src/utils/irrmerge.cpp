@@ -0,0 +1,85 @@
+/*
+    This file is part of Mitsuba, a physically based rendering system.
+
+    Copyright (c) 2007-2011 by Wenzel Jakob and others.
+
+    Mitsuba is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Mitsuba is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <mitsuba/render/util.h>
+#include <mitsuba/render/irrcache.h>
+#if defined(WIN32)
+#include <mitsuba/core/getopt.h>
+#endif
+
+MTS_NAMESPACE_BEGIN
+
+class IrradianceCacheMerge : public Utility {
+public:
+	void help() {
+		cout << endl;
+		cout << "Synopsis: Merges several irradiance cache files (e.g. written by different" << endl;
+		cout << "network nodes or render jobs using the 'cacheFile' parameter of the 'irrcache'" << endl;
+		cout << "integrator) into one file. Records contained in several inputs are only" << endl;
+		cout << "stored once. The parameters of the first file are used for the result." << endl;
+		cout << endl;
+		cout << "Usage: mtsutil irrmerge [options] <output file> <input file 1> [input file 2] .." << endl;
+		cout << "Options/Arguments:" << endl;
+		cout << "   -h             Display this help text" << endl << endl;
+	}
+
+	int run(int argc, char **argv) {
+		char optchar;
+		optind = 1;
+
+		/* Parse command-line arguments */
+		while ((optchar = getopt(argc, argv, "h")) != -1) {
+			switch (optchar) {
+				case 'h': {
+						help();
+						return 0;
+					}
+					break;
+			};
+		}
+
+		if (argc-optind < 2) {
+			help();
+			return 0;
+		}
+
+		ref<IrradianceCache> cache = IrradianceCache::load(argv[optind+1]);
+		Log(EInfo, "\"%s\": " SIZE_T_FMT " records", argv[optind+1], 
+			cache->getRecordCount());
+
+		for (int i=optind+2; i<argc; ++i) {
+			ref<IrradianceCache> other = IrradianceCache::load(argv[i]);
+			if (other->getAABB() != cache->getAABB())
+				Log(EWarn, "\"%s\" was created for a different scene (bounding box: %s)!",
+					argv[i], other->getAABB().toString().c_str());
+			size_t added = cache->merge(other);
+			Log(EInfo, "\"%s\": " SIZE_T_FMT " records (" SIZE_T_FMT " new)", argv[i], 
+				other->getRecordCount(), added);
+		}
+
+		Log(EInfo, "Writing " SIZE_T_FMT " records to \"%s\"", 
+			cache->getRecordCount(), argv[optind]);
+		cache->save(argv[optind]);
+		return 0;
+	}
+
+	MTS_DECLARE_UTILITY()
+};
+
+MTS_EXPORT_UTILITY(IrradianceCacheMerge, "Merge irradiance cache files")
+MTS_NAMESPACE_END
@@ -55,6 +55,8 @@ public:
 		cout << "                  optimization method." << endl << endl;
 		cout << "   -f             Try to empirically find the best SAH cost values by" << endl;
 		cout << "                  fitting the cost model to collected performance data" << endl << endl;
+		cout << "   -s             Rebuild the tree using 1, 2, 4, .. threads and report" << endl;
+		cout << "                  the time spent in each construction phase" << endl << endl;
 		cout << "Examples:" << endl;
 		cout << "  E.g. to build a tree for the Stanford bunny having a low SAH cost, type " << endl << endl;
 		cout << "  $ mtsutil kdbench -e .9 -l1 -d48 -x100000 data/tests/bunny.ply" << endl << endl;
@@ -70,10 +72,11 @@ public:
 		Float intersectionCost = -1, traversalCost = -1, emptySpaceBonus = -1;
 		int stopPrims = -1, maxDepth = -1, exactPrims = -1, minMaxBins = -1;
 		bool clip = true, parallel = true, retract = true, fitParameters = false;
+		bool scaling = false;
 		optind = 1;
 
 		/* Parse command-line arguments */
-		while ((optchar = getopt(argc, argv, "i:t:e:c:p:r:l:x:b:d:hf")) != -1) {
+		while ((optchar = getopt(argc, argv, "i:t:e:c:p:r:l:x:b:d:hfs")) != -1) {
 			switch (optchar) {
 				case 'h': {
 						help();
@@ -83,6 +86,9 @@ public:
 				case 'f': 
 					fitParameters = true;
 					break;
+				case 's': 
+					scaling = true;
+					break;
 				case 'i': 
 					intersectionCost = (Float) strtod(optarg, &end_ptr);
 					if (*end_ptr != '\0')
@@ -177,22 +183,8 @@ public:
 			Log(EError, "The supplied scene filename must end in either PLY or XML!");
 		}
 
-		if (intersectionCost != -1)
-			kdtree->setQueryCost(intersectionCost);
-		if (traversalCost != -1)
-			kdtree->setTraversalCost(traversalCost);
-		if (emptySpaceBonus != -1)
-			kdtree->setEmptySpaceBonus(emptySpaceBonus);
-		if (stopPrims != -1)
-			kdtree->setStopPrims(stopPrims);
-		if (maxDepth != -1)
-			kdtree->setMaxDepth(maxDepth);
-		if (exactPrims != -1)
-			kdtree->setExactPrimitiveThreshold(exactPrims);
-		if (minMaxBins != -1)
-			kdtree->setMinMaxBins(minMaxBins);
-		kdtree->setClip(clip);
-		kdtree->setParallelBuild(parallel);
+		configure(kdtree, intersectionCost, traversalCost, emptySpaceBonus,
+			stopPrims, maxDepth, exactPrims, minMaxBins, clip, retract, parallel);
 
 		/* Show some statistics, and make sure it roughly fits in 80cols */
 		Logger *logger = Thread::getThread()->getLogger();
@@ -205,6 +197,33 @@ public:
 		else
 			kdtree->build();
 
+		logBuildTimes(kdtree);
+
+		if (scaling) {
+			/* Rebuild copies of the tree with an increasing number of threads */
+			int maxThreads = getProcessorCount();
+			std::vector<Float> totalTime;
+			logger->setLogLevel(EInfo);
+			for (int threads = 1; ; threads = std::min(threads * 2, maxThreads)) {
+				ref<ShapeKDTree> tree = new ShapeKDTree();
+				for (size_t i=0; i<kdtree->getShapes().size(); ++i)
+					tree->addShape(kdtree->getShapes()[i]);
+				configure(tree, intersectionCost, traversalCost, emptySpaceBonus,
+					stopPrims, maxDepth, exactPrims, minMaxBins, clip, retract, 
+					threads > 1);
+				tree->setBuildThreadCount(threads);
+				ref<Timer> timer = new Timer();
+				tree->build();
+				totalTime.push_back(timer->getMicroseconds() * 1e-6f);
+				Log(EInfo, "Build using %i thread(s): %.3f s (speedup: %.2fx)",
+					threads, totalTime.back(), totalTime[0] / totalTime.back());
+				logBuildTimes(tree);
+				if (threads == maxThreads)
+					break;
+			}
+			logger->setLogLevel(EDebug);
+		}
+
 		BSphere bsphere(kdtree->getBSphere());
 		const size_t nRays = 5000000;
 
@@ -247,6 +266,38 @@ public:
 		return 0;
 	}
 
+	void configure(ShapeKDTree *kdtree, Float intersectionCost, Float traversalCost,
+			Float emptySpaceBonus, int stopPrims, int maxDepth, int exactPrims, 
+			int minMaxBins, bool clip, bool retract, bool parallel) {
+		if (intersectionCost != -1)
+			kdtree->setQueryCost(intersectionCost);
+		if (traversalCost != -1)
+			kdtree->setTraversalCost(traversalCost);
+		if (emptySpaceBonus != -1)
+			kdtree->setEmptySpaceBonus(emptySpaceBonus);
+		if (stopPrims != -1)
+			kdtree->setStopPrims(stopPrims);
+		if (maxDepth != -1)
+			kdtree->setMaxDepth(maxDepth);
+		if (exactPrims != -1)
+			kdtree->setExactPrimitiveThreshold(exactPrims);
+		if (minMaxBins != -1)
+			kdtree->setMinMaxBins(minMaxBins);
+		kdtree->setClip(clip);
+		kdtree->setRetract(retract);
+		kdtree->setParallelBuild(parallel);
+	}
+
+	void logBuildTimes(const ShapeKDTree *kdtree) {
+		Log(EInfo, "Construction time per phase (summed over threads):");
+		for (int i=0; i<ShapeKDTree::EBuildPhaseCount; ++i) {
+			ShapeKDTree::EBuildPhase phase = (ShapeKDTree::EBuildPhase) i;
+			Log(EInfo, "   %-27s : %.3f s", ShapeKDTree::getBuildPhaseName(phase),
+				kdtree->getBuildTime(phase));
+		}
+		Log(EInfo, "");
+	}
+
 	MTS_DECLARE_UTILITY()
 };
 
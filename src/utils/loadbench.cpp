@@ -0,0 +1,162 @@
+/*
+    This file is part of Mitsuba, a physically based rendering system.
+
+    Copyright (c) 2007-2011 by Wenzel Jakob and others.
+
+    Mitsuba is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Mitsuba is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <mitsuba/render/util.h>
+#include <mitsuba/render/trimesh.h>
+#include <mitsuba/core/timer.h>
+#include <mitsuba/core/plugin.h>
+#include <boost/algorithm/string.hpp>
+#if defined(WIN32)
+#include <mitsuba/core/getopt.h>
+#endif
+#if defined(_OPENMP)
+#include <omp.h>
+#endif
+
+MTS_NAMESPACE_BEGIN
+
+class LoadBench : public Utility {
+public:
+	void help() {
+		cout << endl;
+		cout << "Synopsis: Mesh import benchmark. Repeatedly loads an OBJ or PLY file and" << endl;
+		cout << "reports the time spent and the resulting number of triangles per second." << endl;
+		cout << endl;
+		cout << "Usage: mtsutil loadbench [options] <OBJ or PLY file>" << endl;
+		cout << "Options/Arguments:" << endl;
+		cout << "   -h             Display this help text" << endl << endl;
+		cout << "   -n count       Number of repetitions (default: 3)" << endl << endl;
+		cout << "   -s             Load the file using 1, 2, 4, .. threads and report" << endl;
+		cout << "                  the resulting speedup" << endl << endl;
+	}
+
+	/// Load the mesh and return the total number of triangles
+	size_t load(const std::string &filename, bool obj) {
+		Properties props(obj ? "obj" : "ply");
+		props.setString("filename", filename);
+		ref<Shape> shape = static_cast<Shape *> (PluginManager::getInstance()->
+				createObject(MTS_CLASS(Shape), props));
+
+		size_t triangleCount = 0;
+		if (!shape->isCompound()) {
+			triangleCount = static_cast<TriMesh *>(shape.get())->getTriangleCount();
+		} else {
+			for (int i=0; ; ++i) {
+				Shape *element = shape->getElement(i);
+				if (!element)
+					break;
+				if (element->getClass()->derivesFrom(MTS_CLASS(TriMesh)))
+					triangleCount += static_cast<TriMesh *>(element)->getTriangleCount();
+			}
+		}
+		return triangleCount;
+	}
+
+	/// Load the mesh several times and return the best time in seconds
+	Float benchmark(const std::string &filename, bool obj, int count, size_t &triangleCount) {
+		Float best = std::numeric_limits<Float>::infinity();
+		for (int i=0; i<count; ++i) {
+			ref<Timer> timer = new Timer();
+			triangleCount = load(filename, obj);
+			best = std::min(best, timer->getMicroseconds() * 1e-6f);
+		}
+		return best;
+	}
+
+	int run(int argc, char **argv) {
+		char optchar, *end_ptr = NULL;
+		int count = 3;
+		bool scaling = false;
+		optind = 1;
+
+		/* Parse command-line arguments */
+		while ((optchar = getopt(argc, argv, "n:hs")) != -1) {
+			switch (optchar) {
+				case 'h': {
+						help();
+						return 0;
+					}
+					break;
+				case 's':
+					scaling = true;
+					break;
+				case 'n':
+					count = strtol(optarg, &end_ptr, 10);
+					if (*end_ptr != '\0' || count < 1)
+						SLog(EError, "Could not parse the repetition count!");
+					break;
+			};
+		}
+
+		if (optind == argc || optind+1 < argc) {
+			help();
+			return 0;
+		}
+
+		std::string filename(argv[optind]),
+			lowercase = boost::to_lower_copy(filename);
+		bool obj = boost::ends_with(lowercase, ".obj");
+		if (!obj && !boost::ends_with(lowercase, ".ply"))
+			Log(EError, "The supplied filename must end in either OBJ or PLY!");
+
+		/* Warm up the file system cache (and show the loader's statistics) */
+		size_t triangleCount = load(filename, obj);
+
+		/* Silence the loaders while timing */
+		Logger *logger = Thread::getThread()->getLogger();
+		ELogLevel logLevel = logger->getLogLevel();
+		logger->setLogLevel(EWarn);
+
+		std::vector<std::pair<int, Float> > timings;
+#if defined(_OPENMP)
+		if (scaling) {
+			int maxThreads = getProcessorCount();
+			for (int threads = 1; ; threads = std::min(threads * 2, maxThreads)) {
+				omp_set_num_threads(threads);
+				timings.push_back(std::make_pair(threads,
+					benchmark(filename, obj, count, triangleCount)));
+				if (threads == maxThreads)
+					break;
+			}
+			omp_set_num_threads(maxThreads);
+		}
+#else
+		if (scaling)
+			Log(EWarn, "Compiled without OpenMP support -- ignoring the -s parameter");
+#endif
+		if (timings.empty())
+			timings.push_back(std::make_pair(0, benchmark(filename, obj, count, triangleCount)));
+
+		logger->setLogLevel(logLevel);
+		for (size_t i=0; i<timings.size(); ++i) {
+			Float time = timings[i].second;
+			std::string threads = timings[i].first == 0 ? std::string("default")
+				: formatString("%i", timings[i].first);
+			Log(EInfo, "Loaded " SIZE_T_FMT " triangles using %s thread(s): %.3f s "
+				"(%.2f MTris/s, speedup: %.2fx)", triangleCount, threads.c_str(), time,
+				triangleCount / time * 1e-6f, timings[0].second / time);
+		}
+
+		return 0;
+	}
+
+	MTS_DECLARE_UTILITY()
+};
+
+MTS_EXPORT_UTILITY(LoadBench, "Mesh import benchmark")
+MTS_NAMESPACE_END
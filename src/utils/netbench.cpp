@@ -0,0 +1,273 @@
+/*
+    This file is part of Mitsuba, a physically based rendering system.
+
+    Copyright (c) 2007-2011 by Wenzel Jakob and others.
+
+    Mitsuba is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Mitsuba is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <mitsuba/render/util.h>
+#include <mitsuba/render/range.h>
+#include <mitsuba/render/imageblock.h>
+#include <mitsuba/core/sched_remote.h>
+#include <mitsuba/core/sstream.h>
+#include <mitsuba/core/timer.h>
+#if defined(WIN32)
+#include <mitsuba/core/getopt.h>
+#endif
+
+MTS_NAMESPACE_BEGIN
+
+/**
+ * Produces image blocks filled with noisy, render-like content
+ * (i.e. not trivially compressible) without doing any actual work
+ */
+class NetBenchWorker : public WorkProcessor {
+public:
+	NetBenchWorker(int blockSize, int borderSize)
+		: m_blockSize(blockSize), m_borderSize(borderSize) { }
+
+	NetBenchWorker(Stream *stream, InstanceManager *manager) {
+		m_blockSize = stream->readInt();
+		m_borderSize = stream->readInt();
+	}
+
+	void serialize(Stream *stream, InstanceManager *manager) const {
+		stream->writeInt(m_blockSize);
+		stream->writeInt(m_borderSize);
+	}
+
+	ref<WorkUnit> createWorkUnit() const {
+		return new RangeWorkUnit();
+	}
+
+	ref<WorkResult> createWorkResult() const {
+		return new ImageBlock(Vector2i(m_blockSize), m_borderSize,
+			true, true, false, false);
+	}
+
+	void prepare() { }
+
+	void process(const WorkUnit *workUnit, WorkResult *workResult,
+		const bool &stop) {
+		const RangeWorkUnit *range = static_cast<const RangeWorkUnit *>(workUnit);
+		ImageBlock *block = static_cast<ImageBlock *>(workResult);
+		block->setOffset(Point2i(0, 0));
+		block->setSize(Vector2i(m_blockSize));
+		block->clear();
+
+		/* Smooth gradient plus multiplicative LCG noise */
+		uint32_t state = (uint32_t) range->getRangeStart();
+		const Vector2i &fullSize = block->getFullSize();
+		for (int y=0, idx=0; y<fullSize.y; ++y) {
+			for (int x=0; x<fullSize.x; ++x, ++idx) {
+				state = state * 1664525u + 1013904223u;
+				Float noise = 0.8f + 0.4f * (state >> 8) / (Float) (1 << 24);
+				Spectrum value((x + y) / (Float) (fullSize.x + fullSize.y) * noise);
+				block->setPixel(idx, value);
+				block->setWeight(idx, 1.0f);
+			}
+		}
+	}
+
+	ref<WorkProcessor> clone() const {
+		return new NetBenchWorker(m_blockSize, m_borderSize);
+	}
+
+	MTS_DECLARE_CLASS()
+protected:
+	virtual ~NetBenchWorker() { }
+private:
+	int m_blockSize, m_borderSize;
+};
+
+/// Generates a fixed number of image block work units
+class NetBenchProcess : public ParallelProcess {
+public:
+	NetBenchProcess(size_t unitCount, int blockSize, int borderSize)
+		: m_unitCount(unitCount), m_unitsGenerated(0), m_blockSize(blockSize),
+		  m_borderSize(borderSize), m_bytes(0) {
+		m_resultMutex = new Mutex();
+	}
+
+	ref<WorkProcessor> createWorkProcessor() const {
+		return new NetBenchWorker(m_blockSize, m_borderSize);
+	}
+
+	EStatus generateWork(WorkUnit *unit, int worker) {
+		if (m_unitsGenerated == m_unitCount)
+			return EFailure;
+		static_cast<RangeWorkUnit *>(unit)->setRange(
+			m_unitsGenerated, m_unitsGenerated);
+		m_unitsGenerated++;
+		return ESuccess;
+	}
+
+	void processResult(const WorkResult *wr, bool cancelled) {
+		const ImageBlock *block = static_cast<const ImageBlock *>(wr);
+		const Vector2i &fullSize = block->getFullSize();
+		m_resultMutex->lock();
+		/* Spectrum, alpha and weight per pixel */
+		m_bytes += fullSize.x * fullSize.y * sizeof(Float) * (SPECTRUM_SAMPLES + 2);
+		m_resultMutex->unlock();
+	}
+
+	/* mtsutil loads utilities without going through the plugin manager,
+	   hence remote nodes must be asked to load this plugin explicitly */
+	std::vector<std::string> getRequiredPlugins() {
+		std::vector<std::string> result = ParallelProcess::getRequiredPlugins();
+		if (std::find(result.begin(), result.end(), "netbench") == result.end())
+			result.push_back("netbench");
+		return result;
+	}
+
+	/// Return the (uncompressed) amount of image data received so far
+	inline size_t getBytes() const { return m_bytes; }
+
+	MTS_DECLARE_CLASS()
+protected:
+	virtual ~NetBenchProcess() { }
+private:
+	ref<Mutex> m_resultMutex;
+	size_t m_unitCount, m_unitsGenerated;
+	int m_blockSize, m_borderSize;
+	size_t m_bytes;
+};
+
+class NetBench : public Utility {
+public:
+	void help() {
+		cout << endl;
+		cout << "Synopsis: Network rendering throughput benchmark. Connects to one or more" << endl;
+		cout << "running mtssrv instances (e.g. on the local machine), which send back image" << endl;
+		cout << "blocks of various sizes, and reports the resulting throughput with and" << endl;
+		cout << "without work result compression." << endl;
+		cout << endl;
+		cout << "Usage: mtsutil netbench [options]" << endl;
+		cout << "Options/Arguments:" << endl;
+		cout << "   -h             Display this help text" << endl << endl;
+		cout << "   -c hosts       Semicolon-separated list of servers of the form" << endl;
+		cout << "                  host[:port] (default: localhost)" << endl << endl;
+		cout << "   -n count       Number of work units per run (default: 2000)" << endl << endl;
+		cout << "   -b border      Border size of the image blocks (default: 2)" << endl << endl;
+		cout << "   -l level       Compression level to compare against (default: 1)" << endl << endl;
+	}
+
+	void connect(const std::vector<std::string> &hosts, int compressionLevel) {
+		Scheduler *scheduler = Scheduler::getInstance();
+		for (size_t i=0; i<hosts.size(); ++i) {
+			std::vector<std::string> tokens = tokenize(hosts[i], ":");
+			int port = MTS_DEFAULT_PORT;
+			if (tokens.size() == 0 || tokens.size() > 2)
+				Log(EError, "Invalid host specification '%s'!", hosts[i].c_str());
+			else if (tokens.size() == 2)
+				port = atoi(tokens[1].c_str());
+			ref<Stream> stream = new SocketStream(tokens[0], port);
+			scheduler->registerWorker(new RemoteWorker(
+				formatString("bench%i", (int) i), stream, compressionLevel));
+		}
+	}
+
+	int run(int argc, char **argv) {
+		char optchar, *end_ptr = NULL;
+		size_t unitCount = 2000;
+		int borderSize = 2, compressionLevel = 1;
+		std::string hostList = "localhost";
+		optind = 1;
+
+		/* Parse command-line arguments */
+		while ((optchar = getopt(argc, argv, "c:n:b:l:h")) != -1) {
+			switch (optchar) {
+				case 'h': {
+						help();
+						return 0;
+					}
+					break;
+				case 'c':
+					hostList = optarg;
+					break;
+				case 'n':
+					unitCount = (size_t) strtol(optarg, &end_ptr, 10);
+					if (*end_ptr != '\0')
+						SLog(EError, "Could not parse the work unit count!");
+					break;
+				case 'b':
+					borderSize = strtol(optarg, &end_ptr, 10);
+					if (*end_ptr != '\0' || borderSize < 0)
+						SLog(EError, "Could not parse the border size!");
+					break;
+				case 'l':
+					compressionLevel = strtol(optarg, &end_ptr, 10);
+					if (*end_ptr != '\0' || compressionLevel < 1 || compressionLevel > 9)
+						SLog(EError, "Could not parse the compression level!");
+					break;
+			};
+		}
+		std::vector<std::string> hosts = tokenize(hostList, ";");
+
+		/* Temporarily replace the workers of the scheduler */
+		Scheduler *scheduler = Scheduler::getInstance();
+		std::vector<ref<Worker> > origWorkers;
+		scheduler->pause();
+		while (scheduler->getWorkerCount() > 0) {
+			origWorkers.push_back(scheduler->getWorker(0));
+			scheduler->unregisterWorker(origWorkers.back());
+		}
+
+		Log(EInfo, "Receiving " SIZE_T_FMT " image blocks (border=%i) from %i server(s)",
+			unitCount, borderSize, (int) hosts.size());
+		Log(EInfo, "%6s %12s %12s %12s %12s %9s", "block", "raw [MB/s]", "raw [u/s]",
+			formatString("zlib-%i [MB/s]", compressionLevel).c_str(),
+			formatString("zlib-%i [u/s]", compressionLevel).c_str(), "speedup");
+
+		for (int blockSize = 8; blockSize <= 256; blockSize *= 2) {
+			Float bandwidth[2], throughput[2];
+			for (int mode=0; mode<2; ++mode) {
+				connect(hosts, mode == 0 ? 0 : compressionLevel);
+				scheduler->start();
+
+				ref<NetBenchProcess> proc = new NetBenchProcess(unitCount, blockSize, borderSize);
+				ref<Timer> timer = new Timer();
+				scheduler->schedule(proc);
+				scheduler->wait(proc);
+				unsigned int ms = std::max(timer->getMilliseconds(), 1u);
+				if (proc->getReturnStatus() != ParallelProcess::ESuccess)
+					Log(EError, "The benchmark process did not finish successfully!");
+				bandwidth[mode] = proc->getBytes() / (1024.0f * 1024.0f) / (ms * 1e-3f);
+				throughput[mode] = unitCount / (ms * 1e-3f);
+
+				scheduler->pause();
+				while (scheduler->getWorkerCount() > 0)
+					scheduler->unregisterWorker(scheduler->getWorker(0));
+			}
+
+			Log(EInfo, "%6i %12.1f %12.1f %12.1f %12.1f %8.2fx", blockSize,
+				bandwidth[0], throughput[0], bandwidth[1], throughput[1],
+				throughput[1] / throughput[0]);
+		}
+
+		/* Restore the original configuration */
+		for (size_t i=0; i<origWorkers.size(); ++i)
+			scheduler->registerWorker(origWorkers[i]);
+		scheduler->start();
+
+		return 0;
+	}
+
+	MTS_DECLARE_UTILITY()
+};
+
+MTS_IMPLEMENT_CLASS_S(NetBenchWorker, false, WorkProcessor)
+MTS_IMPLEMENT_CLASS(NetBenchProcess, false, ParallelProcess)
+MTS_EXPORT_UTILITY(NetBench, "Network rendering throughput benchmark")
+MTS_NAMESPACE_END
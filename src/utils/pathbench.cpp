@@ -0,0 +1,241 @@
+/*
+    This file is part of Mitsuba, a physically based rendering system.
+
+    Copyright (c) 2007-2011 by Wenzel Jakob and others.
+
+    Mitsuba is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Mitsuba is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <mitsuba/render/util.h>
+#include <mitsuba/render/scene.h>
+#include <mitsuba/core/sfcurve.h>
+#include <mitsuba/core/statistics.h>
+#include <mitsuba/core/fresolver.h>
+#include <mitsuba/core/plugin.h>
+#include <mitsuba/core/timer.h>
+#include <boost/algorithm/string.hpp>
+#if defined(_OPENMP)
+#include <omp.h>
+#endif
+#if defined(WIN32)
+#include <mitsuba/core/getopt.h>
+#endif
+
+MTS_NAMESPACE_BEGIN
+
+class PathBench : public Utility {
+public:
+	void help() {
+		cout << endl;
+		cout << "Synopsis: Path tracing throughput benchmark. Renders each scene using the" << endl;
+		cout << "path tracer, once tracing one path at a time and once in wavefront mode," << endl;
+		cout << "and reports the resulting number of samples and rays per second. The image" << endl;
+		cout << "is discarded. PLY files are rendered using a default camera and a constant" << endl;
+		cout << "environment source." << endl;
+		cout << endl;
+		cout << "Usage: mtsutil pathbench [options] <Scene XML file or PLY file> [..]" << endl;
+		cout << "Options/Arguments:" << endl;
+		cout << "   -h             Display this help text" << endl << endl;
+		cout << "   -d depth       Maximum path depth (default: -1, i.e. infinite)" << endl << endl;
+		cout << "   -b size        Image block size (default: 32)" << endl << endl;
+		cout << "   -w count       Number of paths per wavefront (default: 4096)" << endl << endl;
+		cout << "   -p count       Number of threads (default: all cores)" << endl << endl;
+		cout << "Examples:" << endl;
+		cout << "  $ mtsutil pathbench -d 5 data/tests/bunny.ply" << endl << endl;
+	}
+
+	/// Load a scene from an XML or PLY file
+	ref<Scene> load(const std::string &filename) {
+		std::string lowercase = boost::to_lower_copy(filename);
+		ref<Scene> scene;
+
+		if (boost::ends_with(lowercase, ".xml")) {
+			ref<FileResolver> fileResolver = Thread::getThread()->getFileResolver();
+			fs::path filePath = fs::complete(fileResolver->resolve(filename)).parent_path();
+			ref<FileResolver> frClone = fileResolver->clone();
+			frClone->addPath(filePath);
+			Thread::getThread()->setFileResolver(frClone);
+			scene = loadScene(filename);
+			Thread::getThread()->setFileResolver(fileResolver);
+		} else if (boost::ends_with(lowercase, ".ply")) {
+			Properties props("ply");
+			props.setString("filename", filename);
+			ref<Shape> mesh = static_cast<Shape *> (PluginManager::getInstance()->
+					createObject(MTS_CLASS(Shape), props));
+			mesh->configure();
+			scene = new Scene(Properties("scene"));
+			scene->addChild("", mesh);
+			scene->configure();
+		} else {
+			Log(EError, "The supplied scene filename must end in either PLY or XML!");
+		}
+
+		scene->initialize();
+		return scene;
+	}
+
+	/// Return the total number of normal and shadow rays traced so far
+	uint64_t getRayCount() {
+		Statistics *statistics = Statistics::getInstance();
+		const StatsCounter *rays = statistics->getCounter("General", "Normal rays traced"),
+			*shadowRays = statistics->getCounter("General", "Shadow rays traced");
+		return (rays ? rays->getValue() : 0) + (shadowRays ? shadowRays->getValue() : 0);
+	}
+
+	/// Render the whole image using \c threadCount threads, returns the time in seconds
+	Float render(Scene *scene, SampleIntegrator *integrator,
+			int threadCount, int blockSize) {
+		Camera *camera = scene->getCamera();
+		const Film *film = camera->getFilm();
+		const TabulatedFilter *filter = film->getTabulatedFilter();
+		const int borderSize = (int) std::ceil(std::max(filter->getFilterSize().x,
+			filter->getFilterSize().y) - (Float) 0.5);
+		const Point2i offset = film->getCropOffset();
+		const Vector2i size = film->getCropSize();
+
+		std::vector<Point2i> blocks;
+		for (int y=0; y<size.y; y += blockSize)
+			for (int x=0; x<size.x; x += blockSize)
+				blocks.push_back(offset + Vector2i(x, y));
+
+		/* Sampler clones are not created concurrently, since cloning
+		   may modify the state of the original sampler */
+		std::vector<ref<Sampler> > samplers(threadCount);
+		for (int i=0; i<threadCount; ++i)
+			samplers[i] = scene->getSampler()->clone();
+
+		bool stop = false;
+		ref<Timer> timer = new Timer();
+
+		#pragma omp parallel num_threads(threadCount)
+		{
+#if defined(_OPENMP)
+			Sampler *sampler = samplers[omp_get_thread_num()];
+#else
+			Sampler *sampler = samplers[0];
+#endif
+			ref<ImageBlock> block = new ImageBlock(Vector2i(blockSize, blockSize),
+				borderSize, true, true, false, false);
+			HilbertCurve2D<int> hilbertCurve;
+
+			#pragma omp for schedule(dynamic)
+			for (int i=0; i<(int) blocks.size(); ++i) {
+				const Point2i &blockOffset = blocks[i];
+				block->setOffset(blockOffset);
+				block->setSize(Vector2i(
+					std::min(blockSize, offset.x + size.x - blockOffset.x),
+					std::min(blockSize, offset.y + size.y - blockOffset.y)));
+				hilbertCurve.initialize(block->getSize());
+				integrator->renderBlock(scene, camera, sampler, block,
+					stop, &hilbertCurve.getPoints());
+			}
+		}
+
+		return std::max(timer->getMicroseconds(), 1u) * 1e-6f;
+	}
+
+	int run(int argc, char **argv) {
+		char optchar, *end_ptr = NULL;
+		int maxDepth = -1, blockSize = 32, threadCount = getProcessorCount();
+		size_t wavefrontSize = 4096;
+		optind = 1;
+
+		/* Parse command-line arguments */
+		while ((optchar = getopt(argc, argv, "d:b:w:p:h")) != -1) {
+			switch (optchar) {
+				case 'h': {
+						help();
+						return 0;
+					}
+					break;
+				case 'd':
+					maxDepth = strtol(optarg, &end_ptr, 10);
+					if (*end_ptr != '\0')
+						SLog(EError, "Could not parse the maximum depth!");
+					break;
+				case 'b':
+					blockSize = strtol(optarg, &end_ptr, 10);
+					if (*end_ptr != '\0' || blockSize < 1)
+						SLog(EError, "Could not parse the block size!");
+					break;
+				case 'w':
+					wavefrontSize = (size_t) strtol(optarg, &end_ptr, 10);
+					if (*end_ptr != '\0' || wavefrontSize < 1)
+						SLog(EError, "Could not parse the wavefront size!");
+					break;
+				case 'p':
+					threadCount = strtol(optarg, &end_ptr, 10);
+					if (*end_ptr != '\0' || threadCount < 1)
+						SLog(EError, "Could not parse the thread count!");
+					break;
+			};
+		}
+
+		if (optind == argc) {
+			help();
+			return 0;
+		}
+
+#if defined(_OPENMP)
+		threadCount = std::min(threadCount, omp_get_max_threads());
+#else
+		threadCount = 1;
+#endif
+
+		for (int arg=optind; arg<argc; ++arg) {
+			ref<Scene> scene = load(argv[arg]);
+			const Vector2i size = scene->getCamera()->getFilm()->getCropSize();
+			const Float sampleCount = (Float) size.x * size.y
+				* scene->getSampler()->getSampleCount();
+
+			Log(EInfo, "Rendering \"%s\" (%ix%i, " SIZE_T_FMT " samples per pixel, "
+				"%i threads)", argv[arg], size.x, size.y,
+				scene->getSampler()->getSampleCount(), threadCount);
+			Log(EInfo, "%10s %10s %16s %14s %9s", "mode", "time [s]",
+				"samples [K/s]", "rays [M/s]", "speedup");
+
+			Float referenceTime = 0;
+			for (int mode=0; mode<2; ++mode) {
+				Properties props("path");
+				props.setInteger("maxDepth", maxDepth);
+				props.setBoolean("wavefront", mode == 1);
+				props.setLong("wavefrontSize", (int64_t) wavefrontSize);
+				ref<SampleIntegrator> integrator = static_cast<SampleIntegrator *>
+					(PluginManager::getInstance()->createObject(
+						MTS_CLASS(SampleIntegrator), props));
+				integrator->configure();
+				integrator->configureSampler(scene->getSampler());
+
+				uint64_t rayCount = getRayCount();
+				Float time = render(scene, integrator, threadCount, blockSize);
+				rayCount = getRayCount() - rayCount;
+				if (mode == 0)
+					referenceTime = time;
+
+				if (rayCount > 0)
+					Log(EInfo, "%10s %10.2f %16.1f %14.2f %8.2fx", mode == 0 ? "path" : "wavefront",
+						time, sampleCount / time * 1e-3f, rayCount / time * 1e-6f, referenceTime / time);
+				else /* Ray statistics are not available (compiled with MTS_NO_STATISTICS) */
+					Log(EInfo, "%10s %10.2f %16.1f %14s %8.2fx", mode == 0 ? "path" : "wavefront",
+						time, sampleCount / time * 1e-3f, "n/a", referenceTime / time);
+			}
+		}
+
+		return 0;
+	}
+
+	MTS_DECLARE_UTILITY()
+};
+
+MTS_EXPORT_UTILITY(PathBench, "Path tracing throughput benchmark")
+MTS_NAMESPACE_END
@@ -0,0 +1,196 @@
+/*
+    This file is part of Mitsuba, a physically based rendering system.
+
+    Copyright (c) 2007-2011 by Wenzel Jakob and others.
+
+    Mitsuba is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Mitsuba is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <mitsuba/render/util.h>
+#include <mitsuba/render/photonmap.h>
+#include <mitsuba/core/random.h>
+#include <mitsuba/core/timer.h>
+#include <mitsuba/core/lock.h>
+#if defined(_OPENMP)
+#include <omp.h>
+#endif
+#if defined(WIN32)
+#include <mitsuba/core/getopt.h>
+#endif
+
+MTS_NAMESPACE_BEGIN
+
+class PhotonBench : public Utility {
+public:
+	void help() {
+		cout << endl;
+		cout << "Synopsis: Photon map construction benchmark. Stores a set of random photons" << endl;
+		cout << "from several threads, either one photon at a time while holding a lock or" << endl;
+		cout << "by merging per-thread buffers without locking, and then balances the" << endl;
+		cout << "photon map. Reports the store throughput and the balancing time as a" << endl;
+		cout << "function of the number of threads." << endl;
+		cout << endl;
+		cout << "Usage: mtsutil photonbench [options]" << endl;
+		cout << "Options/Arguments:" << endl;
+		cout << "   -h             Display this help text" << endl << endl;
+		cout << "   -n count       Number of photons (default: 4000000)" << endl << endl;
+		cout << "   -b count       Photons per thread-local buffer (default: 1024)" << endl << endl;
+		cout << "   -p count       Maximum number of threads (default: all cores)" << endl << endl;
+	}
+
+	/**
+	 * Generate random photons. A third of them is placed on an
+	 * axis-aligned plane, which is a difficult case for the
+	 * partitioning step of the balancing algorithm.
+	 */
+	void createPhotons(std::vector<Photon> &photons) {
+		ref<Random> random = new Random();
+		for (size_t i=0; i<photons.size(); ++i) {
+			Point p(random->nextFloat(), random->nextFloat(), random->nextFloat());
+			if (i % 3 == 0)
+				p.y = 0.0f;
+			Vector d = squareToSphere(Point2(random->nextFloat(), random->nextFloat()));
+			photons[i] = Photon(p, Normal(0.0f, 1.0f, 0.0f), d,
+				Spectrum(random->nextFloat()), 1);
+		}
+	}
+
+	/// Store all photons using the given number of threads, returns photons/s
+	Float store(PhotonMap *photonMap, const std::vector<Photon> &photons,
+			int threadCount, size_t bufferSize, bool lockFree) {
+		ref<Mutex> mutex = new Mutex();
+		int bufferCount = (int) ((photons.size() + bufferSize - 1) / bufferSize);
+		ref<Timer> timer = new Timer();
+
+		#pragma omp parallel num_threads(threadCount)
+		{
+			/* Each thread first fills a local buffer, like a photon tracing worker */
+			std::vector<Photon> buffer(bufferSize);
+
+			#pragma omp for schedule(dynamic)
+			for (int i=0; i<bufferCount; ++i) {
+				size_t start = i * bufferSize,
+					   count = std::min(bufferSize, photons.size() - start);
+				for (size_t j=0; j<count; ++j)
+					buffer[j] = photons[start + j];
+
+				if (lockFree) {
+					photonMap->storePhotons(&buffer[0], count);
+				} else {
+					mutex->lock();
+					for (size_t j=0; j<count; ++j)
+						photonMap->storePhoton(buffer[j]);
+					mutex->unlock();
+				}
+			}
+		}
+
+		Float time = std::max(timer->getMicroseconds(), 1u) * 1e-6f;
+		if (photonMap->getPhotonCount() != photons.size())
+			Log(EError, "Expected " SIZE_T_FMT " photons, but the photon map contains "
+				SIZE_T_FMT "!", photons.size(), photonMap->getPhotonCount());
+		return photons.size() / time;
+	}
+
+	int run(int argc, char **argv) {
+		char optchar, *end_ptr = NULL;
+		size_t photonCount = 4000000, bufferSize = 1024;
+		int maxThreads = getProcessorCount();
+		optind = 1;
+
+		/* Parse command-line arguments */
+		while ((optchar = getopt(argc, argv, "n:b:p:h")) != -1) {
+			switch (optchar) {
+				case 'h': {
+						help();
+						return 0;
+					}
+					break;
+				case 'n':
+					photonCount = (size_t) strtol(optarg, &end_ptr, 10);
+					if (*end_ptr != '\0' || photonCount < 1)
+						SLog(EError, "Could not parse the photon count!");
+					break;
+				case 'b':
+					bufferSize = (size_t) strtol(optarg, &end_ptr, 10);
+					if (*end_ptr != '\0' || bufferSize < 1)
+						SLog(EError, "Could not parse the buffer size!");
+					break;
+				case 'p':
+					maxThreads = strtol(optarg, &end_ptr, 10);
+					if (*end_ptr != '\0' || maxThreads < 1)
+						SLog(EError, "Could not parse the thread count!");
+					break;
+			};
+		}
+
+#if defined(_OPENMP)
+		maxThreads = std::min(maxThreads, omp_get_max_threads());
+#else
+		maxThreads = 1;
+#endif
+
+		std::vector<Photon> photons(photonCount);
+		createPhotons(photons);
+
+		/* Single-threaded reference tree to verify the parallel results */
+		ref<PhotonMap> reference = new PhotonMap(photonCount);
+		reference->storePhotons(&photons[0], photonCount);
+		reference->balance(1);
+
+		Log(EInfo, "Storing and balancing " SIZE_T_FMT " photons (buffers of "
+			SIZE_T_FMT " photons)", photonCount, bufferSize);
+		Log(EInfo, "%8s %16s %16s %9s %13s %9s", "threads", "locked [Kp/s]",
+			"lock-free [Kp/s]", "speedup", "balance [ms]", "speedup");
+
+		Float referenceBalanceTime = 0;
+		for (int threads = 1; ; threads = std::min(threads * 2, maxThreads)) {
+			Float throughput[2];
+			for (int mode=0; mode<2; ++mode) {
+				ref<PhotonMap> photonMap = new PhotonMap(photonCount);
+				throughput[mode] = store(photonMap, photons, threads,
+					bufferSize, mode == 1) * 1e-3f;
+			}
+
+			/* Balance photons stored in the original order, so that
+			   the resulting tree can be compared to the reference */
+			ref<PhotonMap> photonMap = new PhotonMap(photonCount);
+			photonMap->storePhotons(&photons[0], photonCount);
+			ref<Timer> timer = new Timer();
+			photonMap->balance(threads);
+			Float balanceTime = timer->getMicroseconds() * 1e-3f;
+			if (threads == 1)
+				referenceBalanceTime = balanceTime;
+
+			for (size_t i=1; i<=photonCount; ++i) {
+				if (memcmp(&photonMap->getPhoton(i), &reference->getPhoton(i), sizeof(Photon)) != 0)
+					Log(EError, "The photon map balanced using %i threads differs "
+						"from the reference at index " SIZE_T_FMT "!", threads, i);
+			}
+
+			Log(EInfo, "%8i %16.1f %16.1f %8.2fx %13.1f %8.2fx", threads,
+				throughput[0], throughput[1], throughput[1] / throughput[0],
+				balanceTime, referenceBalanceTime / balanceTime);
+
+			if (threads == maxThreads)
+				break;
+		}
+
+		return 0;
+	}
+
+	MTS_DECLARE_UTILITY()
+};
+
+MTS_EXPORT_UTILITY(PhotonBench, "Photon map construction benchmark")
+MTS_NAMESPACE_END
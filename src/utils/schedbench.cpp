@@ -0,0 +1,266 @@
+/*
+    This file is part of Mitsuba, a physically based rendering system.
+
+    Copyright (c) 2007-2011 by Wenzel Jakob and others.
+
+    Mitsuba is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Mitsuba is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <mitsuba/render/util.h>
+#include <mitsuba/render/range.h>
+#include <mitsuba/core/timer.h>
+#include <mitsuba/core/sched.h>
+#if defined(WIN32)
+#include <mitsuba/core/getopt.h>
+#endif
+
+MTS_NAMESPACE_BEGIN
+
+/// Work result of the scheduler benchmark -- just a single number
+class SchedBenchResult : public WorkResult {
+public:
+	inline void load(Stream *stream) { m_value = stream->readUInt(); }
+	inline void save(Stream *stream) const { stream->writeUInt(m_value); }
+	inline std::string toString() const {
+		return formatString("SchedBenchResult[value=%u]", m_value);
+	}
+
+	inline uint32_t getValue() const { return m_value; }
+	inline void setValue(uint32_t value) { m_value = value; }
+
+	MTS_DECLARE_CLASS()
+protected:
+	virtual ~SchedBenchResult() { }
+private:
+	uint32_t m_value;
+};
+
+/// Performs a configurable amount of busy work per work unit
+class SchedBenchWorker : public WorkProcessor {
+public:
+	SchedBenchWorker(int workAmount) : m_workAmount(workAmount) { }
+
+	SchedBenchWorker(Stream *stream, InstanceManager *manager) {
+		m_workAmount = stream->readInt();
+	}
+
+	void serialize(Stream *stream, InstanceManager *manager) const {
+		stream->writeInt(m_workAmount);
+	}
+
+	ref<WorkUnit> createWorkUnit() const {
+		return new RangeWorkUnit();
+	}
+
+	ref<WorkResult> createWorkResult() const {
+		return new SchedBenchResult();
+	}
+
+	void prepare() { }
+
+	void process(const WorkUnit *workUnit, WorkResult *workResult,
+		const bool &stop) {
+		const RangeWorkUnit *range = static_cast<const RangeWorkUnit *>(workUnit);
+		SchedBenchResult *result = static_cast<SchedBenchResult *>(workResult);
+
+		/* Simple LCG busy loop that the compiler cannot remove */
+		uint32_t state = (uint32_t) range->getRangeStart();
+		for (int i=0; i<m_workAmount; ++i)
+			state = state * 1664525u + 1013904223u;
+		result->setValue(state);
+	}
+
+	ref<WorkProcessor> clone() const {
+		return new SchedBenchWorker(m_workAmount);
+	}
+
+	MTS_DECLARE_CLASS()
+protected:
+	virtual ~SchedBenchWorker() { }
+private:
+	int m_workAmount;
+};
+
+/// Generates a fixed number of tiny work units
+class SchedBenchProcess : public ParallelProcess {
+public:
+	SchedBenchProcess(size_t unitCount, int workAmount)
+		: m_unitCount(unitCount), m_unitsGenerated(0),
+		  m_workAmount(workAmount), m_checksum(0) {
+		m_resultMutex = new Mutex();
+	}
+
+	ref<WorkProcessor> createWorkProcessor() const {
+		return new SchedBenchWorker(m_workAmount);
+	}
+
+	EStatus generateWork(WorkUnit *unit, int worker) {
+		if (m_unitsGenerated == m_unitCount)
+			return EFailure;
+		static_cast<RangeWorkUnit *>(unit)->setRange(
+			m_unitsGenerated, m_unitsGenerated);
+		m_unitsGenerated++;
+		return ESuccess;
+	}
+
+	void processResult(const WorkResult *wr, bool cancelled) {
+		const SchedBenchResult *result = static_cast<const SchedBenchResult *>(wr);
+		m_resultMutex->lock();
+		m_checksum ^= result->getValue();
+		m_resultMutex->unlock();
+	}
+
+	bool isLocal() const {
+		return true;
+	}
+
+	inline uint32_t getChecksum() const { return m_checksum; }
+
+	MTS_DECLARE_CLASS()
+protected:
+	virtual ~SchedBenchProcess() { }
+private:
+	ref<Mutex> m_resultMutex;
+	size_t m_unitCount, m_unitsGenerated;
+	int m_workAmount;
+	uint32_t m_checksum;
+};
+
+class SchedBench : public Utility {
+public:
+	void help() {
+		cout << endl;
+		cout << "Synopsis: Scheduler performance benchmark. Runs a parallel process that" << endl;
+		cout << "generates a large number of tiny work units and reports the resulting" << endl;
+		cout << "work unit throughput as a function of the number of local workers, both" << endl;
+		cout << "with the central work queue and in work stealing mode." << endl;
+		cout << endl;
+		cout << "Usage: mtsutil schedbench [options]" << endl;
+		cout << "Options/Arguments:" << endl;
+		cout << "   -h             Display this help text" << endl << endl;
+		cout << "   -n count       Number of work units per run (default: 200000)" << endl << endl;
+		cout << "   -w amount      Busy loop iterations per work unit (default: 1000)" << endl << endl;
+		cout << "   -p count       Maximum number of local workers (default: all cores)" << endl << endl;
+		cout << "   -k count       Work units prefetched per worker in work stealing" << endl;
+		cout << "                  mode (default: 8)" << endl << endl;
+	}
+
+	Float runBenchmark(size_t unitCount, int workAmount) {
+		Scheduler *scheduler = Scheduler::getInstance();
+		ref<SchedBenchProcess> proc = new SchedBenchProcess(unitCount, workAmount);
+		ref<Timer> timer = new Timer();
+		scheduler->schedule(proc);
+		scheduler->wait(proc);
+		unsigned int ms = timer->getMilliseconds();
+		if (proc->getReturnStatus() != ParallelProcess::ESuccess)
+			Log(EError, "The benchmark process did not finish successfully!");
+		return (Float) unitCount / (Float) std::max(ms, 1u);
+	}
+
+	int run(int argc, char **argv) {
+		char optchar, *end_ptr = NULL;
+		size_t unitCount = 200000;
+		int workAmount = 1000, maxWorkers = getProcessorCount(),
+			prefetchCount = 8;
+		optind = 1;
+
+		/* Parse command-line arguments */
+		while ((optchar = getopt(argc, argv, "n:w:p:k:h")) != -1) {
+			switch (optchar) {
+				case 'h': {
+						help();
+						return 0;
+					}
+					break;
+				case 'n':
+					unitCount = (size_t) strtol(optarg, &end_ptr, 10);
+					if (*end_ptr != '\0')
+						SLog(EError, "Could not parse the work unit count!");
+					break;
+				case 'w':
+					workAmount = strtol(optarg, &end_ptr, 10);
+					if (*end_ptr != '\0')
+						SLog(EError, "Could not parse the work amount!");
+					break;
+				case 'p':
+					maxWorkers = strtol(optarg, &end_ptr, 10);
+					if (*end_ptr != '\0' || maxWorkers < 1)
+						SLog(EError, "Could not parse the worker count!");
+					break;
+				case 'k':
+					prefetchCount = strtol(optarg, &end_ptr, 10);
+					if (*end_ptr != '\0' || prefetchCount < 1)
+						SLog(EError, "Could not parse the prefetch count!");
+					break;
+			};
+		}
+
+		/* Temporarily replace the workers of the scheduler */
+		Scheduler *scheduler = Scheduler::getInstance();
+		bool origWorkStealing = scheduler->getWorkStealing();
+		int origPrefetchCount = scheduler->getPrefetchCount();
+		std::vector<ref<Worker> > origWorkers;
+		scheduler->pause();
+		while (scheduler->getWorkerCount() > 0) {
+			origWorkers.push_back(scheduler->getWorker(0));
+			scheduler->unregisterWorker(origWorkers.back());
+		}
+
+		Log(EInfo, "Processing " SIZE_T_FMT " work units with %i iterations each",
+			unitCount, workAmount);
+		Log(EInfo, "%8s %18s %18s %9s", "workers", "central [Ku/s]",
+			"stealing [Ku/s]", "speedup");
+
+		for (int workers = 1; ; workers = std::min(workers * 2, maxWorkers)) {
+			Float throughput[2];
+			for (int mode=0; mode<2; ++mode) {
+				for (int i=0; i<workers; ++i)
+					scheduler->registerWorker(new LocalWorker(formatString("bench%i", i)));
+				scheduler->setWorkStealing(mode == 1, prefetchCount);
+				scheduler->start();
+
+				/* Best of three */
+				throughput[mode] = 0;
+				for (int j=0; j<3; ++j)
+					throughput[mode] = std::max(throughput[mode],
+						runBenchmark(unitCount, workAmount));
+
+				scheduler->pause();
+				while (scheduler->getWorkerCount() > 0)
+					scheduler->unregisterWorker(scheduler->getWorker(0));
+			}
+
+			Log(EInfo, "%8i %18.1f %18.1f %8.2fx", workers, throughput[0],
+				throughput[1], throughput[1] / throughput[0]);
+
+			if (workers == maxWorkers)
+				break;
+		}
+
+		/* Restore the original configuration */
+		scheduler->setWorkStealing(origWorkStealing, origPrefetchCount);
+		for (size_t i=0; i<origWorkers.size(); ++i)
+			scheduler->registerWorker(origWorkers[i]);
+		scheduler->start();
+
+		return 0;
+	}
+
+	MTS_DECLARE_UTILITY()
+};
+
+MTS_IMPLEMENT_CLASS(SchedBenchResult, false, WorkResult)
+MTS_IMPLEMENT_CLASS_S(SchedBenchWorker, false, WorkProcessor)
+MTS_IMPLEMENT_CLASS(SchedBenchProcess, false, ParallelProcess)
+MTS_EXPORT_UTILITY(SchedBench, "Scheduler throughput benchmark")
+MTS_NAMESPACE_END
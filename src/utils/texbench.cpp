@@ -0,0 +1,191 @@
+/*
+    This file is part of Mitsuba, a physically based rendering system.
+
+    Copyright (c) 2007-2011 by Wenzel Jakob and others.
+
+    Mitsuba is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Mitsuba is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <mitsuba/render/util.h>
+#include <mitsuba/render/mipmap.h>
+#include <mitsuba/core/fstream.h>
+#include <mitsuba/core/random.h>
+#include <mitsuba/core/timer.h>
+#include <boost/algorithm/string.hpp>
+#if defined(WIN32)
+#include <mitsuba/core/getopt.h>
+#endif
+
+MTS_NAMESPACE_BEGIN
+
+class TexBench : public Utility {
+public:
+	void help() {
+		cout << endl;
+		cout << "Synopsis: Texture storage benchmark. Builds an EWA mip map from the given" << endl;
+		cout << "image using each supported texel format and reports the memory usage," << endl;
+		cout << "the lookup throughput and the error with respect to full spectral storage." << endl;
+		cout << "LDR images are converted exactly like in the 'ldrtexture' plugin (sRGB)." << endl;
+		cout << endl;
+		cout << "Usage: mtsutil texbench [options] <JPG/PNG/TGA/BMP/EXR image>" << endl;
+		cout << "Options/Arguments:" << endl;
+		cout << "   -h             Display this help text" << endl << endl;
+		cout << "   -n count       Number of texture lookups (default: 4000000)" << endl << endl;
+		cout << "   -w width       Maximum filter width in texture space (default: 0.01)" << endl << endl;
+	}
+
+	/// Load an image and convert it into a linear floating point bitmap
+	ref<Bitmap> loadImage(const fs::path &filename) {
+		std::string extension = boost::to_lower_copy(filename.extension());
+		Bitmap::EFileFormat format;
+		if (extension == ".jpg" || extension == ".jpeg")
+			format = Bitmap::EJPEG;
+		else if (extension == ".png")
+			format = Bitmap::EPNG;
+		else if (extension == ".tga")
+			format = Bitmap::ETGA;
+		else if (extension == ".bmp")
+			format = Bitmap::EBMP;
+		else if (extension == ".exr")
+			format = Bitmap::EEXR;
+		else
+			Log(EError, "Cannot deduce the file type of '%s'!", filename.file_string().c_str());
+
+		ref<FileStream> fs = new FileStream(filename, FileStream::EReadOnly);
+		ref<Bitmap> bitmap = new Bitmap(format, fs);
+		if (bitmap->getBitsPerPixel() == 128)
+			return bitmap;
+
+		int channels = bitmap->getBitsPerPixel() / 8;
+		if (channels < 1 || channels > 4)
+			Log(EError, "%i bpp images are currently not supported!", bitmap->getBitsPerPixel());
+
+		float tbl[256];
+		for (int i=0; i<256; ++i) {
+			Float value = (Float) i / (Float) 255;
+			tbl[i] = (float) ((value <= (Float) 0.04045) ? value / (Float) 12.92
+				: std::pow((value + (Float) 0.055) / (Float) 1.055, (Float) 2.4));
+		}
+
+		ref<Bitmap> result = new Bitmap(bitmap->getWidth(), bitmap->getHeight(), 128);
+		const uint8_t *data = bitmap->getData();
+		float *flData = result->getFloatData();
+		for (int i=0; i<bitmap->getWidth() * bitmap->getHeight(); ++i) {
+			for (int j=0; j<3; ++j)
+				*flData++ = tbl[data[channels >= 3 ? j : 0]];
+			*flData++ = 1.0f;
+			data += channels;
+		}
+		return result;
+	}
+
+	int run(int argc, char **argv) {
+		char optchar, *end_ptr = NULL;
+		size_t lookupCount = 4000000;
+		Float filterWidth = 0.01f;
+		optind = 1;
+
+		/* Parse command-line arguments */
+		while ((optchar = getopt(argc, argv, "n:w:h")) != -1) {
+			switch (optchar) {
+				case 'h': {
+						help();
+						return 0;
+					}
+					break;
+				case 'n':
+					lookupCount = (size_t) strtol(optarg, &end_ptr, 10);
+					if (*end_ptr != '\0' || lookupCount < 1)
+						SLog(EError, "Could not parse the lookup count!");
+					break;
+				case 'w':
+					filterWidth = (Float) strtod(optarg, &end_ptr);
+					if (*end_ptr != '\0' || filterWidth < 0)
+						SLog(EError, "Could not parse the filter width!");
+					break;
+			};
+		}
+
+		if (optind == argc || optind+1 < argc) {
+			help();
+			return 0;
+		}
+
+		ref<Bitmap> bitmap = loadImage(argv[optind]);
+		Log(EInfo, "Performing " SIZE_T_FMT " EWA lookups in a %ix%i texture",
+			lookupCount, bitmap->getWidth(), bitmap->getHeight());
+		Log(EInfo, "%10s %12s %8s %16s %8s %12s", "format", "memory", "ratio",
+			"lookups/s", "speedup", "max. error");
+
+		const MIPMap::ETexelFormat formats[] = {
+			MIPMap::ESpectrum, MIPMap::ESRGB8, MIPMap::EHalfRGB };
+		const char *formatNames[] = { "spectrum", "srgb8", "half" };
+		ref<MIPMap> reference;
+		Float referenceThroughput = 0;
+		size_t referenceMemory = 0;
+
+		for (int i=0; i<3; ++i) {
+			ref<MIPMap> mipmap = MIPMap::fromBitmap(bitmap, MIPMap::EEWA,
+				MIPMap::ERepeat, 8.0f, formats[i]);
+			if (i == 0)
+				reference = mipmap;
+
+			/* Use the same lookup positions and footprints for each format */
+			ref<Random> random = new Random(1234);
+			Spectrum sum(0.0f);
+			ref<Timer> timer = new Timer();
+			for (size_t j=0; j<lookupCount; ++j) {
+				Float u = random->nextFloat(), v = random->nextFloat(),
+					dudx = (random->nextFloat() - 0.5f) * filterWidth,
+					dvdx = (random->nextFloat() - 0.5f) * filterWidth,
+					dudy = (random->nextFloat() - 0.5f) * filterWidth,
+					dvdy = (random->nextFloat() - 0.5f) * filterWidth;
+				sum += mipmap->getValue(u, v, dudx, dudy, dvdx, dvdy);
+			}
+			Float throughput = lookupCount / 
+				(std::max(timer->getMilliseconds(), 1u) * 1e-3f);
+
+			/* Compare a subset of the lookups against the reference */
+			Float maxError = 0;
+			random = new Random(1234);
+			for (size_t j=0; i > 0 && j<std::min(lookupCount, (size_t) 100000); ++j) {
+				Float u = random->nextFloat(), v = random->nextFloat(),
+					dudx = (random->nextFloat() - 0.5f) * filterWidth,
+					dvdx = (random->nextFloat() - 0.5f) * filterWidth,
+					dudy = (random->nextFloat() - 0.5f) * filterWidth,
+					dvdy = (random->nextFloat() - 0.5f) * filterWidth;
+				Spectrum diff = mipmap->getValue(u, v, dudx, dudy, dvdx, dvdy) 
+					- reference->getValue(u, v, dudx, dudy, dvdx, dvdy);
+				for (int k=0; k<SPECTRUM_SAMPLES; ++k)
+					maxError = std::max(maxError, std::abs(diff[k]));
+			}
+			size_t memory = mipmap->getMemoryUsage();
+			if (i == 0) {
+				referenceThroughput = throughput;
+				referenceMemory = memory;
+			}
+
+			Log(EInfo, "%10s %12s %7.2fx %16.0f %7.2fx %12.6f", formatNames[i],
+				memString(memory).c_str(), (Float) referenceMemory / (Float) memory,
+				throughput, throughput / referenceThroughput, maxError);
+			Log(EDebug, "Checksum: %s", sum.toString().c_str());
+		}
+
+		return 0;
+	}
+
+	MTS_DECLARE_UTILITY()
+};
+
+MTS_EXPORT_UTILITY(TexBench, "Texture storage benchmark")
+MTS_NAMESPACE_END
@@ -0,0 +1,176 @@
+/*
+    This file is part of Mitsuba, a physically based rendering system.
+
+    Copyright (c) 2007-2011 by Wenzel Jakob and others.
+
+    Mitsuba is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Mitsuba is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <mitsuba/render/util.h>
+#include <mitsuba/render/track.h>
+#include <mitsuba/core/fstream.h>
+#include <mitsuba/core/random.h>
+#include <mitsuba/core/timer.h>
+#if defined(WIN32)
+#include <mitsuba/core/getopt.h>
+#endif
+
+MTS_NAMESPACE_BEGIN
+
+class TrackBench : public Utility {
+public:
+	void help() {
+		cout << endl;
+		cout << "Synopsis: Animated instance benchmark. Transforms random rays into the local" << endl;
+		cout << "coordinate system of an animated instance at random times, once by evaluating" << endl;
+		cout << "the animation tracks for every ray and once using the pre-sampled transform" << endl;
+		cout << "cache, and reports the throughput and the maximum deviation of both methods." << endl;
+		cout << endl;
+		cout << "Usage: mtsutil trackbench [options] [Animation track file]" << endl;
+		cout << "Options/Arguments:" << endl;
+		cout << "   -h             Display this help text" << endl << endl;
+		cout << "   -n count       Number of rays (default: 1000000)" << endl << endl;
+		cout << "   -k count       Number of keyframes of the synthetic animation, which" << endl;
+		cout << "                  is used when no file is specified (default: 20)" << endl << endl;
+	}
+
+	/// Create an animation with translation, rotation and scale keyframes
+	ref<AnimatedTransform> createAnimation(int keyCount, Random *random) {
+		ref<VectorTrack> translation = new VectorTrack(
+			AbstractAnimationTrack::ETranslationXYZ, keyCount);
+		ref<VectorTrack> scale = new VectorTrack(
+			AbstractAnimationTrack::EScaleXYZ, keyCount);
+		/* Rotation keyframes at different times */
+		ref<QuatTrack> rotation = new QuatTrack(
+			AbstractAnimationTrack::ERotationQuat, keyCount-1);
+
+		for (int i=0; i<keyCount; ++i) {
+			Float time = i / (Float) (keyCount-1);
+			translation->setTime(i, time);
+			translation->setValue(i, Vector(random->nextFloat(), 
+				random->nextFloat(), random->nextFloat()) * 10);
+			scale->setTime(i, time);
+			scale->setValue(i, Vector(0.5f + random->nextFloat(),
+				0.5f + random->nextFloat(), 0.5f + random->nextFloat()));
+			if (i+1 < keyCount) {
+				rotation->setTime(i, (i + 0.5f) / (Float) (keyCount-1));
+				rotation->setValue(i, Quaternion::fromAxisAngle(squareToSphere(
+					Point2(random->nextFloat(), random->nextFloat())),
+					random->nextFloat() * M_PI));
+			}
+		}
+
+		ref<AnimatedTransform> trafo = new AnimatedTransform();
+		trafo->addTrack(translation);
+		trafo->addTrack(rotation);
+		trafo->addTrack(scale);
+		return trafo;
+	}
+
+	int run(int argc, char **argv) {
+		char optchar, *end_ptr = NULL;
+		size_t rayCount = 1000000;
+		int keyCount = 20;
+		optind = 1;
+
+		/* Parse command-line arguments */
+		while ((optchar = getopt(argc, argv, "n:k:h")) != -1) {
+			switch (optchar) {
+				case 'h': {
+						help();
+						return 0;
+					}
+					break;
+				case 'n':
+					rayCount = (size_t) strtol(optarg, &end_ptr, 10);
+					if (*end_ptr != '\0' || rayCount < 1)
+						SLog(EError, "Could not parse the ray count!");
+					break;
+				case 'k':
+					keyCount = strtol(optarg, &end_ptr, 10);
+					if (*end_ptr != '\0' || keyCount < 2)
+						SLog(EError, "Could not parse the keyframe count!");
+					break;
+			};
+		}
+
+		if (optind+1 < argc) {
+			help();
+			return 0;
+		}
+
+		ref<Random> random = new Random();
+		ref<AnimatedTransform> trafo;
+		if (optind < argc) {
+			ref<FileStream> fs = new FileStream(argv[optind], FileStream::EReadOnly);
+			trafo = new AnimatedTransform(fs);
+		} else {
+			trafo = createAnimation(keyCount, random);
+		}
+
+		AnimatedTransformCache cache(trafo);
+		Float minT, maxT;
+		trafo->computeTimeBounds(minT, maxT);
+		Log(EInfo, "Animation with %i track(s), " SIZE_T_FMT " distinct keyframes, "
+			"time range [%f, %f]", (int) trafo->getTrackCount(), 
+			cache.getKeyframeCount(), minT, maxT);
+
+		/* Random rays (with some times slightly outside of the animation) */
+		std::vector<Ray> rays(rayCount);
+		for (size_t i=0; i<rayCount; ++i) {
+			Float time = minT + (maxT-minT) * (1.2f * random->nextFloat() - 0.1f);
+			rays[i] = Ray(Point(random->nextFloat(), random->nextFloat(),
+				random->nextFloat()) * 20 - Vector(10.0f), squareToSphere(Point2(
+				random->nextFloat(), random->nextFloat())), time);
+		}
+
+		std::vector<Ray> result[2];
+		Float time[2];
+		const char *names[2] = { "track evaluation", "transform cache" };
+		for (int mode=0; mode<2; ++mode) {
+			result[mode].resize(rayCount);
+			Transform objectToWorld;
+			ref<Timer> timer = new Timer();
+			for (size_t i=0; i<rayCount; ++i) {
+				const Ray &ray = rays[i];
+				if (mode == 0)
+					trafo->eval(ray.time, objectToWorld);
+				else
+					cache.eval(ray.time, objectToWorld);
+				objectToWorld.inverse()(ray, result[mode][i]);
+			}
+			time[mode] = timer->getMicroseconds() * 1e-6f;
+			Log(EInfo, "%s: %.3f s (%.2f Mrays/s)", names[mode], time[mode], 
+				rayCount / time[mode] * 1e-6f);
+		}
+
+		Float maxError = 0;
+		for (size_t i=0; i<rayCount; ++i) {
+			const Ray &r0 = result[0][i], &r1 = result[1][i];
+			for (int j=0; j<3; ++j) {
+				Float scale = std::max((Float) 1, std::abs(r0.o[j]));
+				maxError = std::max(maxError, std::abs(r0.o[j] - r1.o[j]) / scale);
+				maxError = std::max(maxError, std::abs(r0.d[j] - r1.d[j]));
+			}
+		}
+		Log(EInfo, "Speedup: %.2fx, max. relative deviation: %e", 
+			time[0] / time[1], maxError);
+
+		return 0;
+	}
+
+	MTS_DECLARE_UTILITY()
+};
+
+MTS_EXPORT_UTILITY(TrackBench, "Animated instance benchmark")
+MTS_NAMESPACE_END
@@ -0,0 +1,278 @@
+/*
+    This file is part of Mitsuba, a physically based rendering system.
+
+    Copyright (c) 2007-2011 by Wenzel Jakob and others.
+
+    Mitsuba is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Mitsuba is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <mitsuba/render/util.h>
+#include <mitsuba/render/medium.h>
+#include <mitsuba/render/volume.h>
+#include <mitsuba/render/sampler.h>
+#include <mitsuba/core/timer.h>
+#include <mitsuba/core/random.h>
+#include <mitsuba/core/plugin.h>
+#include <mitsuba/core/atomic.h>
+#if defined(WIN32)
+#include <mitsuba/core/getopt.h>
+#endif
+#if defined(_OPENMP)
+#include <omp.h>
+#endif
+
+MTS_NAMESPACE_BEGIN
+
+/// Forwards float lookups to another data source and counts them
+class CountingDataSource : public VolumeDataSource {
+public:
+	CountingDataSource(VolumeDataSource *nested) 
+			: VolumeDataSource(Properties()), m_nested(nested), m_count(0) {
+		m_aabb = nested->getAABB();
+	}
+
+	Float lookupFloat(const Point &p) const {
+		atomicAdd(&m_count, 1);
+		return m_nested->lookupFloat(p);
+	}
+
+	bool supportsFloatLookups() const { return true; }
+	Float getStepSize() const { return m_nested->getStepSize(); }
+	Float getMaximumFloatValue() const { return m_nested->getMaximumFloatValue(); }
+
+	/// Return the number of lookups since the last reset
+	inline int64_t getCount() const { return m_count; }
+
+	/// Reset the lookup counter
+	inline void reset() { m_count = 0; }
+
+	MTS_DECLARE_CLASS()
+protected:
+	virtual ~CountingDataSource() { }
+private:
+	ref<VolumeDataSource> m_nested;
+	mutable volatile int64_t m_count;
+};
+
+class VolBench : public Utility {
+public:
+	void help() {
+		cout << endl;
+		cout << "Synopsis: Heterogeneous medium benchmark. Traces random rays through a grid" << endl;
+		cout << "volume using Woodcock tracking, once with a single global majorant and" << endl;
+		cout << "once with the majorant grid, and reports the throughput and the average" << endl;
+		cout << "transmittance and free-flight distance of both methods (which should agree)." << endl;
+		cout << endl;
+		cout << "Usage: mtsutil volbench [options] <Grid volume file>" << endl;
+		cout << "Options/Arguments:" << endl;
+		cout << "   -h             Display this help text" << endl << endl;
+		cout << "   -n count       Number of rays or lookups (default: 1000000)" << endl << endl;
+		cout << "   -d value       Density multiplier (default: 1)" << endl << endl;
+		cout << "   -r res         Resolution of the majorant grid (default: automatic)" << endl << endl;
+		cout << "   -c             Instead benchmark the volume cache ('volcache' plugin):" << endl;
+		cout << "                  perform coherent random walks of lookups on all cores, once" << endl;
+		cout << "                  with per-thread caches and once with the shared cache, and" << endl;
+		cout << "                  report the hit rate and the time per lookup." << endl << endl;
+		cout << "   -m size        Memory limit of the volume cache in MiB (default: 32)" << endl << endl;
+	}
+
+	/// Compare the per-thread and shared modes of the volume cache
+	void benchmarkCache(VolumeDataSource *density, size_t lookupCount, int memoryLimit) {
+		PluginManager *pluginManager = PluginManager::getInstance();
+		ref<CountingDataSource> counter = new CountingDataSource(density);
+		const AABB &aabb = density->getAABB();
+		const Float stepSize = density->getStepSize();
+		const int blockSize = 4, walkLength = 1000;
+		const int walkCount = (int) std::max((size_t) 1, lookupCount / walkLength);
+
+		int threadCount = 1;
+#if defined(_OPENMP)
+		threadCount = omp_get_max_threads();
+#endif
+		Log(EInfo, "Performing " SIZE_T_FMT " cached lookups on %i thread(s) (memory limit: %i MiB)",
+			(size_t) walkCount * walkLength, threadCount, memoryLimit);
+
+		const char *names[2] = { "per-thread caches", "shared cache" };
+		Float time[2];
+		for (int mode=0; mode<2; ++mode) {
+			Properties props("volcache");
+			props.setInteger("blockSize", blockSize);
+			props.setLong("memoryLimit", memoryLimit);
+			props.setBoolean("shared", mode == 1);
+			ref<VolumeDataSource> cache = static_cast<VolumeDataSource *> (
+				pluginManager->createObject(MTS_CLASS(VolumeDataSource), props));
+			cache->addChild("", counter);
+			cache->configure();
+			counter->reset();
+
+			double sum = 0;
+			ref<Timer> timer = new Timer();
+			#pragma omp parallel for schedule(dynamic) reduction(+:sum)
+			for (int i=0; i<walkCount; ++i) {
+				/* Random walk with steps of about one voxel, restarting
+				   at a random position whenever it leaves the volume */
+				ref<Random> random = new Random((uint64_t) i);
+				Point p;
+				for (int j=0; j<walkLength; ++j) {
+					if (j == 0 || !aabb.contains(p)) {
+						for (int k=0; k<3; ++k)
+							p[k] = aabb.min[k] + random->nextFloat() * (aabb.max[k]-aabb.min[k]);
+					}
+					sum += cache->lookupFloat(p);
+					p += squareToSphere(Point2(random->nextFloat(),
+						random->nextFloat())) * stepSize;
+				}
+			}
+			time[mode] = timer->getMicroseconds() * 1e-6f;
+
+			/* Every miss evaluates the nested source at all vertices of a block */
+			size_t lookups = (size_t) walkCount * walkLength;
+			Float misses = counter->getCount() 
+				/ (Float) ((blockSize+1) * (blockSize+1) * (blockSize+1));
+			Log(EInfo, "%s: %.3f s (%.1f ns/lookup), hit rate=%.2f%%, checksum=%f",
+				names[mode], time[mode], time[mode] * 1e9f / lookups,
+				100 * (1 - misses / lookups), sum / lookups);
+		}
+		Log(EInfo, "Speedup: %.2fx", time[0] / time[1]);
+	}
+
+	/// Create a heterogeneous medium with the given density volume
+	ref<Medium> createMedium(VolumeDataSource *density, Float densityMultiplier, 
+			int majorantRes) {
+		PluginManager *pluginManager = PluginManager::getInstance();
+		Properties albedoProps("constvolume");
+		albedoProps.setSpectrum("value", Spectrum(0.8f));
+		ref<VolumeDataSource> albedo = static_cast<VolumeDataSource *> (
+			pluginManager->createObject(MTS_CLASS(VolumeDataSource), albedoProps));
+		albedo->configure();
+
+		Properties props("heterogeneous");
+		props.setString("method", "woodcock");
+		props.setFloat("densityMultiplier", densityMultiplier);
+		props.setInteger("majorantResolution", majorantRes);
+		ref<Medium> medium = static_cast<Medium *> (
+			pluginManager->createObject(MTS_CLASS(Medium), props));
+		medium->addChild("density", density);
+		medium->addChild("albedo", albedo);
+		medium->configure();
+		return medium;
+	}
+
+	int run(int argc, char **argv) {
+		char optchar, *end_ptr = NULL;
+		size_t rayCount = 1000000;
+		Float densityMultiplier = 1;
+		int majorantRes = 0, memoryLimit = 32;
+		bool cacheBenchmark = false;
+		optind = 1;
+
+		/* Parse command-line arguments */
+		while ((optchar = getopt(argc, argv, "n:d:r:m:ch")) != -1) {
+			switch (optchar) {
+				case 'h': {
+						help();
+						return 0;
+					}
+					break;
+				case 'n':
+					rayCount = (size_t) strtol(optarg, &end_ptr, 10);
+					if (*end_ptr != '\0' || rayCount < 1)
+						SLog(EError, "Could not parse the ray count!");
+					break;
+				case 'd':
+					densityMultiplier = (Float) strtod(optarg, &end_ptr);
+					if (*end_ptr != '\0' || densityMultiplier <= 0)
+						SLog(EError, "Could not parse the density multiplier!");
+					break;
+				case 'r':
+					majorantRes = strtol(optarg, &end_ptr, 10);
+					if (*end_ptr != '\0' || majorantRes < 0)
+						SLog(EError, "Could not parse the majorant grid resolution!");
+					break;
+				case 'm':
+					memoryLimit = strtol(optarg, &end_ptr, 10);
+					if (*end_ptr != '\0' || memoryLimit < 1)
+						SLog(EError, "Could not parse the memory limit!");
+					break;
+				case 'c':
+					cacheBenchmark = true;
+					break;
+			};
+		}
+
+		if (optind == argc || optind+1 < argc) {
+			help();
+			return 0;
+		}
+
+		PluginManager *pluginManager = PluginManager::getInstance();
+		Properties densityProps("gridvolume");
+		densityProps.setString("filename", argv[optind]);
+		ref<VolumeDataSource> density = static_cast<VolumeDataSource *> (
+			pluginManager->createObject(MTS_CLASS(VolumeDataSource), densityProps));
+		density->configure();
+
+		if (cacheBenchmark) {
+			benchmarkCache(density, rayCount, memoryLimit);
+			return 0;
+		}
+
+		/* Rays between pairs of random points on the bounding sphere */
+		BSphere bsphere = density->getAABB().getBSphere();
+		ref<Random> random = new Random();
+		std::vector<Ray> rays(rayCount);
+		for (size_t i=0; i<rayCount; ++i) {
+			Point p1 = bsphere.center + squareToSphere(Point2(random->nextFloat(),
+				random->nextFloat())) * bsphere.radius;
+			Point p2 = bsphere.center + squareToSphere(Point2(random->nextFloat(),
+				random->nextFloat())) * bsphere.radius;
+			rays[i] = Ray(p1, normalize(p2-p1), 0.0f);
+			rays[i].maxt = (p2-p1).length();
+		}
+
+		const char *names[2] = { "global majorant", "majorant grid" };
+		Float time[2];
+		for (int mode=0; mode<2; ++mode) {
+			ref<Medium> medium = createMedium(density, densityMultiplier, 
+				mode == 0 ? 1 : majorantRes);
+			ref<Sampler> sampler = static_cast<Sampler *> (pluginManager->
+				createObject(MTS_CLASS(Sampler), Properties("independent")));
+			sampler->configure();
+
+			MediumSamplingRecord mRec;
+			double transmittance = 0, distance = 0;
+			ref<Timer> timer = new Timer();
+			for (size_t i=0; i<rayCount; ++i) {
+				const Ray &ray = rays[i];
+				transmittance += medium->getTransmittance(ray, sampler)[0];
+				distance += medium->sampleDistance(ray, mRec, sampler) 
+					? mRec.t : ray.maxt;
+			}
+			time[mode] = timer->getMicroseconds() * 1e-6f;
+
+			Log(EInfo, "%s: %.3f s (%.2f Krays/s), avg. transmittance=%f, "
+				"avg. free-flight distance=%f", names[mode], time[mode],
+				rayCount / time[mode] * 1e-3f, transmittance / rayCount,
+				distance / rayCount);
+		}
+		Log(EInfo, "Speedup: %.2fx", time[0] / time[1]);
+
+		return 0;
+	}
+
+	MTS_DECLARE_UTILITY()
+};
+
+MTS_IMPLEMENT_CLASS(CountingDataSource, false, VolumeDataSource)
+MTS_EXPORT_UTILITY(VolBench, "Heterogeneous medium benchmark")
+MTS_NAMESPACE_END
@@ -22,6 +22,9 @@
 #include <mitsuba/core/properties.h>
 #include <mitsuba/core/mmap.h>
 
+#if defined(_OPENMP)
+#include <omp.h>
+#endif
 
 // Uncomment to enable nearest-neighbor direction interpolation
 //#define VINTERP_NEAREST_NEIGHBOR
@@ -557,6 +560,55 @@ public:
 		return 1.0f;
 	}
 
+	void getMaximumFloatValues(const Vector3i &res, Float *maxima) const {
+		if (m_channels != 1 || (m_volumeType != EFloat32 && m_volumeType != EUInt8)) {
+			VolumeDataSource::getMaximumFloatValues(res, maxima);
+			return;
+		}
+
+		Vector cellSize = m_aabb.getExtents();
+		for (int i=0; i<3; ++i)
+			cellSize[i] /= res[i];
+
+		#pragma omp parallel for schedule(dynamic)
+		for (int z=0; z<res.z; ++z) {
+			for (int y=0; y<res.y; ++y) {
+				for (int x=0; x<res.x; ++x) {
+					AABB cell(
+						m_aabb.min + Vector(x*cellSize.x, y*cellSize.y, z*cellSize.z),
+						m_aabb.min + Vector((x+1)*cellSize.x, (y+1)*cellSize.y, (z+1)*cellSize.z));
+
+					/* Find the voxels, which can influence interpolated lookups
+					   within the (possibly rotated) cell */
+					AABB gridCell;
+					for (int i=0; i<8; ++i)
+						gridCell.expandBy(m_worldToGrid.transformAffine(cell.getCorner(i)));
+					int lo[3], hi[3];
+					for (int i=0; i<3; ++i) {
+						lo[i] = std::max(0, floorToInt(gridCell.min[i] - Epsilon));
+						hi[i] = std::min(m_res[i] - 1, floorToInt(gridCell.max[i] + Epsilon) + 1);
+					}
+
+					Float value = 0;
+					for (int vz=lo[2]; vz<=hi[2]; ++vz) {
+						for (int vy=lo[1]; vy<=hi[1]; ++vy) {
+							size_t offset = ((size_t) vz*m_res.y + vy)*m_res.x;
+							if (m_volumeType == EFloat32) {
+								const float *floatData = (float *) m_data;
+								for (int vx=lo[0]; vx<=hi[0]; ++vx)
+									value = std::max(value, (Float) floatData[offset + vx]);
+							} else {
+								for (int vx=lo[0]; vx<=hi[0]; ++vx)
+									value = std::max(value, m_densityMap[m_data[offset + vx]]);
+							}
+						}
+					}
+					maxima[(z*res.y + y)*res.x + x] = value;
+				}
+			}
+		}
+	}
+
 	MTS_DECLARE_CLASS()
 protected: 
 	FINLINE Vector lookupQuantizedDirection(size_t index) const {
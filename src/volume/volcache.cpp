@@ -29,6 +29,9 @@ static StatsCounter statsHitRate("Volume cache", "Cache hit rate", EPercentage);
 static StatsCounter statsCreate("Volume cache", "Block creations");
 static StatsCounter statsDestruct("Volume cache", "Block destructions");
 static StatsCounter statsEmpty("Volume cache", "Empty blocks", EPercentage);
+static StatsCounter statsPinned("Volume cache", "Lookups within the thread's current block", EPercentage);
+static StatsCounter statsEvict("Volume cache", "Block evictions (shared cache)");
+static StatsCounter statsRace("Volume cache", "Concurrently created blocks (shared cache)");
 
 /* Lexicographic ordering for Vector3i */
 struct Vector3iKeyOrder : public std::binary_function<Vector3i, Vector3i, bool> {
@@ -43,10 +46,169 @@ struct Vector3iKeyOrder : public std::binary_function<Vector3i, Vector3i, bool>
 	}
 };
 
+/// Hash function for block indices (used to distribute them over shards)
+static inline uint32_t hashBlockIndex(const Vector3i &key) {
+	uint32_t hash = ((uint32_t) key.x * 73856093u)
+		^ ((uint32_t) key.y * 19349663u) ^ ((uint32_t) key.z * 83492791u);
+	return hash ^ (hash >> 16);
+}
+
+/**
+ * \brief Reference-counted block of voxels stored in a \ref SharedBlockCache
+ *
+ * Both the cache and any threads still interpolating within the block hold
+ * references, hence evicted blocks remain valid until they are released.
+ */
+class CacheBlock : public Object {
+public:
+	/// Create a new block (\c data may be \c NULL to denote an empty block)
+	CacheBlock(const Vector3i &key, float *data) 
+		: key(key), data(data), referenced(true) { }
+
+	/// Block index
+	Vector3i key;
+	/// Voxel values or \c NULL
+	float *data;
+	/// Reference bit of the CLOCK eviction scheme
+	volatile bool referenced;
+
+	MTS_DECLARE_CLASS()
+protected:
+	virtual ~CacheBlock() {
+		++statsDestruct;
+		if (data)
+			delete[] data;
+	}
+};
+
+/**
+ * \brief Block cache that is shared by all threads
+ *
+ * The blocks are distributed over a number of shards, each of which 
+ * has its own lock and uses CLOCK (second chance) eviction. Lookups 
+ * therefore only contend when they access the same shard, and blocks 
+ * are generated without holding any lock.
+ */
+class SharedBlockCache : public Object {
+public:
+	typedef boost::function<float *(const Vector3i &)> GeneratorFunction;
+
+	/**
+	 * \param capacity
+	 *     Total number of blocks stored by the cache
+	 * \param shardCount
+	 *     Number of shards (will be rounded up to a power of two)
+	 * \param generatorFunction
+	 *     Computes the contents of a block that is not in the cache
+	 */
+	SharedBlockCache(size_t capacity, size_t shardCount, 
+			const GeneratorFunction &generatorFunction)
+			: m_generatorFunction(generatorFunction) {
+		size_t pow2 = 1;
+		while (pow2 < shardCount)
+			pow2 *= 2;
+		shardCount = pow2;
+		m_shards.resize(shardCount);
+		m_shardMask = (uint32_t) shardCount - 1;
+		m_shardCapacity = std::max((size_t) 1, capacity / shardCount);
+		for (size_t i=0; i<shardCount; ++i) {
+			m_shards[i].mutex = new Mutex();
+			m_shards[i].hand = 0;
+			m_shards[i].slots.reserve(m_shardCapacity);
+		}
+	}
+
+	/// Return the number of shards
+	inline size_t getShardCount() const { return m_shards.size(); }
+
+	/// Return the block with the given index (generating it if necessary)
+	ref<CacheBlock> get(const Vector3i &key, bool &hit) {
+		Shard &shard = m_shards[hashBlockIndex(key) & m_shardMask];
+
+		shard.mutex->lock();
+		BlockIndex::iterator it = shard.index.find(key);
+		if (it != shard.index.end()) {
+			ref<CacheBlock> block = shard.slots[it->second];
+			block->referenced = true;
+			shard.mutex->unlock();
+			hit = true;
+			return block;
+		}
+		shard.mutex->unlock();
+		hit = false;
+
+		/* Generate the block without holding the lock */
+		ref<CacheBlock> block = new CacheBlock(key, m_generatorFunction(key));
+
+		shard.mutex->lock();
+		it = shard.index.find(key);
+		if (it != shard.index.end()) {
+			/* Another thread has created the same block in the meantime */
+			++statsRace;
+			block = shard.slots[it->second];
+			block->referenced = true;
+		} else {
+			insert(shard, block);
+		}
+		shard.mutex->unlock();
+		return block;
+	}
+
+	MTS_DECLARE_CLASS()
+protected:
+	virtual ~SharedBlockCache() { }
+
+	typedef std::map<Vector3i, size_t, Vector3iKeyOrder> BlockIndex;
+
+	struct Shard {
+		ref<Mutex> mutex;
+		/// Maps block indices to slots
+		BlockIndex index;
+		std::vector<ref<CacheBlock> > slots;
+		/// Position of the CLOCK hand
+		size_t hand;
+	};
+
+	/// Insert a block into a shard, evicting another one if necessary
+	void insert(Shard &shard, CacheBlock *block) {
+		if (shard.slots.size() < m_shardCapacity) {
+			shard.index[block->key] = shard.slots.size();
+			shard.slots.push_back(block);
+			return;
+		}
+
+		while (true) {
+			ref<CacheBlock> &slot = shard.slots[shard.hand];
+			if (slot->referenced) {
+				/* Give the block a second chance */
+				slot->referenced = false;
+			} else {
+				++statsEvict;
+				shard.index.erase(slot->key);
+				shard.index[block->key] = shard.hand;
+				slot = block;
+				shard.hand = (shard.hand + 1) % shard.slots.size();
+				return;
+			}
+			shard.hand = (shard.hand + 1) % shard.slots.size();
+		}
+	}
+private:
+	std::vector<Shard> m_shards;
+	uint32_t m_shardMask;
+	size_t m_shardCapacity;
+	GeneratorFunction m_generatorFunction;
+};
+
 /**
  * This class sits in between the renderer and another data source, for which 
  * it caches all data lookups using a LRU scheme. This is useful if the nested 
  * volume data source is expensive to evaluate.
+ *
+ * By default, every thread uses its own cache, which receives an equal share
+ * of the memory limit. When 'shared' is set to \c true, all threads instead
+ * use one sharded cache with approximate LRU (CLOCK) eviction, which avoids
+ * storing hot blocks once per thread on machines with many cores.
  */
 class CachingDataSource : public VolumeDataSource {
 public:
@@ -70,11 +232,20 @@ public:
 		m_stepSizeMultiplier = (Float) props.getFloat("stepSizeMultiplier", 1.0f);
 
 		m_volumeToWorld = props.getTransform("toWorld", Transform());
+
+		/* Share one cache between all threads? */
+		m_shared = props.getBoolean("shared", false);
 	}
 
 	CachingDataSource(Stream *stream, InstanceManager *manager) 
 	: VolumeDataSource(stream, manager) {
 		m_nested = static_cast<VolumeDataSource *>(manager->getInstance(stream));
+		m_blockSize = stream->readInt();
+		m_voxelWidth = stream->readFloat();
+		m_memoryLimit = stream->readSize();
+		m_stepSizeMultiplier = stream->readFloat();
+		m_volumeToWorld = Transform(stream);
+		m_shared = stream->readBool();
 		configure();
 	}
 
@@ -84,6 +255,12 @@ public:
 	void serialize(Stream *stream, InstanceManager *manager) const {
 		VolumeDataSource::serialize(stream, manager);
 		manager->serialize(stream, m_nested.get());
+		stream->writeInt(m_blockSize);
+		stream->writeFloat(m_voxelWidth);
+		stream->writeSize(m_memoryLimit);
+		stream->writeFloat(m_stepSizeMultiplier);
+		m_volumeToWorld.serialize(stream);
+		stream->writeBool(m_shared);
 	}
 
 	void configure() {
@@ -96,8 +273,9 @@ public:
 		if (m_voxelWidth == -1)
 			m_voxelWidth = m_nested->getStepSize();
 
-		size_t memoryLimitPerCore = m_memoryLimit 
-			/ std::max((size_t) 1, Scheduler::getInstance()->getLocalWorkerCount());
+		size_t coreCount = std::max((size_t) 1, 
+			Scheduler::getInstance()->getLocalWorkerCount());
+		size_t memoryLimitPerCore = m_shared ? m_memoryLimit : (m_memoryLimit / coreCount);
 
 		Vector totalCells  = m_aabb.getExtents() / m_voxelWidth;
 		for (int i=0; i<3; ++i)
@@ -128,8 +306,20 @@ public:
 		Log(EInfo, "   Voxel width               = %f", m_voxelWidth);
 		Log(EInfo, "   Memory usage of one block = %s", memString(blockMemoryUsage).c_str());
 		Log(EInfo, "   Memory limit              = %s", memString(m_memoryLimit).c_str());
-		Log(EInfo, "   Memory limit per core     = %s", memString(memoryLimitPerCore).c_str());
-		Log(EInfo, "   Max. blocks per core      = %i", m_blocksPerCore);
+		if (m_shared) {
+			/* Use a few shards per core to keep lock contention low */
+			size_t shardCount = std::min((size_t) 1024, std::max((size_t) 16, 4*coreCount));
+			m_sharedCache = new SharedBlockCache(m_blocksPerCore, shardCount,
+				boost::bind(&CachingDataSource::renderBlock, this, _1));
+			Log(EInfo, "   Cache mode                = shared (%i shards)",
+				(int) m_sharedCache->getShardCount());
+			Log(EInfo, "   Max. blocks               = %i", (int) m_blocksPerCore);
+		} else {
+			m_sharedCache = NULL;
+			Log(EInfo, "   Cache mode                = per-thread");
+			Log(EInfo, "   Memory limit per core     = %s", memString(memoryLimitPerCore).c_str());
+			Log(EInfo, "   Max. blocks per core      = %i", (int) m_blocksPerCore);
+		}
 		Log(EInfo, "   Effective resolution      = %s", totalCells.toString().c_str());
 		Log(EInfo, "   Effective storage         = %s", memString((size_t)
 			(totalCells[0]*totalCells[1]*totalCells[2]*sizeof(float)*m_channels)).c_str());
@@ -145,6 +335,35 @@ public:
 			z < 0 || z >= m_cellCount.z)) 
 			return 0.0f;
 
+		const Vector3i blockIdx(
+			(x & m_blockMask) >> m_blockShift,
+			(y & m_blockMask) >> m_blockShift,
+			(z & m_blockMask) >> m_blockShift);
+
+		if (m_shared) {
+			/* Each thread keeps a reference to the last block it accessed,
+			   which avoids any synchronization for coherent lookups */
+			CacheBlock *block = m_pinned.get();
+			statsPinned.incrementBase();
+			statsHitRate.incrementBase();
+			if (block != NULL && block->key == blockIdx) {
+				++statsPinned;
+				++statsHitRate;
+				if (!block->referenced)
+					block->referenced = true;
+			} else {
+				bool hit = false;
+				ref<CacheBlock> newBlock = m_sharedCache->get(blockIdx, hit);
+				if (hit)
+					++statsHitRate;
+				m_pinned.set(newBlock);
+				block = newBlock;
+			}
+			if (block->data == NULL)
+				return 0.0f;
+			return interpolate(block->data, p, x, y, z);
+		}
+
 		BlockCache *cache = m_cache.get();
 		if (EXPECT_NOT_TAKEN(cache == NULL)) {
 			cache = new BlockCache(m_blocksPerCore,
@@ -182,10 +401,7 @@ public:
 #endif
 
 		bool hit = false;
-		float *blockData = cache->get(Vector3i(
-			(x & m_blockMask) >> m_blockShift,
-			(y & m_blockMask) >> m_blockShift,
-			(z & m_blockMask) >> m_blockShift), hit);
+		float *blockData = cache->get(blockIdx, hit);
 
 		statsHitRate.incrementBase();
 		if (hit) 
@@ -194,6 +410,11 @@ public:
 		if (blockData == NULL)
 			return 0.0f;
 
+		return interpolate(blockData, p, x, y, z);
+	}
+
+	/// Trilinearly interpolate within a block
+	inline Float interpolate(const float *blockData, const Point &p, int x, int y, int z) const {
 		const int x1 = x & m_voxelMask, y1 = y & m_voxelMask, z1 = z & m_voxelMask,
 				x2 = x1 + 1, y2 = y1 + 1, z2 = z1 + 1;
 
@@ -292,6 +513,33 @@ public:
 		return m_nested->getMaximumFloatValue();
 	}
 
+	void getMaximumFloatValues(const Vector3i &res, Float *maxima) const {
+		m_nested->getMaximumFloatValues(res, maxima);
+
+		/* Cached lookups interpolate samples of the nested data source, 
+		   which lie up to one voxel away from the lookup position. Dilate
+		   the maxima of the nested data source accordingly */
+		Vector extents = m_aabb.getExtents();
+		int radius[3];
+		for (int i=0; i<3; ++i)
+			radius[i] = (int) std::ceil(m_voxelWidth * res[i] / extents[i]);
+
+		size_t cellCount = (size_t) res.x * (size_t) res.y * (size_t) res.z;
+		std::vector<Float> temp(maxima, maxima + cellCount);
+		for (int z=0; z<res.z; ++z) {
+			for (int y=0; y<res.y; ++y) {
+				for (int x=0; x<res.x; ++x) {
+					Float value = temp[(z*res.y + y)*res.x + x];
+					for (int dz=std::max(0, z-radius[2]); dz<=std::min(res.z-1, z+radius[2]); ++dz)
+						for (int dy=std::max(0, y-radius[1]); dy<=std::min(res.y-1, y+radius[1]); ++dy)
+							for (int dx=std::max(0, x-radius[0]); dx<=std::min(res.x-1, x+radius[0]); ++dx)
+								value = std::max(value, temp[(dz*res.y + dy)*res.x + dx]);
+					maxima[(z*res.y + y)*res.x + x] = value;
+				}
+			}
+		}
+	}
+
 	MTS_DECLARE_CLASS()
 protected:
 	ref<VolumeDataSource> m_nested;
@@ -307,8 +555,13 @@ protected:
 	int m_blockMask, m_voxelMask, m_blockShift;
 	Vector3i m_cellCount;
 	mutable ThreadLocal<BlockCache> m_cache;
+	bool m_shared;
+	mutable ref<SharedBlockCache> m_sharedCache;
+	mutable ThreadLocal<CacheBlock> m_pinned;
 };
 
+MTS_IMPLEMENT_CLASS(CacheBlock, false, Object);
+MTS_IMPLEMENT_CLASS(SharedBlockCache, false, Object);
 MTS_IMPLEMENT_CLASS_S(CachingDataSource, false, VolumeDataSource);
 MTS_EXPORT_PLUGIN(CachingDataSource, "Caching data source");
 MTS_NAMESPACE_END